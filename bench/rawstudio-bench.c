@@ -0,0 +1,774 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * rawstudio-bench runs single filters on generated images and prints the
+ * throughput as CSV, one line per filter and image size. The kernel variant
+ * is chosen by RS_CPU_LEVEL and the number of threads by RS_THREADS, "make
+ * bench" runs this once for every variant.
+ *
+ * With --verify every variant is run in a child process (the cpu level can
+ * only be chosen once per process), the output of each is compared to the C
+ * variant and the speedup against it is reported.
+ */
+
+#include <rawstudio.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <config.h>
+
+static const gchar *cpu_levels[] = {"c", "sse2", "sse4", "avx", "avx2"};
+
+typedef struct {
+	gint width;
+	gint height;
+	RSFilterResponse *cfa;
+	RSFilterResponse *rgb;
+} BenchImage;
+
+typedef struct {
+	gchar *only;
+	gint iterations;
+	RSDcpFile *profile;
+	const gchar *camera_make;
+	const gchar *camera_model;
+	gchar *dump_dir;
+} Bench;
+
+typedef struct _Benchmark Benchmark;
+
+struct _Benchmark {
+	const gchar *name;
+	gboolean cfa;     /* Feed the filter CFA data instead of RGB */
+	gboolean image8;  /* Ask for 8 bit output */
+	RSFilter *(*setup)(const Benchmark *benchmark, RSFilter *input, Bench *bench);
+	const gchar *arg;
+	gint max_error;   /* Largest difference allowed from the C variant per sample */
+};
+
+/* The settings must live as long as the filter using them */
+static RSSettings *
+attach_settings(RSFilter *filter)
+{
+	RSSettings *settings = rs_settings_new();
+
+	g_object_set_data_full(G_OBJECT(filter), "bench-settings", settings, g_object_unref);
+	return settings;
+}
+
+static RSFilter *
+setup_demosaic(const Benchmark *benchmark, RSFilter *input, Bench *bench)
+{
+	RSFilter *filter = rs_filter_new("RSDemosaic", input);
+
+	g_object_set(filter, "method", benchmark->arg, NULL);
+	return filter;
+}
+
+static RSFilter *
+setup_resample(const Benchmark *benchmark, RSFilter *input, Bench *bench)
+{
+	RSFilter *filter = rs_filter_new("RSResample", input);
+	const gdouble scale = g_ascii_strtod(benchmark->arg, NULL);
+	gint width, height;
+
+	rs_filter_get_size_simple(input, RS_FILTER_REQUEST_QUICK, &width, &height);
+	g_object_set(filter,
+		"width", MAX(6, (gint) (width * scale)),
+		"height", MAX(6, (gint) (height * scale)),
+		NULL);
+	return filter;
+}
+
+static RSFilter *
+setup_dcp(const Benchmark *benchmark, RSFilter *input, Bench *bench)
+{
+	RSFilter *filter;
+
+	/* There is no profile to measure */
+	if (benchmark->arg && !bench->profile)
+		return NULL;
+
+	filter = rs_filter_new("RSDcp", input);
+	g_object_set(filter, "settings", attach_settings(filter), NULL);
+	if (benchmark->arg)
+		g_object_set(filter, "profile", bench->profile, "use-profile", TRUE, NULL);
+	return filter;
+}
+
+static RSFilter *
+setup_lensfun(const Benchmark *benchmark, RSFilter *input, Bench *bench)
+{
+	RSFilter *filter = rs_filter_new("RSLensfun", input);
+	RSSettings *settings = attach_settings(filter);
+	RSLens *lens = rs_lens_new();
+
+	/* Without a known lens, TCA and vignetting correction needs a known camera */
+	g_object_set(settings, "tca_kr", 0.5, "tca_kb", -0.5, "vignetting", 0.3, NULL);
+	g_object_set(filter,
+		"make", bench->camera_make,
+		"model", bench->camera_model,
+		"lens", lens,
+		"settings", settings,
+		NULL);
+	g_object_unref(lens);
+	return filter;
+}
+
+static RSFilter *
+setup_rotate(const Benchmark *benchmark, RSFilter *input, Bench *bench)
+{
+	RSFilter *filter = rs_filter_new("RSRotate", input);
+
+	g_object_set(filter, "angle", 2.5, NULL);
+	return filter;
+}
+
+static RSFilter *
+setup_denoise(const Benchmark *benchmark, RSFilter *input, Bench *bench)
+{
+	RSFilter *filter = rs_filter_new("RSDenoise", input);
+	RSSettings *settings = attach_settings(filter);
+
+	g_object_set(settings,
+		"sharpen", 5.0,
+		"denoise_luma", 20.0,
+		"denoise_chroma", g_ascii_strtod(benchmark->arg, NULL),
+		NULL);
+	g_object_set(filter, "settings", settings, NULL);
+	return filter;
+}
+
+static RSFilter *
+setup_colorspace(const Benchmark *benchmark, RSFilter *input, Bench *bench)
+{
+	/* Converts from the ProPhoto input to the sRGB requested */
+	return rs_filter_new("RSColorspaceTransform", input);
+}
+
+/* Integer kernels must match exactly, float kernels are allowed to differ by
+ * approximations and FMA rounding. 16 bit output errors are in 1/65535 */
+static const Benchmark benchmarks[] = {
+	{ "demosaic-bilinear", TRUE, FALSE, setup_demosaic, "bilinear", 0 },
+	{ "demosaic-ppg", TRUE, FALSE, setup_demosaic, "pixel-grouping", 0 },
+	/* AHD is meant for exports, it should stay within 3 times the time of PPG */
+	{ "demosaic-ahd", TRUE, FALSE, setup_demosaic, "ahd", 0 },
+	{ "resample-down", FALSE, FALSE, setup_resample, "0.5", 1 },
+	{ "resample-up", FALSE, FALSE, setup_resample, "1.5", 1 },
+	{ "dcp", FALSE, FALSE, setup_dcp, NULL, 655 },
+	{ "dcp-profile", FALSE, FALSE, setup_dcp, "profile", 655 },
+	{ "lensfun", FALSE, FALSE, setup_lensfun, NULL, 16 },
+	{ "rotate", FALSE, FALSE, setup_rotate, NULL, 0 },
+	{ "denoise-luma", FALSE, FALSE, setup_denoise, "0", 64 },
+	{ "denoise-chroma", FALSE, FALSE, setup_denoise, "20", 64 },
+	{ "colorspace16", FALSE, FALSE, setup_colorspace, NULL, 256 },
+	{ "colorspace8", FALSE, TRUE, setup_colorspace, NULL, 1 },
+};
+
+static const Benchmark *
+find_benchmark(const gchar *name)
+{
+	gint b;
+
+	for(b = 0; b < G_N_ELEMENTS(benchmarks); b++)
+		if (g_str_equal(benchmarks[b].name, name))
+			return &benchmarks[b];
+
+	return NULL;
+}
+
+/* Smooth gradients with some noise, the same on every run */
+static RSFilterResponse *
+generate_image(gint width, gint height, gboolean cfa)
+{
+	RSFilterResponse *response = rs_filter_response_new();
+	RS_IMAGE16 *image;
+	GRand *rand = g_rand_new_with_seed(42);
+	gint x, y, c;
+
+	if (cfa)
+	{
+		image = rs_image16_new(width, height, 1, 1);
+		/* RGGB */
+		image->filters = 0x94949494;
+	}
+	else
+		image = rs_image16_new(width, height, 3, 4);
+
+	for(y = 0; y < height; y++)
+	{
+		gushort *pixel = GET_PIXEL(image, 0, y);
+		for(x = 0; x < width; x++)
+		{
+			for(c = 0; c < image->channels; c++)
+			{
+				gint value = (x * 40000 / width) + (y * 20000 / height) + (c * 4000) + g_rand_int_range(rand, -1500, 1500);
+				pixel[c] = CLAMP(value, 0, 65535);
+			}
+			pixel += image->pixelsize;
+		}
+	}
+	g_rand_free(rand);
+
+	rs_filter_response_set_image(response, image);
+	g_object_unref(image);
+
+	return response;
+}
+
+/* The result of the last run is returned in output if not NULL */
+static gdouble
+run_benchmark(const Benchmark *benchmark, RSFilter *filter, gint iterations, RSFilterResponse **output)
+{
+	RSFilterRequest *request = rs_filter_request_new();
+	GTimer *timer = g_timer_new();
+	gdouble best = G_MAXDOUBLE;
+	gint i;
+
+	rs_filter_param_set_object(RS_FILTER_PARAM(request), "colorspace", rs_color_space_new_singleton("RSSrgb"));
+
+	/* The first run initializes tables and warms caches, it doesn't count */
+	for(i = -1; i < iterations; i++)
+	{
+		RSFilterResponse *response;
+
+		g_timer_start(timer);
+		if (benchmark->image8)
+			response = rs_filter_get_image8(filter, request);
+		else
+			response = rs_filter_get_image(filter, request);
+		g_timer_stop(timer);
+
+		if (output && i == iterations - 1)
+			*output = response;
+		else
+			g_object_unref(response);
+
+		if (i >= 0)
+			best = MIN(best, g_timer_elapsed(timer, NULL));
+	}
+
+	g_timer_destroy(timer);
+	g_object_unref(request);
+
+	return best;
+}
+
+typedef struct {
+	gint32 width;
+	gint32 height;
+	gint32 channels;
+	gint32 bytes;
+} DumpHeader;
+
+static gchar *
+dump_filename(const gchar *dir, const gchar *name, gint width, gint height, const gchar *variant)
+{
+	gchar *basename = g_strdup_printf("%s-%dx%d-%s.raw", name, width, height, variant);
+	gchar *filename = g_build_filename(dir, basename, NULL);
+
+	g_free(basename);
+	return filename;
+}
+
+/* Writes the color channels of the output without padding or alpha */
+static void
+dump_response(const gchar *filename, RSFilterResponse *response, gboolean image8)
+{
+	FILE *file = g_fopen(filename, "wb");
+	DumpHeader header;
+	gint x, y, c;
+
+	if (!file)
+	{
+		g_printerr("Could not write %s\n", filename);
+		return;
+	}
+
+	if (image8)
+	{
+		GdkPixbuf *pixbuf = rs_filter_response_get_image8(response);
+		const gint channels = gdk_pixbuf_get_n_channels(pixbuf);
+		guchar *row = g_new(guchar, gdk_pixbuf_get_width(pixbuf) * 3);
+
+		header.width = gdk_pixbuf_get_width(pixbuf);
+		header.height = gdk_pixbuf_get_height(pixbuf);
+		header.channels = 3;
+		header.bytes = 1;
+		fwrite(&header, sizeof(header), 1, file);
+
+		for(y = 0; y < header.height; y++)
+		{
+			guchar *pixel = gdk_pixbuf_get_pixels(pixbuf) + y * gdk_pixbuf_get_rowstride(pixbuf);
+			for(x = 0; x < header.width; x++)
+				for(c = 0; c < 3; c++)
+					row[x * 3 + c] = pixel[x * channels + c];
+			fwrite(row, 1, header.width * 3, file);
+		}
+		g_free(row);
+		g_object_unref(pixbuf);
+	}
+	else
+	{
+		RS_IMAGE16 *image = rs_filter_response_get_image(response);
+		gushort *row = g_new(gushort, image->w * image->channels);
+
+		header.width = image->w;
+		header.height = image->h;
+		header.channels = image->channels;
+		header.bytes = 2;
+		fwrite(&header, sizeof(header), 1, file);
+
+		for(y = 0; y < image->h; y++)
+		{
+			gushort *pixel = GET_PIXEL(image, 0, y);
+			for(x = 0; x < image->w; x++)
+				for(c = 0; c < image->channels; c++)
+					row[x * image->channels + c] = pixel[x * image->pixelsize + c];
+			fwrite(row, sizeof(gushort), image->w * image->channels, file);
+		}
+		g_free(row);
+		g_object_unref(image);
+	}
+
+	fclose(file);
+}
+
+/* Returns the largest difference between two dumps or -1 if they can't be compared */
+static gint
+compare_dumps(const gchar *reference_filename, const gchar *filename, gdouble *mean_error)
+{
+	gchar *reference, *data;
+	gsize reference_length, length;
+	DumpHeader *header;
+	gint max_error = -1;
+	gint64 sum = 0;
+	gsize i, samples;
+
+	*mean_error = 0.0;
+
+	if (!g_file_get_contents(reference_filename, &reference, &reference_length, NULL))
+		return -1;
+	if (!g_file_get_contents(filename, &data, &length, NULL))
+	{
+		g_free(reference);
+		return -1;
+	}
+
+	header = (DumpHeader *) reference;
+	if (length == reference_length && length >= sizeof(DumpHeader) && memcmp(reference, data, sizeof(DumpHeader)) == 0)
+	{
+		const guchar *ref8 = (guchar *) reference + sizeof(DumpHeader);
+		const guchar *data8 = (guchar *) data + sizeof(DumpHeader);
+		const gushort *ref16 = (gushort *) ref8;
+		const gushort *data16 = (gushort *) data8;
+
+		samples = (gsize) header->width * header->height * header->channels;
+		max_error = 0;
+		for(i = 0; i < samples; i++)
+		{
+			gint error;
+			if (header->bytes == 1)
+				error = ABS((gint) ref8[i] - (gint) data8[i]);
+			else
+				error = ABS((gint) ref16[i] - (gint) data16[i]);
+			max_error = MAX(max_error, error);
+			sum += error;
+		}
+		if (samples > 0)
+			*mean_error = (gdouble) sum / samples;
+	}
+
+	g_free(reference);
+	g_free(data);
+
+	return max_error;
+}
+
+typedef struct {
+	gchar *name;
+	gchar *variant;
+	gint width;
+	gint height;
+	gdouble seconds;
+} BenchResult;
+
+/* Reads the CSV written by a child and appends a BenchResult per line */
+static GList *
+parse_results(const gchar *output, GList *results)
+{
+	gchar **lines = g_strsplit(output, "\n", 0);
+	gint i;
+
+	for(i = 0; lines[i]; i++)
+	{
+		gchar **fields;
+
+		if (lines[i][0] == '\0' || lines[i][0] == '#')
+			continue;
+
+		fields = g_strsplit(lines[i], ",", 0);
+		if (g_strv_length(fields) >= 6)
+		{
+			BenchResult *result = g_new0(BenchResult, 1);
+			result->name = g_strdup(fields[0]);
+			result->variant = g_strdup(fields[1]);
+			result->width = atoi(fields[3]);
+			result->height = atoi(fields[4]);
+			result->seconds = g_ascii_strtod(fields[5], NULL);
+			results = g_list_append(results, result);
+		}
+		g_strfreev(fields);
+	}
+	g_strfreev(lines);
+
+	return results;
+}
+
+static BenchResult *
+find_result(GList *results, const gchar *name, gint width, gint height, const gchar *variant)
+{
+	for(; results; results = g_list_next(results))
+	{
+		BenchResult *result = results->data;
+		if (g_str_equal(result->name, name) && g_str_equal(result->variant, variant)
+			&& result->width == width && result->height == height)
+			return result;
+	}
+
+	return NULL;
+}
+
+/**
+ * Runs all cpu levels in child processes dumping their output, and compares
+ * the output of each to the C variant
+ * @param child_argv Arguments for the child, the dump directory will be appended
+ * @return 0 if all variants are within bounds, 1 otherwise
+ */
+static gint
+verify(GPtrArray *child_argv)
+{
+	gchar *dump_dir = g_build_filename(g_get_tmp_dir(), "rawstudio-bench-XXXXXX", NULL);
+	GList *results = NULL, *node;
+	gint failures = 0;
+	gint level;
+
+	if (!mkdtemp(dump_dir))
+	{
+		g_printerr("Could not create %s\n", dump_dir);
+		g_free(dump_dir);
+		return 1;
+	}
+
+	g_ptr_array_add(child_argv, "--dump");
+	g_ptr_array_add(child_argv, dump_dir);
+	g_ptr_array_add(child_argv, NULL);
+
+	for(level = 0; level < G_N_ELEMENTS(cpu_levels); level++)
+	{
+		gchar *output = NULL;
+		gint status = 0;
+		GError *error = NULL;
+
+		g_setenv("RS_CPU_LEVEL", cpu_levels[level], TRUE);
+		if (!g_spawn_sync(NULL, (gchar **) child_argv->pdata, NULL, 0, NULL, NULL, &output, NULL, &status, &error))
+		{
+			g_printerr("%s: %s\n", g_quark_to_string(error->domain), error->message);
+			g_error_free(error);
+			failures++;
+			break;
+		}
+		if (status != 0)
+		{
+			g_printerr("# %s exited with status %d\n", cpu_levels[level], status);
+			failures++;
+		}
+		results = parse_results(output, results);
+		g_free(output);
+	}
+	g_unsetenv("RS_CPU_LEVEL");
+
+	printf("# benchmark,variant,width,height,max_error,mean_error,allowed_error,speedup,result\n");
+
+	for(node = results; node; node = g_list_next(node))
+	{
+		BenchResult *result = node->data;
+		const Benchmark *benchmark = find_benchmark(result->name);
+		BenchResult *reference = find_result(results, result->name, result->width, result->height, cpu_levels[0]);
+		gchar *reference_filename, *filename;
+		gdouble mean_error;
+		gint max_error;
+		gboolean ok;
+
+		if (!benchmark || result == reference)
+			continue;
+
+		if (!reference)
+		{
+			printf("%s,%s,%d,%d,,,%d,,no-reference\n", result->name, result->variant, result->width, result->height, benchmark->max_error);
+			failures++;
+			continue;
+		}
+
+		reference_filename = dump_filename(dump_dir, result->name, result->width, result->height, reference->variant);
+		filename = dump_filename(dump_dir, result->name, result->width, result->height, result->variant);
+		max_error = compare_dumps(reference_filename, filename, &mean_error);
+		g_free(reference_filename);
+		g_free(filename);
+
+		ok = (max_error >= 0 && max_error <= benchmark->max_error);
+		if (!ok)
+			failures++;
+
+		printf("%s,%s,%d,%d,%d,%.4f,%d,%.2f,%s\n", result->name, result->variant, result->width, result->height,
+			max_error, mean_error, benchmark->max_error, reference->seconds / MAX(result->seconds, 1e-9),
+			ok ? "ok" : (max_error < 0 ? "mismatch" : "FAIL"));
+	}
+
+	/* Clean up the dumps */
+	for(node = results; node; node = g_list_next(node))
+	{
+		BenchResult *result = node->data;
+		gchar *filename = dump_filename(dump_dir, result->name, result->width, result->height, result->variant);
+		g_unlink(filename);
+		g_free(filename);
+		g_free(result->name);
+		g_free(result->variant);
+		g_free(result);
+	}
+	g_list_free(results);
+	g_rmdir(dump_dir);
+	g_free(dump_dir);
+
+	return (failures > 0) ? 1 : 0;
+}
+
+static gboolean
+parse_sizes(const gchar *str, GArray *sizes)
+{
+	gchar **list = g_strsplit(str, ",", 0);
+	gint i;
+
+	for(i = 0; list[i]; i++)
+	{
+		BenchImage image = {0};
+		if (sscanf(list[i], "%dx%d", &image.width, &image.height) != 2 || image.width < 16 || image.height < 16)
+		{
+			g_printerr("Invalid size \"%s\", expected WIDTHxHEIGHT\n", list[i]);
+			g_strfreev(list);
+			return FALSE;
+		}
+		g_array_append_val(sizes, image);
+	}
+	g_strfreev(list);
+
+	return sizes->len > 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	Bench bench = {0};
+	GArray *sizes;
+	gchar *plugin_dir = NULL;
+	gchar *profile_filename = NULL;
+	gchar *size_list = "640x480,3008x2000,6048x4032";
+	gchar *debug = NULL;
+	gboolean do_verify = FALSE;
+	const gchar *requested_level = g_getenv("RS_CPU_LEVEL");
+	const gchar *variant;
+	gint threads;
+	GError *error = NULL;
+	GOptionContext *option_context;
+	gint i, b;
+
+	bench.iterations = 5;
+	bench.camera_make = "Canon";
+	bench.camera_model = "Canon EOS 5D Mark II";
+
+	const GOptionEntry option_entries[] = {
+		{ "plugins", 0, 0, G_OPTION_ARG_FILENAME, &plugin_dir, "Load plugins from this directory instead of the installed ones", "directory" },
+		{ "sizes", 's', 0, G_OPTION_ARG_STRING, &size_list, "Image sizes to test", "WxH,..." },
+		{ "iterations", 'i', 0, G_OPTION_ARG_INT, &bench.iterations, "Runs of each benchmark, the fastest is reported", "n" },
+		{ "only", 'o', 0, G_OPTION_ARG_STRING, &bench.only, "Only run benchmarks with names containing this", "name" },
+		{ "profile", 'p', 0, G_OPTION_ARG_FILENAME, &profile_filename, "DCP profile for the dcp-profile benchmark", "filename" },
+		{ "debug", 'd', 0, G_OPTION_ARG_STRING, &debug, "Debug flags to use", "flags" },
+		{ "verify", 0, 0, G_OPTION_ARG_NONE, &do_verify, "Compare all variants to the C variant and report speedups", NULL },
+		{ "dump", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_FILENAME, &bench.dump_dir, "Write the output images to this directory", "directory" },
+		{ NULL }
+	};
+
+#if GLIB_MAJOR_VERSION <= 2 && GLIB_MINOR_VERSION < 31
+	g_thread_init(NULL);
+#endif
+
+	option_context = g_option_context_new(NULL);
+	g_option_context_set_summary(option_context, "Measure the speed of Rawstudio filters on generated images.\n"
+		"Set RS_CPU_LEVEL to c, sse2, sse4, avx or avx2 to limit the kernels used and RS_THREADS to set the number of threads.");
+	g_option_context_add_main_entries(option_context, option_entries, NULL);
+
+	if (!g_option_context_parse(option_context, &argc, &argv, &error))
+	{
+		g_printerr("option parsing failed: %s\n", error->message);
+		return 1;
+	}
+	g_option_context_free(option_context);
+
+	if (debug)
+		rs_debug_setup(debug);
+
+	sizes = g_array_new(FALSE, TRUE, sizeof(BenchImage));
+	if (!parse_sizes(size_list, sizes))
+		return 1;
+
+	/* Verification is done by running ourself once per variant */
+	if (do_verify)
+	{
+		GPtrArray *child_argv = g_ptr_array_new();
+		gchar *iterations = g_strdup_printf("%d", bench.iterations);
+		gint ret;
+
+		g_ptr_array_add(child_argv, argv[0]);
+		g_ptr_array_add(child_argv, "--sizes");
+		g_ptr_array_add(child_argv, size_list);
+		g_ptr_array_add(child_argv, "--iterations");
+		g_ptr_array_add(child_argv, iterations);
+		if (plugin_dir)
+		{
+			g_ptr_array_add(child_argv, "--plugins");
+			g_ptr_array_add(child_argv, plugin_dir);
+		}
+		if (bench.only)
+		{
+			g_ptr_array_add(child_argv, "--only");
+			g_ptr_array_add(child_argv, bench.only);
+		}
+		if (profile_filename)
+		{
+			g_ptr_array_add(child_argv, "--profile");
+			g_ptr_array_add(child_argv, profile_filename);
+		}
+
+		ret = verify(child_argv);
+
+		g_ptr_array_free(child_argv, TRUE);
+		g_free(iterations);
+		g_array_free(sizes, TRUE);
+		return ret;
+	}
+
+	/* Make sure the GType system is initialized */
+	g_type_init();
+
+	if (plugin_dir)
+		rs_plugin_manager_load_plugins_from(plugin_dir);
+	else
+		rs_plugin_manager_load_all_plugins();
+
+	if (profile_filename)
+	{
+		bench.profile = rs_dcp_file_new_from_file(profile_filename);
+		if (!bench.profile)
+		{
+			g_printerr("Could not load profile %s\n", profile_filename);
+			return 1;
+		}
+	}
+
+	variant = rs_cpu_level_get_name(rs_cpu_get_level());
+	threads = rs_parallel_get_n_workers();
+
+	/* Don't report the same variant twice when asked for more than the cpu has */
+	if (requested_level && g_ascii_strcasecmp(requested_level, variant) != 0)
+	{
+		g_printerr("# %s not supported by this cpu, skipping\n", requested_level);
+		return 0;
+	}
+
+	printf("# benchmark,variant,threads,width,height,seconds,mpix_per_second\n");
+
+	for(i = 0; i < sizes->len; i++)
+	{
+		BenchImage *image = &g_array_index(sizes, BenchImage, i);
+
+		for(b = 0; b < G_N_ELEMENTS(benchmarks); b++)
+		{
+			const Benchmark *benchmark = &benchmarks[b];
+			RSFilterResponse **input_response = benchmark->cfa ? &image->cfa : &image->rgb;
+			RSFilter *input, *filter;
+			RSFilterResponse *output = NULL;
+			gdouble seconds;
+
+			if (bench.only && !strstr(benchmark->name, bench.only))
+				continue;
+
+			/* Images are only generated when first needed */
+			if (!*input_response)
+				*input_response = generate_image(image->width, image->height, benchmark->cfa);
+
+			input = rs_filter_new("RSInputImage16", NULL);
+			g_object_set(input,
+				"image", *input_response,
+				"color-space", rs_color_space_new_singleton("RSProphoto"),
+				NULL);
+
+			filter = benchmark->setup(benchmark, input, &bench);
+			if (!filter)
+			{
+				g_object_unref(input);
+				continue;
+			}
+
+			seconds = run_benchmark(benchmark, filter, MAX(1, bench.iterations), bench.dump_dir ? &output : NULL);
+
+			/* Throughput is measured in input pixels */
+			printf("%s,%s,%d,%d,%d,%.6f,%.2f\n", benchmark->name, variant, threads,
+				image->width, image->height, seconds,
+				((gdouble) image->width * image->height) / (seconds * 1000000.0));
+			fflush(stdout);
+
+			if (output)
+			{
+				gchar *filename = dump_filename(bench.dump_dir, benchmark->name, image->width, image->height, variant);
+				dump_response(filename, output, benchmark->image8);
+				g_free(filename);
+				g_object_unref(output);
+			}
+
+			g_object_unref(filter);
+			g_object_unref(input);
+		}
+
+		if (image->cfa)
+			g_object_unref(image->cfa);
+		if (image->rgb)
+			g_object_unref(image->rgb);
+		image->cfa = image->rgb = NULL;
+	}
+
+	g_array_free(sizes, TRUE);
+	if (bench.profile)
+		g_object_unref(bench.profile);
+
+	return 0;
+}
@@ -38,6 +38,10 @@
 #define CONF_BATCH_SIZE_WIDTH "batch_size_width"
 #define CONF_BATCH_SIZE_HEIGHT "batch_size_height"
 #define CONF_BATCH_SIZE_SCALE "batch_size_scale"
+#define CONF_BATCH_MEMORY_LIMIT "batch_memory_limit"
+#define CONF_CACHE_MEMORY_LIMIT "cache_memory_limit"
+#define CONF_HUGE_PAGES "huge_pages"
+#define CONF_CACHE_PACKED "cache_packed"
 #define CONF_ROI_GRID "roi_grid"
 #define CONF_CROP_ASPECT "crop_aspect"
 #define CONF_SHOW_FILENAMES "show_filenames_in_iconview"
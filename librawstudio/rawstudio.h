@@ -53,6 +53,7 @@ extern "C" {
 #include "rs-library.h"
 #include "rs-filetypes.h"
 #include "rs-plugin.h"
+#include "rs-trace.h"
 #include "rs-filter-param.h"
 #include "rs-filter-request.h"
 #include "rs-filter-response.h"
@@ -60,6 +61,9 @@ extern "C" {
 #include "rs-output.h"
 #include "rs-plugin-manager.h"
 #include "rs-job-queue.h"
+#include "rs-parallel.h"
+#include "rs-memory.h"
+#include "rs-buffer-pool.h"
 #include "rs-utils.h"
 #include "rs-math.h"
 #include "rs-color.h"
@@ -0,0 +1,301 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifdef WIN32 /* Win32 _aligned_malloc */
+#include <malloc.h>
+#endif
+
+#include <rawstudio.h>
+#include <stdlib.h>
+#ifdef __linux__
+#include <sys/mman.h> /* madvise() */
+#endif
+#include "rs-buffer-pool.h"
+
+/* Every buffer starts with a header telling its size class. This is a full
+ * alignment unit, so the data after it keeps the alignment */
+#define HEADER_SIZE RS_BUFFER_POOL_ALIGNMENT
+
+/* Smaller buffers are cheap to get from malloc, and not worth keeping */
+#define MIN_POOLED_SIZE (64*1024)
+
+/* Size classes are spaced 1/8 of a power of two apart, so at most 12.5%
+ * of a buffer is wasted */
+#define CLASSES_PER_POWER 8
+
+#define HUGE_PAGE_SIZE (2*1024*1024)
+
+/* Used if we can't find the amount of physical memory */
+#define FALLBACK_LIMIT (G_GUINT64_CONSTANT(256)*1024*1024)
+
+typedef struct {
+	gsize size; /* Size of the data area, 0 for unpooled buffers */
+	gboolean huge;
+} Header;
+
+static GStaticMutex lock = G_STATIC_MUTEX_INIT;
+static GHashTable *free_lists = NULL; /* size class -> GSList of free buffers */
+static guint64 idle_bytes = 0;
+static guint64 limit = 0;
+static gboolean huge_pages = FALSE;
+static guint64 n_recycled = 0;
+static guint64 n_allocated = 0;
+
+static gsize
+size_class(gsize size)
+{
+	gsize step = 1;
+
+	if (size < MIN_POOLED_SIZE)
+		return 0;
+
+	/* Round up to a multiple of 1/8 of the highest power of two */
+	while ((step * 2 * CLASSES_PER_POWER) <= size)
+		step *= 2;
+
+	return ((size + step - 1) / step) * step;
+}
+
+static guint64
+default_limit(void)
+{
+	guint64 physical = rs_get_physical_memory();
+
+	if (physical > 0)
+		return physical / 8;
+
+	return FALLBACK_LIMIT;
+}
+
+static Header *
+system_alloc(gsize size, gboolean huge)
+{
+	gpointer mem = NULL;
+	gsize total = HEADER_SIZE + size;
+
+#ifdef WIN32
+	mem = _aligned_malloc(total, RS_BUFFER_POOL_ALIGNMENT);
+#else
+	if (huge)
+	{
+		/* Huge pages must be aligned to the huge page size */
+		total = ((total + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE) * HUGE_PAGE_SIZE;
+		if (posix_memalign(&mem, HUGE_PAGE_SIZE, total) != 0)
+			mem = NULL;
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+		if (mem)
+			madvise(mem, total, MADV_HUGEPAGE);
+#endif
+	}
+	else if (posix_memalign(&mem, RS_BUFFER_POOL_ALIGNMENT, total) != 0)
+		mem = NULL;
+#endif
+
+	return mem;
+}
+
+static void
+system_free(Header *header)
+{
+#ifdef WIN32
+	_aligned_free(header);
+#else
+	free(header);
+#endif
+}
+
+/**
+ * Allocate a buffer for pixel data, a recycled buffer will be used if one of
+ * the right size class is available
+ * @param size The number of bytes needed
+ * @return A buffer aligned to RS_BUFFER_POOL_ALIGNMENT bytes or NULL if out
+ *         of memory, this must be freed with rs_buffer_pool_free()
+ */
+gpointer
+rs_buffer_pool_alloc(gsize size)
+{
+	const gsize class = size_class(size);
+	Header *header = NULL;
+	gboolean huge;
+
+	if (class > 0)
+	{
+		g_static_mutex_lock(&lock);
+		if (free_lists)
+		{
+			GSList *list = g_hash_table_lookup(free_lists, GSIZE_TO_POINTER(class));
+			if (list)
+			{
+				header = list->data;
+				list = g_slist_delete_link(list, list);
+				g_hash_table_insert(free_lists, GSIZE_TO_POINTER(class), list);
+				idle_bytes -= class;
+				n_recycled++;
+			}
+		}
+		huge = huge_pages && class >= HUGE_PAGE_SIZE;
+		if (!header)
+			n_allocated++;
+		g_static_mutex_unlock(&lock);
+
+		if (!header)
+		{
+			RS_DEBUG(PERFORMANCE, "Allocating %" G_GSIZE_FORMAT "kB pixel buffer%s", class/1024, huge ? " backed by huge pages" : "");
+			header = system_alloc(class, huge);
+			if (!header)
+				return NULL;
+			header->size = class;
+			header->huge = huge;
+		}
+	}
+	else
+	{
+		header = system_alloc(size, FALSE);
+		if (!header)
+			return NULL;
+		header->size = 0;
+		header->huge = FALSE;
+	}
+
+	return ((guchar *) header) + HEADER_SIZE;
+}
+
+/**
+ * Give a buffer back to the pool for reuse
+ * @param buffer A buffer returned by rs_buffer_pool_alloc() or NULL
+ */
+void
+rs_buffer_pool_free(gpointer buffer)
+{
+	Header *header;
+
+	if (!buffer)
+		return;
+
+	header = (Header *) (((guchar *) buffer) - HEADER_SIZE);
+
+	if (header->size > 0)
+	{
+		gboolean keep = FALSE;
+
+		g_static_mutex_lock(&lock);
+		if (limit == 0)
+			limit = default_limit();
+		/* Don't recycle buffers of the wrong kind after huge pages was toggled */
+		if (idle_bytes + header->size <= limit && header->huge == (huge_pages && header->size >= HUGE_PAGE_SIZE))
+		{
+			GSList *list;
+
+			if (!free_lists)
+				free_lists = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+			list = g_hash_table_lookup(free_lists, GSIZE_TO_POINTER(header->size));
+			g_hash_table_insert(free_lists, GSIZE_TO_POINTER(header->size), g_slist_prepend(list, header));
+			idle_bytes += header->size;
+			keep = TRUE;
+		}
+		g_static_mutex_unlock(&lock);
+
+		if (keep)
+			return;
+	}
+
+	system_free(header);
+}
+
+/**
+ * Set how many bytes of unused buffers the pool may keep around
+ * @param bytes The limit in bytes or 0 to use the default
+ */
+void
+rs_buffer_pool_set_limit(guint64 bytes)
+{
+	gboolean trim;
+
+	g_static_mutex_lock(&lock);
+	limit = (bytes > 0) ? bytes : default_limit();
+	trim = (idle_bytes > limit);
+	g_static_mutex_unlock(&lock);
+
+	/* Easier than picking which buffers to keep */
+	if (trim)
+		rs_buffer_pool_trim();
+}
+
+/**
+ * Enable or disable huge page backing for large buffers, this will only
+ * affect buffers allocated from now on. This is only supported on Linux
+ * @param enable TRUE to enable, FALSE to disable
+ */
+void
+rs_buffer_pool_set_huge_pages(gboolean enable)
+{
+	g_static_mutex_lock(&lock);
+	huge_pages = enable;
+	g_static_mutex_unlock(&lock);
+}
+
+/**
+ * Release all unused buffers to the system
+ */
+void
+rs_buffer_pool_trim(void)
+{
+	GHashTable *lists;
+	GHashTableIter iter;
+	gpointer key, value;
+
+	g_static_mutex_lock(&lock);
+	lists = free_lists;
+	free_lists = NULL;
+	idle_bytes = 0;
+	g_static_mutex_unlock(&lock);
+
+	if (!lists)
+		return;
+
+	g_hash_table_iter_init(&iter, lists);
+	while (g_hash_table_iter_next(&iter, &key, &value))
+	{
+		GSList *list;
+		for(list = value; list; list = list->next)
+			system_free(list->data);
+		g_slist_free(value);
+	}
+	g_hash_table_destroy(lists);
+}
+
+/**
+ * Get statistics for the pool
+ * @param recycled Number of allocations served by recycled buffers or NULL
+ * @param allocated Number of buffers allocated from the system or NULL
+ * @param idle Bytes held in unused buffers or NULL
+ */
+void
+rs_buffer_pool_get_stats(guint64 *recycled, guint64 *allocated, guint64 *idle)
+{
+	g_static_mutex_lock(&lock);
+	if (recycled)
+		*recycled = n_recycled;
+	if (allocated)
+		*allocated = n_allocated;
+	if (idle)
+		*idle = idle_bytes;
+	g_static_mutex_unlock(&lock);
+}
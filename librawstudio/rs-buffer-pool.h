@@ -0,0 +1,75 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef RS_BUFFER_POOL_H
+#define RS_BUFFER_POOL_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * Alignment of all buffers returned by rs_buffer_pool_alloc()
+ */
+#define RS_BUFFER_POOL_ALIGNMENT 64
+
+/**
+ * Allocate a buffer for pixel data, a recycled buffer will be used if one of
+ * the right size class is available
+ * @param size The number of bytes needed
+ * @return A buffer aligned to RS_BUFFER_POOL_ALIGNMENT bytes or NULL if out
+ *         of memory, this must be freed with rs_buffer_pool_free()
+ */
+extern gpointer rs_buffer_pool_alloc(gsize size);
+
+/**
+ * Give a buffer back to the pool for reuse
+ * @param buffer A buffer returned by rs_buffer_pool_alloc() or NULL
+ */
+extern void rs_buffer_pool_free(gpointer buffer);
+
+/**
+ * Set how many bytes of unused buffers the pool may keep around
+ * @param bytes The limit in bytes or 0 to use the default
+ */
+extern void rs_buffer_pool_set_limit(guint64 bytes);
+
+/**
+ * Enable or disable huge page backing for large buffers, this will only
+ * affect buffers allocated from now on. This is only supported on Linux
+ * @param enable TRUE to enable, FALSE to disable
+ */
+extern void rs_buffer_pool_set_huge_pages(gboolean enable);
+
+/**
+ * Release all unused buffers to the system
+ */
+extern void rs_buffer_pool_trim(void);
+
+/**
+ * Get statistics for the pool
+ * @param recycled Number of allocations served by recycled buffers or NULL
+ * @param allocated Number of buffers allocated from the system or NULL
+ * @param idle Bytes held in unused buffers or NULL
+ */
+extern void rs_buffer_pool_get_stats(guint64 *recycled, guint64 *allocated, guint64 *idle);
+
+G_END_DECLS
+
+#endif /* RS_BUFFER_POOL_H */
@@ -17,6 +17,8 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <rawstudio.h>
+#include <string.h>
 #include "rs-filter-param.h"
 
 #define RS_TYPE_FLOAT4 rs_float4_get_type()
@@ -36,6 +38,103 @@ rs_float4_get_type(void)
 	return type;
 }
 
+typedef struct {
+	GQuark id;
+	GValue value;
+} Slot;
+
+/* A small vector of properties. Properties are few, so a linear search of
+ * interned names is faster than hashing the name. This is shared by clones
+ * and copied when written to while shared */
+struct _RSFilterParamSlots {
+	gint refcount;
+	guint n;
+	guint allocated;
+	Slot *slot;
+};
+
+#define SLOTS_PREALLOC 8
+
+/* Shared by all new RSFilterParams, the extra reference keeps it alive and
+ * read-only */
+static RSFilterParamSlots empty_slots = { 1, 0, 0, NULL };
+
+static RSFilterParamSlots *
+slots_new(guint allocated)
+{
+	RSFilterParamSlots *slots = g_slice_new(RSFilterParamSlots);
+
+	slots->refcount = 1;
+	slots->n = 0;
+	slots->allocated = MAX(allocated, SLOTS_PREALLOC);
+	slots->slot = g_new0(Slot, slots->allocated);
+
+	return slots;
+}
+
+static RSFilterParamSlots *
+slots_ref(RSFilterParamSlots *slots)
+{
+	g_atomic_int_inc(&slots->refcount);
+
+	return slots;
+}
+
+static void
+slots_unref(RSFilterParamSlots *slots)
+{
+	guint i;
+
+	if (!g_atomic_int_dec_and_test(&slots->refcount))
+		return;
+
+	for(i = 0; i < slots->n; i++)
+		g_value_unset(&slots->slot[i].value);
+	g_free(slots->slot);
+	g_slice_free(RSFilterParamSlots, slots);
+}
+
+static Slot *
+slots_lookup(const RSFilterParamSlots *slots, GQuark id)
+{
+	guint i;
+
+	if (id == 0)
+		return NULL;
+
+	for(i = 0; i < slots->n; i++)
+		if (slots->slot[i].id == id)
+			return &slots->slot[i];
+
+	return NULL;
+}
+
+/* Make sure filter_param is the only user of its slots before changing them */
+static RSFilterParamSlots *
+slots_writable(RSFilterParam *filter_param)
+{
+	RSFilterParamSlots *slots = filter_param->slots;
+
+	if (g_atomic_int_get(&slots->refcount) > 1)
+	{
+		RSFilterParamSlots *copy = slots_new(slots->n);
+		guint i;
+
+		for(i = 0; i < slots->n; i++)
+		{
+			copy->slot[i].id = slots->slot[i].id;
+			g_value_init(&copy->slot[i].value, G_VALUE_TYPE(&slots->slot[i].value));
+			g_value_copy(&slots->slot[i].value, &copy->slot[i].value);
+		}
+		copy->n = slots->n;
+
+		slots_unref(slots);
+		filter_param->slots = copy;
+	}
+
+	return filter_param->slots;
+}
+
 G_DEFINE_TYPE(RSFilterParam, rs_filter_param, G_TYPE_OBJECT)
 
 static void
@@ -47,7 +146,8 @@ rs_filter_param_dispose(GObject *object)
 	{
 		filter_param->dispose_has_run = TRUE;
 
-		g_hash_table_destroy(filter_param->properties);
+		slots_unref(filter_param->slots);
+		filter_param->slots = NULL;
 	}
 
 	G_OBJECT_CLASS(rs_filter_param_parent_class)->dispose (object);
@@ -77,29 +177,10 @@ new_value(GType type)
 	return value;
 }
 
-static void
-free_value(gpointer data)
-{
-	GValue *value = (GValue *) data;
-
-	g_value_unset(value);
-	g_slice_free(GValue, value);
-}
-
-static inline GValue *
-clone_value(const GValue *value)
-{
-	GType type = G_VALUE_TYPE(value);
-	GValue *ret = new_value(type);
-	g_value_copy(value, ret);
-
-	return ret;
-}
-
 static void
 rs_filter_param_init(RSFilterParam *param)
 {
-	param->properties = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free_value);
+	param->slots = slots_ref(&empty_slots);
 }
 
 RSFilterParam *
@@ -108,39 +189,194 @@ rs_filter_param_new(void)
 	return g_object_new (RS_TYPE_FILTER_PARAM, NULL);
 }
 
+static void rs_filter_param_set_gvalue(RSFilterParam *filter_param, const gchar *name, GValue * value);
+
+/**
+ * Copy all properties from one RSFilterParam to another. Properties are shared
+ * until one of the RSFilterParams is changed, so this is cheap
+ * @param destination A RSFilterParam to copy properties to
+ * @param source A RSFilterParam to copy properties from
+ */
 void
 rs_filter_param_clone(RSFilterParam *destination, const RSFilterParam *source)
 {
+	guint i;
+
 	g_return_if_fail(RS_IS_FILTER_PARAM(destination));
 	g_return_if_fail(RS_IS_FILTER_PARAM(source));
 
-	/* Clone the properties table */
-	GHashTableIter iter;
-	gpointer key, value;
+	if (destination->slots == source->slots)
+		return;
+
+	/* The usual case, share the properties */
+	if (destination->slots->n == 0)
+	{
+		slots_unref(destination->slots);
+		destination->slots = slots_ref(source->slots);
+		return;
+	}
+
+	/* Merge into existing properties */
+	for(i = 0; i < source->slots->n; i++)
+	{
+		const Slot *slot = &source->slots->slot[i];
+		GValue *value = new_value(G_VALUE_TYPE(&slot->value));
+
+		g_value_copy(&slot->value, value);
+		rs_filter_param_set_gvalue(destination, g_quark_to_string(slot->id), value);
+	}
+}
+
+/**
+ * Get a hash of all properties in a RSFilterParam, two RSFilterParams with the
+ * same properties will have the same hash. Objects are compared by identity
+ * @param filter_param A RSFilterParam
+ * @return A hash of all properties
+ */
+guint
+rs_filter_param_hash(const RSFilterParam *filter_param)
+{
+	guint hash = 0;
+	guint i;
+
+	g_return_val_if_fail(RS_IS_FILTER_PARAM(filter_param), 0);
+
+	for(i = 0; i < filter_param->slots->n; i++)
+	{
+		const Slot *slot = &filter_param->slots->slot[i];
+		const GValue *value = &slot->value;
+		guint value_hash;
+
+		if (G_VALUE_HOLDS(value, RS_TYPE_FLOAT4))
+		{
+			const guint32 *f = g_value_get_boxed(value);
+			gint j;
+
+			/* Hash the bits of the four floats */
+			value_hash = RS_TYPE_FLOAT4;
+			for(j = 0; f && j < 4; j++)
+				value_hash = value_hash * 31 + f[j];
+		}
+		else
+			value_hash = rs_value_hash(value);
+
+		/* Properties are stored in the order they were set, combine entries
+		 * in an order independent way */
+		hash += slot->id * 31 + value_hash;
+	}
+
+	return hash;
+}
+
+static gboolean
+value_equal(const GValue *a, const GValue *b)
+{
+	if (G_VALUE_TYPE(a) != G_VALUE_TYPE(b))
+		return FALSE;
+
+	if (G_VALUE_HOLDS(a, RS_TYPE_FLOAT4))
+	{
+		const gfloat *fa = g_value_get_boxed(a);
+		const gfloat *fb = g_value_get_boxed(b);
+
+		if (!fa || !fb)
+			return fa == fb;
+		return memcmp(fa, fb, sizeof(gfloat)*4) == 0;
+	}
+
+	switch (G_TYPE_FUNDAMENTAL(G_VALUE_TYPE(a)))
+	{
+		case G_TYPE_STRING:
+			return g_strcmp0(g_value_get_string(a), g_value_get_string(b)) == 0;
+		case G_TYPE_OBJECT:
+		case G_TYPE_BOXED:
+		case G_TYPE_POINTER:
+			return g_value_peek_pointer(a) == g_value_peek_pointer(b);
+		default:
+			/* Plain numbers live in the first data member, the rest is
+			 * zeroed by g_value_init() */
+			return memcmp(&a->data[0], &b->data[0], sizeof(a->data[0])) == 0;
+	}
+}
+
+/**
+ * Compare all properties of two RSFilterParams. Objects are compared by
+ * identity, like rs_filter_param_hash() does
+ * @param a A RSFilterParam
+ * @param b A RSFilterParam
+ * @return TRUE if a and b hold the same properties with the same values
+ */
+gboolean
+rs_filter_param_equal(const RSFilterParam *a, const RSFilterParam *b)
+{
+	guint i;
+
+	g_return_val_if_fail(RS_IS_FILTER_PARAM(a), FALSE);
+	g_return_val_if_fail(RS_IS_FILTER_PARAM(b), FALSE);
+
+	if (a->slots == b->slots)
+		return TRUE;
+
+	if (a->slots->n != b->slots->n)
+		return FALSE;
+
+	for(i = 0; i < a->slots->n; i++)
+	{
+		const Slot *slot = &a->slots->slot[i];
+		const Slot *other = slots_lookup(b->slots, slot->id);
+
+		if (!other || !value_equal(&slot->value, &other->value))
+			return FALSE;
+	}
 
-	g_hash_table_iter_init (&iter, source->properties);
-	while (g_hash_table_iter_next (&iter, &key, &value))
-		g_hash_table_insert(destination->properties, (gpointer) g_strdup(key), clone_value(value));
+	return TRUE;
 }
 
+/* Takes ownership of value */
 static void
 rs_filter_param_set_gvalue(RSFilterParam *filter_param, const gchar *name, GValue * value)
 {
+	RSFilterParamSlots *slots;
+	GQuark id;
+	Slot *slot;
+
 	g_return_if_fail(RS_IS_FILTER_PARAM(filter_param));
 	g_return_if_fail(name != NULL);
 	g_return_if_fail(name[0] != '\0');
 
-	g_hash_table_insert(filter_param->properties, (gpointer) g_strdup(name), value);
+	id = g_quark_from_string(name);
+	slots = slots_writable(filter_param);
+
+	slot = slots_lookup(slots, id);
+	if (slot)
+		g_value_unset(&slot->value);
+	else
+	{
+		if (slots->n == slots->allocated)
+		{
+			slots->allocated *= 2;
+			slots->slot = g_renew(Slot, slots->slot, slots->allocated);
+		}
+		slot = &slots->slot[slots->n++];
+		slot->id = id;
+	}
+
+	/* Move the value into the slot */
+	slot->value = *value;
+	g_slice_free(GValue, value);
 }
 
 static GValue *
 rs_filter_param_get_gvalue(const RSFilterParam *filter_param, const gchar *name)
 {
+	Slot *slot;
+
 	g_return_val_if_fail(RS_IS_FILTER_PARAM(filter_param), NULL);
 
-	GValue *value = g_hash_table_lookup(filter_param->properties, name);
+	/* Names never set anywhere are not interned */
+	slot = slots_lookup(filter_param->slots, g_quark_try_string(name));
 
-	return value;
+	return slot ? &slot->value : NULL;
 }
 
 /**
@@ -152,9 +388,24 @@ rs_filter_param_get_gvalue(const RSFilterParam *filter_param, const gchar *name)
 gboolean
 rs_filter_param_delete(RSFilterParam *filter_param, const gchar *name)
 {
+	RSFilterParamSlots *slots;
+	GQuark id;
+	Slot *slot;
+
 	g_return_val_if_fail(RS_IS_FILTER_PARAM(filter_param), FALSE);
 
-	return g_hash_table_remove(filter_param->properties, name);
+	id = g_quark_try_string(name);
+	if (!slots_lookup(filter_param->slots, id))
+		return FALSE;
+
+	slots = slots_writable(filter_param);
+	slot = slots_lookup(slots, id);
+	g_value_unset(&slot->value);
+
+	/* Keep the vector packed */
+	*slot = slots->slot[--slots->n];
+
+	return TRUE;
 }
 
 /**
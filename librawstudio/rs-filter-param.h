@@ -31,11 +31,14 @@ G_BEGIN_DECLS
 #define RS_IS_FILTER_PARAM_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), RS_TYPE_FILTER_PARAM))
 #define RS_FILTER_PARAM_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS ((obj), RS_TYPE_FILTER_PARAM, RSFilterParamClass))
 
+typedef struct _RSFilterParamSlots RSFilterParamSlots;
+
 typedef struct {
 	GObject parent;
 	gboolean dispose_has_run;
 
-	GHashTable *properties;
+	/* Shared between clones until one of them is changed */
+	RSFilterParamSlots *slots;
 } RSFilterParam;
 
 typedef struct {
@@ -46,9 +49,34 @@ GType rs_filter_param_get_type(void);
 
 RSFilterParam *rs_filter_param_new(void);
 
+/**
+ * Copy all properties from one RSFilterParam to another. Properties are shared
+ * until one of the RSFilterParams is changed, so this is cheap
+ * @param destination A RSFilterParam to copy properties to
+ * @param source A RSFilterParam to copy properties from
+ */
 void
 rs_filter_param_clone(RSFilterParam *destination, const RSFilterParam *source);
 
+/**
+ * Get a hash of all properties in a RSFilterParam, two RSFilterParams with the
+ * same properties will have the same hash. Objects are compared by identity
+ * @param filter_param A RSFilterParam
+ * @return A hash of all properties
+ */
+guint
+rs_filter_param_hash(const RSFilterParam *filter_param);
+
+/**
+ * Compare all properties of two RSFilterParams. Objects are compared by
+ * identity, like rs_filter_param_hash() does
+ * @param a A RSFilterParam
+ * @param b A RSFilterParam
+ * @return TRUE if a and b hold the same properties with the same values
+ */
+gboolean
+rs_filter_param_equal(const RSFilterParam *a, const RSFilterParam *b);
+
 /**
  * Delete a property from a RSFilterParam
  * @param filter_param A RSFilterParam
@@ -25,6 +25,9 @@ struct _RSFilterRequest {
 	gboolean roi_set;
 	GdkRectangle roi;
 	gboolean quick;
+	RSTrace *trace;
+	GCancellable *cancellable;
+	gpointer float_producer;
 };
 
 G_DEFINE_TYPE(RSFilterRequest, rs_filter_request, RS_TYPE_FILTER_PARAM)
@@ -32,6 +35,13 @@ G_DEFINE_TYPE(RSFilterRequest, rs_filter_request, RS_TYPE_FILTER_PARAM)
 static void
 rs_filter_request_finalize(GObject *object)
 {
+	RSFilterRequest *filter_request = RS_FILTER_REQUEST(object);
+
+	if (filter_request->trace)
+		g_object_unref(filter_request->trace);
+	if (filter_request->cancellable)
+		g_object_unref(filter_request->cancellable);
+
 	G_OBJECT_CLASS (rs_filter_request_parent_class)->finalize (object);
 }
 
@@ -48,6 +58,9 @@ rs_filter_request_init(RSFilterRequest *filter_request)
 {
 	filter_request->roi_set = FALSE;
 	filter_request->quick = FALSE;
+	filter_request->trace = NULL;
+	filter_request->cancellable = NULL;
+	filter_request->float_producer = NULL;
 }
 
 /**
@@ -96,6 +109,9 @@ rs_filter_request_clone(const RSFilterRequest *filter_request)
 		new_filter_request->roi_set = filter_request->roi_set;
 		new_filter_request->roi = filter_request->roi;
 		new_filter_request->quick = filter_request->quick;
+		rs_filter_request_set_trace(new_filter_request, filter_request->trace);
+		rs_filter_request_set_cancellable(new_filter_request, filter_request->cancellable);
+		new_filter_request->float_producer = filter_request->float_producer;
 
 		rs_filter_param_clone(RS_FILTER_PARAM(new_filter_request), RS_FILTER_PARAM(filter_request));
 	}
@@ -165,3 +181,116 @@ gboolean rs_filter_request_get_quick(const RSFilterRequest *filter_request)
 
 	return ret;
 }
+
+/**
+ * Attach a trace to a request, filters will record how long they spent
+ * rendering the request. The trace will be passed on to cloned requests
+ * @param filter_request A RSFilterRequest
+ * @param trace A RSTrace or NULL to use the default trace
+ */
+void
+rs_filter_request_set_trace(RSFilterRequest *filter_request, RSTrace *trace)
+{
+	g_return_if_fail(RS_IS_FILTER_REQUEST(filter_request));
+	g_return_if_fail(trace == NULL || RS_IS_TRACE(trace));
+
+	if (trace)
+		g_object_ref(trace);
+	if (filter_request->trace)
+		g_object_unref(filter_request->trace);
+	filter_request->trace = trace;
+}
+
+/**
+ * Get the trace used for a request
+ * @param filter_request A RSFilterRequest
+ * @return The RSTrace attached to filter_request, the default RSTrace if none
+ *         is attached or NULL if nothing should be traced. This should not be
+ *         unreffed
+ */
+RSTrace *
+rs_filter_request_get_trace(const RSFilterRequest *filter_request)
+{
+	if (RS_IS_FILTER_REQUEST(filter_request) && filter_request->trace)
+		return filter_request->trace;
+
+	return rs_trace_get_default();
+}
+
+/**
+ * Attach a GCancellable to a request. When cancelled, filters will stop
+ * working on the request as soon as possible and return incomplete images.
+ * The GCancellable will be passed on to cloned requests
+ * @param filter_request A RSFilterRequest
+ * @param cancellable A GCancellable or NULL
+ */
+void
+rs_filter_request_set_cancellable(RSFilterRequest *filter_request, GCancellable *cancellable)
+{
+	g_return_if_fail(RS_IS_FILTER_REQUEST(filter_request));
+	g_return_if_fail(cancellable == NULL || G_IS_CANCELLABLE(cancellable));
+
+	if (cancellable)
+		g_object_ref(cancellable);
+	if (filter_request->cancellable)
+		g_object_unref(filter_request->cancellable);
+	filter_request->cancellable = cancellable;
+}
+
+/**
+ * Get the GCancellable attached to a request
+ * @param filter_request A RSFilterRequest
+ * @return A GCancellable or NULL, this should not be unreffed
+ */
+GCancellable *
+rs_filter_request_get_cancellable(const RSFilterRequest *filter_request)
+{
+	g_return_val_if_fail(RS_IS_FILTER_REQUEST(filter_request), NULL);
+
+	return filter_request->cancellable;
+}
+
+/**
+ * Check if a request has been cancelled, filters should call this between
+ * expensive steps and output from cancelled requests must not be cached
+ * @param filter_request A RSFilterRequest
+ * @return TRUE if the request has been cancelled, FALSE otherwise
+ */
+gboolean
+rs_filter_request_is_cancelled(const RSFilterRequest *filter_request)
+{
+	if (!RS_IS_FILTER_REQUEST(filter_request) || !filter_request->cancellable)
+		return FALSE;
+
+	return g_cancellable_is_cancelled(filter_request->cancellable);
+}
+
+/**
+ * Allow a filter to deliver float planar image data (RSImage) instead of a
+ * RS_IMAGE16. This should be set by filters able to consume RSImage, for
+ * their previous filter. Other filters will get RS_IMAGE16 as usual, even
+ * if they are passed this request
+ * @param filter_request A RSFilterRequest
+ * @param producer The RSFilter allowed to deliver float data or NULL
+ */
+void
+rs_filter_request_set_float_producer(RSFilterRequest *filter_request, gpointer producer)
+{
+	g_return_if_fail(RS_IS_FILTER_REQUEST(filter_request));
+
+	filter_request->float_producer = producer;
+}
+
+/**
+ * Check if a filter may deliver float planar image data for a request
+ * @param filter_request A RSFilterRequest
+ * @param filter The RSFilter that wants to deliver float data
+ * @return TRUE if filter may set a RSImage in its response instead of a RS_IMAGE16
+ */
+gboolean
+rs_filter_request_get_float_allowed(const RSFilterRequest *filter_request, gpointer filter)
+{
+	g_return_val_if_fail(RS_IS_FILTER_REQUEST(filter_request), FALSE);
+
+	return (filter != NULL) && (filter_request->float_producer == filter);
+}
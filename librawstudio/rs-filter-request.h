@@ -22,6 +22,8 @@
 
 #include <glib-object.h>
 #include "rs-filter-param.h"
+#include "rs-trace.h"
+#include <gio/gio.h>
 
 G_BEGIN_DECLS
 
@@ -91,6 +93,65 @@ void rs_filter_request_set_quick(RSFilterRequest *filter_request, gboolean quick
  */
 gboolean rs_filter_request_get_quick(const RSFilterRequest *filter_request);
 
+/**
+ * Attach a trace to a request, filters will record how long they spent
+ * rendering the request. The trace will be passed on to cloned requests
+ * @param filter_request A RSFilterRequest
+ * @param trace A RSTrace or NULL to use the default trace
+ */
+void rs_filter_request_set_trace(RSFilterRequest *filter_request, RSTrace *trace);
+
+/**
+ * Get the trace used for a request
+ * @param filter_request A RSFilterRequest
+ * @return The RSTrace attached to filter_request, the default RSTrace if none
+ *         is attached or NULL if nothing should be traced. This should not be
+ *         unreffed
+ */
+RSTrace *rs_filter_request_get_trace(const RSFilterRequest *filter_request);
+
+/**
+ * Attach a GCancellable to a request. When cancelled, filters will stop
+ * working on the request as soon as possible and return incomplete images.
+ * The GCancellable will be passed on to cloned requests
+ * @param filter_request A RSFilterRequest
+ * @param cancellable A GCancellable or NULL
+ */
+void rs_filter_request_set_cancellable(RSFilterRequest *filter_request, GCancellable *cancellable);
+
+/**
+ * Get the GCancellable attached to a request
+ * @param filter_request A RSFilterRequest
+ * @return A GCancellable or NULL, this should not be unreffed
+ */
+GCancellable *rs_filter_request_get_cancellable(const RSFilterRequest *filter_request);
+
+/**
+ * Check if a request has been cancelled, filters should call this between
+ * expensive steps and output from cancelled requests must not be cached
+ * @param filter_request A RSFilterRequest
+ * @return TRUE if the request has been cancelled, FALSE otherwise
+ */
+gboolean rs_filter_request_is_cancelled(const RSFilterRequest *filter_request);
+
+/**
+ * Allow a filter to deliver float planar image data (RSImage) instead of a
+ * RS_IMAGE16. This should be set by filters able to consume RSImage, for
+ * their previous filter. Other filters will get RS_IMAGE16 as usual, even
+ * if they are passed this request
+ * @param filter_request A RSFilterRequest
+ * @param producer The RSFilter allowed to deliver float data or NULL
+ */
+void rs_filter_request_set_float_producer(RSFilterRequest *filter_request, gpointer producer);
+
+/**
+ * Check if a filter may deliver float planar image data for a request
+ * @param filter_request A RSFilterRequest
+ * @param filter The RSFilter that wants to deliver float data
+ * @return TRUE if filter may set a RSImage in its response instead of a RS_IMAGE16
+ */
+gboolean rs_filter_request_get_float_allowed(const RSFilterRequest *filter_request, gpointer filter);
+
 G_END_DECLS
 
 #endif /* RS_FILTER_REQUEST_H */
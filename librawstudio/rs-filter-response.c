@@ -29,6 +29,7 @@ struct _RSFilterResponse {
 	gboolean quick;
 	RS_IMAGE16 *image;
 	GdkPixbuf *image8;
+	RSImage *image_float;
 	gint width;
 	gint height;
 };
@@ -49,6 +50,9 @@ rs_filter_response_dispose(GObject *object)
 
 		if (filter_response->image8)
 			g_object_unref(filter_response->image8);
+
+		if (filter_response->image_float)
+			g_object_unref(filter_response->image_float);
 	}
 
 	G_OBJECT_CLASS (rs_filter_response_parent_class)->dispose (object);
@@ -76,6 +80,7 @@ rs_filter_response_init(RSFilterResponse *filter_response)
 	filter_response->quick = FALSE;
 	filter_response->image = NULL;
 	filter_response->image8 = NULL;
+	filter_response->image_float = NULL;
 	filter_response->width = -1;
 	filter_response->height = -1;
 	filter_response->dispose_has_run = FALSE;
@@ -233,6 +238,58 @@ rs_filter_response_get_image(const RSFilterResponse *filter_response)
 	return ret;
 }
 
+/**
+ * Set float planar image data, this should only be set instead of 16 bit
+ * image data if rs_filter_request_get_float_allowed() returns TRUE
+ * @param filter_response A RSFilterResponse
+ * @param image A RSImage
+ */
+void
+rs_filter_response_set_float_image(RSFilterResponse *filter_response, RSImage *image)
+{
+	g_return_if_fail(RS_IS_FILTER_RESPONSE(filter_response));
+
+	if (filter_response->image_float)
+	{
+		g_object_unref(filter_response->image_float);
+		filter_response->image_float = NULL;
+	}
+
+	if (image)
+		filter_response->image_float = g_object_ref(image);
+}
+
+/**
+ * Is there a float planar image attached
+ * @param filter_response A RSFilterResponse
+ * @return A gboolean TRUE if a float image is attached, FALSE otherwise
+ */
+gboolean
+rs_filter_response_has_float_image(const RSFilterResponse *filter_response)
+{
+	g_return_val_if_fail(RS_IS_FILTER_RESPONSE(filter_response), FALSE);
+
+	return !!filter_response->image_float;
+}
+
+/**
+ * Get float planar image data
+ * @param filter_response A RSFilterResponse
+ * @return A RSImage (must be unreffed after usage) or NULL if none is set
+ */
+RSImage *
+rs_filter_response_get_float_image(const RSFilterResponse *filter_response)
+{
+	RSImage *ret = NULL;
+
+	g_return_val_if_fail(RS_IS_FILTER_RESPONSE(filter_response), NULL);
+
+	if (filter_response->image_float)
+		ret = g_object_ref(filter_response->image_float);
+
+	return ret;
+}
+
 /**
  * Set 8 bit image data
  * @param filter_response A RSFilterResponse
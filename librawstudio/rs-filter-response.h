@@ -109,6 +109,28 @@ void rs_filter_response_set_image(RSFilterResponse *filter_response, RS_IMAGE16
  */
 RS_IMAGE16 *rs_filter_response_get_image(const RSFilterResponse *filter_response);
 
+/**
+ * Set float planar image data, this should only be set instead of 16 bit
+ * image data if rs_filter_request_get_float_allowed() returns TRUE
+ * @param filter_response A RSFilterResponse
+ * @param image A RSImage
+ */
+void rs_filter_response_set_float_image(RSFilterResponse *filter_response, RSImage *image);
+
+/**
+ * Is there a float planar image attached
+ * @param filter_response A RSFilterResponse
+ * @return A gboolean TRUE if a float image is attached, FALSE otherwise
+ */
+gboolean rs_filter_response_has_float_image(const RSFilterResponse *filter_response);
+
+/**
+ * Get float planar image data
+ * @param filter_response A RSFilterResponse
+ * @return A RSImage (must be unreffed after usage) or NULL if none is set
+ */
+RSImage *rs_filter_response_get_float_image(const RSFilterResponse *filter_response);
+
 /**
  * Set 8 bit image data
  * @param filter_response A RSFilterResponse
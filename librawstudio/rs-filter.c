@@ -18,20 +18,10 @@
  */
 
 #include <stdlib.h> /* system() */
+#include <string.h> /* memcpy() */
 #include <rawstudio.h>
 #include "rs-filter.h"
 
-#if 0 /* Change to 1 to enable performance info */
-#define filter_performance printf
-#define FILTER_SHOW_PERFORMANCE
-#else
-#define filter_performance(...) {}
-#endif
-
-/* How much time should a filter at least have taken to show performance number */
-#define FILTER_PERF_ELAPSED_MIN 0.001
-#define CHAIN_PERF_ELAPSED_MIN 0.001
-
 G_DEFINE_TYPE (RSFilter, rs_filter, G_TYPE_OBJECT)
 
 enum {
@@ -41,6 +31,9 @@ enum {
 
 static guint signals[LAST_SIGNAL] = { 0 };
 
+/* Protects the memoized sizes of all filters */
+static GStaticMutex size_lock = G_STATIC_MUTEX_INIT;
+
 static void
 dispose(GObject *obj)
 {
@@ -54,6 +47,9 @@ dispose(GObject *obj)
 			filter->previous->next_filters = g_slist_remove(filter->previous->next_filters, filter);
 			g_object_unref(filter->previous);
 		}
+		if (filter->size)
+			g_object_unref(filter->size);
+		filter->size = NULL;
 	}
 }
 
@@ -76,6 +72,7 @@ rs_filter_class_init(RSFilterClass *klass)
 	klass->get_image8 = NULL;
 	klass->get_size = NULL;
 	klass->previous_changed = NULL;
+	klass->get_border = NULL;
 
 	object_class->dispose = dispose;
 }
@@ -87,6 +84,25 @@ rs_filter_init(RSFilter *self)
 	self->previous = NULL;
 	self->next_filters = NULL;
 	self->enabled = TRUE;
+	self->size = NULL;
+	self->size_serial = 0;
+}
+
+/* Forget the memoized size of filter and all filters depending on it */
+static void
+size_invalidate(RSFilter *filter)
+{
+	GSList *node;
+
+	g_static_mutex_lock(&size_lock);
+	if (filter->size)
+		g_object_unref(filter->size);
+	filter->size = NULL;
+	filter->size_serial++;
+	g_static_mutex_unlock(&size_lock);
+
+	for(node = filter->next_filters; node; node = g_slist_next(node))
+		size_invalidate(RS_FILTER(node->data));
 }
 
 /**
@@ -142,6 +158,8 @@ rs_filter_set_previous(RSFilter *filter, RSFilter *previous)
 
 		previous->next_filters = g_slist_append(previous->next_filters, filter);
 	}
+
+	size_invalidate(filter);
 }
 
 /**
@@ -158,6 +176,10 @@ rs_filter_changed(RSFilter *filter, RSFilterChangedMask mask)
 
 	gint i, n_next = g_slist_length(filter->next_filters);
 
+	/* Must be done before anyone downstream is notified and asks for the size */
+	if ((mask & RS_FILTER_CHANGED_DIMENSION) == RS_FILTER_CHANGED_DIMENSION)
+		size_invalidate(filter);
+
 	for(i=0; i<n_next; i++)
 	{
 		RSFilter *next = RS_FILTER(g_slist_nth_data(filter->next_filters, i));
@@ -174,25 +196,35 @@ rs_filter_changed(RSFilter *filter, RSFilterChangedMask mask)
 	g_signal_emit(G_OBJECT(filter), signals[CHANGED_SIGNAL], 0, mask);
 }
 
-/* Clamps ROI rectangle to image size */
-/* Returns a new rectangle, or NULL if ROI was within bounds*/
+/* Expands ROI rectangle by the border needed by the filter and clamps it to image size */
+/* Returns a new rectangle, or NULL if ROI can be used as is */
 
 static GdkRectangle* 
 clamp_roi(const GdkRectangle *roi, RSFilter *filter, const RSFilterRequest *request)
 {
+	gint border = rs_filter_get_border(filter, request);
 	RSFilterResponse *response = rs_filter_get_size(filter, request);
 	gint w = rs_filter_response_get_width(response);
 	gint h = rs_filter_response_get_height(response);
 	g_object_unref(response);
 
-	if ((roi->x >= 0) && (roi->y >=0) && (roi->x + roi->width <= w) && (roi->y + roi->height <= h))
+	/* We don't know the size, nothing to clamp against */
+	if (w < 1 || h < 1)
+		return NULL;
+
+	gint x1 = MAX(0, roi->x - border);
+	gint y1 = MAX(0, roi->y - border);
+	gint x2 = MIN(w, roi->x + roi->width + border);
+	gint y2 = MIN(h, roi->y + roi->height + border);
+
+	if ((x1 == roi->x) && (y1 == roi->y) && (x2 == roi->x + roi->width) && (y2 == roi->y + roi->height))
 		return NULL;
 
 	GdkRectangle* new_roi = g_new(GdkRectangle, 1);
-	new_roi->x = MAX(0, roi->x);
-	new_roi->y = MAX(0, roi->y);
-	new_roi->width = MIN(w - new_roi->x, roi->width);
-	new_roi->height = MAX(h - new_roi->y, roi->height);
+	new_roi->x = x1;
+	new_roi->y = y1;
+	new_roi->width = x2 - x1;
+	new_roi->height = y2 - y1;
 	return new_roi;
 }
 
@@ -207,24 +239,19 @@ rs_filter_get_image(RSFilter *filter, const RSFilterRequest *request)
 {
 	GdkRectangle* roi = NULL;
 	RSFilterRequest *r = NULL;
+	RSFilterResponse *response;
+	RSTrace *trace;
+	RSTraceSpan span;
 
 	g_return_val_if_fail(RS_IS_FILTER(filter), NULL);
 	g_return_val_if_fail(RS_IS_FILTER_REQUEST(request), NULL);
 
 	RS_DEBUG(FILTERS, "rs_filter_get_image(%s [%p])", RS_FILTER_NAME(filter), filter);
 
-	/* This timer-hack will break badly when multithreaded! */
-	static gfloat last_elapsed = 0.0;
-	static gint count = -1;
-	gfloat elapsed;
-	static GTimer *gt = NULL;
-
-	RSFilterResponse *response;
-	RS_IMAGE16 *image;
-
-	if (count == -1)
-		gt = g_timer_new();
-	count++;
+	/* Disabled filters are passed through, don't clutter the trace with them */
+	trace = (filter->enabled) ? rs_filter_request_get_trace(request) : NULL;
+	if (trace)
+		rs_trace_begin(trace, &span);
 
 	if (filter->enabled && (roi = rs_filter_request_get_roi(request)))
 	{
@@ -238,56 +265,58 @@ rs_filter_get_image(RSFilter *filter, const RSFilterRequest *request)
 	}
 
 	if (RS_FILTER_GET_CLASS(filter)->get_image && filter->enabled)
+	{
 		response = RS_FILTER_GET_CLASS(filter)->get_image(filter, request);
+
+		/* Convert float data for callers not asking for it */
+		if (rs_filter_response_has_float_image(response) && !rs_filter_response_has_image(response)
+			&& !rs_filter_request_get_float_allowed(request, filter))
+		{
+			RSImage *image_float = rs_filter_response_get_float_image(response);
+			RS_IMAGE16 *image = rs_image_to_image16(image_float);
+
+			RS_DEBUG(PERFORMANCE, "%s delivered float data not asked for, converting", RS_FILTER_NAME(filter));
+
+			rs_filter_response_set_image(response, image);
+			rs_filter_response_set_float_image(response, NULL);
+			if (image)
+				g_object_unref(image);
+			g_object_unref(image_float);
+		}
+	}
 	else
 		response = rs_filter_get_image(filter->previous, request);
 
 	g_assert(RS_IS_FILTER_RESPONSE(response));
 
-	image = rs_filter_response_get_image(response);
-
-	elapsed = g_timer_elapsed(gt, NULL) - last_elapsed;
-
 	if (roi)
 		g_free(roi);
 	if (r)
 		g_object_unref(r);
 
-#ifdef FILTER_SHOW_PERFORMANCE
-	if ((elapsed > FILTER_PERF_ELAPSED_MIN) && (image != NULL)) 
+	if (trace)
 	{
-		gint iw = image->w;
-		gint ih = image->h;
-		if (rs_filter_response_get_roi(response)) 
+		RS_IMAGE16 *image = rs_filter_response_get_image(response);
+		GdkRectangle *response_roi = rs_filter_response_get_roi(response);
+		gint w = 0, h = 0;
+
+		g_assert(RS_IS_IMAGE16(image) || (image == NULL));
+
+		if (response_roi)
 		{
-			roi = rs_filter_response_get_roi(response);
-			iw = roi->width;
-			ih = roi->height;
+			w = response_roi->width;
+			h = response_roi->height;
 		}
-		filter_performance("%s took: \033[32m%.0f\033[0mms", RS_FILTER_NAME(filter), elapsed*1000);
-		if ((elapsed > 0.001) && (image != NULL))
-			filter_performance(" [\033[33m%.01f\033[0mMpix/s]", ((gfloat)(iw*ih))/elapsed/1000000.0);
-		if (image)
-			filter_performance(" [w: %d, h: %d, roi-w:%d, roi-h:%d, channels: %d, pixelsize: %d, rowstride: %d]",
-				image->w, image->h, iw, ih, image->channels, image->pixelsize, image->rowstride);
-		filter_performance("\n");
-	}
-#endif
-	g_assert(RS_IS_IMAGE16(image) || (image == NULL));
-	last_elapsed += elapsed;
+		else if (image)
+		{
+			w = image->w;
+			h = image->h;
+		}
+		rs_trace_end(trace, &span, RS_FILTER_NAME(filter), filter->label, "16 bit", w, h);
 
-	count--;
-	if (count == -1)
-	{
-		last_elapsed = 0.0;
-		if (g_timer_elapsed(gt,NULL) > CHAIN_PERF_ELAPSED_MIN)
-			filter_performance("Complete 16 bit chain took: \033[32m%.0f\033[0mms\n\n", g_timer_elapsed(gt, NULL)*1000.0);
-		rs_filter_param_set_float(RS_FILTER_PARAM(response), "16-bit-time", g_timer_elapsed(gt, NULL));
-		g_timer_destroy(gt);
+		if (image)
+			g_object_unref(image);
 	}
-	
-	if (image)
-		g_object_unref(image);
 
 	return response;
 }
@@ -302,28 +331,20 @@ rs_filter_get_image(RSFilter *filter, const RSFilterRequest *request)
 RSFilterResponse *
 rs_filter_get_image8(RSFilter *filter, const RSFilterRequest *request)
 {
-	g_return_val_if_fail(RS_IS_FILTER(filter), NULL);
-	g_return_val_if_fail(RS_IS_FILTER_REQUEST(request), NULL);
-
-	RS_DEBUG(FILTERS, "rs_filter_get_image8(%s [%p])", RS_FILTER_NAME(filter), filter);
-
-	/* This timer-hack will break badly when multithreaded! */
-	static gfloat last_elapsed = 0.0;
-	static gint count = -1;
-	gfloat elapsed, temp;
-	static GTimer *gt = NULL;
-
 	RSFilterResponse *response = NULL;
-	GdkPixbuf *image = NULL;
 	GdkRectangle* roi = NULL;
 	RSFilterRequest *r = NULL;
+	RSTrace *trace;
+	RSTraceSpan span;
 
 	g_return_val_if_fail(RS_IS_FILTER(filter), NULL);
 	g_return_val_if_fail(RS_IS_FILTER_REQUEST(request), NULL);
 
-	if (count == -1)
-		gt = g_timer_new();
-	count++;
+	RS_DEBUG(FILTERS, "rs_filter_get_image8(%s [%p])", RS_FILTER_NAME(filter), filter);
+
+	trace = (filter->enabled) ? rs_filter_request_get_trace(request) : NULL;
+	if (trace)
+		rs_trace_begin(trace, &span);
 
 	if (filter->enabled && (roi = rs_filter_request_get_roi(request)))
 	{
@@ -343,58 +364,41 @@ rs_filter_get_image8(RSFilter *filter, const RSFilterRequest *request)
 
 	g_assert(RS_IS_FILTER_RESPONSE(response));
 
-	image = rs_filter_response_get_image8(response);
-	elapsed = g_timer_elapsed(gt, NULL) - last_elapsed;
-
-	/* Subtract 16 bit time */
-	if (rs_filter_param_get_float(RS_FILTER_PARAM(response), "16-bit-time", &temp))
-		elapsed -= temp;
-
 	if (roi)
 		g_free(roi);
 	if (r)
 		g_object_unref(r);
 
-#ifdef FILTER_SHOW_PERFORMANCE
-	if ((elapsed > FILTER_PERF_ELAPSED_MIN) && (image != NULL)) {
-		gint iw = gdk_pixbuf_get_width(image);
-		gint ih = gdk_pixbuf_get_height(image);
-		if (rs_filter_response_get_roi(response)) 
-		{
-			GdkRectangle *roi = rs_filter_response_get_roi(response);
-			iw = roi->width;
-			ih = roi->height;
-		}
-		filter_performance("%s took: \033[32m%.0f\033[0mms", RS_FILTER_NAME(filter), elapsed * 1000);
-		filter_performance(" [\033[33m%.01f\033[0mMpix/s]", ((gfloat)(iw * ih)) / elapsed / 1000000.0);
-		filter_performance("\n");
-	}
-#endif
+	if (trace)
+	{
+		GdkPixbuf *image = rs_filter_response_get_image8(response);
+		GdkRectangle *response_roi = rs_filter_response_get_roi(response);
+		gint w = 0, h = 0;
 
-	last_elapsed += elapsed;
+		g_assert(GDK_IS_PIXBUF(image) || (image == NULL));
 
-	g_assert(GDK_IS_PIXBUF(image) || (image == NULL));
+		if (response_roi)
+		{
+			w = response_roi->width;
+			h = response_roi->height;
+		}
+		else if (image)
+		{
+			w = gdk_pixbuf_get_width(image);
+			h = gdk_pixbuf_get_height(image);
+		}
+		rs_trace_end(trace, &span, RS_FILTER_NAME(filter), filter->label, "8 bit", w, h);
 
-	count--;
-	if (count == -1)
-	{
-		last_elapsed = 0.0;
-		rs_filter_param_get_float(RS_FILTER_PARAM(response), "16-bit-time", &last_elapsed);
-		last_elapsed = g_timer_elapsed(gt, NULL)-last_elapsed;
-		if (last_elapsed > CHAIN_PERF_ELAPSED_MIN)
-			filter_performance("Complete 8 bit chain took: \033[32m%.0f\033[0mms\n\n", last_elapsed*1000.0);
-		g_timer_destroy(gt);
-		last_elapsed = 0.0;
+		if (image)
+			g_object_unref(image);
 	}
 
-	if (image)
-		g_object_unref(image);
-
 	return response;
 }
 
 /**
- * Get predicted size of a RSFilter
+ * Get predicted size of a RSFilter. The size is memoized until the filter or
+ * a filter before it signals RS_FILTER_CHANGED_DIMENSION
  * @param filter A RSFilter
  * @param request A RSFilterRequest defining parameters for the request
  */
@@ -402,15 +406,48 @@ RSFilterResponse *
 rs_filter_get_size(RSFilter *filter, const RSFilterRequest *request)
 {
 	RSFilterResponse *response = NULL;
+	RSFilterResponse *cached = NULL;
+	guint hash;
+	guint serial;
 
 	g_return_val_if_fail(RS_IS_FILTER(filter), NULL);
 	g_return_val_if_fail(RS_IS_FILTER_REQUEST(request), NULL);
 
+	hash = rs_filter_param_hash(RS_FILTER_PARAM(request)) * 2 + rs_filter_request_get_quick(request);
+
+	g_static_mutex_lock(&size_lock);
+	if (filter->size && filter->size_hash == hash)
+		cached = g_object_ref(filter->size);
+	serial = filter->size_serial;
+	g_static_mutex_unlock(&size_lock);
+
+	/* Responses are cheap to clone, and the caller is free to change it */
+	if (cached)
+	{
+		response = rs_filter_response_clone(cached);
+		g_object_unref(cached);
+		return response;
+	}
+
 	if (RS_FILTER_GET_CLASS(filter)->get_size && filter->enabled)
 		response = RS_FILTER_GET_CLASS(filter)->get_size(filter, request);
 	else if (filter->previous)
 		response = rs_filter_get_size(filter->previous, request);
 
+	if (RS_IS_FILTER_RESPONSE(response))
+	{
+		g_static_mutex_lock(&size_lock);
+		/* Don't store anything if the filter changed while we were asking */
+		if (filter->size_serial == serial)
+		{
+			if (filter->size)
+				g_object_unref(filter->size);
+			filter->size = rs_filter_response_clone(response);
+			filter->size_hash = hash;
+		}
+		g_static_mutex_unlock(&size_lock);
+	}
+
 	return response;
 }
 
@@ -448,6 +485,190 @@ rs_filter_get_size_simple(RSFilter *filter, const RSFilterRequest *request, gint
 	return ((w>0) && (h>0));
 }
 
+static guint
+hash_properties(GObject *object)
+{
+	GParamSpec **specs;
+	guint n_specs = 0, i;
+	guint hash = G_OBJECT_TYPE(object);
+
+	specs = g_object_class_list_properties(G_OBJECT_GET_CLASS(object), &n_specs);
+	for(i = 0; i < n_specs; i++)
+	{
+		GValue value = {0};
+
+		if (!(specs[i]->flags & G_PARAM_READABLE))
+			continue;
+
+		g_value_init(&value, specs[i]->value_type);
+		g_object_get_property(object, specs[i]->name, &value);
+		hash = hash * 31 + rs_value_hash(&value);
+
+		/* Settings are shared and changed in place, hash their content too */
+		if (G_VALUE_HOLDS(&value, RS_TYPE_SETTINGS) && g_value_get_object(&value))
+		{
+			RSSettings *settings = g_value_get_object(&value);
+			gint k;
+
+			hash = hash * 31 + hash_properties(G_OBJECT(settings));
+			for(k = 0; k < settings->curve_nknots * 2; k++)
+			{
+				guint32 bits;
+				memcpy(&bits, &settings->curve_knots[k], sizeof(bits));
+				hash = hash * 31 + bits;
+			}
+		}
+
+		g_value_unset(&value);
+	}
+	g_free(specs);
+
+	return hash;
+}
+
+/**
+ * Get a hash describing the state of a filter and all filters before it. The
+ * hash is built from all readable properties, so different hashes means
+ * that the chain will render differently. Equal hashes will usually render
+ * the same, but filters can keep state that is not visible as properties
+ * @param filter A RSFilter
+ * @return A hash of the state of the chain
+ */
+guint
+rs_filter_get_upstream_hash(RSFilter *filter)
+{
+	guint hash = 0;
+
+	while (RS_IS_FILTER(filter))
+	{
+		hash = hash * 31 + ((filter->enabled) ? hash_properties(G_OBJECT(filter)) : G_OBJECT_TYPE(filter));
+		filter = filter->previous;
+	}
+
+	return hash;
+}
+
+/**
+ * Get the number of pixels a filter needs around a region of interest to
+ * render the region correctly. The region of interest will be expanded by
+ * this amount before the filter is asked to render it.
+ * @param filter A RSFilter
+ * @param request A RSFilterRequest defining parameters for the request
+ * @return The border in pixels, 0 if the filter doesn't look at neighbouring pixels
+ */
+gint
+rs_filter_get_border(RSFilter *filter, const RSFilterRequest *request)
+{
+	g_return_val_if_fail(RS_IS_FILTER(filter), 0);
+	g_return_val_if_fail(RS_IS_FILTER_REQUEST(request), 0);
+
+	if (RS_FILTER_GET_CLASS(filter)->get_border && filter->enabled)
+		return MAX(0, RS_FILTER_GET_CLASS(filter)->get_border(filter, request));
+
+	return 0;
+}
+
+static gboolean
+get_image_tiled(RSFilter *filter, const RSFilterRequest *request, gint tile_width, gint tile_height, RSFilterTileFunc func, gpointer user_data, gboolean eight_bit)
+{
+	GdkRectangle full, area, tile;
+	GdkRectangle *roi;
+	RSFilterRequest *tile_request;
+	RSFilterResponse *response;
+	gboolean ret = TRUE;
+
+	full.x = 0;
+	full.y = 0;
+	if (!rs_filter_get_size_simple(filter, request, &full.width, &full.height))
+		return FALSE;
+
+	/* Only render the requested area, if any */
+	if ((roi = rs_filter_request_get_roi(request)))
+	{
+		if (!gdk_rectangle_intersect(roi, &full, &area))
+			return TRUE;
+	}
+	else
+		area = full;
+
+	if (tile_width < 1)
+		tile_width = RS_FILTER_TILE_SIZE;
+	if (tile_height < 1)
+		tile_height = RS_FILTER_TILE_SIZE;
+
+	tile_request = rs_filter_request_clone(request);
+
+	for(tile.y = area.y; ret && (tile.y < area.y + area.height); tile.y += tile_height)
+	{
+		tile.height = MIN(tile_height, area.y + area.height - tile.y);
+		for(tile.x = area.x; ret && (tile.x < area.x + area.width); tile.x += tile_width)
+		{
+			tile.width = MIN(tile_width, area.x + area.width - tile.x);
+
+			RS_DEBUG(FILTERS, "Tile %dx%d at %d,%d from %s [%p]", tile.width, tile.height, tile.x, tile.y, RS_FILTER_NAME(filter), filter);
+
+			rs_filter_request_set_roi(tile_request, &tile);
+
+			if (eight_bit)
+				response = rs_filter_get_image8(filter, tile_request);
+			else
+				response = rs_filter_get_image(filter, tile_request);
+
+			/* Tiles from a cancelled request may be incomplete */
+			ret = !rs_filter_request_is_cancelled(tile_request) && func(filter, response, &tile, user_data);
+
+			g_object_unref(response);
+		}
+	}
+
+	g_object_unref(tile_request);
+
+	return ret;
+}
+
+/**
+ * Render the output of a RSFilter one tile at a time. The region of interest
+ * of request, or the whole image if none is set, will be split into tiles
+ * and func will be called once for every tile in top-to-bottom,
+ * left-to-right order
+ * @param filter A RSFilter
+ * @param request A RSFilterRequest defining parameters for the request
+ * @param tile_width Width of tiles or 0 to use RS_FILTER_TILE_SIZE
+ * @param tile_height Height of tiles or 0 to use RS_FILTER_TILE_SIZE
+ * @param func A RSFilterTileFunc to call for every tile
+ * @param user_data Pointer passed on to func
+ * @return TRUE if all tiles were delivered, FALSE otherwise
+ */
+gboolean
+rs_filter_get_image_tiled(RSFilter *filter, const RSFilterRequest *request, gint tile_width, gint tile_height, RSFilterTileFunc func, gpointer user_data)
+{
+	g_return_val_if_fail(RS_IS_FILTER(filter), FALSE);
+	g_return_val_if_fail(RS_IS_FILTER_REQUEST(request), FALSE);
+	g_return_val_if_fail(func != NULL, FALSE);
+
+	return get_image_tiled(filter, request, tile_width, tile_height, func, user_data, FALSE);
+}
+
+/**
+ * Render the 8 bit output of a RSFilter one tile at a time, see rs_filter_get_image_tiled()
+ * @param filter A RSFilter
+ * @param request A RSFilterRequest defining parameters for the request
+ * @param tile_width Width of tiles or 0 to use RS_FILTER_TILE_SIZE
+ * @param tile_height Height of tiles or 0 to use RS_FILTER_TILE_SIZE
+ * @param func A RSFilterTileFunc to call for every tile
+ * @param user_data Pointer passed on to func
+ * @return TRUE if all tiles were delivered, FALSE otherwise
+ */
+gboolean
+rs_filter_get_image8_tiled(RSFilter *filter, const RSFilterRequest *request, gint tile_width, gint tile_height, RSFilterTileFunc func, gpointer user_data)
+{
+	g_return_val_if_fail(RS_IS_FILTER(filter), FALSE);
+	g_return_val_if_fail(RS_IS_FILTER_REQUEST(request), FALSE);
+	g_return_val_if_fail(func != NULL, FALSE);
+
+	return get_image_tiled(filter, request, tile_width, tile_height, func, user_data, TRUE);
+}
+
 /**
  * Set a GObject property on zero or more filters above #filter recursively
  * @param filter A RSFilter
@@ -599,6 +820,8 @@ rs_filter_set_enabled(RSFilter *filter, gboolean enabled)
 	if (filter->enabled != enabled)
 	{
 		filter->enabled = enabled;
+		/* Filters changing size may have been switched on or off */
+		size_invalidate(filter);
 		rs_filter_changed(filter, RS_FILTER_CHANGED_PIXELDATA);
 	}
 
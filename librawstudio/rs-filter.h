@@ -70,6 +70,11 @@ type_name##_get_type(GTypeModule *module) \
 
 #define RS_FILTER_NAME(filter) (((filter)) ? g_type_name(G_TYPE_FROM_CLASS(RS_FILTER_GET_CLASS ((filter)))) : "(nil)")
 
+/* What changed, passed to rs_filter_changed(). There's no region or group of
+ * settings, RSCache keys its entries on the state of all filters before it
+ * (rs_filter_get_upstream_hash()), so images rendered for other settings are
+ * kept anyway - it only drops everything if the pixels changed without any
+ * visible change of state */
 typedef enum {
 	RS_FILTER_CHANGED_PIXELDATA   = 1<<0,
 	RS_FILTER_CHANGED_DIMENSION   = 1<<0 | 1<<1, /* This implies pixeldata changed */
@@ -81,6 +86,21 @@ typedef struct _RSFilterClass RSFilterClass;
 
 typedef RSFilterResponse *(*RSFilterFunc)(RSFilter *filter, const RSFilterRequest *request);
 
+/**
+ * Default tile size used for tiled rendering
+ */
+#define RS_FILTER_TILE_SIZE 256
+
+/**
+ * Callback for rs_filter_get_image_tiled() and rs_filter_get_image8_tiled()
+ * @param filter The RSFilter the tile was requested from
+ * @param response The response for this tile, only the tile area is guaranteed to be valid
+ * @param tile The area of the tile in output coordinates of filter
+ * @param user_data Pointer passed to rs_filter_get_image_tiled()
+ * @return TRUE to continue with the next tile, FALSE to stop
+ */
+typedef gboolean (*RSFilterTileFunc)(RSFilter *filter, RSFilterResponse *response, const GdkRectangle *tile, gpointer user_data);
+
 struct _RSFilter {
 	GObject parent;
 	gboolean dispose_has_run;
@@ -90,8 +110,23 @@ struct _RSFilter {
 	RSFilter *previous;
 	GSList *next_filters;
 	gboolean enabled;
+
+	/* Memoized result of rs_filter_get_size() */
+	RSFilterResponse *size;
+	guint size_hash;
+	guint size_serial;
 };
 
+/**
+ * Thread safety: get_image(), get_image8(), get_size() and get_border() can
+ * be called from any thread, and from several threads at once - on the same
+ * instance as well as on different instances in separate chains. Filters
+ * must not keep rendering state in static variables. State that can be
+ * changed by properties or settings while rendering must be protected by a
+ * lock in the instance, and that lock should not be held while requesting
+ * images from the previous filter. Setting properties and changing the chain
+ * itself should still be done from one thread only.
+ */
 struct _RSFilterClass {
 	GObjectClass parent_class;
 	const gchar *name;
@@ -99,6 +134,7 @@ struct _RSFilterClass {
 	RSFilterFunc get_image8;
 	RSFilterResponse *(*get_size)(RSFilter *filter, const RSFilterRequest *request);
 	void (*previous_changed)(RSFilter *filter, RSFilter *parent, RSFilterChangedMask mask);
+	gint (*get_border)(RSFilter *filter, const RSFilterRequest *request);
 };
 
 GType rs_filter_get_type(void) G_GNUC_CONST;
@@ -159,6 +195,53 @@ extern RSFilterResponse *rs_filter_get_size(RSFilter *filter, const RSFilterRequ
  */
 extern gboolean rs_filter_get_size_simple(RSFilter *filter, const RSFilterRequest *request, gint *width, gint *height);
 
+/**
+ * Get a hash describing the state of a filter and all filters before it. The
+ * hash is built from all readable properties, so different hashes means
+ * that the chain will render differently. Equal hashes will usually render
+ * the same, but filters can keep state that is not visible as properties
+ * @param filter A RSFilter
+ * @return A hash of the state of the chain
+ */
+extern guint rs_filter_get_upstream_hash(RSFilter *filter);
+
+/**
+ * Get the number of pixels a filter needs around a region of interest to
+ * render the region correctly. The region of interest will be expanded by
+ * this amount before the filter is asked to render it.
+ * @param filter A RSFilter
+ * @param request A RSFilterRequest defining parameters for the request
+ * @return The border in pixels, 0 if the filter doesn't look at neighbouring pixels
+ */
+extern gint rs_filter_get_border(RSFilter *filter, const RSFilterRequest *request);
+
+/**
+ * Render the output of a RSFilter one tile at a time. The region of interest
+ * of request, or the whole image if none is set, will be split into tiles
+ * and func will be called once for every tile in top-to-bottom,
+ * left-to-right order
+ * @param filter A RSFilter
+ * @param request A RSFilterRequest defining parameters for the request
+ * @param tile_width Width of tiles or 0 to use RS_FILTER_TILE_SIZE
+ * @param tile_height Height of tiles or 0 to use RS_FILTER_TILE_SIZE
+ * @param func A RSFilterTileFunc to call for every tile
+ * @param user_data Pointer passed on to func
+ * @return TRUE if all tiles were delivered, FALSE otherwise
+ */
+extern gboolean rs_filter_get_image_tiled(RSFilter *filter, const RSFilterRequest *request, gint tile_width, gint tile_height, RSFilterTileFunc func, gpointer user_data);
+
+/**
+ * Render the 8 bit output of a RSFilter one tile at a time, see rs_filter_get_image_tiled()
+ * @param filter A RSFilter
+ * @param request A RSFilterRequest defining parameters for the request
+ * @param tile_width Width of tiles or 0 to use RS_FILTER_TILE_SIZE
+ * @param tile_height Height of tiles or 0 to use RS_FILTER_TILE_SIZE
+ * @param func A RSFilterTileFunc to call for every tile
+ * @param user_data Pointer passed on to func
+ * @return TRUE if all tiles were delivered, FALSE otherwise
+ */
+extern gboolean rs_filter_get_image8_tiled(RSFilter *filter, const RSFilterRequest *request, gint tile_width, gint tile_height, RSFilterTileFunc func, gpointer user_data);
+
 /**
  * Set a GObject property on zero or more filters above #filter recursively
  * @param filter A RSFilter
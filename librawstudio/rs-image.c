@@ -44,7 +44,7 @@ rs_image_finalize (GObject *object)
 	gint plane;
 
 	for (plane=0; plane<image->number_of_planes; plane++)
-		g_free(image->planes[plane]);
+		rs_buffer_pool_free(image->planes[plane]);
 	g_free(image->planes);
 
 	if (G_OBJECT_CLASS (rs_image_parent_class)->finalize)
@@ -89,10 +89,17 @@ rs_image_new(gint width, gint height, gint number_of_planes)
 	image->width = width;
 	image->height = height;
 
-	/* Allocate space for all planes and all pixels */
-	image->planes = g_new(gfloat *, number_of_planes);
+	/* Allocate space for all planes and all pixels, aligned for SIMD */
+	image->planes = g_new0(gfloat *, number_of_planes);
 	for(plane=0; plane<image->number_of_planes; plane++)
-		image->planes[plane] = g_new(gfloat, image->width*image->height);
+	{
+		image->planes[plane] = rs_buffer_pool_alloc(image->width*image->height*sizeof(gfloat));
+		if (!image->planes[plane])
+		{
+			g_object_unref(image);
+			return NULL;
+		}
+	}
 
 	return image;
 }
@@ -133,8 +140,109 @@ gfloat *
 rs_image_get_plane(RSImage *image, gint plane_num)
 {
 	g_return_val_if_fail(RS_IS_IMAGE(image), NULL);
-	g_return_val_if_fail(plane_num > 0, NULL);
+	g_return_val_if_fail(plane_num >= 0, NULL);
 	g_return_val_if_fail(plane_num < image->number_of_planes, NULL);
 
 	return image->planes[plane_num];
 }
+
+typedef struct {
+	RS_IMAGE16 *image16;
+	RSImage *image;
+} ConvertInfo;
+
+static void
+unpack_part(gint start_y, gint end_y, gpointer user_data)
+{
+	ConvertInfo *info = user_data;
+	RS_IMAGE16 *input = info->image16;
+	const gint w = info->image->width;
+	const gint planes = info->image->number_of_planes;
+	const gfloat scale = 1.0f/65535.0f;
+	gint x, y, c;
+
+	for(y = start_y; y < end_y; y++)
+	{
+		for(c = 0; c < planes; c++)
+		{
+			const gushort *in = GET_PIXEL(input, 0, y) + c;
+			gfloat *out = info->image->planes[c] + y * w;
+			for(x = 0; x < w; x++)
+			{
+				out[x] = (gfloat) *in * scale;
+				in += input->pixelsize;
+			}
+		}
+	}
+}
+
+static void
+pack_part(gint start_y, gint end_y, gpointer user_data)
+{
+	ConvertInfo *info = user_data;
+	RS_IMAGE16 *output = info->image16;
+	const gint w = info->image->width;
+	const gint planes = info->image->number_of_planes;
+	gint x, y, c;
+
+	for(y = start_y; y < end_y; y++)
+	{
+		for(c = 0; c < planes; c++)
+		{
+			const gfloat *in = info->image->planes[c] + y * w;
+			gushort *out = GET_PIXEL(output, 0, y) + c;
+			for(x = 0; x < w; x++)
+			{
+				gint v = (gint) (in[x] * 65535.0f + 0.5f);
+				*out = CLAMP(v, 0, 65535);
+				out += output->pixelsize;
+			}
+		}
+	}
+}
+
+/**
+ * Create a float planar image from a RS_IMAGE16, values are scaled to 0.0-1.0
+ * @param input A demosaiced RS_IMAGE16
+ * @return A new RSImage with a plane for each channel, NULL on error
+ */
+RSImage *
+rs_image_new_from_image16(RS_IMAGE16 *input)
+{
+	ConvertInfo info;
+
+	g_return_val_if_fail(RS_IS_IMAGE16(input), NULL);
+	g_return_val_if_fail(input->filters == 0, NULL);
+
+	info.image16 = input;
+	info.image = rs_image_new(input->w, input->h, input->channels);
+	if (!info.image)
+		return NULL;
+
+	rs_parallel_for(0, input->h, 0, unpack_part, &info);
+
+	return info.image;
+}
+
+/**
+ * Create a RS_IMAGE16 from a float planar image, values are clamped to 0.0-1.0
+ * @param image A RSImage with 1 to 4 planes
+ * @return A new RS_IMAGE16, NULL on error
+ */
+RS_IMAGE16 *
+rs_image_to_image16(RSImage *image)
+{
+	ConvertInfo info;
+
+	g_return_val_if_fail(RS_IS_IMAGE(image), NULL);
+	g_return_val_if_fail(image->number_of_planes <= 4, NULL);
+
+	info.image = image;
+	info.image16 = rs_image16_new(image->width, image->height, image->number_of_planes, 4);
+	if (!info.image16)
+		return NULL;
+
+	rs_parallel_for(0, image->height, 0, pack_part, &info);
+
+	return info.image16;
+}
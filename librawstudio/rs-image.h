@@ -52,6 +52,22 @@ rs_image_get_number_of_planes(RSImage *image);
 extern gfloat *
 rs_image_get_plane(RSImage *image, gint plane_num);
 
+/**
+ * Create a float planar image from a RS_IMAGE16, values are scaled to 0.0-1.0
+ * @param input A demosaiced RS_IMAGE16
+ * @return A new RSImage with a plane for each channel, NULL on error
+ */
+extern RSImage *
+rs_image_new_from_image16(RS_IMAGE16 *input);
+
+/**
+ * Create a RS_IMAGE16 from a float planar image, values are clamped to 0.0-1.0
+ * @param image A RSImage with 1 to 4 planes
+ * @return A new RS_IMAGE16, NULL on error
+ */
+extern RS_IMAGE16 *
+rs_image_to_image16(RSImage *image);
+
 G_END_DECLS
 
 #endif /* RS_IMAGE_H */
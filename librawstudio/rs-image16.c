@@ -17,11 +17,6 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
-#ifdef WIN32 /* Win32 _aligned_malloc */
-#include <malloc.h>
-#include <stdio.h>
-#endif
-
 #include <rawstudio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -47,6 +42,10 @@ rs_image16_dispose (GObject *obj)
 		return;
 	self->dispose_has_run = TRUE;
 
+	if (self->pixels_owner)
+		g_object_unref(self->pixels_owner);
+	self->pixels_owner = NULL;
+
 	G_OBJECT_CLASS (parent_class)->dispose (obj);
 }
 
@@ -56,7 +55,7 @@ rs_image16_finalize (GObject *obj)
 	RS_IMAGE16 *self = (RS_IMAGE16 *)obj;
 
 	if (self->pixels && (self->pixels_refcount == 1))
-		free(self->pixels);
+		rs_buffer_pool_free(self->pixels);
 
 	self->pixels_refcount--;
 
@@ -81,6 +80,7 @@ rs_image16_init (RS_IMAGE16 *self)
 	self->filters = 0;
 	self->pixels = NULL;
 	self->pixels_refcount = 0;
+	self->pixels_owner = NULL;
 }
 
 void
@@ -125,7 +125,6 @@ rs_image16_transform_getwh(RS_IMAGE16 *in, RS_RECT *crop, gdouble angle, gint or
 RS_IMAGE16 *
 rs_image16_new(const guint width, const guint height, const guint channels, const guint pixelsize)
 {
-	gint ret;
 	RS_IMAGE16 *rsi;
 
 	g_return_val_if_fail(width < 65536, NULL);
@@ -146,23 +145,19 @@ rs_image16_new(const guint width, const guint height, const guint channels, cons
 	rsi->pixelsize = pixelsize;
 	rsi->filters = 0;
 
-	/* Allocate actual pixels */
-#ifdef WIN32
-	rsi->pixels = _aligned_malloc(rsi->h*rsi->rowstride * sizeof(gushort), 16); 
+	/* Allocate actual pixels, recycled from earlier images if possible */
+	rsi->pixels = rs_buffer_pool_alloc(rsi->h*rsi->rowstride * sizeof(gushort));
 	if (rsi->pixels == NULL)
-#else
-	ret = posix_memalign((void **) &rsi->pixels, 16, rsi->h*rsi->rowstride * sizeof(gushort));
-	if (ret > 0)
-#endif
 	{
-		rsi->pixels = NULL;
 		g_object_unref(rsi);
 		return NULL;
 	}
 	rsi->pixels_refcount = 1;
 
+	rs_trace_count_allocation(rsi->h*rsi->rowstride * sizeof(gushort));
+
 	/* Verify alignment */
-	g_assert((GPOINTER_TO_INT(rsi->pixels) % 16) == 0);
+	g_assert((GPOINTER_TO_INT(rsi->pixels) % RS_BUFFER_POOL_ALIGNMENT) == 0);
 	g_assert((rsi->rowstride % 16) == 0);
 
 	return(rsi);
@@ -221,6 +216,9 @@ rs_image16_new_subframe(RS_IMAGE16 *input, GdkRectangle *rectangle)
 	output->pixels = GET_PIXEL(input, x, y);
 	output->pixels_refcount = input->pixels_refcount + 1;
 
+	/* Keep the pixels alive, and let the owner know it's shared */
+	output->pixels_owner = g_object_ref(input->pixels_owner ? input->pixels_owner : input);
+
 	/* Some sanity checks */
 	g_assert(output->w <= input->w);
 	g_assert(output->h <= input->h);
@@ -275,6 +273,49 @@ rs_image16_copy(RS_IMAGE16 *in, gboolean copy_pixels)
 	return(out);
 }
 
+/**
+ * Check if the caller is the only user of the pixel data of an image. This is
+ * the case if the caller holds the only reference and the image is not, and
+ * has no, subframes
+ * @param image A RS_IMAGE16
+ * @return TRUE if the pixels can be modified without affecting anyone else
+ */
+gboolean
+rs_image16_is_exclusive(RS_IMAGE16 *image)
+{
+	g_return_val_if_fail(RS_IS_IMAGE16(image), FALSE);
+
+	/* Subframes hold a reference to the owner, so the refcount covers them */
+	return (image->pixels != NULL)
+		&& (image->pixels_refcount == 1)
+		&& (image->pixels_owner == NULL)
+		&& (g_atomic_int_get((gint *) &G_OBJECT(image)->ref_count) == 1);
+}
+
+/**
+ * Get an image whose pixels can be modified in place, copy-on-write style.
+ * This takes over the callers reference to @image
+ * @param image A RS_IMAGE16
+ * @param copy_pixels If a copy is needed, copy the pixel data as well
+ * @return @image itself if the caller held the only reference, a new copy
+ *         otherwise, unref when done
+ */
+RS_IMAGE16 *
+rs_image16_make_writable(RS_IMAGE16 *image, gboolean copy_pixels)
+{
+	RS_IMAGE16 *out;
+
+	g_return_val_if_fail(RS_IS_IMAGE16(image), NULL);
+
+	if (rs_image16_is_exclusive(image))
+		return image;
+
+	out = rs_image16_copy(image, copy_pixels);
+	g_object_unref(image);
+
+	return out;
+}
+
 /**
  * Returns a single pixel from a RS_IMAGE16
  * @param image A RS_IMAGE16
@@ -39,6 +39,7 @@ struct _rs_image16 {
 	guint pixelsize; /* the size of a pixel in SHORTS */
 	gushort *pixels;
 	gint pixels_refcount;
+	RS_IMAGE16 *pixels_owner; /* The image owning pixels if this is a subframe */
 	guint filters;
 	gboolean dispose_has_run;
 };
@@ -78,6 +79,25 @@ extern void rs_image16_transform_getwh(RS_IMAGE16 *in, RS_RECT *crop, gdouble an
 
 extern RS_IMAGE16 *rs_image16_copy(RS_IMAGE16 *rsi, gboolean copy_pixels);
 
+/**
+ * Check if the caller is the only user of the pixel data of an image. This is
+ * the case if the caller holds the only reference and the image is not, and
+ * has no, subframes
+ * @param image A RS_IMAGE16
+ * @return TRUE if the pixels can be modified without affecting anyone else
+ */
+extern gboolean rs_image16_is_exclusive(RS_IMAGE16 *image);
+
+/**
+ * Get an image whose pixels can be modified in place, copy-on-write style.
+ * This takes over the callers reference to @image
+ * @param image A RS_IMAGE16
+ * @param copy_pixels If a copy is needed, copy the pixel data as well
+ * @return @image itself if the caller held the only reference, a new copy
+ *         otherwise, unref when done
+ */
+extern RS_IMAGE16 *rs_image16_make_writable(RS_IMAGE16 *image, gboolean copy_pixels);
+
 /**
  * Returns a single pixel from a RS_IMAGE16
  * @param image A RS_IMAGE16
@@ -0,0 +1,356 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * Buffers are evicted using the GreedyDual-Size algorithm: every buffer gets
+ * a priority of inflation + cost/size when registered or used, the buffer
+ * with the lowest priority is evicted first, and inflation is raised to the
+ * priority of the evicted buffer. This way cheap and big buffers go first,
+ * and buffers not used for a while will eventually go no matter the cost.
+ */
+
+#include <rawstudio.h>
+#include "rs-memory.h"
+
+/* Used if we can't find the amount of physical memory */
+#define FALLBACK_LIMIT (G_GUINT64_CONSTANT(512)*1024*1024)
+
+typedef struct {
+	guint64 id;
+	gpointer owner;
+	const gchar *name;
+	guint64 bytes;
+	gdouble cost;
+	gdouble priority;
+	RSMemoryEvictFunc evict_func;
+} Buffer;
+
+static GStaticMutex lock = G_STATIC_MUTEX_INIT;
+/* Held while calling evict functions, so owners can wait for them */
+static GStaticRecMutex evict_lock = G_STATIC_REC_MUTEX_INIT;
+
+static GHashTable *buffers = NULL;
+static guint64 next_id = 1;
+static guint64 used = 0;
+static guint64 limit = 0;
+static gdouble inflation = 0.0;
+
+static guint64
+default_limit(void)
+{
+	guint64 physical = rs_get_physical_memory();
+
+	/* Leave room for the rest of the system and for images being rendered */
+	if (physical > 0)
+		return physical / 4;
+
+	return FALLBACK_LIMIT;
+}
+
+/* Must be called with lock held */
+static void
+init(void)
+{
+	if (!buffers)
+		buffers = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, g_free);
+	if (limit == 0)
+		limit = default_limit();
+}
+
+static gdouble
+priority(const Buffer *buffer)
+{
+	/* Cost per megabyte, the scale doesn't matter as long as it's constant */
+	return inflation + buffer->cost / (MAX(buffer->bytes, 1) / (1024.0*1024.0));
+}
+
+/**
+ * Set the maximum number of bytes all registered buffers may use together
+ * @param bytes The limit in bytes or 0 to use the default
+ */
+void
+rs_memory_set_limit(guint64 bytes)
+{
+	g_static_mutex_lock(&lock);
+	limit = (bytes > 0) ? bytes : default_limit();
+	g_static_mutex_unlock(&lock);
+
+	RS_DEBUG(PERFORMANCE, "Image memory limit set to %" G_GUINT64_FORMAT "MB", limit/(1024*1024));
+
+	rs_memory_trim();
+}
+
+/**
+ * Get the maximum number of bytes all registered buffers may use together
+ * @return The limit in bytes
+ */
+guint64
+rs_memory_get_limit(void)
+{
+	guint64 ret;
+
+	g_static_mutex_lock(&lock);
+	init();
+	ret = limit;
+	g_static_mutex_unlock(&lock);
+
+	return ret;
+}
+
+/**
+ * Get the number of bytes used by all registered buffers
+ * @return Bytes in use
+ */
+guint64
+rs_memory_get_used(void)
+{
+	guint64 ret;
+
+	g_static_mutex_lock(&lock);
+	ret = used;
+	g_static_mutex_unlock(&lock);
+
+	return ret;
+}
+
+/**
+ * Register a buffer that can be released if memory gets tight
+ * @param owner The owner of the buffer, passed on to evict_func
+ * @param name The name of the owner used for reporting, this will be copied
+ * @param bytes The size of the buffer
+ * @param cost How expensive the buffer is to recreate, usually the time in seconds it took
+ * @param evict_func A function to call when the buffer should be released
+ * @return An id identifying the buffer
+ */
+guint64
+rs_memory_register(gpointer owner, const gchar *name, guint64 bytes, gdouble cost, RSMemoryEvictFunc evict_func)
+{
+	Buffer *buffer;
+	guint64 id;
+
+	g_return_val_if_fail(evict_func != NULL, 0);
+
+	buffer = g_new(Buffer, 1);
+	buffer->owner = owner;
+	buffer->name = g_intern_string(name);
+	buffer->bytes = bytes;
+	buffer->cost = MAX(cost, 0.0);
+	buffer->evict_func = evict_func;
+
+	g_static_mutex_lock(&lock);
+	init();
+	id = buffer->id = next_id++;
+	buffer->priority = priority(buffer);
+	g_hash_table_insert(buffers, &buffer->id, buffer);
+	used += bytes;
+	g_static_mutex_unlock(&lock);
+
+	return id;
+}
+
+/**
+ * Mark a buffer as recently used
+ * @param id An id returned by rs_memory_register()
+ */
+void
+rs_memory_touch(guint64 id)
+{
+	Buffer *buffer;
+
+	g_static_mutex_lock(&lock);
+	if (buffers && (buffer = g_hash_table_lookup(buffers, &id)))
+		buffer->priority = priority(buffer);
+	g_static_mutex_unlock(&lock);
+}
+
+/**
+ * Forget a buffer, this is safe to call for buffers already evicted
+ * @param id An id returned by rs_memory_register()
+ */
+void
+rs_memory_unregister(guint64 id)
+{
+	Buffer *buffer;
+
+	g_static_mutex_lock(&lock);
+	if (buffers && (buffer = g_hash_table_lookup(buffers, &id)))
+	{
+		used -= buffer->bytes;
+		g_hash_table_remove(buffers, &id);
+	}
+	g_static_mutex_unlock(&lock);
+}
+
+/**
+ * Forget all buffers of an owner and wait for evictions in progress for this
+ * owner to finish. This must be called before the owner is freed
+ * @param owner An owner given to rs_memory_register()
+ */
+void
+rs_memory_unregister_owner(gpointer owner)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+
+	g_static_rec_mutex_lock(&evict_lock);
+	g_static_mutex_lock(&lock);
+	if (buffers)
+	{
+		g_hash_table_iter_init(&iter, buffers);
+		while (g_hash_table_iter_next(&iter, &key, &value))
+		{
+			Buffer *buffer = value;
+			if (buffer->owner == owner)
+			{
+				used -= buffer->bytes;
+				g_hash_table_iter_remove(&iter);
+			}
+		}
+	}
+	g_static_mutex_unlock(&lock);
+	g_static_rec_mutex_unlock(&evict_lock);
+}
+
+/**
+ * Evict buffers until the memory limit is respected. Buffers are picked by
+ * recency of use and cost per byte. This must not be called while holding
+ * locks that the eviction functions need
+ */
+void
+rs_memory_trim(void)
+{
+	gboolean evicted_any = FALSE;
+
+	g_static_rec_mutex_lock(&evict_lock);
+	while (TRUE)
+	{
+		GHashTableIter iter;
+		gpointer key, value;
+		Buffer *victim = NULL;
+		Buffer evicted;
+
+		g_static_mutex_lock(&lock);
+		init();
+		if (used <= limit)
+		{
+			g_static_mutex_unlock(&lock);
+			break;
+		}
+
+		g_hash_table_iter_init(&iter, buffers);
+		while (g_hash_table_iter_next(&iter, &key, &value))
+		{
+			Buffer *buffer = value;
+			if (!victim || buffer->priority < victim->priority)
+				victim = buffer;
+		}
+
+		if (!victim)
+		{
+			g_static_mutex_unlock(&lock);
+			break;
+		}
+
+		evicted = *victim;
+		inflation = victim->priority;
+		used -= victim->bytes;
+		g_hash_table_remove(buffers, &evicted.id);
+		g_static_mutex_unlock(&lock);
+
+		RS_DEBUG(PERFORMANCE, "Evicting %" G_GUINT64_FORMAT "kB from %s", evicted.bytes/1024, evicted.name);
+
+		evicted.evict_func(evicted.owner, evicted.id);
+		evicted_any = TRUE;
+	}
+	g_static_rec_mutex_unlock(&evict_lock);
+
+	/* Show who is left holding the memory */
+	if (evicted_any && G_UNLIKELY(rs_debug_flags & RS_DEBUG_PERFORMANCE))
+	{
+		GArray *usage = rs_memory_get_usage();
+		guint i;
+
+		for(i = 0; i < usage->len; i++)
+		{
+			RSMemoryUsage *u = &g_array_index(usage, RSMemoryUsage, i);
+			RS_DEBUG(PERFORMANCE, "Memory in use: %" G_GUINT64_FORMAT "kB in %u buffers by %s", u->bytes/1024, u->buffers, u->name);
+		}
+		g_array_free(usage, TRUE);
+	}
+}
+
+static gint
+usage_compare(gconstpointer a, gconstpointer b)
+{
+	const RSMemoryUsage *ua = a;
+	const RSMemoryUsage *ub = b;
+
+	if (ua->bytes > ub->bytes)
+		return -1;
+	if (ua->bytes < ub->bytes)
+		return 1;
+	return 0;
+}
+
+/**
+ * Get memory usage per owner
+ * @return A GArray of RSMemoryUsage, largest first, free with g_array_free()
+ */
+GArray *
+rs_memory_get_usage(void)
+{
+	GArray *usage = g_array_new(FALSE, TRUE, sizeof(RSMemoryUsage));
+	GHashTableIter iter;
+	gpointer key, value;
+	guint i;
+
+	g_static_mutex_lock(&lock);
+	if (buffers)
+	{
+		g_hash_table_iter_init(&iter, buffers);
+		while (g_hash_table_iter_next(&iter, &key, &value))
+		{
+			Buffer *buffer = value;
+			RSMemoryUsage *u = NULL;
+
+			for(i = 0; i < usage->len; i++)
+				if (g_array_index(usage, RSMemoryUsage, i).owner == buffer->owner)
+				{
+					u = &g_array_index(usage, RSMemoryUsage, i);
+					break;
+				}
+
+			if (!u)
+			{
+				g_array_set_size(usage, usage->len + 1);
+				u = &g_array_index(usage, RSMemoryUsage, usage->len - 1);
+				u->owner = buffer->owner;
+				u->name = buffer->name;
+			}
+
+			u->bytes += buffer->bytes;
+			u->buffers++;
+		}
+	}
+	g_static_mutex_unlock(&lock);
+
+	g_array_sort(usage, usage_compare);
+
+	return usage;
+}
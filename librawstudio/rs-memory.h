@@ -0,0 +1,108 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef RS_MEMORY_H
+#define RS_MEMORY_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * Called by the memory manager when a buffer should be released. The owner
+ * must forget the buffer, rs_memory_unregister() is not needed for it
+ * @param owner The owner given to rs_memory_register()
+ * @param id The id returned by rs_memory_register()
+ */
+typedef void (*RSMemoryEvictFunc)(gpointer owner, guint64 id);
+
+/**
+ * Memory used by one owner, see rs_memory_get_usage()
+ */
+typedef struct {
+	gpointer owner;
+	const gchar *name;
+	guint64 bytes;
+	guint buffers;
+} RSMemoryUsage;
+
+/**
+ * Set the maximum number of bytes all registered buffers may use together
+ * @param bytes The limit in bytes or 0 to use the default
+ */
+extern void rs_memory_set_limit(guint64 bytes);
+
+/**
+ * Get the maximum number of bytes all registered buffers may use together
+ * @return The limit in bytes
+ */
+extern guint64 rs_memory_get_limit(void);
+
+/**
+ * Get the number of bytes used by all registered buffers
+ * @return Bytes in use
+ */
+extern guint64 rs_memory_get_used(void);
+
+/**
+ * Register a buffer that can be released if memory gets tight
+ * @param owner The owner of the buffer, passed on to evict_func
+ * @param name The name of the owner used for reporting, this will be copied
+ * @param bytes The size of the buffer
+ * @param cost How expensive the buffer is to recreate, usually the time in seconds it took
+ * @param evict_func A function to call when the buffer should be released
+ * @return An id identifying the buffer
+ */
+extern guint64 rs_memory_register(gpointer owner, const gchar *name, guint64 bytes, gdouble cost, RSMemoryEvictFunc evict_func);
+
+/**
+ * Mark a buffer as recently used
+ * @param id An id returned by rs_memory_register()
+ */
+extern void rs_memory_touch(guint64 id);
+
+/**
+ * Forget a buffer, this is safe to call for buffers already evicted
+ * @param id An id returned by rs_memory_register()
+ */
+extern void rs_memory_unregister(guint64 id);
+
+/**
+ * Forget all buffers of an owner and wait for evictions in progress for this
+ * owner to finish. This must be called before the owner is freed
+ * @param owner An owner given to rs_memory_register()
+ */
+extern void rs_memory_unregister_owner(gpointer owner);
+
+/**
+ * Evict buffers until the memory limit is respected. Buffers are picked by
+ * recency of use and cost per byte. This must not be called while holding
+ * locks that the eviction functions need
+ */
+extern void rs_memory_trim(void);
+
+/**
+ * Get memory usage per owner
+ * @return A GArray of RSMemoryUsage, largest first, free with g_array_free()
+ */
+extern GArray *rs_memory_get_usage(void);
+
+G_END_DECLS
+
+#endif /* RS_MEMORY_H */
@@ -0,0 +1,311 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <rawstudio.h>
+#include "rs-parallel.h"
+
+/* How many chunks per worker we aim for, when no grain is given. More chunks
+ * gives better balancing, fewer gives less overhead */
+#define CHUNKS_PER_WORKER 4
+
+typedef struct {
+	RSParallelFunc func;
+	gpointer user_data;
+	GCancellable *cancellable;
+	gint pending;
+	gboolean finished;
+} Job;
+
+typedef struct {
+	Job *job;
+	gint start;
+	gint end;
+} Task;
+
+typedef struct {
+	GMutex *lock;
+	GQueue *tasks;
+} WorkerQueue;
+
+static GStaticMutex init_lock = G_STATIC_MUTEX_INIT;
+static GStaticPrivate worker_index = G_STATIC_PRIVATE_INIT;
+static gint n_workers = 0;
+static WorkerQueue *queues = NULL;
+
+/* Number of tasks waiting in all queues, only changed while holding a queue lock */
+static gint queued = 0;
+
+/* Used by outside threads to spread out where they start stealing */
+static gint next_victim = 0;
+
+static GMutex *sleep_lock = NULL;
+static GCond *sleep_cond = NULL;
+static GMutex *done_lock = NULL;
+static GCond *done_cond = NULL;
+
+static void
+push_task(gint queue, Task *task)
+{
+	WorkerQueue *q = &queues[queue];
+
+	g_mutex_lock(q->lock);
+	g_queue_push_tail(q->tasks, task);
+	g_atomic_int_inc(&queued);
+	g_mutex_unlock(q->lock);
+}
+
+static gboolean
+pop_task(gint queue, gboolean newest, Task *task)
+{
+	WorkerQueue *q = &queues[queue];
+	Task *t;
+
+	g_mutex_lock(q->lock);
+	if (newest)
+		t = g_queue_pop_tail(q->tasks);
+	else
+		t = g_queue_pop_head(q->tasks);
+	if (t)
+		g_atomic_int_add(&queued, -1);
+	g_mutex_unlock(q->lock);
+
+	if (!t)
+		return FALSE;
+
+	*task = *t;
+	g_slice_free(Task, t);
+
+	return TRUE;
+}
+
+/* self is the index of the calling worker, or -1 if called from outside the pool */
+static gboolean
+take_task(gint self, Task *task)
+{
+	guint first;
+	gint i;
+
+	if (g_atomic_int_get(&queued) < 1)
+		return FALSE;
+
+	/* Our own queue first, newest first - it's most likely to be in cache */
+	if (self >= 0 && pop_task(self, TRUE, task))
+		return TRUE;
+
+	/* Steal the oldest task from someone else */
+	if (self >= 0)
+		first = self + 1;
+	else
+		first = (guint) g_atomic_int_exchange_and_add(&next_victim, 1);
+
+	for(i = 0; i < n_workers; i++)
+	{
+		gint victim = (first + i) % n_workers;
+		if (victim != self && pop_task(victim, FALSE, task))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static void
+run_task(Task *task)
+{
+	Job *job = task->job;
+
+	if (!job->cancellable || !g_cancellable_is_cancelled(job->cancellable))
+		job->func(task->start, task->end, job->user_data);
+
+	if (g_atomic_int_dec_and_test(&job->pending))
+	{
+		g_mutex_lock(done_lock);
+		job->finished = TRUE;
+		g_cond_broadcast(done_cond);
+		g_mutex_unlock(done_lock);
+	}
+}
+
+static gpointer
+worker_thread(gpointer data)
+{
+	gint self = GPOINTER_TO_INT(data);
+	Task task;
+
+	g_static_private_set(&worker_index, GINT_TO_POINTER(self + 1), NULL);
+
+	while (TRUE)
+	{
+		if (take_task(self, &task))
+		{
+			run_task(&task);
+			continue;
+		}
+
+		g_mutex_lock(sleep_lock);
+		while (g_atomic_int_get(&queued) < 1)
+			g_cond_wait(sleep_cond, sleep_lock);
+		g_mutex_unlock(sleep_lock);
+	}
+
+	return NULL;
+}
+
+static void
+init(void)
+{
+	g_static_mutex_lock(&init_lock);
+
+	if (g_atomic_int_get(&n_workers) == 0)
+	{
+		gint i;
+		const gint n = rs_get_number_of_processor_cores();
+
+		if (n > 1)
+		{
+			sleep_lock = g_mutex_new();
+			sleep_cond = g_cond_new();
+			done_lock = g_mutex_new();
+			done_cond = g_cond_new();
+
+			queues = g_new(WorkerQueue, n);
+			for(i = 0; i < n; i++)
+			{
+				queues[i].lock = g_mutex_new();
+				queues[i].tasks = g_queue_new();
+			}
+
+			/* Workers will never exit, they sleep when there's nothing to do */
+			for(i = 0; i < n; i++)
+				g_thread_create(worker_thread, GINT_TO_POINTER(i), FALSE, NULL);
+
+			RS_DEBUG(PERFORMANCE, "Started %d worker threads", n);
+		}
+
+		g_atomic_int_set(&n_workers, n);
+	}
+
+	g_static_mutex_unlock(&init_lock);
+}
+
+/**
+ * Get the number of worker threads used by rs_parallel_for()
+ * @return The number of worker threads
+ */
+gint
+rs_parallel_get_n_workers(void)
+{
+	if (g_atomic_int_get(&n_workers) == 0)
+		init();
+
+	return n_workers;
+}
+
+/**
+ * Run func over the range [start, end) using the shared worker threads.
+ * The range is split into chunks that are distributed to per-worker queues,
+ * idle workers will steal chunks from busy workers. The calling thread helps
+ * out and this function returns when all chunks have been processed. It is
+ * safe to call this from within func.
+ * @param start The first item to process
+ * @param end The item after the last item to process
+ * @param grain The minimum number of items in a chunk or 0 to let the scheduler decide
+ * @param func The function to call for every chunk
+ * @param user_data Pointer passed on to func
+ */
+void
+rs_parallel_for(gint start, gint end, gint grain, RSParallelFunc func, gpointer user_data)
+{
+	rs_parallel_for_cancellable(start, end, grain, func, user_data, NULL);
+}
+
+/**
+ * Like rs_parallel_for(), but chunks not yet started when cancellable is
+ * cancelled will be skipped. The output of func will be incomplete if this
+ * happens, so callers should not keep it
+ * @param start The first item to process
+ * @param end The item after the last item to process
+ * @param grain The minimum number of items in a chunk or 0 to let the scheduler decide
+ * @param func The function to call for every chunk
+ * @param user_data Pointer passed on to func
+ * @param cancellable A GCancellable or NULL
+ */
+void
+rs_parallel_for_cancellable(gint start, gint end, gint grain, RSParallelFunc func, gpointer user_data, GCancellable *cancellable)
+{
+	gint i, n, n_chunks, self;
+	Job job;
+	Task task;
+
+	g_return_if_fail(func != NULL);
+
+	if (end <= start)
+		return;
+
+	n = rs_parallel_get_n_workers();
+
+	if (grain < 1)
+		grain = MAX(1, (end - start + n * CHUNKS_PER_WORKER - 1) / (n * CHUNKS_PER_WORKER));
+
+	n_chunks = (end - start + grain - 1) / grain;
+
+	/* Nothing to gain from the pool */
+	if (n < 2 || n_chunks < 2)
+	{
+		if (!cancellable)
+			func(start, end, user_data);
+		else
+			for(i = start; i < end && !g_cancellable_is_cancelled(cancellable); i += grain)
+				func(i, MIN(end, i + grain), user_data);
+		return;
+	}
+
+	self = GPOINTER_TO_INT(g_static_private_get(&worker_index)) - 1;
+
+	job.func = func;
+	job.user_data = user_data;
+	job.cancellable = cancellable;
+	job.pending = n_chunks;
+	job.finished = FALSE;
+
+	for(i = 0; i < n_chunks; i++)
+	{
+		Task *t = g_slice_new(Task);
+		t->job = &job;
+		t->start = start + i * grain;
+		t->end = MIN(end, t->start + grain);
+
+		/* Outside callers deal out chunks to all workers, workers keep nested
+		 * work in their own queue and let idle workers steal it */
+		push_task((self >= 0) ? self : (i % n), t);
+	}
+
+	g_mutex_lock(sleep_lock);
+	g_cond_broadcast(sleep_cond);
+	g_mutex_unlock(sleep_lock);
+
+	/* Help out while there's something to do */
+	while (g_atomic_int_get(&job.pending) > 0 && take_task(self, &task))
+		run_task(&task);
+
+	/* Wait for chunks still running on other threads */
+	g_mutex_lock(done_lock);
+	while (!job.finished)
+		g_cond_wait(done_cond, done_lock);
+	g_mutex_unlock(done_lock);
+}
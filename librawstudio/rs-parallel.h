@@ -0,0 +1,71 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef RS_PARALLEL_H
+#define RS_PARALLEL_H
+
+#include <glib.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/**
+ * Function called by rs_parallel_for() for every chunk of work
+ * @param start First item (usually a row) in this chunk
+ * @param end The item after the last item in this chunk
+ * @param user_data The pointer passed to rs_parallel_for()
+ */
+typedef void (*RSParallelFunc)(gint start, gint end, gpointer user_data);
+
+/**
+ * Run func over the range [start, end) using the shared worker threads.
+ * The range is split into chunks that are distributed to per-worker queues,
+ * idle workers will steal chunks from busy workers. The calling thread helps
+ * out and this function returns when all chunks have been processed. It is
+ * safe to call this from within func.
+ * @param start The first item to process
+ * @param end The item after the last item to process
+ * @param grain The minimum number of items in a chunk or 0 to let the scheduler decide
+ * @param func The function to call for every chunk
+ * @param user_data Pointer passed on to func
+ */
+extern void rs_parallel_for(gint start, gint end, gint grain, RSParallelFunc func, gpointer user_data);
+
+/**
+ * Like rs_parallel_for(), but chunks not yet started when cancellable is
+ * cancelled will be skipped. The output of func will be incomplete if this
+ * happens, so callers should not keep it
+ * @param start The first item to process
+ * @param end The item after the last item to process
+ * @param grain The minimum number of items in a chunk or 0 to let the scheduler decide
+ * @param func The function to call for every chunk
+ * @param user_data Pointer passed on to func
+ * @param cancellable A GCancellable or NULL
+ */
+extern void rs_parallel_for_cancellable(gint start, gint end, gint grain, RSParallelFunc func, gpointer user_data, GCancellable *cancellable);
+
+/**
+ * Get the number of worker threads used by rs_parallel_for()
+ * @return The number of worker threads
+ */
+extern gint rs_parallel_get_n_workers(void);
+
+G_END_DECLS
+
+#endif /* RS_PARALLEL_H */
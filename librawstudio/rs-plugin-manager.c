@@ -24,36 +24,30 @@
 
 static GList *plugins = NULL;
 
-/**
- * Load all installed Rawstudio plugins
- */
-gint
-rs_plugin_manager_load_all_plugins()
+static gint
+load_directory(const gchar *plugin_directory)
 {
 	gint num = 0;
-	gchar *plugin_directory;
 	GDir *dir;
 	const gchar *filename;
-	GTimer *gt = g_timer_new();
-
-	g_assert(g_module_supported());
 
-	plugin_directory = g_build_filename(PACKAGE_DATA_DIR, PACKAGE, "plugins", NULL);
 	RS_DEBUG(PLUGINS, "Loading modules from %s", plugin_directory);
 
 	dir = g_dir_open(plugin_directory, 0, NULL);
 
 	while(dir && (filename = g_dir_read_name(dir)))
 	{
-		if (g_str_has_suffix(filename, "." G_MODULE_SUFFIX))
+		gchar *path = g_build_filename(plugin_directory, filename, NULL);
+
+		/* Plugins in a build tree are found in subdirectories */
+		if (g_file_test(path, G_FILE_TEST_IS_DIR))
+			num += load_directory(path);
+		else if (g_str_has_suffix(filename, "." G_MODULE_SUFFIX))
 		{
 			RSPlugin *plugin;
-			gchar *path;
 
 			/* Load the plugin */
-			path = g_build_filename(plugin_directory, filename, NULL);
 			plugin = rs_plugin_new(path);
-			g_free(path);
 
 			g_assert(g_type_module_use(G_TYPE_MODULE(plugin)));
 			/* This doesn't work for some reason, GType's blow up */
@@ -64,7 +58,46 @@ rs_plugin_manager_load_all_plugins()
 			RS_DEBUG(PLUGINS, "%s loaded", filename);
 			num++;
 		}
+		g_free(path);
 	}
+
+	if (dir)
+		g_dir_close(dir);
+
+	return num;
+}
+
+/**
+ * Load all installed Rawstudio plugins
+ */
+gint
+rs_plugin_manager_load_all_plugins()
+{
+	gchar *plugin_directory;
+	gint num;
+
+	plugin_directory = g_build_filename(PACKAGE_DATA_DIR, PACKAGE, "plugins", NULL);
+	num = rs_plugin_manager_load_plugins_from(plugin_directory);
+	g_free(plugin_directory);
+
+	return num;
+}
+
+/**
+ * Load all plugins found in a directory and its subdirectories, this allows
+ * running uninstalled programs from the build tree
+ * @param plugin_directory A directory
+ * @return The number of plugins loaded
+ */
+gint
+rs_plugin_manager_load_plugins_from(const gchar *plugin_directory)
+{
+	gint num = 0;
+	GTimer *gt = g_timer_new();
+
+	g_assert(g_module_supported());
+
+	num = load_directory(plugin_directory);
 	RS_DEBUG(PLUGINS, "%d plugins loaded in %.03f second", num, g_timer_elapsed(gt, NULL));
 
 
@@ -134,9 +167,6 @@ rs_plugin_manager_load_all_plugins()
 	}
 	g_free(plugins);
 
-	if (dir)
-		g_dir_close(dir);
-
 	g_timer_destroy(gt);
 
 	return num;
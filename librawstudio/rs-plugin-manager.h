@@ -28,6 +28,15 @@ G_BEGIN_DECLS
 extern gint
 rs_plugin_manager_load_all_plugins(void);
 
+/**
+ * Load all plugins found in a directory and its subdirectories, this allows
+ * running uninstalled programs from the build tree
+ * @param plugin_directory A directory
+ * @return The number of plugins loaded
+ */
+extern gint
+rs_plugin_manager_load_plugins_from(const gchar *plugin_directory);
+
 G_END_DECLS
 
 #endif /* RS_PLUGIN_MANAGER_H */
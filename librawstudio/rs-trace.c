@@ -0,0 +1,436 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <rawstudio.h>
+#include <string.h>
+#include "rs-trace.h"
+
+/* Spans nested deeper than this are still recorded, but self time and self
+ * allocations will include their children */
+#define MAX_DEPTH 64
+
+/* Stop recording when this many spans have been recorded, we don't want a
+ * forgotten trace to eat all memory */
+#define MAX_SPANS 1000000
+
+struct _RSTrace {
+	GObject parent;
+
+	GMutex *lock;
+	GTimer *timer;
+	GArray *spans;
+	guint dropped;
+};
+
+typedef struct {
+	const gchar *name;
+	const gchar *label;
+	const gchar *category;
+	gint thread;
+	gint depth;
+	gdouble start;
+	gdouble duration;
+	gdouble self;
+	gint width;
+	gint height;
+	guint64 allocated;
+	guint64 self_allocated;
+} Span;
+
+/* Per thread bookkeeping, shared by all traces */
+typedef struct {
+	gint id;
+	gint depth;
+	guint64 allocated;
+	gdouble child_time[MAX_DEPTH];
+	guint64 child_allocated[MAX_DEPTH];
+} TraceThread;
+
+static GStaticPrivate trace_thread = G_STATIC_PRIVATE_INIT;
+static gint next_thread_id = 0;
+
+static GStaticMutex default_lock = G_STATIC_MUTEX_INIT;
+static RSTrace *default_trace = NULL;
+
+G_DEFINE_TYPE(RSTrace, rs_trace, G_TYPE_OBJECT)
+
+static void
+rs_trace_finalize(GObject *object)
+{
+	RSTrace *trace = RS_TRACE(object);
+
+	g_mutex_free(trace->lock);
+	g_timer_destroy(trace->timer);
+	g_array_free(trace->spans, TRUE);
+
+	G_OBJECT_CLASS (rs_trace_parent_class)->finalize (object);
+}
+
+static void
+rs_trace_class_init(RSTraceClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+	object_class->finalize = rs_trace_finalize;
+}
+
+static void
+rs_trace_init(RSTrace *trace)
+{
+	trace->lock = g_mutex_new();
+	trace->timer = g_timer_new();
+	trace->spans = g_array_new(FALSE, FALSE, sizeof(Span));
+	trace->dropped = 0;
+}
+
+static TraceThread *
+get_thread(void)
+{
+	TraceThread *thread = g_static_private_get(&trace_thread);
+
+	if (G_UNLIKELY(!thread))
+	{
+		thread = g_new0(TraceThread, 1);
+		thread->id = g_atomic_int_exchange_and_add(&next_thread_id, 1) + 1;
+		g_static_private_set(&trace_thread, thread, g_free);
+	}
+
+	return thread;
+}
+
+/**
+ * Instantiate a new RSTrace, all timestamps will be relative to this moment
+ * @return A new RSTrace with a refcount of 1
+ */
+RSTrace *
+rs_trace_new(void)
+{
+	return g_object_new(RS_TYPE_TRACE, NULL);
+}
+
+/**
+ * Set the trace used for requests without a trace of their own
+ * @param trace A RSTrace or NULL to stop tracing such requests
+ */
+void
+rs_trace_set_default(RSTrace *trace)
+{
+	g_return_if_fail(trace == NULL || RS_IS_TRACE(trace));
+
+	g_static_mutex_lock(&default_lock);
+	if (trace)
+		g_object_ref(trace);
+	if (default_trace)
+		g_object_unref(default_trace);
+	default_trace = trace;
+	g_static_mutex_unlock(&default_lock);
+}
+
+/**
+ * Get the trace used for requests without a trace of their own
+ * @return The default RSTrace or NULL, this should not be unreffed
+ */
+RSTrace *
+rs_trace_get_default(void)
+{
+	/* This is called for every filter in every request, skip the lock. The
+	 * default trace is expected to be set once at startup */
+	return default_trace;
+}
+
+/**
+ * Mark the beginning of a traced span in the calling thread. Spans must be
+ * ended in reverse order of beginning, from the same thread
+ * @param trace A RSTrace
+ * @param span A RSTraceSpan to initialize
+ */
+void
+rs_trace_begin(RSTrace *trace, RSTraceSpan *span)
+{
+	TraceThread *thread;
+
+	g_return_if_fail(RS_IS_TRACE(trace));
+	g_return_if_fail(span != NULL);
+
+	thread = get_thread();
+
+	if (thread->depth < MAX_DEPTH)
+	{
+		thread->child_time[thread->depth] = 0.0;
+		thread->child_allocated[thread->depth] = 0;
+	}
+	thread->depth++;
+
+	span->allocated = thread->allocated;
+	span->start = g_timer_elapsed(trace->timer, NULL);
+}
+
+/**
+ * Mark the end of a traced span and record it
+ * @param trace A RSTrace
+ * @param span A RSTraceSpan initialized by rs_trace_begin()
+ * @param name The name of the span, this must be a static string
+ * @param label A label for the span or NULL, this will be copied
+ * @param category The category of the span, this must be a static string
+ * @param width Width in pixels of the area processed or 0 if unknown
+ * @param height Height in pixels of the area processed or 0 if unknown
+ */
+void
+rs_trace_end(RSTrace *trace, RSTraceSpan *span, const gchar *name, const gchar *label, const gchar *category, gint width, gint height)
+{
+	TraceThread *thread;
+	Span s;
+
+	g_return_if_fail(RS_IS_TRACE(trace));
+	g_return_if_fail(span != NULL);
+
+	s.duration = g_timer_elapsed(trace->timer, NULL) - span->start;
+
+	thread = get_thread();
+	g_return_if_fail(thread->depth > 0);
+	thread->depth--;
+
+	s.name = name;
+	s.label = (label) ? g_intern_string(label) : NULL;
+	s.category = category;
+	s.thread = thread->id;
+	s.depth = thread->depth;
+	s.start = span->start;
+	s.width = width;
+	s.height = height;
+	s.allocated = thread->allocated - span->allocated;
+	s.self = s.duration;
+	s.self_allocated = s.allocated;
+
+	if (thread->depth < MAX_DEPTH)
+	{
+		s.self -= thread->child_time[thread->depth];
+		s.self_allocated -= thread->child_allocated[thread->depth];
+	}
+
+	/* Let our parent know how much of its time was spent here */
+	if (thread->depth > 0 && thread->depth <= MAX_DEPTH)
+	{
+		thread->child_time[thread->depth-1] += s.duration;
+		thread->child_allocated[thread->depth-1] += s.allocated;
+	}
+
+	g_mutex_lock(trace->lock);
+	if (trace->spans->len < MAX_SPANS)
+		g_array_append_val(trace->spans, s);
+	else
+		trace->dropped++;
+	g_mutex_unlock(trace->lock);
+}
+
+/**
+ * Tell the tracer that the calling thread allocated memory for image data
+ * @param bytes The number of bytes allocated
+ */
+void
+rs_trace_count_allocation(gsize bytes)
+{
+	get_thread()->allocated += bytes;
+}
+
+/**
+ * Forget all recorded spans
+ * @param trace A RSTrace
+ */
+void
+rs_trace_clear(RSTrace *trace)
+{
+	g_return_if_fail(RS_IS_TRACE(trace));
+
+	g_mutex_lock(trace->lock);
+	g_array_set_size(trace->spans, 0);
+	trace->dropped = 0;
+	g_mutex_unlock(trace->lock);
+}
+
+static gdouble
+mpix_per_second(const Span *s)
+{
+	if (s->duration <= 0.0)
+		return 0.0;
+
+	return ((gdouble) s->width * s->height) / s->duration / 1000000.0;
+}
+
+/* Appends a string as a quoted JSON or CSV string */
+static void
+append_quoted(GString *out, const gchar *str, gboolean json)
+{
+	g_string_append_c(out, '"');
+	for(; str && *str; str++)
+	{
+		if (*str == '"')
+			g_string_append(out, json ? "\\\"" : "\"\"");
+		else if (json && *str == '\\')
+			g_string_append(out, "\\\\");
+		else if ((guchar) *str < 0x20)
+			g_string_append_c(out, ' ');
+		else
+			g_string_append_c(out, *str);
+	}
+	g_string_append_c(out, '"');
+}
+
+/* Appends a double without depending on the current locale */
+static void
+append_double(GString *out, const gchar *format, gdouble value)
+{
+	gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+	g_string_append(out, g_ascii_formatd(buf, sizeof(buf), format, value));
+}
+
+/**
+ * Save recorded spans in Chrome trace event format, this can be loaded by
+ * chrome://tracing and compatible viewers
+ * @param trace A RSTrace
+ * @param filename The file to write
+ * @param error A location for a GError or NULL
+ * @return TRUE on success, FALSE otherwise
+ */
+gboolean
+rs_trace_save_json(RSTrace *trace, const gchar *filename, GError **error)
+{
+	GString *out;
+	gboolean ret;
+	guint i;
+
+	g_return_val_if_fail(RS_IS_TRACE(trace), FALSE);
+	g_return_val_if_fail(filename != NULL, FALSE);
+
+	out = g_string_new("{\"traceEvents\":[\n");
+
+	g_mutex_lock(trace->lock);
+	for(i = 0; i < trace->spans->len; i++)
+	{
+		const Span *s = &g_array_index(trace->spans, Span, i);
+
+		if (i > 0)
+			g_string_append(out, ",\n");
+
+		/* Complete events, the viewer works out nesting from timestamps */
+		g_string_append(out, "{\"name\":");
+		append_quoted(out, s->name, TRUE);
+		g_string_append(out, ",\"cat\":");
+		append_quoted(out, s->category, TRUE);
+		g_string_append_printf(out, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":", s->thread);
+		append_double(out, "%.1f", s->start * 1000000.0);
+		g_string_append(out, ",\"dur\":");
+		append_double(out, "%.1f", s->duration * 1000000.0);
+		g_string_append(out, ",\"args\":{");
+		if (s->label)
+		{
+			g_string_append(out, "\"label\":");
+			append_quoted(out, s->label, TRUE);
+			g_string_append_c(out, ',');
+		}
+		g_string_append_printf(out, "\"width\":%d,\"height\":%d,\"mpix_per_s\":", s->width, s->height);
+		append_double(out, "%.2f", mpix_per_second(s));
+		g_string_append(out, ",\"self_ms\":");
+		append_double(out, "%.3f", s->self * 1000.0);
+		g_string_append_printf(out, ",\"bytes_allocated\":%" G_GUINT64_FORMAT ",\"self_bytes_allocated\":%" G_GUINT64_FORMAT "}}",
+			s->allocated, s->self_allocated);
+	}
+	g_string_append_printf(out, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped\":%u}}\n", trace->dropped);
+	g_mutex_unlock(trace->lock);
+
+	ret = g_file_set_contents(filename, out->str, out->len, error);
+	g_string_free(out, TRUE);
+
+	return ret;
+}
+
+/**
+ * Save recorded spans as comma separated values, one span per line
+ * @param trace A RSTrace
+ * @param filename The file to write
+ * @param error A location for a GError or NULL
+ * @return TRUE on success, FALSE otherwise
+ */
+gboolean
+rs_trace_save_csv(RSTrace *trace, const gchar *filename, GError **error)
+{
+	GString *out;
+	gboolean ret;
+	guint i;
+
+	g_return_val_if_fail(RS_IS_TRACE(trace), FALSE);
+	g_return_val_if_fail(filename != NULL, FALSE);
+
+	out = g_string_new("name,label,category,thread,depth,start_ms,duration_ms,self_ms,width,height,mpix_per_s,bytes_allocated,self_bytes_allocated\n");
+
+	g_mutex_lock(trace->lock);
+	for(i = 0; i < trace->spans->len; i++)
+	{
+		const Span *s = &g_array_index(trace->spans, Span, i);
+
+		append_quoted(out, s->name, FALSE);
+		g_string_append_c(out, ',');
+		append_quoted(out, s->label, FALSE);
+		g_string_append_c(out, ',');
+		append_quoted(out, s->category, FALSE);
+		g_string_append_printf(out, ",%d,%d,", s->thread, s->depth);
+		append_double(out, "%.3f", s->start * 1000.0);
+		g_string_append_c(out, ',');
+		append_double(out, "%.3f", s->duration * 1000.0);
+		g_string_append_c(out, ',');
+		append_double(out, "%.3f", s->self * 1000.0);
+		g_string_append_printf(out, ",%d,%d,", s->width, s->height);
+		append_double(out, "%.2f", mpix_per_second(s));
+		g_string_append_printf(out, ",%" G_GUINT64_FORMAT ",%" G_GUINT64_FORMAT "\n", s->allocated, s->self_allocated);
+	}
+	g_mutex_unlock(trace->lock);
+
+	ret = g_file_set_contents(filename, out->str, out->len, error);
+	g_string_free(out, TRUE);
+
+	return ret;
+}
+
+/**
+ * Save recorded spans, CSV will be used if filename ends in ".csv",
+ * Chrome trace event format otherwise
+ * @param trace A RSTrace
+ * @param filename The file to write
+ * @param error A location for a GError or NULL
+ * @return TRUE on success, FALSE otherwise
+ */
+gboolean
+rs_trace_save(RSTrace *trace, const gchar *filename, GError **error)
+{
+	gboolean ret;
+	gchar *lower;
+
+	g_return_val_if_fail(RS_IS_TRACE(trace), FALSE);
+	g_return_val_if_fail(filename != NULL, FALSE);
+
+	lower = g_ascii_strdown(filename, -1);
+	if (g_str_has_suffix(lower, ".csv"))
+		ret = rs_trace_save_csv(trace, filename, error);
+	else
+		ret = rs_trace_save_json(trace, filename, error);
+	g_free(lower);
+
+	return ret;
+}
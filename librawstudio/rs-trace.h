@@ -0,0 +1,131 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef RS_TRACE_H
+#define RS_TRACE_H
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define RS_TYPE_TRACE rs_trace_get_type()
+#define RS_TRACE(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), RS_TYPE_TRACE, RSTrace))
+#define RS_TRACE_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST ((klass), RS_TYPE_TRACE, RSTraceClass))
+#define RS_IS_TRACE(obj) (G_TYPE_CHECK_INSTANCE_TYPE ((obj), RS_TYPE_TRACE))
+#define RS_IS_TRACE_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), RS_TYPE_TRACE))
+#define RS_TRACE_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS ((obj), RS_TYPE_TRACE, RSTraceClass))
+
+typedef struct _RSTrace RSTrace;
+
+typedef struct {
+	GObjectClass parent_class;
+} RSTraceClass;
+
+/**
+ * State kept between rs_trace_begin() and rs_trace_end(), usually on the stack
+ */
+typedef struct {
+	gdouble start;
+	guint64 allocated;
+} RSTraceSpan;
+
+GType rs_trace_get_type(void);
+
+/**
+ * Instantiate a new RSTrace, all timestamps will be relative to this moment
+ * @return A new RSTrace with a refcount of 1
+ */
+extern RSTrace *rs_trace_new(void);
+
+/**
+ * Set the trace used for requests without a trace of their own
+ * @param trace A RSTrace or NULL to stop tracing such requests
+ */
+extern void rs_trace_set_default(RSTrace *trace);
+
+/**
+ * Get the trace used for requests without a trace of their own
+ * @return The default RSTrace or NULL, this should not be unreffed
+ */
+extern RSTrace *rs_trace_get_default(void);
+
+/**
+ * Mark the beginning of a traced span in the calling thread. Spans must be
+ * ended in reverse order of beginning, from the same thread
+ * @param trace A RSTrace
+ * @param span A RSTraceSpan to initialize
+ */
+extern void rs_trace_begin(RSTrace *trace, RSTraceSpan *span);
+
+/**
+ * Mark the end of a traced span and record it
+ * @param trace A RSTrace
+ * @param span A RSTraceSpan initialized by rs_trace_begin()
+ * @param name The name of the span, this must be a static string
+ * @param label A label for the span or NULL, this will be copied
+ * @param category The category of the span, this must be a static string
+ * @param width Width in pixels of the area processed or 0 if unknown
+ * @param height Height in pixels of the area processed or 0 if unknown
+ */
+extern void rs_trace_end(RSTrace *trace, RSTraceSpan *span, const gchar *name, const gchar *label, const gchar *category, gint width, gint height);
+
+/**
+ * Tell the tracer that the calling thread allocated memory for image data
+ * @param bytes The number of bytes allocated
+ */
+extern void rs_trace_count_allocation(gsize bytes);
+
+/**
+ * Forget all recorded spans
+ * @param trace A RSTrace
+ */
+extern void rs_trace_clear(RSTrace *trace);
+
+/**
+ * Save recorded spans in Chrome trace event format, this can be loaded by
+ * chrome://tracing and compatible viewers
+ * @param trace A RSTrace
+ * @param filename The file to write
+ * @param error A location for a GError or NULL
+ * @return TRUE on success, FALSE otherwise
+ */
+extern gboolean rs_trace_save_json(RSTrace *trace, const gchar *filename, GError **error);
+
+/**
+ * Save recorded spans as comma separated values, one span per line
+ * @param trace A RSTrace
+ * @param filename The file to write
+ * @param error A location for a GError or NULL
+ * @return TRUE on success, FALSE otherwise
+ */
+extern gboolean rs_trace_save_csv(RSTrace *trace, const gchar *filename, GError **error);
+
+/**
+ * Save recorded spans, CSV will be used if filename ends in ".csv",
+ * Chrome trace event format otherwise
+ * @param trace A RSTrace
+ * @param filename The file to write
+ * @param error A location for a GError or NULL
+ * @return TRUE on success, FALSE otherwise
+ */
+extern gboolean rs_trace_save(RSTrace *trace, const gchar *filename, GError **error);
+
+G_END_DECLS
+
+#endif /* RS_TRACE_H */
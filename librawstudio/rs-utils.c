@@ -150,7 +150,8 @@ rs_constrain_to_bounding_box(gint target_width, gint target_height, gint *width,
 }
 
 /**
- * Try to count the number of processor cores in a system.
+ * Try to count the number of processor cores in a system. This can be
+ * overridden by setting the environment variable RS_THREADS
  * @note This currently only works for systems with /proc/cpuinfo
  * @return The numver of cores or 1 if the system is unsupported
  */
@@ -198,9 +199,14 @@ rs_get_number_of_processor_cores(void)
 #else
  #error This needs porting
 #endif
+		RS_DEBUG(PERFORMANCE, "Detected %d CPU cores.", temp_num);
+
+		/* Allow running with fewer (or more) threads for benchmarking */
+		if (g_getenv("RS_THREADS"))
+			temp_num = atoi(g_getenv("RS_THREADS"));
+
 		/* Be sure we have at least 1 processor and as sanity check, clamp to no more than 127 */
 		temp_num = (temp_num <= 0) ? 1 : MIN(temp_num, 127);
-		RS_DEBUG(PERFORMANCE, "Detected %d CPU cores.", temp_num);
 		num = temp_num;
 	}
 	g_static_mutex_unlock (&lock);
@@ -208,11 +214,159 @@ rs_get_number_of_processor_cores(void)
 	return num;
 }
 
+/**
+ * Get the amount of physical memory in the system
+ * @return The number of bytes of physical memory or 0 if unknown
+ */
+guint64
+rs_get_physical_memory(void)
+{
+	guint64 bytes = 0;
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+	glong pages = sysconf(_SC_PHYS_PAGES);
+	glong page_size = sysconf(_SC_PAGESIZE);
+
+	if (pages > 0 && page_size > 0)
+		bytes = (guint64) pages * (guint64) page_size;
+#endif
+	return bytes;
+}
+
+/**
+ * Get a number identifying an object, unlike the address of the object this
+ * will never be reused for another object
+ * @param object A GObject or NULL
+ * @return A serial number, 0 if object is NULL
+ */
+guint
+rs_object_get_serial(gpointer object)
+{
+	static GStaticMutex lock = G_STATIC_MUTEX_INIT;
+	static GQuark quark = 0;
+	static guint next_serial = 1;
+	guint serial;
+
+	if (!object)
+		return 0;
+
+	g_return_val_if_fail(G_IS_OBJECT(object), 0);
+
+	g_static_mutex_lock(&lock);
+	if (!quark)
+		quark = g_quark_from_static_string("rs-object-serial");
+
+	serial = GPOINTER_TO_UINT(g_object_get_qdata(G_OBJECT(object), quark));
+	if (!serial)
+	{
+		serial = next_serial++;
+		g_object_set_qdata(G_OBJECT(object), quark, GUINT_TO_POINTER(serial));
+	}
+	g_static_mutex_unlock(&lock);
+
+	return serial;
+}
+
+/**
+ * Hash a GValue, objects are hashed by their serial from rs_object_get_serial()
+ * and boxed values by their type only
+ * @param value An initialized GValue
+ * @return A hash of the value
+ */
+guint
+rs_value_hash(const GValue *value)
+{
+	union {
+		gfloat f;
+		gdouble d;
+		guint64 i;
+	} bits;
+	const gchar *str;
+	guint hash = G_VALUE_TYPE(value);
+
+	switch (G_TYPE_FUNDAMENTAL(G_VALUE_TYPE(value)))
+	{
+		case G_TYPE_BOOLEAN:
+			return hash * 31 + g_value_get_boolean(value);
+		case G_TYPE_CHAR:
+			return hash * 31 + g_value_get_schar(value);
+		case G_TYPE_UCHAR:
+			return hash * 31 + g_value_get_uchar(value);
+		case G_TYPE_INT:
+			return hash * 31 + g_value_get_int(value);
+		case G_TYPE_UINT:
+			return hash * 31 + g_value_get_uint(value);
+		case G_TYPE_LONG:
+			return hash * 31 + g_value_get_long(value);
+		case G_TYPE_ULONG:
+			return hash * 31 + g_value_get_ulong(value);
+		case G_TYPE_INT64:
+			bits.i = g_value_get_int64(value);
+			return hash * 31 + (guint) (bits.i ^ (bits.i >> 32));
+		case G_TYPE_UINT64:
+			bits.i = g_value_get_uint64(value);
+			return hash * 31 + (guint) (bits.i ^ (bits.i >> 32));
+		case G_TYPE_ENUM:
+			return hash * 31 + g_value_get_enum(value);
+		case G_TYPE_FLAGS:
+			return hash * 31 + g_value_get_flags(value);
+		case G_TYPE_FLOAT:
+			bits.i = 0;
+			bits.f = g_value_get_float(value);
+			return hash * 31 + (guint) bits.i;
+		case G_TYPE_DOUBLE:
+			bits.d = g_value_get_double(value);
+			return hash * 31 + (guint) (bits.i ^ (bits.i >> 32));
+		case G_TYPE_STRING:
+			str = g_value_get_string(value);
+			return hash * 31 + ((str) ? g_str_hash(str) : 0);
+		case G_TYPE_OBJECT:
+			return hash * 31 + rs_object_get_serial(g_value_get_object(value));
+		case G_TYPE_POINTER:
+			return hash * 31 + GPOINTER_TO_UINT(g_value_get_pointer(value));
+		default:
+			/* Boxed values are copied when read, we can't hash them in
+			 * general - callers must handle the types they know */
+			return hash;
+	}
+}
+
+static const gchar *cpu_level_names[RS_CPU_LEVELS] = {"c", "sse2", "sse4", "avx", "avx2"};
+
 #if defined (__i386__) || defined (__x86_64__)
 
 #define xgetbv(index,eax,edx)                                   \
    __asm__ (".byte 0x0f, 0x01, 0xd0" : "=a"(eax), "=d"(edx) : "c" (index))
 
+/* Flags allowed at each level */
+static const guint cpu_level_masks[RS_CPU_LEVELS] = {
+	0,
+	RS_CPU_FLAG_MMX | RS_CPU_FLAG_SSE | RS_CPU_FLAG_CMOV | RS_CPU_FLAG_3DNOW | RS_CPU_FLAG_3DNOW_EXT | RS_CPU_FLAG_AMD_ISSE | RS_CPU_FLAG_SSE2 | RS_CPU_FLAG_SSE3,
+	RS_CPU_FLAG_MMX | RS_CPU_FLAG_SSE | RS_CPU_FLAG_CMOV | RS_CPU_FLAG_3DNOW | RS_CPU_FLAG_3DNOW_EXT | RS_CPU_FLAG_AMD_ISSE | RS_CPU_FLAG_SSE2 | RS_CPU_FLAG_SSE3 | RS_CPU_FLAG_SSSE3 | RS_CPU_FLAG_SSE4_1 | RS_CPU_FLAG_SSE4_2,
+	~(RS_CPU_FLAG_AVX2 | RS_CPU_FLAG_FMA),
+	~0
+};
+
+/* Limit the flags to the level requested in RS_CPU_LEVEL, if any */
+static guint
+cpu_flags_override(guint cpuflags)
+{
+	const gchar *env = g_getenv("RS_CPU_LEVEL");
+	gint level;
+
+	if (!env || !*env)
+		return cpuflags;
+
+	for(level = 0; level < RS_CPU_LEVELS; level++)
+		if (g_ascii_strcasecmp(env, cpu_level_names[level]) == 0)
+		{
+			RS_DEBUG(PERFORMANCE, "CPU features limited to %s by RS_CPU_LEVEL", cpu_level_names[level]);
+			return cpuflags & cpu_level_masks[level];
+		}
+
+	g_warning("Unknown RS_CPU_LEVEL \"%s\", use c, sse2, sse4, avx or avx2", env);
+	return cpuflags;
+}
+
 /**
  * Detect cpu features
  * @return A bitmask of @RSCpuFlags
@@ -230,6 +384,19 @@ rs_detect_cpu_features(void)
        : "=a" (eax), "=c" (ecx),  "=d" (edx) \
        : "0" (cmd) \
      ); \
+} while(0)
+/* Structured extended features are returned in ebx, which we must preserve */
+#define cpuid_ebx(cmd, sub, eax, ebx) \
+  do { \
+     guint _ecx, _edx; \
+     asm ( \
+       "push %%"REG_b"\n\t"\
+       "cpuid\n\t" \
+       "mov %%ebx, %%esi\n\t" \
+       "pop %%"REG_b"\n\t" \
+       : "=a" (eax), "=S" (ebx), "=c" (_ecx), "=d" (_edx) \
+       : "0" (cmd), "2" (sub) \
+     ); \
 } while(0)
 	guint eax;
 	guint edx;
@@ -270,9 +437,11 @@ rs_detect_cpu_features(void)
 		{
 			guint std_dsc;
 			guint ext_dsc;
+			guint max_std;
 
 			/* Get the standard level */
 			cpuid(0x00000000, std_dsc, ecx, edx);
+			max_std = std_dsc;
 
 			if (std_dsc)
 			{
@@ -302,6 +471,19 @@ rs_detect_cpu_features(void)
 						if ((eax & 0x6) == 0x6)
 							cpuflags |= RS_CPU_FLAG_AVX;
 				}
+				/* FMA uses the AVX registers */
+				if ((cpuflags & RS_CPU_FLAG_AVX) && (ecx & 0x00001000))
+					cpuflags |= RS_CPU_FLAG_FMA;
+			}
+
+			if (max_std >= 7 && (cpuflags & RS_CPU_FLAG_AVX))
+			{
+				guint ebx;
+				/* Request for structured extended features */
+				cpuid_ebx(0x00000007, 0, eax, ebx);
+
+				if (ebx & 0x00000020)
+					cpuflags |= RS_CPU_FLAG_AVX2;
 			}
 
 			/* Is there extensions */
@@ -324,7 +506,7 @@ rs_detect_cpu_features(void)
 			if (cpuflags & RS_CPU_FLAG_SSE)
 				cpuflags |= RS_CPU_FLAG_AMD_ISSE;
 		}
-		stored_cpuflags = cpuflags;
+		stored_cpuflags = cpu_flags_override(cpuflags);
 	}
 	g_static_mutex_unlock(&lock);
 
@@ -341,10 +523,13 @@ rs_detect_cpu_features(void)
 	report("SSE4.1",RS_CPU_FLAG_SSE4_1);
 	report("SSE4.2",RS_CPU_FLAG_SSE4_2);
 	report("AVX",RS_CPU_FLAG_AVX);
+	report("AVX2",RS_CPU_FLAG_AVX2);
+	report("FMA",RS_CPU_FLAG_FMA);
 #undef report
 
 	return(stored_cpuflags);
 #undef cpuid
+#undef cpuid_ebx
 }
 
 #else
@@ -355,6 +540,62 @@ rs_detect_cpu_features()
 }
 #endif /* __i386__ || __x86_64__ */
 
+/**
+ * Get the best kernel variant supported by this cpu. The instruction sets
+ * used can be limited by setting the environment variable RS_CPU_LEVEL to
+ * "c", "sse2", "sse4", "avx" or "avx2"
+ * @return The highest usable level
+ */
+RSCpuLevel
+rs_cpu_get_level(void)
+{
+	const guint cpu = rs_detect_cpu_features();
+
+	if ((cpu & RS_CPU_FLAG_AVX2) && (cpu & RS_CPU_FLAG_FMA))
+		return RS_CPU_LEVEL_AVX2;
+	if (cpu & RS_CPU_FLAG_AVX)
+		return RS_CPU_LEVEL_AVX;
+	if (cpu & RS_CPU_FLAG_SSE4_1)
+		return RS_CPU_LEVEL_SSE4_1;
+	if (cpu & RS_CPU_FLAG_SSE2)
+		return RS_CPU_LEVEL_SSE2;
+	return RS_CPU_LEVEL_C;
+}
+
+/**
+ * Get the name of a kernel variant, as used by RS_CPU_LEVEL
+ * @param level A level
+ * @return A constant string
+ */
+const gchar *
+rs_cpu_level_get_name(RSCpuLevel level)
+{
+	g_return_val_if_fail(level < RS_CPU_LEVELS, NULL);
+
+	return cpu_level_names[level];
+}
+
+/**
+ * Pick the best kernel from a table of variants
+ * @param kernels RS_CPU_LEVELS functions indexed by RSCpuLevel, NULL for
+ *                variants not implemented. The C variant must be present
+ * @return The function to use on this cpu
+ */
+gpointer
+rs_cpu_dispatch(const gpointer *kernels)
+{
+	gint level;
+
+	g_return_val_if_fail(kernels != NULL, NULL);
+	g_return_val_if_fail(kernels[RS_CPU_LEVEL_C] != NULL, NULL);
+
+	for(level = rs_cpu_get_level(); level > RS_CPU_LEVEL_C; level--)
+		if (kernels[level])
+			break;
+
+	return kernels[level];
+}
+
 /**
  * Return a path to the current config directory for Rawstudio - this is the
  * .rawstudio direcotry in home
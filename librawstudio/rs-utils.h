@@ -22,6 +22,7 @@
 
 #include <rs-types.h>
 #include <glib.h>
+#include "x86-cpu.h"
 
 #define GETVAL(adjustment) \
 	gtk_adjustment_get_value((GtkAdjustment *) adjustment)
@@ -65,13 +66,39 @@ extern void
 rs_constrain_to_bounding_box(gint target_width, gint target_height, gint *width, gint *height);
 
 /**
- * Try to count the number of processor cores in a system.
+ * Try to count the number of processor cores in a system. This can be
+ * overridden by setting the environment variable RS_THREADS
  * @note This currently only works for systems with /proc/cpuinfo
  * @return The numver of cores or 1 if the system is unsupported
  */
 extern gint
 rs_get_number_of_processor_cores(void);
 
+/**
+ * Get the amount of physical memory in the system
+ * @return The number of bytes of physical memory or 0 if unknown
+ */
+extern guint64
+rs_get_physical_memory(void);
+
+/**
+ * Get a number identifying an object, unlike the address of the object this
+ * will never be reused for another object
+ * @param object A GObject or NULL
+ * @return A serial number, 0 if object is NULL
+ */
+extern guint
+rs_object_get_serial(gpointer object);
+
+/**
+ * Hash a GValue, objects are hashed by their serial from rs_object_get_serial()
+ * and boxed values by their type only
+ * @param value An initialized GValue
+ * @return A hash of the value
+ */
+extern guint
+rs_value_hash(const GValue *value);
+
 /**
  * Detect cpu features
  * @return A bitmask of @RSCpuFlags
@@ -79,6 +106,32 @@ rs_get_number_of_processor_cores(void);
 guint
 rs_detect_cpu_features(void);
 
+/**
+ * Get the best kernel variant supported by this cpu. The instruction sets
+ * used can be limited by setting the environment variable RS_CPU_LEVEL to
+ * "c", "sse2", "sse4", "avx" or "avx2"
+ * @return The highest usable level
+ */
+extern RSCpuLevel
+rs_cpu_get_level(void);
+
+/**
+ * Get the name of a kernel variant, as used by RS_CPU_LEVEL
+ * @param level A level
+ * @return A constant string
+ */
+extern const gchar *
+rs_cpu_level_get_name(RSCpuLevel level);
+
+/**
+ * Pick the best kernel from a table of variants
+ * @param kernels RS_CPU_LEVELS functions indexed by RSCpuLevel, NULL for
+ *                variants not implemented. The C variant must be present
+ * @return The function to use on this cpu
+ */
+extern gpointer
+rs_cpu_dispatch(const gpointer *kernels);
+
 /**
  * Return a path to the current config directory for Rawstudio - this is the
  * .rawstudio direcotry in home
@@ -13,9 +13,21 @@ typedef enum {
 	RS_CPU_FLAG_SSSE3 =  1<<8,
 	RS_CPU_FLAG_SSE4_1 =  1<<9,
 	RS_CPU_FLAG_SSE4_2 =  1<<10,
-	RS_CPU_FLAG_AVX =  1<<11
+	RS_CPU_FLAG_AVX =  1<<11,
+	RS_CPU_FLAG_AVX2 =  1<<12,
+	RS_CPU_FLAG_FMA =  1<<13
 } RSCpuFlags;
 
+/* Kernel variants, in order of preference */
+typedef enum {
+	RS_CPU_LEVEL_C = 0,
+	RS_CPU_LEVEL_SSE2,
+	RS_CPU_LEVEL_SSE4_1,
+	RS_CPU_LEVEL_AVX,
+	RS_CPU_LEVEL_AVX2, /* AVX2 and FMA */
+	RS_CPU_LEVELS
+} RSCpuLevel;
+
 #if defined(__x86_64__)
 #  define REG_a "rax"
 #  define REG_b "rbx"
@@ -0,0 +1,116 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <rawstudio.h>
+
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+
+/* Two 4 channel pixels to 6 shorts in the low 12 bytes */
+static const guchar _pack_mask[16] __attribute__ ((aligned (16))) =
+	{0, 1, 2, 3, 4, 5, 8, 9, 10, 11, 12, 13, 0x80, 0x80, 0x80, 0x80};
+
+/* 6 shorts in the low 12 bytes to two 4 channel pixels, 4th channel cleared */
+static const guchar _unpack_mask[16] __attribute__ ((aligned (16))) =
+	{0, 1, 2, 3, 4, 5, 0x80, 0x80, 6, 7, 8, 9, 10, 11, 0x80, 0x80};
+
+/* Pixels are done two at a time with 16 byte stores of which only 12 bytes
+ * are used, the rest is overwritten by the next pixel. So we must always
+ * leave one pixel for the C loop to not write (or read) outside the buffers */
+
+void
+cache_pack48_sse4(const gushort *in, gushort *out, gint pixels)
+{
+	const __m128i mask = _mm_load_si128((__m128i *) _pack_mask);
+
+	while (pixels >= 3)
+	{
+		__m128i p = _mm_loadu_si128((__m128i *) in);
+		_mm_storeu_si128((__m128i *) out, _mm_shuffle_epi8(p, mask));
+		in += 8;
+		out += 6;
+		pixels -= 2;
+	}
+
+	while (pixels-- > 0)
+	{
+		out[0] = in[0];
+		out[1] = in[1];
+		out[2] = in[2];
+		in += 4;
+		out += 3;
+	}
+}
+
+void
+cache_unpack48_sse4(const gushort *in, gushort *out, gint pixels)
+{
+	const __m128i mask = _mm_load_si128((__m128i *) _unpack_mask);
+
+	while (pixels >= 3)
+	{
+		__m128i p = _mm_loadu_si128((__m128i *) in);
+		_mm_storeu_si128((__m128i *) out, _mm_shuffle_epi8(p, mask));
+		in += 6;
+		out += 8;
+		pixels -= 2;
+	}
+
+	while (pixels-- > 0)
+	{
+		out[0] = in[0];
+		out[1] = in[1];
+		out[2] = in[2];
+		out[3] = 0;
+		in += 3;
+		out += 4;
+	}
+}
+
+gboolean
+cache_has_sse4(void)
+{
+	return TRUE;
+}
+
+#else /* !defined __SSE4_1__ */
+
+/* Provide empty functions if not SSE4 compiled to avoid linker errors */
+
+void
+cache_pack48_sse4(const gushort *in, gushort *out, gint pixels)
+{
+	/* We should never even get here */
+	g_assert(FALSE);
+}
+
+void
+cache_unpack48_sse4(const gushort *in, gushort *out, gint pixels)
+{
+	/* We should never even get here */
+	g_assert(FALSE);
+}
+
+gboolean
+cache_has_sse4(void)
+{
+	return FALSE;
+}
+
+#endif
@@ -32,16 +32,67 @@
 #define RS_CACHE_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST ((klass), RS_TYPE_CACHE, RSCacheClass))
 #define RS_IS_CACHE(obj) (G_TYPE_CHECK_INSTANCE_TYPE ((obj), RS_TYPE_CACHE))
 
+/* No budget of our own by default, the global limit from rs_memory_trim()
+ * applies to all caches */
+#define DEFAULT_MAX_BYTES G_MAXUINT64
+
+/* SSE4 optimized functions */
+extern void cache_pack48_sse4(const gushort *in, gushort *out, gint pixels);
+extern void cache_unpack48_sse4(const gushort *in, gushort *out, gint pixels);
+extern gboolean cache_has_sse4(void);
+
 typedef struct _RSCache RSCache;
 typedef struct _RSCacheClass RSCacheClass;
 
+typedef struct {
+	gboolean image8;
+	gboolean float_image; /* The previous filter may deliver a RSImage */
+	gboolean quick;
+	gboolean roi_set;
+	GdkRectangle roi;
+	guint param_hash;
+	RSFilterParam *params; /* param_hash is only used to rule out entries fast */
+	guint upstream_hash;
+} CacheKey;
+
+/* A demosaiced image stored without the unused 4th channel, 6 bytes per pixel
+ * instead of 8. This is refcounted so we can unpack without holding the lock */
+typedef struct {
+	gint refcount;
+	gint width;
+	gint height;
+	guint channels;
+	guint pixelsize;
+	guint filters;
+	GdkRectangle rect; /* The part of the image stored */
+	gushort *data;
+} PackedImage;
+
+typedef struct {
+	CacheKey key;
+	RSFilterResponse *response; /* Without image if packed is set */
+	PackedImage *packed;
+	guint64 bytes;
+	guint64 memory_id;
+} CacheEntry;
+
 struct _RSCache {
 	RSFilter parent;
 
-	RSFilterResponse *cached_image;
+	GQueue *entries; /* Most recently used first */
+	guint64 bytes_used;
+	guint64 max_bytes;
+	guint upstream_hash;
+	guint generation; /* Bumped on every change upstream */
+
+	guint hits;
+	guint misses;
+	guint evictions;
+
 	gboolean ignore_changed;
 	RSFilterChangedMask mask;
 	gboolean ignore_roi;
+	gboolean packed;
 	gint latency;
 	GMutex *cache_mutex;
 };
@@ -55,7 +106,13 @@ RS_DEFINE_FILTER(rs_cache, RSCache)
 enum {
 	PROP_0,
 	PROP_LATENCY,
-	PROP_IGNORE_ROI
+	PROP_IGNORE_ROI,
+	PROP_PACKED,
+	PROP_MAX_BYTES,
+	PROP_BYTES_USED,
+	PROP_HITS,
+	PROP_MISSES,
+	PROP_EVICTIONS
 };
 
 static void finalize(GObject *object);
@@ -94,6 +151,42 @@ rs_cache_class_init(RSCacheClass *klass)
 			FALSE,
 			G_PARAM_READWRITE)
 	);
+	g_object_class_install_property(object_class,
+		PROP_PACKED, g_param_spec_boolean(
+			"packed", "packed", "Store demosaiced images as 48 bit pixels, saving 25% memory at the cost of unpacking for every request answered",
+			FALSE,
+			G_PARAM_READWRITE)
+	);
+	g_object_class_install_property(object_class,
+		PROP_MAX_BYTES, g_param_spec_uint64(
+			"max-bytes", "max-bytes", "Memory budget for this cache in bytes, the most recently used image is always kept. The global limit applies as well",
+			0, G_MAXUINT64, DEFAULT_MAX_BYTES,
+			G_PARAM_READWRITE)
+	);
+	g_object_class_install_property(object_class,
+		PROP_BYTES_USED, g_param_spec_uint64(
+			"bytes-used", "bytes-used", "Memory used by cached images in bytes",
+			0, G_MAXUINT64, 0,
+			G_PARAM_READABLE)
+	);
+	g_object_class_install_property(object_class,
+		PROP_HITS, g_param_spec_uint(
+			"hits", "hits", "Number of requests answered from the cache",
+			0, G_MAXUINT, 0,
+			G_PARAM_READABLE)
+	);
+	g_object_class_install_property(object_class,
+		PROP_MISSES, g_param_spec_uint(
+			"misses", "misses", "Number of requests passed on to the previous filter",
+			0, G_MAXUINT, 0,
+			G_PARAM_READABLE)
+	);
+	g_object_class_install_property(object_class,
+		PROP_EVICTIONS, g_param_spec_uint(
+			"evictions", "evictions", "Number of images dropped to stay within max-bytes or the global memory limit",
+			0, G_MAXUINT, 0,
+			G_PARAM_READABLE)
+	);
 
 	filter_class->name = "Listen for changes and caches image data";
 	filter_class->get_image = get_image;
@@ -106,8 +199,16 @@ rs_cache_init(RSCache *cache)
 {
 	cache->ignore_changed = FALSE;
 	cache->ignore_roi = FALSE;
+	cache->packed = FALSE;
 	cache->latency = 0;
-	cache->cached_image = rs_filter_response_new();
+	cache->entries = g_queue_new();
+	cache->bytes_used = 0;
+	cache->max_bytes = DEFAULT_MAX_BYTES;
+	cache->upstream_hash = 0;
+	cache->generation = 0;
+	cache->hits = 0;
+	cache->misses = 0;
+	cache->evictions = 0;
 	cache->cache_mutex = g_mutex_new();
 }
 
@@ -115,10 +216,203 @@ static void
 finalize(GObject *object)
 {
 	RSCache *cache = RS_CACHE(object);
+	rs_memory_unregister_owner(cache);
 	flush(cache);
+	g_queue_free(cache->entries);
 	g_mutex_free(cache->cache_mutex);
 }
 
+static void
+packed_unref(PackedImage *packed)
+{
+	if (g_atomic_int_dec_and_test(&packed->refcount))
+	{
+		rs_buffer_pool_free(packed->data);
+		g_slice_free(PackedImage, packed);
+	}
+}
+
+static void
+entry_free(CacheEntry *entry)
+{
+	rs_memory_unregister(entry->memory_id);
+	g_object_unref(entry->key.params);
+	g_object_unref(entry->response);
+	if (entry->packed)
+		packed_unref(entry->packed);
+	g_slice_free(CacheEntry, entry);
+}
+
+static void
+pack48(const gushort *in, gushort *out, gint pixels)
+{
+	while (pixels-- > 0)
+	{
+		out[0] = in[0];
+		out[1] = in[1];
+		out[2] = in[2];
+		in += 4;
+		out += 3;
+	}
+}
+
+static void
+unpack48(const gushort *in, gushort *out, gint pixels)
+{
+	while (pixels-- > 0)
+	{
+		out[0] = in[0];
+		out[1] = in[1];
+		out[2] = in[2];
+		out[3] = 0;
+		in += 3;
+		out += 4;
+	}
+}
+
+static gboolean
+has_sse4(void)
+{
+	return (!!(rs_detect_cpu_features() & RS_CPU_FLAG_SSE4_1)) && cache_has_sse4();
+}
+
+typedef struct {
+	PackedImage *packed;
+	RS_IMAGE16 *image;
+} PackInfo;
+
+static void
+pack_part(gint start_y, gint end_y, gpointer user_data)
+{
+	PackInfo *info = user_data;
+	const GdkRectangle *rect = &info->packed->rect;
+	const gboolean sse4 = has_sse4();
+	gint y;
+
+	for(y = start_y; y < end_y; y++)
+	{
+		const gushort *in = GET_PIXEL(info->image, rect->x, rect->y + y);
+		gushort *out = info->packed->data + (gsize) y * rect->width * 3;
+		if (sse4)
+			cache_pack48_sse4(in, out, rect->width);
+		else
+			pack48(in, out, rect->width);
+	}
+}
+
+static void
+unpack_part(gint start_y, gint end_y, gpointer user_data)
+{
+	PackInfo *info = user_data;
+	const GdkRectangle *rect = &info->packed->rect;
+	const gboolean sse4 = has_sse4();
+	gint y;
+
+	for(y = start_y; y < end_y; y++)
+	{
+		const gushort *in = info->packed->data + (gsize) y * rect->width * 3;
+		gushort *out = GET_PIXEL(info->image, rect->x, rect->y + y);
+		if (sse4)
+			cache_unpack48_sse4(in, out, rect->width);
+		else
+			unpack48(in, out, rect->width);
+	}
+}
+
+/* Returns NULL if the image can't be packed */
+static PackedImage *
+pack(RS_IMAGE16 *image, const CacheKey *key)
+{
+	PackInfo info;
+	PackedImage *packed;
+	GdkRectangle rect = {0, 0, image->w, image->h};
+
+	/* Only demosaiced images have an unused channel */
+	if (image->channels != 3 || image->pixelsize != 4 || image->filters != 0)
+		return NULL;
+
+	/* Only the ROI is defined */
+	if (key->roi_set && !gdk_rectangle_intersect(&rect, (GdkRectangle *) &key->roi, &rect))
+		return NULL;
+
+	packed = g_slice_new(PackedImage);
+	packed->data = rs_buffer_pool_alloc((gsize) rect.width * rect.height * 3 * sizeof(gushort));
+	if (!packed->data)
+	{
+		g_slice_free(PackedImage, packed);
+		return NULL;
+	}
+	packed->refcount = 1;
+	packed->width = image->w;
+	packed->height = image->h;
+	packed->channels = image->channels;
+	packed->pixelsize = image->pixelsize;
+	packed->filters = image->filters;
+	packed->rect = rect;
+
+	info.packed = packed;
+	info.image = image;
+	rs_parallel_for(0, rect.height, 0, pack_part, &info);
+
+	return packed;
+}
+
+static RS_IMAGE16 *
+unpack(PackedImage *packed)
+{
+	PackInfo info;
+
+	info.packed = packed;
+	info.image = rs_image16_new(packed->width, packed->height, packed->channels, packed->pixelsize);
+	if (!info.image)
+		return NULL;
+	info.image->filters = packed->filters;
+
+	rs_parallel_for(0, packed->rect.height, 0, unpack_part, &info);
+
+	return info.image;
+}
+
+/* Drop least recently used entries until we're within budget */
+static void
+shrink(RSCache *cache)
+{
+	while (cache->bytes_used > cache->max_bytes && g_queue_get_length(cache->entries) > 1)
+	{
+		CacheEntry *entry = g_queue_pop_tail(cache->entries);
+
+		filter_debug("Cache[%p]: Evicting %" G_GUINT64_FORMAT " bytes", cache, entry->bytes);
+		cache->bytes_used -= entry->bytes;
+		cache->evictions++;
+		entry_free(entry);
+	}
+}
+
+/* Called by the memory manager when memory is needed elsewhere */
+static void
+evict(gpointer owner, guint64 id)
+{
+	RSCache *cache = RS_CACHE(owner);
+	GList *node;
+
+	g_mutex_lock(cache->cache_mutex);
+	for(node = cache->entries->head; node; node = node->next)
+	{
+		CacheEntry *entry = node->data;
+
+		if (entry->memory_id == id)
+		{
+			filter_debug("Cache[%p]: Evicting %" G_GUINT64_FORMAT " bytes for global limit", cache, entry->bytes);
+			cache->bytes_used -= entry->bytes;
+			cache->evictions++;
+			entry_free(entry);
+			g_queue_delete_link(cache->entries, node);
+			break;
+		}
+	}
+	g_mutex_unlock(cache->cache_mutex);
+}
+
 static void
 get_property(GObject *object, guint property_id, GValue *value, GParamSpec *pspec)
 {
@@ -132,6 +426,26 @@ get_property(GObject *object, guint property_id, GValue *value, GParamSpec *pspe
 		case PROP_IGNORE_ROI:
 			g_value_set_boolean(value, cache->ignore_roi);
 			break;
+		case PROP_PACKED:
+			g_value_set_boolean(value, cache->packed);
+			break;
+		case PROP_MAX_BYTES:
+			g_value_set_uint64(value, cache->max_bytes);
+			break;
+		case PROP_BYTES_USED:
+			g_mutex_lock(cache->cache_mutex);
+			g_value_set_uint64(value, cache->bytes_used);
+			g_mutex_unlock(cache->cache_mutex);
+			break;
+		case PROP_HITS:
+			g_value_set_uint(value, cache->hits);
+			break;
+		case PROP_MISSES:
+			g_value_set_uint(value, cache->misses);
+			break;
+		case PROP_EVICTIONS:
+			g_value_set_uint(value, cache->evictions);
+			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
 	}
@@ -150,13 +464,23 @@ set_property(GObject *object, guint property_id, const GValue *value, GParamSpec
 		case PROP_IGNORE_ROI:
 			cache->ignore_roi = g_value_get_boolean(value);
 			break;
+		case PROP_PACKED:
+			/* Applies to images cached from now on */
+			cache->packed = g_value_get_boolean(value);
+			break;
+		case PROP_MAX_BYTES:
+			g_mutex_lock(cache->cache_mutex);
+			cache->max_bytes = g_value_get_uint64(value);
+			shrink(cache);
+			g_mutex_unlock(cache->cache_mutex);
+			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
 	}
 }
 
 static gboolean
-rectangle_is_inside(GdkRectangle *outer_rect, GdkRectangle *inner_rect)
+rectangle_is_inside(const GdkRectangle *outer_rect, const GdkRectangle *inner_rect)
 {
 	return inner_rect->x >= outer_rect->x &&
 		inner_rect->x + inner_rect->width <= outer_rect->x + outer_rect->width &&
@@ -164,262 +488,351 @@ rectangle_is_inside(GdkRectangle *outer_rect, GdkRectangle *inner_rect)
 		inner_rect->y + inner_rect->height <= outer_rect->y + outer_rect->height;
 }
 
-static gint get_cached_width(RSCache *cache)
+static void
+key_init(CacheKey *key, RSFilter *filter, const RSFilterRequest *request, gboolean image8)
 {
-	gint ret = -1;
-	if (rs_filter_response_has_image(cache->cached_image)) {
-		RS_IMAGE16 *img = rs_filter_response_get_image(cache->cached_image);
-		ret = img->w;
-		g_object_unref(img);
-	}
+	GdkRectangle *roi = rs_filter_request_get_roi(request);
 
-	if (rs_filter_response_has_image8(cache->cached_image)) {
-		GdkPixbuf *img  =  rs_filter_response_get_image8(cache->cached_image);
-		ret = gdk_pixbuf_get_width(img);
-		g_object_unref(img);
-	}
-	return ret;
+	key->image8 = image8;
+	key->float_image = rs_filter_request_get_float_allowed(request, filter->previous);
+	key->quick = rs_filter_request_get_quick(request);
+	key->roi_set = (roi != NULL);
+	if (roi)
+		key->roi = *roi;
+	key->param_hash = rs_filter_param_hash(RS_FILTER_PARAM(request));
+	key->params = RS_FILTER_PARAM(request);
+	key->upstream_hash = rs_filter_get_upstream_hash(filter->previous);
 }
 
-static gint get_cached_height(RSCache *cache)
+/* Returns TRUE if an image rendered for cached can be used for wanted */
+static gboolean
+key_covers(const CacheKey *cached, const CacheKey *wanted)
 {
-	gint ret = -1;
-	if (rs_filter_response_has_image(cache->cached_image)) {
-		RS_IMAGE16 *img = rs_filter_response_get_image(cache->cached_image);
-		ret = img->h;
-		g_object_unref(img);
-	}
+	if (cached->image8 != wanted->image8
+		|| cached->float_image != wanted->float_image
+		|| cached->upstream_hash != wanted->upstream_hash
+		|| cached->param_hash != wanted->param_hash
+		|| !rs_filter_param_equal(cached->params, wanted->params))
+		return FALSE;
 
-	if (rs_filter_response_has_image8(cache->cached_image)) {
-		GdkPixbuf *img  =  rs_filter_response_get_image8(cache->cached_image);
-		ret = gdk_pixbuf_get_height(img);
-		g_object_unref(img);
-	}
-	return ret;
-}
+	/* A quick image can't be used for a full quality request */
+	if (cached->quick && !wanted->quick)
+		return FALSE;
 
-static void
-set_roi_to_full(RSCache *cache) {
-	GdkRectangle *r = g_new(GdkRectangle, 1);
-	r->x = 0;
-	r->y = 0;
-
-	if (rs_filter_response_has_image(cache->cached_image)) {
-		RS_IMAGE16 *img = rs_filter_response_get_image(cache->cached_image);
-		r->width = img->w;
-		r->height = img->h;
-		rs_filter_response_set_roi(cache->cached_image,r);
-		g_object_unref(img);
-	}
+	if (!wanted->roi_set)
+		return !cached->roi_set;
 
-	if (rs_filter_response_has_image8(cache->cached_image)) {
-		GdkPixbuf *img  =  rs_filter_response_get_image8(cache->cached_image);
-		r->width = gdk_pixbuf_get_width(img);
-		r->height = gdk_pixbuf_get_height(img);
-		rs_filter_response_set_roi(cache->cached_image,r);
-		g_object_unref(img);
-	}
-	filter_debug("Cache[%p]: Setting request ROI to full from cache!", cache);
-	filter_debug("Cache[%p]: Saved   ROI x:%d, y:%d, w:%d, h:%d", cache, r->x, r->y, r->width, r->height);
+	/* A complete image covers any ROI */
+	if (!cached->roi_set)
+		return TRUE;
+
+	return rectangle_is_inside(&cached->roi, &wanted->roi);
 }
 
-static RSFilterResponse *
-get_image(RSFilter *filter, const RSFilterRequest *_request)
+static CacheEntry *
+lookup(RSCache *cache, const CacheKey *key)
 {
-	RSCache *cache = RS_CACHE(filter);
-	RSFilterRequest *request = rs_filter_request_clone(_request);
-	GdkRectangle *roi = rs_filter_request_get_roi(request);
+	GList *node;
 
-	filter_debug("Cache[%p]: getimage() called", filter);
-
-	g_mutex_lock(cache->cache_mutex);
-	if (roi && cache->ignore_roi)
+	for(node = cache->entries->head; node; node = node->next)
 	{
-		roi = NULL;
-		rs_filter_request_set_roi(request, NULL);
-		filter_debug("Cache[%p]: Disabling ROI for upward calls", filter);
-	}
+		CacheEntry *entry = node->data;
 
-	if (rs_filter_response_has_image(cache->cached_image)) {
-
-		if (rs_filter_response_get_quick(cache->cached_image) && !rs_filter_request_get_quick(request))
+		if (key_covers(&entry->key, key))
 		{
-			filter_debug("Cache[%p]: Cached image is quick and requested image is not!", filter);
-			flush(cache);
+			/* Move to front */
+			g_queue_unlink(cache->entries, node);
+			g_queue_push_head_link(cache->entries, node);
+			return entry;
 		}
+	}
+
+	return NULL;
+}
 
-		if (!rs_filter_response_get_roi(cache->cached_image) && roi)
-			set_roi_to_full(cache);
+static void
+insert(RSCache *cache, const CacheKey *key, RSFilterResponse *response, gdouble cost)
+{
+	CacheEntry *entry;
+	GList *node, *next;
 
-		if (!roi && rs_filter_response_get_roi(cache->cached_image))
-		{
-				roi = g_new(GdkRectangle, 1);
-				roi->x = 0;
-				roi->y = 0;
-				roi->width = get_cached_width(cache);
-				roi->height = get_cached_height(cache);
-				rs_filter_request_set_roi(request, roi);
-				filter_debug("Cache[%p]: Setting request ROI from cache!", filter);
-		}
-		if (rs_filter_response_get_roi(cache->cached_image) && roi)
-		{
-			roi->x = MAX(0, roi->x);
-			roi->y = MAX(0, roi->y);
-			roi->width = MIN(roi->width, get_cached_width(cache));
-			roi->height = MIN(roi->height, get_cached_height(cache));
-		}
+	/* Someone else could have rendered the same while we were busy */
+	if (lookup(cache, key))
+		return;
 
-		if (!cache->ignore_roi && roi)
+	/* Forget entries this one replaces, quick renderings and smaller ROI's */
+	for(node = cache->entries->head; node; node = next)
+	{
+		next = node->next;
+		entry = node->data;
+		if (key_covers(key, &entry->key))
 		{
-			if (rs_filter_response_get_roi(cache->cached_image)) 
-				if (!rectangle_is_inside(rs_filter_response_get_roi(cache->cached_image), roi))
-				{
-					filter_debug("Cache[%p]: Cached image ROI does not cover requested ROI!", filter);
-#if 0
-					GdkRectangle *r = rs_filter_response_get_roi(cache->cached_image);
-					filter_debug("Cache[%p]: Request ROI x:%d, y:%d, w:%d, h:%d", filter, roi->x, roi->y, roi->width, roi->height);
-					filter_debug("Cache[%p]: Cached  ROI x:%d, y:%d, w:%d, h:%d", filter, r->x, r->y, r->width, r->height);
-#endif
-					flush(cache);
-				}
+			cache->bytes_used -= entry->bytes;
+			entry_free(entry);
+			g_queue_delete_link(cache->entries, node);
 		}
 	}
 
-	if (!rs_filter_response_has_image(cache->cached_image))
-	{
-		filter_debug("Cache[%p]: Cached image NOT found", filter);
-		g_object_unref(cache->cached_image);
-		cache->cached_image = rs_filter_get_image(filter->previous, request);
+	entry = g_slice_new(CacheEntry);
+	entry->key = *key;
+	/* Keep the parameters only, they're shared with the request until changed */
+	entry->key.params = rs_filter_param_new();
+	rs_filter_param_clone(entry->key.params, key->params);
+	entry->response = NULL;
+	entry->packed = NULL;
+	entry->bytes = 0;
 
-		if (cache->cached_image && !roi)
-			set_roi_to_full(cache);
-		else
+	if (key->image8)
+	{
+		GdkPixbuf *pixbuf = rs_filter_response_get_image8(response);
+		if (pixbuf)
 		{
-			rs_filter_response_set_roi(cache->cached_image, roi);
-			if (roi)
-				filter_debug("Cache[%p]: Saved   ROI x:%d, y:%d, w:%d, h:%d", filter, roi->x, roi->y, roi->width, roi->height);
+			entry->bytes = (guint64) gdk_pixbuf_get_rowstride(pixbuf) * gdk_pixbuf_get_height(pixbuf);
+			g_object_unref(pixbuf);
 		}
-
-		if (rs_filter_request_get_quick(request))
+	}
+	else if (rs_filter_response_has_float_image(response))
+	{
+		RSImage *image = rs_filter_response_get_float_image(response);
+		entry->bytes = (guint64) rs_image_get_width(image) * rs_image_get_height(image) * rs_image_get_number_of_planes(image) * sizeof(gfloat);
+		g_object_unref(image);
+	}
+	else
+	{
+		RS_IMAGE16 *image = rs_filter_response_get_image(response);
+		if (image)
 		{
-			rs_filter_response_set_quick(cache->cached_image);
-			filter_debug("Cache[%p]: Setting image as quick", filter);
+			if (cache->packed && (entry->packed = pack(image, key)))
+			{
+				/* Keep everything but the image */
+				entry->response = rs_filter_response_clone(response);
+				entry->bytes = (guint64) entry->packed->rect.width * entry->packed->rect.height * 3 * sizeof(gushort);
+			}
+			else
+				entry->bytes = (guint64) image->rowstride * image->h * sizeof(gushort);
+			g_object_unref(image);
 		}
 	}
 
-	RSFilterResponse *fr = rs_filter_response_clone(cache->cached_image);
-	RS_IMAGE16* img = rs_filter_response_get_image(cache->cached_image);
-	rs_filter_response_set_image(fr, img);
+	if (!entry->response)
+		entry->response = g_object_ref(response);
 
-	if (img)
-		g_object_unref(img);
+	/* Name the memory after what we're caching, "RSCache" tells nothing */
+	gchar *name = g_strdup_printf("%s (cached)", RS_FILTER_NAME(RS_FILTER(cache)->previous));
+	entry->memory_id = rs_memory_register(cache, name, entry->bytes, cost, evict);
+	g_free(name);
 
-	g_object_unref(request);
-	g_mutex_unlock(cache->cache_mutex);
+	g_queue_push_head(cache->entries, entry);
+	cache->bytes_used += entry->bytes;
 
-	return fr;
+	shrink(cache);
 }
 
+/* Set the ROI of a response to the complete image */
+static void
+set_roi_to_full(RSFilterResponse *response)
+{
+	GdkRectangle r;
+	r.x = 0;
+	r.y = 0;
+	r.width = 0;
+	r.height = 0;
+
+	if (rs_filter_response_has_image(response)) {
+		RS_IMAGE16 *img = rs_filter_response_get_image(response);
+		r.width = img->w;
+		r.height = img->h;
+		g_object_unref(img);
+	}
+
+	if (rs_filter_response_has_float_image(response)) {
+		RSImage *img = rs_filter_response_get_float_image(response);
+		r.width = rs_image_get_width(img);
+		r.height = rs_image_get_height(img);
+		g_object_unref(img);
+	}
+
+	if (rs_filter_response_has_image8(response)) {
+		GdkPixbuf *img = rs_filter_response_get_image8(response);
+		r.width = gdk_pixbuf_get_width(img);
+		r.height = gdk_pixbuf_get_height(img);
+		g_object_unref(img);
+	}
+
+	rs_filter_response_set_roi(response, &r);
+	filter_debug("Cache[%p]: Saved   ROI x:%d, y:%d, w:%d, h:%d", response, r.x, r.y, r.width, r.height);
+}
 
 static RSFilterResponse *
-get_image8(RSFilter *filter, const RSFilterRequest *_request)
+get_response(RSFilter *filter, const RSFilterRequest *_request, gboolean image8)
 {
 	RSCache *cache = RS_CACHE(filter);
 	RSFilterRequest *request = rs_filter_request_clone(_request);
-	GdkRectangle *roi = rs_filter_request_get_roi(request);
-	filter_debug("Cache[%p]: getimage8() called", filter);
-
-	g_mutex_lock(cache->cache_mutex);
-	if (roi && cache->ignore_roi)
+	RSFilterResponse *response = NULL;
+	RSFilterResponse *fr;
+	CacheEntry *entry;
+	PackedImage *packed = NULL;
+	CacheKey key;
+	guint generation;
+
+	if (cache->ignore_roi && rs_filter_request_get_roi(request))
 	{
-		roi = NULL;
 		rs_filter_request_set_roi(request, NULL);
 		filter_debug("Cache[%p]: Disabling ROI for upward calls", filter);
 	}
 
-	if (rs_filter_response_has_image8(cache->cached_image)) {
+	/* If our next filter takes float data, so do we */
+	if (!image8 && rs_filter_request_get_float_allowed(_request, filter))
+		rs_filter_request_set_float_producer(request, filter->previous);
 
-		if (rs_filter_response_get_quick(cache->cached_image) && !rs_filter_request_get_quick(request))
-		{
-			filter_debug("Cache[%p]: Cached image is quick and requested image is not!", filter);
-			flush(cache);
-		}
+	key_init(&key, filter, request, image8);
 
-		if (!rs_filter_response_get_roi(cache->cached_image) && roi)
-		{
-			set_roi_to_full(cache);
-		}
+	g_mutex_lock(cache->cache_mutex);
+	cache->upstream_hash = key.upstream_hash;
+	generation = cache->generation;
+	entry = lookup(cache, &key);
+	if (entry)
+	{
+		cache->hits++;
+		rs_memory_touch(entry->memory_id);
+		response = g_object_ref(entry->response);
+		if ((packed = entry->packed))
+			g_atomic_int_inc(&packed->refcount);
+	}
+	else
+		cache->misses++;
+	g_mutex_unlock(cache->cache_mutex);
 
-		if (!cache->ignore_roi && roi) 
-			if (rs_filter_response_get_roi(cache->cached_image)) 
-				if (!rectangle_is_inside(rs_filter_response_get_roi(cache->cached_image), roi))
-				{
-					filter_debug("Cache[%p]: Cached image ROI does not cover requested ROI!", filter);
-					flush(cache);
-				}
+	/* Unpack outside the lock, the entry may be evicted meanwhile */
+	if (packed)
+	{
+		RSFilterResponse *cached = response;
+		RS_IMAGE16 *image = unpack(packed);
+
+		response = rs_filter_response_clone(cached);
+		rs_filter_response_set_image(response, image);
+		if (image)
+			g_object_unref(image);
+		g_object_unref(cached);
+		packed_unref(packed);
+	}
 
-		if (!roi && rs_filter_response_get_roi(cache->cached_image))
-		{
-			filter_debug("Cache[%p]: Cached image has ROI, but request does not.", filter);
-			flush(cache);
-		}
+	/* Render without holding the lock, other threads may use what we have */
+	if (!response)
+	{
+		GTimer *timer = g_timer_new();
+
+		filter_debug("Cache[%p]: Cached image NOT found", filter);
 
-		RSColorSpace *cached_space = NULL;
-		if (cache->cached_image)
-			cached_space = rs_filter_param_get_object_with_type(RS_FILTER_PARAM(cache->cached_image), "colorspace", RS_TYPE_COLOR_SPACE);
+		if (image8)
+			response = rs_filter_get_image8(filter->previous, request);
+		else
+			response = rs_filter_get_image(filter->previous, request);
 
-		RSColorSpace *requested_space = rs_filter_param_get_object_with_type(RS_FILTER_PARAM(request), "colorspace", RS_TYPE_COLOR_SPACE);
+		if (key.roi_set)
+			rs_filter_response_set_roi(response, &key.roi);
+		else if (!image8)
+			set_roi_to_full(response);
+		else
+			rs_filter_response_set_roi(response, NULL);
 
-		if (cached_space && requested_space)
-			if (cached_space != requested_space)
-			{
-				filter_debug("Cache[%p]: Colorspace does not match Cached:%s vs Requested:%s.", filter, 
-										 rs_color_space_get_name(cached_space), rs_color_space_get_name(requested_space));
-				flush(cache);
-			}
+		if (key.quick)
+			rs_filter_response_set_quick(response);
+
+		/* Images from cancelled requests may be incomplete */
+		if (!rs_filter_request_is_cancelled(request))
+		{
+			g_mutex_lock(cache->cache_mutex);
+			/* If anything changed upstream while we rendered, the key may no
+			 * longer describe the image - pass it on, but don't keep it */
+			if (cache->generation == generation)
+				insert(cache, &key, response, g_timer_elapsed(timer, NULL));
+			else
+				filter_debug("Cache[%p]: Upstream changed while rendering, not cached", filter);
+			g_mutex_unlock(cache->cache_mutex);
+
+			/* Make room, this may evict from any cache including this one */
+			rs_memory_trim();
+		}
+		g_timer_destroy(timer);
 	}
 
-	if (!rs_filter_response_has_image8(cache->cached_image))
+	fr = rs_filter_response_clone(response);
+	if (image8)
+	{
+		GdkPixbuf* img = rs_filter_response_get_image8(response);
+		rs_filter_response_set_image8(fr, img);
+		if (img)
+			g_object_unref(img);
+	}
+	else
 	{
-		filter_debug("Cache[%p]: Cached image8 NOT found", filter);
-		g_object_unref(cache->cached_image);
-		cache->cached_image = rs_filter_get_image8(filter->previous, request);
-		rs_filter_response_set_roi(cache->cached_image, roi);
-		if (rs_filter_request_get_quick(request))
-			rs_filter_response_set_quick(cache->cached_image);
+		RS_IMAGE16* img = rs_filter_response_get_image(response);
+		RSImage *img_float = rs_filter_response_get_float_image(response);
+		rs_filter_response_set_image(fr, img);
+		rs_filter_response_set_float_image(fr, img_float);
+		if (img)
+			g_object_unref(img);
+		if (img_float)
+			g_object_unref(img_float);
 	}
 
-	RSFilterResponse *fr = rs_filter_response_clone(cache->cached_image);
-	GdkPixbuf* img = rs_filter_response_get_image8(cache->cached_image);
-	rs_filter_response_set_image8(fr, img);
-
-	if (img)
-		g_object_unref(img);
+	/* A complete image was used for a ROI request */
+	if (key.roi_set && !rs_filter_response_get_roi(fr))
+		set_roi_to_full(fr);
 
+	g_object_unref(response);
 	g_object_unref(request);
-	g_mutex_unlock(cache->cache_mutex);
 
 	return fr;
 }
 
+static RSFilterResponse *
+get_image(RSFilter *filter, const RSFilterRequest *request)
+{
+	filter_debug("Cache[%p]: getimage() called", filter);
+
+	return get_response(filter, request, FALSE);
+}
+
+static RSFilterResponse *
+get_image8(RSFilter *filter, const RSFilterRequest *request)
+{
+	filter_debug("Cache[%p]: getimage8() called", filter);
+
+	return get_response(filter, request, TRUE);
+}
 
 static void
 flush(RSCache *cache)
 {
+	CacheEntry *entry;
+
 	filter_debug("Cache[%p]: Cache flushed", cache);
-	g_object_unref(cache->cached_image);
-	cache->cached_image = rs_filter_response_new();
+	while ((entry = g_queue_pop_head(cache->entries)))
+		entry_free(entry);
+	cache->bytes_used = 0;
 }
 
 static void
 previous_changed(RSFilter *filter, RSFilter *parent, RSFilterChangedMask mask)
 {
 	RSCache *cache = RS_CACHE(filter);
+	guint upstream_hash;
 
 	filter_debug("Cache[%p]: Previous Changed (%x)", filter, mask);
+
+	upstream_hash = rs_filter_get_upstream_hash(filter->previous);
+
 	g_mutex_lock(cache->cache_mutex);
-	if (mask & RS_FILTER_CHANGED_PIXELDATA)
+	cache->generation++;
+	/* Entries are keyed by the upstream state, so they will simply not be
+	 * found while the state differs - and found again if we go back. If the
+	 * pixels changed without any visible change of state, we can't tell
+	 * what is still valid */
+	if ((mask & RS_FILTER_CHANGED_PIXELDATA) && upstream_hash == cache->upstream_hash)
 		flush(cache);
+	cache->upstream_hash = upstream_hash;
 	g_mutex_unlock(cache->cache_mutex);
 	rs_filter_changed(filter, mask);
 }
@@ -27,10 +27,11 @@
 
 struct _RSColorspaceTransform {
 	RSFilter parent;
-	gfloat premul[4];
-	gboolean has_premul;
 
+	/* The RSCmm keeps profiles, premul and ROI between calls, so only one
+	 * request at a time can use it */
 	RSCmm *cmm;
+	GMutex *cmm_lock;
 };
 
 struct _RSColorspaceTransformClass {
@@ -46,8 +47,9 @@ enum {
 
 static RSFilterResponse *get_image(RSFilter *filter, const RSFilterRequest *request);
 static RSFilterResponse *get_image8(RSFilter *filter, const RSFilterRequest *request);
-static gboolean convert_colorspace16(RSColorspaceTransform *colorspace_transform, RS_IMAGE16 *input_image, RS_IMAGE16 *output_image, RSColorSpace *input_space, RSColorSpace *output_space, GdkRectangle *_roi);
-static void convert_colorspace8(RSColorspaceTransform *colorspace_transform, RS_IMAGE16 *input_image, GdkPixbuf *output_image, RSColorSpace *input_space, RSColorSpace *output_space, GdkRectangle *roi);
+static gboolean convert_colorspace16(RSColorspaceTransform *colorspace_transform, RS_IMAGE16 *input_image, RS_IMAGE16 *output_image, RSColorSpace *input_space, RSColorSpace *output_space, const gfloat *premul, gboolean has_premul, GdkRectangle *_roi);
+static void convert_colorspace8(RSColorspaceTransform *colorspace_transform, RS_IMAGE16 *input_image, GdkPixbuf *output_image, RSColorSpace *input_space, RSColorSpace *output_space, const gfloat *premul, GdkRectangle *roi, GCancellable *cancellable);
+static void convert_colorspace8_float(RSColorspaceTransform *colorspace_transform, RSImage *input_image, GdkPixbuf *output_image, RSColorSpace *input_space, RSColorSpace *output_space, const gfloat *premul, GdkRectangle *roi, GCancellable *cancellable);
 
 static RSFilterClass *rs_colorspace_transform_parent_class = NULL;
 
@@ -61,6 +63,11 @@ extern void transform8_srgb_avx(ThreadInfo* t);
 extern void transform8_otherrgb_avx(ThreadInfo* t);
 extern gboolean cst_has_avx(void);
 
+/* AVX2 and FMA optimized functions */
+extern void transform8_srgb_avx2(ThreadInfo* t);
+extern void transform8_otherrgb_avx2(ThreadInfo* t);
+extern gboolean cst_has_avx2(void);
+
 G_MODULE_EXPORT void
 rs_plugin_load(RSPlugin *plugin)
 {
@@ -85,6 +92,7 @@ rs_colorspace_transform_init(RSColorspaceTransform *colorspace_transform)
 	/* FIXME: unref this at some point */
 	colorspace_transform->cmm = rs_cmm_new();
 	rs_cmm_set_num_threads(colorspace_transform->cmm, rs_get_number_of_processor_cores());
+	colorspace_transform->cmm_lock = g_mutex_new();
 }
 
 static RSFilterResponse *
@@ -96,10 +104,24 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	RS_IMAGE16 *input;
 	RS_IMAGE16 *output = NULL;
 	GdkRectangle *roi;
-	int i;
+	gboolean defer = FALSE;
+	gfloat premul[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+	gboolean has_premul = FALSE;
 
 	roi = rs_filter_request_get_roi(request);
-	previous_response = rs_filter_get_image(filter->previous, request);
+
+	/* The next filter can do the conversion while processing the image,
+	 * don't pass this on, it's not meant for filters before us */
+	if (rs_filter_param_get_boolean(RS_FILTER_PARAM(request), "defer-colorspace", &defer) && defer)
+	{
+		RSFilterRequest *request_clone = rs_filter_request_clone(request);
+		rs_filter_param_delete(RS_FILTER_PARAM(request_clone), "defer-colorspace");
+		previous_response = rs_filter_get_image(filter->previous, request_clone);
+		g_object_unref(request_clone);
+	}
+	else
+		previous_response = rs_filter_get_image(filter->previous, request);
+
 	input = rs_filter_response_get_image(previous_response);
 	if (!RS_IS_IMAGE16(input))
 		return previous_response;
@@ -107,8 +129,16 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	RSColorSpace *input_space = rs_filter_param_get_object_with_type(RS_FILTER_PARAM(previous_response), "colorspace", RS_TYPE_COLOR_SPACE);
 	RSColorSpace *output_space = rs_filter_param_get_object_with_type(RS_FILTER_PARAM(request), "colorspace", RS_TYPE_COLOR_SPACE);
 
-	for( i = 0; i < 4; i++)
-		colorspace_transform->premul[i] = 1.0f;
+	/* Leave matrix conversions to the next filter if it asked for it, it
+	 * will set "colorspace" in its response when done */
+	if (defer && input_space && output_space
+		&& !RS_COLOR_SPACE_REQUIRES_CMS(input_space) && !RS_COLOR_SPACE_REQUIRES_CMS(output_space))
+	{
+		g_object_unref(input_space);
+		g_object_unref(output_space);
+		g_object_unref(input);
+		return previous_response;
+	}
 
 	if (input_space && output_space && (input_space != output_space))
 	{
@@ -116,30 +146,36 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 		rs_filter_param_get_boolean(RS_FILTER_PARAM(previous_response), "is-premultiplied", &is_premultiplied);
 
 		if (!is_premultiplied)
-			colorspace_transform->has_premul = rs_filter_param_get_float4(RS_FILTER_PARAM(request), "premul", colorspace_transform->premul);
-		rs_cmm_set_premul(colorspace_transform->cmm, colorspace_transform->premul);
+			has_premul = rs_filter_param_get_float4(RS_FILTER_PARAM(request), "premul", premul);
+
+		/* Let go of the previous response, so we can tell if we're the only
+		 * user of the input */
+		response = rs_filter_response_clone(previous_response);
+		g_object_unref(previous_response);
 
-		output = rs_image16_copy(input, FALSE);
+		/* Matrix conversions can be done in place if nobody else uses the input */
+		if (!RS_COLOR_SPACE_REQUIRES_CMS(input_space) && !RS_COLOR_SPACE_REQUIRES_CMS(output_space)
+			&& rs_image16_is_exclusive(input))
+			output = g_object_ref(input);
+		else
+			output = rs_image16_copy(input, FALSE);
 
-		if (convert_colorspace16(colorspace_transform, input, output, input_space, output_space, roi))
+		if (convert_colorspace16(colorspace_transform, input, output, input_space, output_space, premul, has_premul, roi))
 		{
 			/* Image was converted */
-			response = rs_filter_response_clone(previous_response);
-			g_object_unref(previous_response);
-			if (colorspace_transform->has_premul)
+			if (has_premul)
 				rs_filter_param_set_boolean(RS_FILTER_PARAM(response), "is-premultiplied", TRUE);
 			rs_filter_param_set_object(RS_FILTER_PARAM(response), "colorspace", output_space);
 			rs_filter_response_set_image(response, output);
-			g_object_unref(output);
-			g_object_unref(input);
-			return response;
-		} else
+		}
+		else
 		{
 			/* No conversion was needed */
-			g_object_unref(input);
-			g_object_unref(output);
-			return previous_response;
+			rs_filter_response_set_image(response, input);
 		}
+		g_object_unref(output);
+		g_object_unref(input);
+		return response;
 	}
 	else
 	{
@@ -153,36 +189,51 @@ static RSFilterResponse *
 get_image8(RSFilter *filter, const RSFilterRequest *request)
 {
 	RSColorspaceTransform *colorspace_transform = RS_COLORSPACE_TRANSFORM(filter);
+	RSFilterRequest *request_clone;
 	RSFilterResponse *previous_response;
 	RSFilterResponse *response;
 	RS_IMAGE16 *input;
+	RSImage *input_float;
 	GdkPixbuf *output = NULL;
 	GdkRectangle *roi;
-	int i;
+	gfloat premul[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+	gboolean has_premul = FALSE;
+
+	/* We can convert float planar data directly, saving the previous filter
+	 * from converting it to 16 bit */
+	request_clone = rs_filter_request_clone(request);
+	rs_filter_request_set_float_producer(request_clone, filter->previous);
+	previous_response = rs_filter_get_image(filter->previous, request_clone);
+	g_object_unref(request_clone);
 
-	previous_response = rs_filter_get_image(filter->previous, request);
 	input = rs_filter_response_get_image(previous_response);
-	if (!RS_IS_IMAGE16(input))
+	input_float = rs_filter_response_get_float_image(previous_response);
+	if (!RS_IS_IMAGE16(input) && !RS_IS_IMAGE(input_float))
 		return previous_response;
 
 	roi = rs_filter_request_get_roi(request);
 	RSColorSpace *input_space = rs_filter_param_get_object_with_type(RS_FILTER_PARAM(previous_response), "colorspace", RS_TYPE_COLOR_SPACE);
 	RSColorSpace *output_space = rs_filter_param_get_object_with_type(RS_FILTER_PARAM(request), "colorspace", RS_TYPE_COLOR_SPACE);
 
+	/* Only the matrix path handles float data */
+	if (input_float && (input || RS_COLOR_SPACE_REQUIRES_CMS(input_space) || RS_COLOR_SPACE_REQUIRES_CMS(output_space)))
+	{
+		if (!input)
+			input = rs_image_to_image16(input_float);
+		g_object_unref(input_float);
+		input_float = NULL;
+	}
+
 	response = rs_filter_response_clone(previous_response);
 	g_object_unref(previous_response);
 
-	for( i = 0; i < 4; i++)
-		colorspace_transform->premul[i] = 1.0f;
-
 	gboolean is_premultiplied = FALSE;
 	rs_filter_param_get_boolean(RS_FILTER_PARAM(response), "is-premultiplied", &is_premultiplied);
 
 	if (!is_premultiplied)
-		if ((colorspace_transform->has_premul = rs_filter_param_get_float4(RS_FILTER_PARAM(request), "premul", colorspace_transform->premul)))
-			rs_cmm_set_premul(colorspace_transform->cmm, colorspace_transform->premul);
+		has_premul = rs_filter_param_get_float4(RS_FILTER_PARAM(request), "premul", premul);
 
-	if (colorspace_transform->has_premul)
+	if (has_premul)
 		rs_filter_param_set_boolean(RS_FILTER_PARAM(response), "is-premultiplied", TRUE);
 
 #if 0
@@ -190,15 +241,23 @@ get_image8(RSFilter *filter, const RSFilterRequest *request)
 	printf("\033[33m8 output_space: %s\n\033[0m", (output_space) ? G_OBJECT_TYPE_NAME(output_space) : "none");
 #endif
 
-	output = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, input->w, input->h);
-
 	/* Process output */
-	convert_colorspace8(colorspace_transform, input, output, input_space, output_space, roi);
+	if (input_float)
+	{
+		output = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, rs_image_get_width(input_float), rs_image_get_height(input_float));
+		convert_colorspace8_float(colorspace_transform, input_float, output, input_space, output_space, premul, roi, rs_filter_request_get_cancellable(request));
+		g_object_unref(input_float);
+	}
+	else
+	{
+		output = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, input->w, input->h);
+		convert_colorspace8(colorspace_transform, input, output, input_space, output_space, premul, roi, rs_filter_request_get_cancellable(request));
+		g_object_unref(input);
+	}
 
 	rs_filter_response_set_image8(response, output);
 	rs_filter_param_set_object(RS_FILTER_PARAM(response), "colorspace", output_space);
 	g_object_unref(output);
-	g_object_unref(input);
 	return response;
 }
 
@@ -300,7 +359,7 @@ transform16_c(gushort* __restrict input, gushort* __restrict output, gint num_pi
 }
 
 static gboolean
-convert_colorspace16(RSColorspaceTransform *colorspace_transform, RS_IMAGE16 *input_image, RS_IMAGE16 *output_image, RSColorSpace *input_space, RSColorSpace *output_space, GdkRectangle *_roi)
+convert_colorspace16(RSColorspaceTransform *colorspace_transform, RS_IMAGE16 *input_image, RS_IMAGE16 *output_image, RSColorSpace *input_space, RSColorSpace *output_space, const gfloat *premul, gboolean has_premul, GdkRectangle *_roi)
 {
 	g_assert(RS_IS_IMAGE16(input_image));
 	g_assert(RS_IS_IMAGE16(output_image));
@@ -308,7 +367,7 @@ convert_colorspace16(RSColorspaceTransform *colorspace_transform, RS_IMAGE16 *in
 	g_assert(RS_IS_COLOR_SPACE(output_space));
 
 	/* If input/output-image doesn't differ, return no transformation needed */
-	if (input_space == output_space && !colorspace_transform->has_premul)
+	if (input_space == output_space && !has_premul)
 		return FALSE;
 
 	GdkRectangle *roi = _roi;
@@ -333,17 +392,20 @@ convert_colorspace16(RSColorspaceTransform *colorspace_transform, RS_IMAGE16 *in
 		i = rs_color_space_get_icc_profile(input_space, TRUE);
 		o = rs_color_space_get_icc_profile(output_space, TRUE);
 
+		g_mutex_lock(colorspace_transform->cmm_lock);
+		rs_cmm_set_premul(colorspace_transform->cmm, premul);
 		rs_cmm_set_input_profile(colorspace_transform->cmm, i);
 		rs_cmm_set_output_profile(colorspace_transform->cmm, o);
 
 		rs_cmm_set_roi(colorspace_transform->cmm, roi);
 		rs_cmm_transform(colorspace_transform->cmm, input_image, output_image, TRUE);
+		g_mutex_unlock(colorspace_transform->cmm_lock);
 	}
 
 	/* If we get here, we can transform using simple vector math */
 	else
 	{
-		RS_VECTOR3 vec = {{colorspace_transform->premul[0]},{colorspace_transform->premul[1]},{colorspace_transform->premul[2]}};
+		RS_VECTOR3 vec = {{premul[0]},{premul[1]},{premul[2]}};
 		const RS_MATRIX3 mul_vec = vector3_as_diagonal(&vec);
 		const RS_MATRIX3 a = rs_color_space_get_matrix_from_pcs(input_space);
 		RS_MATRIX3 a_premul;
@@ -352,20 +414,26 @@ convert_colorspace16(RSColorspaceTransform *colorspace_transform, RS_IMAGE16 *in
 		RS_MATRIX3 mat;
 		matrix3_multiply(&b, &a_premul, &mat);
 
-		transform16_c(
-			GET_PIXEL(input_image, 0, 0),
-			GET_PIXEL(output_image, 0, 0),
-			input_image->h * input_image->pitch,
-			input_image->pixelsize,
-			&mat);
+		/* Only transform the region of interest, the rest of the image is undefined */
+		gint row;
+		for(row = roi->y; row < roi->y + roi->height; row++)
+			transform16_c(
+				GET_PIXEL(input_image, roi->x, row),
+				GET_PIXEL(output_image, roi->x, row),
+				roi->width,
+				input_image->pixelsize,
+				&mat);
 	}
+
+	if (!_roi)
+		g_free(roi);
+
 	return TRUE;
 }
 
-gpointer
-start_single_cs8_transform_thread(gpointer _thread_info)
+static void
+transform8_rows(ThreadInfo* t)
 {
-	ThreadInfo* t = _thread_info;
 	RS_IMAGE16 *input_image = t->input; 
 	GdkPixbuf *output = (GdkPixbuf*) t->output;
 	RSColorSpace *input_space = t->input_space;
@@ -376,50 +444,104 @@ start_single_cs8_transform_thread(gpointer _thread_info)
 	g_assert(RS_IS_COLOR_SPACE(input_space));
 	g_assert(RS_IS_COLOR_SPACE(output_space));
 
-	gboolean avx_available = (!!(rs_detect_cpu_features() & RS_CPU_FLAG_AVX)) && cst_has_avx();
-	gboolean sse2_available = (!!(rs_detect_cpu_features() & RS_CPU_FLAG_SSE2)) && cst_has_sse2();
+	const RSCpuLevel level = rs_cpu_get_level();
+	gboolean avx2_available = level >= RS_CPU_LEVEL_AVX2 && cst_has_avx2();
+	gboolean avx_available = level >= RS_CPU_LEVEL_AVX && cst_has_avx();
+	gboolean sse2_available = level >= RS_CPU_LEVEL_SSE2 && cst_has_sse2();
+
+	if (avx2_available && rs_color_space_new_singleton("RSSrgb") == output_space)
+	{
+		transform8_srgb_avx2(t);
+		return;
+	}
+	if (avx2_available && rs_color_space_new_singleton("RSAdobeRGB") == output_space)
+	{
+		t->output_gamma = 1.0 / 2.19921875;
+		transform8_otherrgb_avx2(t);
+		return;
+	}
+	if (avx2_available && rs_color_space_new_singleton("RSProphoto") == output_space)
+	{
+		t->output_gamma = 1.0 / 1.8;
+		transform8_otherrgb_avx2(t);
+		return;
+	}
 
 	if (avx_available && rs_color_space_new_singleton("RSSrgb") == output_space)
 	{
 		transform8_srgb_avx(t);
-		return (NULL);
+		return;
 	}
 	if (avx_available && rs_color_space_new_singleton("RSAdobeRGB") == output_space)
 	{
 		t->output_gamma = 1.0 / 2.19921875;
 		transform8_otherrgb_avx(t);
-		return (NULL);
+		return;
 	}
 	if (avx_available && rs_color_space_new_singleton("RSProphoto") == output_space)
 	{
 		t->output_gamma = 1.0 / 1.8;
 		transform8_otherrgb_avx(t);
-		return (NULL);
+		return;
 	}
 
 	if (sse2_available && rs_color_space_new_singleton("RSSrgb") == output_space)
 	{
 		transform8_srgb_sse2(t);
-		return (NULL);
+		return;
 	}
 	if (sse2_available && rs_color_space_new_singleton("RSAdobeRGB") == output_space)
 	{
 		t->output_gamma = 1.0 / 2.19921875;
 		transform8_otherrgb_sse2(t);
-		return (NULL);
+		return;
 	}
 	if (sse2_available && rs_color_space_new_singleton("RSProphoto") == output_space)
 	{
 		t->output_gamma = 1.0 / 1.8;
 		transform8_otherrgb_sse2(t);
-		return (NULL);
+		return;
 	}
 	
 	/* Fall back to C-functions */
-	/* Calculate our gamma table */
+	g_assert(t->table8 != NULL);
+	transform8_c(t);
+}
+
+static void
+transform8_part(gint start_y, gint end_y, gpointer _thread_info)
+{
+	ThreadInfo t = *(ThreadInfo *) _thread_info;
+
+	t.start_y = start_y;
+	t.end_y = end_y;
+
+	transform8_rows(&t);
+}
+
+/* Returns TRUE if transform8_rows() will use SIMD code that doesn't need a lookup table */
+static gboolean
+transform8_has_simd(RSColorSpace *output_space)
+{
+	const RSCpuLevel level = rs_cpu_get_level();
+	gboolean avx_available = level >= RS_CPU_LEVEL_AVX && cst_has_avx();
+	gboolean sse2_available = level >= RS_CPU_LEVEL_SSE2 && cst_has_sse2();
+
+	/* AVX2 builds and cpus always have AVX too */
+	if (!avx_available && !sse2_available)
+		return FALSE;
+
+	return (rs_color_space_new_singleton("RSSrgb") == output_space
+		|| rs_color_space_new_singleton("RSAdobeRGB") == output_space
+		|| rs_color_space_new_singleton("RSProphoto") == output_space);
+}
+
+/* Calculate our gamma table */
+static void
+transform8_calc_table(guchar *table8, RSColorSpace *input_space, RSColorSpace *output_space)
+{
 	const RS1dFunction *input_gamma = rs_color_space_get_gamma_function(input_space);
 	const RS1dFunction *output_gamma = rs_color_space_get_gamma_function(output_space);
-	guchar table8[65536];
 	gint i;
 	for(i=0;i<65536;i++)
 	{
@@ -433,13 +555,10 @@ start_single_cs8_transform_thread(gpointer _thread_info)
 		_CLAMP255(res);
 		table8[i] = res;
 	}
-	t->table8 = table8;
-	transform8_c(t);
-	return (NULL);
 }
 
 static void
-convert_colorspace8(RSColorspaceTransform *colorspace_transform, RS_IMAGE16 *input_image, GdkPixbuf *output_image, RSColorSpace *input_space, RSColorSpace *output_space, GdkRectangle *_roi)
+convert_colorspace8(RSColorspaceTransform *colorspace_transform, RS_IMAGE16 *input_image, GdkPixbuf *output_image, RSColorSpace *input_space, RSColorSpace *output_space, const gfloat *premul, GdkRectangle *_roi, GCancellable *cancellable)
 {
 	g_assert(RS_IS_IMAGE16(input_image));
 	g_assert(GDK_IS_PIXBUF(output_image));
@@ -468,17 +587,20 @@ convert_colorspace8(RSColorspaceTransform *colorspace_transform, RS_IMAGE16 *inp
 		i = rs_color_space_get_icc_profile(input_space, TRUE);
 		o = rs_color_space_get_icc_profile(output_space, FALSE);
 
+		g_mutex_lock(colorspace_transform->cmm_lock);
+		rs_cmm_set_premul(colorspace_transform->cmm, premul);
 		rs_cmm_set_input_profile(colorspace_transform->cmm, i);
 		rs_cmm_set_output_profile(colorspace_transform->cmm, o);
 
 		rs_cmm_set_roi(colorspace_transform->cmm, roi);
 		rs_cmm_transform(colorspace_transform->cmm, input_image, output_image, FALSE);
+		g_mutex_unlock(colorspace_transform->cmm_lock);
 	}
 
 	/* If we get here, we can transform using simple vector math and a lookup table */
 	else
 	{
-		const RS_VECTOR3 vec = {{colorspace_transform->premul[0]},{colorspace_transform->premul[1]},{colorspace_transform->premul[2]}};
+		const RS_VECTOR3 vec = {{premul[0]},{premul[1]},{premul[2]}};
 		const RS_MATRIX3 mul_vec = vector3_as_diagonal(&vec);
 		const RS_MATRIX3 a = rs_color_space_get_matrix_from_pcs(input_space);
 		RS_MATRIX3 a_premul;
@@ -488,47 +610,116 @@ convert_colorspace8(RSColorspaceTransform *colorspace_transform, RS_IMAGE16 *inp
 		matrix3_multiply(&b, &a_premul, &mat);
 
 
-		gint i;
-		guint y_offset, y_per_thread, threaded_h;
-		guint threads = rs_get_number_of_processor_cores();
-		if (roi->height * roi->width < 200*200)
-			threads = 1;
-		
-		ThreadInfo *t = g_new(ThreadInfo, threads);
-
-		threaded_h = roi->height;
-		y_per_thread = (threaded_h + threads-1)/threads;
-		y_offset = roi->y;
-
-		for (i = 0; i < threads; i++)
+		ThreadInfo t;
+		t.input = input_image;
+		t.input_float = NULL;
+		t.output = output_image;
+		t.start_x = roi->x;
+		t.end_x = roi->x + roi->width;
+		t.cst = colorspace_transform;
+		t.input_space = input_space;
+		t.output_space = output_space;
+		t.matrix = &mat;
+		t.table8 = NULL;
+
+		/* The table is shared by all parts, so calculate it only once */
+		if (!transform8_has_simd(output_space))
 		{
-			t[i].input = input_image;
-			t[i].output = output_image;
-			t[i].start_y = y_offset;
-			t[i].start_x = roi->x;
-			t[i].end_x = roi->x + roi->width;
-			t[i].cst = colorspace_transform;
-			t[i].input_space = input_space;
-			t[i].output_space = output_space;
-			y_offset += y_per_thread;
-			y_offset = MIN(input_image->h, y_offset);
-			t[i].end_y = y_offset;
-			t[i].matrix = &mat;
-			t[i].table8 = NULL;
-			t[i].single_thread = (threads == 1);
-			if (threads == 1)
-				start_single_cs8_transform_thread(&t[0]);
-			else
-				t[i].threadid = g_thread_create(start_single_cs8_transform_thread, &t[i], TRUE, NULL);
+			t.table8 = g_new(guchar, 65536);
+			transform8_calc_table(t.table8, input_space, output_space);
 		}
 
-		/* Wait for threads to finish */
-		for(i = 0; threads > 1 && i < threads; i++)
-			g_thread_join(t[i].threadid);
+		/* Small images are not worth splitting */
+		rs_parallel_for_cancellable(roi->y, MIN(input_image->h, roi->y + roi->height),
+			(roi->height * roi->width < 200*200) ? roi->height : 0, transform8_part, &t, cancellable);
 
-		g_free(t);
+		g_free(t.table8);
 	}
 	/* If we created the ROI here, free it */
 	if (!_roi) 
 		g_free(roi);
 }
+
+/* Planar input is easily vectorized by the compiler, no need for SIMD versions */
+static void
+transform8_float_part(gint start_y, gint end_y, gpointer _thread_info)
+{
+	ThreadInfo *t = _thread_info;
+	RSImage *input = t->input_float;
+	GdkPixbuf *output = (GdkPixbuf *)t->output;
+	const guchar *table8 = t->table8;
+	const gint w = rs_image_get_width(input);
+	const gint o_channels = gdk_pixbuf_get_n_channels(output);
+	const RS_MATRIX3 *mat = t->matrix;
+	gint row, x;
+
+	for(row = start_y; row < end_y; row++)
+	{
+		const gfloat *in_r = rs_image_get_plane(input, 0) + row * w;
+		const gfloat *in_g = rs_image_get_plane(input, 1) + row * w;
+		const gfloat *in_b = rs_image_get_plane(input, 2) + row * w;
+		guchar *o = GET_PIXBUF_PIXEL(output, t->start_x, row);
+
+		for(x = t->start_x; x < t->end_x; x++)
+		{
+			gfloat r = in_r[x] * mat->coeff[0][0] + in_g[x] * mat->coeff[0][1] + in_b[x] * mat->coeff[0][2];
+			gfloat g = in_r[x] * mat->coeff[1][0] + in_g[x] * mat->coeff[1][1] + in_b[x] * mat->coeff[1][2];
+			gfloat b = in_r[x] * mat->coeff[2][0] + in_g[x] * mat->coeff[2][1] + in_b[x] * mat->coeff[2][2];
+
+			r = CLAMP(r, 0.0f, 1.0f);
+			g = CLAMP(g, 0.0f, 1.0f);
+			b = CLAMP(b, 0.0f, 1.0f);
+
+			o[R] = table8[(gint) (r * 65535.0f + 0.5f)];
+			o[G] = table8[(gint) (g * 65535.0f + 0.5f)];
+			o[B] = table8[(gint) (b * 65535.0f + 0.5f)];
+			o[3] = 255;
+
+			o += o_channels;
+		}
+	}
+}
+
+static void
+convert_colorspace8_float(RSColorspaceTransform *colorspace_transform, RSImage *input_image, GdkPixbuf *output_image, RSColorSpace *input_space, RSColorSpace *output_space, const gfloat *premul, GdkRectangle *_roi, GCancellable *cancellable)
+{
+	g_assert(RS_IS_IMAGE(input_image));
+	g_assert(GDK_IS_PIXBUF(output_image));
+	g_assert(RS_IS_COLOR_SPACE(input_space));
+	g_assert(RS_IS_COLOR_SPACE(output_space));
+	g_assert(rs_image_get_number_of_planes(input_image) >= 3);
+
+	const gint width = rs_image_get_width(input_image);
+	const gint height = rs_image_get_height(input_image);
+	GdkRectangle roi = {0, 0, width, height};
+	if (_roi)
+		roi = *_roi;
+
+	const RS_VECTOR3 vec = {{premul[0]},{premul[1]},{premul[2]}};
+	const RS_MATRIX3 mul_vec = vector3_as_diagonal(&vec);
+	const RS_MATRIX3 a = rs_color_space_get_matrix_from_pcs(input_space);
+	RS_MATRIX3 a_premul;
+	matrix3_multiply(&a, &mul_vec, &a_premul);
+	const RS_MATRIX3 b = rs_color_space_get_matrix_to_pcs(output_space);
+	RS_MATRIX3 mat;
+	matrix3_multiply(&b, &a_premul, &mat);
+
+	ThreadInfo t;
+	t.input = NULL;
+	t.input_float = input_image;
+	t.output = output_image;
+	t.start_x = roi.x;
+	t.end_x = MIN(width, roi.x + roi.width);
+	t.cst = colorspace_transform;
+	t.input_space = input_space;
+	t.output_space = output_space;
+	t.matrix = &mat;
+	t.table8 = g_new(guchar, 65536);
+	transform8_calc_table(t.table8, input_space, output_space);
+
+	/* Small images are not worth splitting */
+	rs_parallel_for_cancellable(roi.y, MIN(height, roi.y + roi.height),
+		(roi.height * roi.width < 200*200) ? roi.height : 0, transform8_float_part, &t, cancellable);
+
+	g_free(t.table8);
+}
@@ -33,12 +33,12 @@ typedef struct _RSColorspaceTransformClass RSColorspaceTransformClass;
 
 typedef struct {
 	RSColorspaceTransform *cst;
-	GThread *threadid;
 	gint start_x;
 	gint start_y;
 	gint end_x;
 	gint end_y;
 	RS_IMAGE16 *input;
+	RSImage *input_float;
 	void *output;
 	RSColorSpace *input_space;
 	RSColorSpace *output_space;
@@ -46,12 +46,6 @@ typedef struct {
 	gboolean gamma_correct;
 	guchar* table8;
 	gfloat output_gamma;
-	GCond* run_transform;
-	GMutex* run_transform_mutex;
-	GCond* transform_finished;
-	GMutex* transform_finished_mutex;
-	gboolean do_run_transform;
-	gboolean single_thread;
 } ThreadInfo;
 
 /* SSE2 optimized functions */
@@ -63,3 +57,8 @@ gboolean cst_has_sse2(void);
 void transform8_srgb_avx(ThreadInfo* t);
 void transform8_otherrgb_avx(ThreadInfo* t);
 gboolean cst_has_avx(void);
+
+/* AVX2 and FMA optimized functions */
+void transform8_srgb_avx2(ThreadInfo* t);
+void transform8_otherrgb_avx2(ThreadInfo* t);
+gboolean cst_has_avx2(void);
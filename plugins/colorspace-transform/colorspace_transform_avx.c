@@ -28,17 +28,24 @@
 
 #include <emmintrin.h>
 
+/* colorspace_transform_avx2.c builds this file with FMA enabled */
+#if defined(__FMA__)
+#include <immintrin.h>
+#define MADD_PS(a, b, c) _mm_fmadd_ps(a, b, c)
+#else
+#define MADD_PS(a, b, c) _mm_add_ps(_mm_mul_ps(a, b), c)
+#endif
 
 /* AVX Polynomial pow function from Mesa3d (MIT License) */
 
 #define EXP_POLY_DEGREE 2
 
 #define POLY0(x, c0) _mm_load_ps(c0)
-#define POLY1(x, c0, c1) _mm_add_ps(_mm_mul_ps(POLY0(x, c1), x), _mm_load_ps(c0))
-#define POLY2(x, c0, c1, c2) _mm_add_ps(_mm_mul_ps(POLY1(x, c1, c2), x), _mm_load_ps(c0))
-#define POLY3(x, c0, c1, c2, c3) _mm_add_ps(_mm_mul_ps(POLY2(x, c1, c2, c3), x), _mm_load_ps(c0))
-#define POLY4(x, c0, c1, c2, c3, c4) _mm_add_ps(_mm_mul_ps(POLY3(x, c1, c2, c3, c4), x), _mm_load_ps(c0))
-#define POLY5(x, c0, c1, c2, c3, c4, c5) _mm_add_ps(_mm_mul_ps(POLY4(x, c1, c2, c3, c4, c5), x), _mm_load_ps(c0))
+#define POLY1(x, c0, c1) MADD_PS(POLY0(x, c1), x, _mm_load_ps(c0))
+#define POLY2(x, c0, c1, c2) MADD_PS(POLY1(x, c1, c2), x, _mm_load_ps(c0))
+#define POLY3(x, c0, c1, c2, c3) MADD_PS(POLY2(x, c1, c2, c3), x, _mm_load_ps(c0))
+#define POLY4(x, c0, c1, c2, c3, c4) MADD_PS(POLY3(x, c1, c2, c3, c4), x, _mm_load_ps(c0))
+#define POLY5(x, c0, c1, c2, c3, c4, c5) MADD_PS(POLY4(x, c1, c2, c3, c4, c5), x, _mm_load_ps(c0))
 
 static const gfloat exp_p5_0[4] __attribute__ ((aligned (16))) = {9.9999994e-1f, 9.9999994e-1f, 9.9999994e-1f, 9.9999994e-1f};
 static const gfloat exp_p5_1[4] __attribute__ ((aligned (16))) = {6.9315308e-1f, 6.9315308e-1f, 6.9315308e-1f, 6.9315308e-1f};
@@ -176,10 +183,10 @@ sse_matrix3_mul(float* mul, __m128 a, __m128 b, __m128 c)
 	__m128 acc = _mm_mul_ps(a, v);
 
 	v = _mm_load_ps(mul+4);
-	acc = _mm_add_ps(acc, _mm_mul_ps(b, v));
+	acc = MADD_PS(b, v, acc);
 
 	v = _mm_load_ps(mul+8);
-	acc = _mm_add_ps(acc, _mm_mul_ps(c, v));
+	acc = MADD_PS(c, v, acc);
 
 	return acc;
 }
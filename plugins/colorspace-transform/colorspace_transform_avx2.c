@@ -0,0 +1,60 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>, 
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+/* Plugin tmpl version 5 */
+
+#if defined(__AVX2__) && defined(__FMA__)
+
+/* The AVX transforms compiled for AVX2 with fused multiply-add in the
+ * polynomials and matrix, colorspace_transform_avx.c includes our headers */
+#define transform8_srgb_avx transform8_srgb_avx2
+#define transform8_otherrgb_avx transform8_otherrgb_avx2
+#define cst_has_avx cst_has_avx2
+#include "colorspace_transform_avx.c"
+
+#else // !defined __AVX2__ || !defined __FMA__
+
+#include <rawstudio.h>
+#include <lcms.h>
+#include "rs-cmm.h"
+#include "colorspace_transform.h"
+
+/* Provide empty functions if not AVX2 compiled to avoid linker errors */
+
+void
+transform8_srgb_avx2(ThreadInfo* t)
+{
+	/* We should never even get here */
+	g_assert(FALSE);
+}
+
+void
+transform8_otherrgb_avx2(ThreadInfo* t)
+{
+	/* We should never even get here */
+	g_assert(FALSE);
+}
+
+gboolean cst_has_avx2() 
+{
+	return FALSE;
+}
+
+#endif
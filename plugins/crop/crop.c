@@ -344,11 +344,11 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 		return previous_response;
 
 	response = rs_filter_response_clone(previous_response);
-	gboolean half_size = FALSE;
-	rs_filter_param_get_boolean(RS_FILTER_PARAM(previous_response), "half-size", &half_size);
+	/* The demosaic filter may have binned the image to 1/2, 1/4 or 1/8 size */
+	gint shift = 0;
+	rs_filter_param_get_integer(RS_FILTER_PARAM(previous_response), "downscale-shift", &shift);
 	g_object_unref(previous_response);
 
-	int shift = half_size ? 1 : 0;
 	output = rs_image16_new(crop->width>>shift, crop->height>>shift, 3, input->pixelsize);
 	rs_filter_response_set_image(response, output);
 	g_object_unref(output);
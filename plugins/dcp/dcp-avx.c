@@ -24,6 +24,14 @@
 #include <smmintrin.h>
 #include <math.h> /* powf() */
 
+/* dcp-avx2.c builds this file with FMA enabled */
+#if defined(__FMA__)
+#include <immintrin.h>
+#define MADD_PS(a, b, c) _mm_fmadd_ps(a, b, c)
+#else
+#define MADD_PS(a, b, c) _mm_add_ps(_mm_mul_ps(a, b), c)
+#endif
+
 #pragma GCC diagnostic ignored "-Wstrict-aliasing"
 /* We ignore this pragma, because we are casting a pointer from float to int to pass a float using */
 /* _mm_insert_epi32, since no-one was kind enough to include "insertps xmm, mem32, imm8" */
@@ -503,7 +511,7 @@ curve_interpolate_lookup(__m128 value, const gfloat * const tone_lut)
 	/* Pack all lower values in v0, high in v1 and interpolate */
 	__m128 v0 = _mm_shuffle_ps(p0p1, p2p3, _MM_SHUFFLE(2,0,2,0));
 	__m128 v1 = _mm_shuffle_ps(p0p1, p2p3, _MM_SHUFFLE(3,1,3,1));
-	return _mm_add_ps(_mm_mul_ps(inv_frac, v0), _mm_mul_ps(frac, v1));
+	return MADD_PS(inv_frac, v0, _mm_mul_ps(frac, v1));
 }
 
 static inline void 
@@ -553,7 +561,7 @@ rgb_tone_sse2(__m128* _r, __m128* _g, __m128* _b, const gfloat * const tone_lut)
 	__m128 p = _mm_rcp_ps(_mm_sub_ps(lg, sm));
 	__m128 q = _mm_sub_ps(md, sm);
 	__m128 o = _mm_sub_ps(LG, SM);
-	__m128 MD = _mm_add_ps(SM, _mm_mul_ps(o, _mm_mul_ps(p, q)));
+	__m128 MD = MADD_PS(o, _mm_mul_ps(p, q), SM);
 
 	/* Inserted here again, to lighten register presssure */
 	is_r_lg = _mm_cmpeq_epi32(DW(r), DW(lg));
@@ -592,10 +600,10 @@ sse_matrix3_mul(float* mul, __m128 a, __m128 b, __m128 c)
 	__m128 acc = _mm_mul_ps(a, v);
 
 	v = _mm_load_ps(mul+4);
-	acc = _mm_add_ps(acc, _mm_mul_ps(b, v));
+	acc = MADD_PS(b, v, acc);
 
 	v = _mm_load_ps(mul+8);
-	acc = _mm_add_ps(acc, _mm_mul_ps(c, v));
+	acc = MADD_PS(c, v, acc);
 
 	return acc;
 }
@@ -0,0 +1,38 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+ 
+
+#include "dcp.h"
+
+#if defined(__AVX2__) && defined(__FMA__)
+
+/* The AVX renderer compiled for AVX2, with fused multiply-add in the tone
+ * curve and matrix code */
+#define render_AVX render_AVX2
+#include "dcp-avx.c"
+
+#else // if not __AVX2__ and __FMA__
+
+gboolean
+render_AVX2(ThreadInfo* t)
+{
+	return FALSE;
+}
+
+#endif
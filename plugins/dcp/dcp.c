@@ -51,7 +51,6 @@ static void read_profile(RSDcp *dcp, RSDcpFile *dcp_file);
 static void free_dcp_profile(RSDcp *dcp);
 static void set_prophoto_wb(RSDcp *dcp, gfloat warmth, gfloat tint);
 static void calculate_huesat_maps(RSDcp *dcp, gfloat temp);
-static GStaticRecMutex dcp_mutex = G_STATIC_REC_MUTEX_INIT;
 
 G_MODULE_EXPORT void
 rs_plugin_load(RSPlugin *plugin)
@@ -79,6 +78,10 @@ finalize(GObject *object)
 	dcp->settings_signal_id = 0;
 	dcp->settings = NULL;
 	dcp->read_out_curve = NULL;
+	if (dcp->profile)
+		g_object_unref(dcp->profile);
+	dcp->profile = NULL;
+	g_static_rec_mutex_free(&dcp->lock);
 }
 
 static void
@@ -124,6 +127,8 @@ settings_changed(RSSettings *settings, RSSettingsMask mask, RSDcp *dcp)
 {
 	gboolean changed = FALSE;
 
+	g_static_rec_mutex_lock(&dcp->lock);
+
 	if (mask & MASK_EXPOSURE)
 	{
 		g_object_get(settings, "exposure", &dcp->exposure, NULL);
@@ -208,12 +213,18 @@ settings_changed(RSSettings *settings, RSSettingsMask mask, RSDcp *dcp)
 			}
 			dcp->warmth = CLAMP(dcp->warmth, 2000, 12000);
 			dcp->tint = CLAMP(dcp->tint, -150, 150);
+
+			/* Don't hold the lock while others are notified */
+			gfloat warmth = dcp->warmth;
+			gfloat tint = dcp->tint;
+			g_static_rec_mutex_unlock(&dcp->lock);
 			g_object_set(settings,
-				"dcp-temp", dcp->warmth,
-				"dcp-tint", dcp->tint,
+				"dcp-temp", warmth,
+				"dcp-tint", tint,
 				"recalc-temp", FALSE,
 				NULL);
 			g_signal_emit_by_name(settings, "wb-recalculated");
+			g_static_rec_mutex_lock(&dcp->lock);
 		}
 		if (dcp->use_profile)
 		{
@@ -289,6 +300,8 @@ settings_changed(RSSettings *settings, RSSettingsMask mask, RSDcp *dcp)
 		changed = TRUE;
 	}
 
+	g_static_rec_mutex_unlock(&dcp->lock);
+
 	if (changed)
 	{
 		rs_filter_changed(RS_FILTER(dcp), RS_FILTER_CHANGED_PIXELDATA);
@@ -340,11 +353,13 @@ static void
 rs_dcp_init(RSDcp *dcp)
 {
 	RSDcpClass *klass = RS_DCP_GET_CLASS(dcp);
+	g_static_rec_mutex_init(&dcp->lock);
 	g_assert(0 == posix_memalign((void**)&dcp->curve_samples, 16, sizeof(gfloat)*2*257));
 	dcp->huesatmap_interpolated = NULL;
 	dcp->use_profile = FALSE;
 	dcp->curve_is_flat = TRUE;
 	dcp->read_out_curve = NULL;
+	dcp->profile = NULL;
 	/* Standard D65, this default should really not be used */
 	dcp->white_xy.x = 0.31271f;
 	dcp->white_xy.y = 0.32902f;
@@ -398,6 +413,10 @@ get_property(GObject *object, guint property_id, GValue *value, GParamSpec *pspe
 	switch (property_id)
 	{
 		case PROP_SETTINGS:
+			g_value_set_object(value, dcp->settings);
+			break;
+		case PROP_PROFILE:
+			g_value_set_object(value, dcp->profile);
 			break;
 		case PROP_USE_PROFILE:
 			g_value_set_boolean(value, dcp->use_profile);
@@ -437,10 +456,13 @@ set_property(GObject *object, guint property_id, const GValue *value, GParamSpec
 			g_object_weak_ref(G_OBJECT(dcp->settings), settings_weak_notify, dcp);
 			break;
 		case PROP_PROFILE:
-			g_static_rec_mutex_lock(&dcp_mutex);
-			read_profile(dcp, g_value_get_object(value));
+			g_static_rec_mutex_lock(&dcp->lock);
+			if (dcp->profile)
+				g_object_unref(dcp->profile);
+			dcp->profile = g_value_dup_object(value);
+			read_profile(dcp, dcp->profile);
 			changed = TRUE;
-			g_static_rec_mutex_unlock(&dcp_mutex);
+			g_static_rec_mutex_unlock(&dcp->lock);
 			break;
 		case PROP_READ_OUT_CURVE:
 			temp = g_value_get_object(value);
@@ -449,13 +471,13 @@ set_property(GObject *object, guint property_id, const GValue *value, GParamSpec
 			dcp->read_out_curve = temp;
 			break;
 		case PROP_USE_PROFILE:
-			g_static_rec_mutex_lock(&dcp_mutex);
+			g_static_rec_mutex_lock(&dcp->lock);
 			dcp->use_profile = g_value_get_boolean(value);
 			if (!dcp->use_profile)
 				free_dcp_profile(dcp);
 			else
 				precalc(dcp);
-			g_static_rec_mutex_unlock(&dcp_mutex);
+			g_static_rec_mutex_unlock(&dcp->lock);
 			break;
 		default:
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -473,16 +495,26 @@ settings_weak_notify(gpointer data, GObject *where_the_object_was)
 }
 
 
-gpointer
-start_single_dcp_thread(gpointer _thread_info)
+static void
+render_rows(ThreadInfo* t)
 {
-	ThreadInfo* t = _thread_info;
 	RS_IMAGE16 *tmp = t->tmp;
+	const RSCpuLevel level = rs_cpu_get_level();
 
 	pre_cache_tables(t->dcp);
-	if (tmp->pixelsize == 4  && (rs_detect_cpu_features() & RS_CPU_FLAG_SSE2) && !t->dcp->read_out_curve)
+	if (tmp->pixelsize == 4  && level >= RS_CPU_LEVEL_SSE2 && !t->dcp->read_out_curve)
 	{
-		if ((rs_detect_cpu_features() & RS_CPU_FLAG_AVX) && render_AVX(t))
+		if (level >= RS_CPU_LEVEL_AVX2 && render_AVX2(t))
+		{
+			/* AVX2 routine renders 4 pixels in parallel, but any remaining must be */
+			/* calculated using C routines */
+			if (tmp->w & 3)
+			{
+				t->start_x = tmp->w - (tmp->w & 3);
+				render(t);
+			}
+		} 
+		else if (level >= RS_CPU_LEVEL_AVX && render_AVX(t))
 		{
 			/* AVX routine renders 4 pixels in parallel, but any remaining must be */
 			/* calculated using C routines */
@@ -492,7 +524,7 @@ start_single_dcp_thread(gpointer _thread_info)
 				render(t);
 			}
 		} 
-		else if ((rs_detect_cpu_features() & RS_CPU_FLAG_SSE4_1) && render_SSE4(t))
+		else if (level >= RS_CPU_LEVEL_SSE4_1 && render_SSE4(t))
 		{
 			/* SSE4 routine renders 4 pixels in parallel, but any remaining must be */
 			/* calculated using C routines */
@@ -518,11 +550,88 @@ start_single_dcp_thread(gpointer _thread_info)
 	}
 	else
 		render(t);
+}
+
+/* Rows converted and rendered at a time when fused with the input colorspace
+ * transform, small enough to stay in cache between the two steps */
+#define FUSED_ROWS 8
+
+/* Does the same as the matrix path of RSColorspaceTransform */
+static void
+convert_rows(ThreadInfo *t, gint start_y, gint end_y)
+{
+	const RS_MATRIX3Int *mati = &t->input_matrix;
+	const gint pixelsize = t->input->pixelsize;
+	gint r, g, b;
+	gint x, y;
+
+	for(y = start_y; y < end_y; y++)
+	{
+		const gushort *in = GET_PIXEL(t->input, t->input_x, t->input_y + y);
+		gushort *out = GET_PIXEL(t->tmp, 0, y);
+
+		for(x = 0; x < t->tmp->w; x++)
+		{
+			r =
+				( in[R] * mati->coeff[0][0]
+				+ in[G] * mati->coeff[0][1]
+				+ in[B] * mati->coeff[0][2]
+				+ MATRIX_RESOLUTION_ROUNDER ) >> MATRIX_RESOLUTION;
+			g =
+				( in[R] * mati->coeff[1][0]
+				+ in[G] * mati->coeff[1][1]
+				+ in[B] * mati->coeff[1][2]
+				+ MATRIX_RESOLUTION_ROUNDER ) >> MATRIX_RESOLUTION;
+			b =
+				( in[R] * mati->coeff[2][0]
+				+ in[G] * mati->coeff[2][1]
+				+ in[B] * mati->coeff[2][2]
+				+ MATRIX_RESOLUTION_ROUNDER ) >> MATRIX_RESOLUTION;
+
+			out[R] = CLAMP(r, 0, 65535);
+			out[G] = CLAMP(g, 0, 65535);
+			out[B] = CLAMP(b, 0, 65535);
+
+			in += pixelsize;
+			out += pixelsize;
+		}
+	}
+}
 
-	if (!t->single_thread)
-		g_thread_exit(NULL);
+static void
+render_part(gint start_y, gint end_y, gpointer _thread_info)
+{
+	ThreadInfo *shared = _thread_info;
+	ThreadInfo t = *shared;
+	gint i, y;
+
+	memset(t.curve_input_values, 0, sizeof(t.curve_input_values));
+
+	if (t.input)
+	{
+		/* Convert a few rows and render them while they are in cache */
+		for(y = start_y; y < end_y; y += FUSED_ROWS)
+		{
+			t.start_x = 0;
+			t.start_y = y;
+			t.end_y = MIN(end_y, y + FUSED_ROWS);
+			convert_rows(&t, t.start_y, t.end_y);
+			render_rows(&t);
+		}
+	}
+	else
+	{
+		t.start_x = 0;
+		t.start_y = start_y;
+		t.end_y = end_y;
+		render_rows(&t);
+	}
 
-	return NULL; /* Make the compiler shut up - we'll never return */
+	/* Add our part of the histogram to the total */
+	if (t.dcp->read_out_curve)
+		for(i = 0; i < 256; i++)
+			if (t.curve_input_values[i])
+				g_atomic_int_add((gint *) &shared->curve_input_values[i], t.curve_input_values[i]);
 }
 
 static inline void 
@@ -543,6 +652,54 @@ bit_blt(char* dstp, int dst_pitch, const char* srcp, int src_pitch, int row_size
 	}
 }
 
+static gboolean
+previous_is_colorspace_transform(RSFilter *filter)
+{
+	static GType transform_type = 0;
+
+	if (!transform_type)
+		transform_type = g_type_from_name("RSColorspaceTransform");
+
+	return (transform_type != 0)
+		&& G_TYPE_CHECK_INSTANCE_TYPE(filter->previous, transform_type)
+		&& filter->previous->enabled;
+}
+
+/* Calculates the matrix RSColorspaceTransform would have used to convert from
+ * input_space to output_space, FALSE if it can't be done using a matrix. The
+ * transform defers premultiplication even if the spaces are the same */
+static gboolean
+calc_input_matrix(RSFilterResponse *response, const RSFilterRequest *request, RSColorSpace *input_space, RSColorSpace *output_space, RS_MATRIX3 *matrix)
+{
+	gfloat premul[4] = {1.0, 1.0, 1.0, 1.0};
+	gboolean is_premultiplied = FALSE;
+
+	if (RS_COLOR_SPACE_REQUIRES_CMS(input_space) || RS_COLOR_SPACE_REQUIRES_CMS(output_space))
+		return FALSE;
+
+	rs_filter_param_get_boolean(RS_FILTER_PARAM(response), "is-premultiplied", &is_premultiplied);
+	if (!is_premultiplied && rs_filter_param_get_float4(RS_FILTER_PARAM(request), "premul", premul))
+		rs_filter_param_set_boolean(RS_FILTER_PARAM(response), "is-premultiplied", TRUE);
+
+	RS_VECTOR3 vec = {{premul[0]},{premul[1]},{premul[2]}};
+	const RS_MATRIX3 mul_vec = vector3_as_diagonal(&vec);
+
+	/* Only premultiplication is left to do */
+	if (input_space == output_space)
+	{
+		*matrix = mul_vec;
+		return TRUE;
+	}
+
+	const RS_MATRIX3 a = rs_color_space_get_matrix_from_pcs(input_space);
+	RS_MATRIX3 a_premul;
+	matrix3_multiply(&a, &mul_vec, &a_premul);
+	const RS_MATRIX3 b = rs_color_space_get_matrix_to_pcs(output_space);
+	matrix3_multiply(&b, &a_premul, matrix);
+
+	return TRUE;
+}
+
 static RSFilterResponse *
 get_image(RSFilter *filter, const RSFilterRequest *request)
 {
@@ -558,6 +715,10 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	gint j;
 
 	RSFilterRequest *request_clone = rs_filter_request_clone(request);
+	RSColorSpace *input_space;
+	gboolean fuse;
+	gboolean exclusive;
+	RS_MATRIX3 input_matrix;
 
 	if (!dcp->use_profile)
 	{
@@ -566,91 +727,100 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	}
 
 	rs_filter_param_set_object(RS_FILTER_PARAM(request_clone), "colorspace", klass->prophoto);
+
+	/* If we're fed directly by a colorspace transform, we will do its work
+	 * while rendering, instead of having it write a full image for us */
+	fuse = previous_is_colorspace_transform(filter);
+	if (fuse)
+		rs_filter_param_set_boolean(RS_FILTER_PARAM(request_clone), "defer-colorspace", TRUE);
+
 	previous_response = rs_filter_get_image(filter->previous, request_clone);
-	g_object_unref(request_clone);
 
 	if (!RS_IS_FILTER(filter->previous))
+	{
+		g_object_unref(request_clone);
 		return previous_response;
+	}
 
 	input = rs_filter_response_get_image(previous_response);
-	if (!input) return previous_response;
+	if (!input)
+	{
+		g_object_unref(request_clone);
+		return previous_response;
+	}
 	response = rs_filter_response_clone(previous_response);
 
+	/* Find out if the transform left the conversion to us */
+	input_space = rs_filter_param_get_object_with_type(RS_FILTER_PARAM(previous_response), "colorspace", RS_TYPE_COLOR_SPACE);
+	fuse = fuse && input_space;
+	if (fuse)
+		fuse = calc_input_matrix(response, request_clone, input_space, klass->prophoto, &input_matrix);
+	if (input_space)
+		g_object_unref(input_space);
+	g_object_unref(request_clone);
+
 	/* We always deliver in ProPhoto */
 	rs_filter_param_set_object(RS_FILTER_PARAM(response), "colorspace", klass->prophoto);
 	g_object_unref(previous_response);
 
+	/* If nobody else is using the input, we can render in place */
+	exclusive = rs_image16_is_exclusive(input);
+
 	if ((roi = rs_filter_request_get_roi(request)))
 	{
 		/* Align so we start at even pixel counts */
 		roi->width += (roi->x&1);
 		roi->x -= (roi->x&1);
 		roi->width = MIN(input->w - roi->x, roi->width);
-		output = rs_image16_copy(input, FALSE);
+		output = exclusive ? g_object_ref(input) : rs_image16_copy(input, FALSE);
 		tmp = rs_image16_new_subframe(output, roi);
-		bit_blt((char*)GET_PIXEL(tmp,0,0), tmp->rowstride * 2, 
-			(const char*)GET_PIXEL(input,roi->x,roi->y), input->rowstride * 2, tmp->w * tmp->pixelsize * 2, tmp->h);
+		/* The pixels will be converted into place while rendering */
+		if (!fuse && !exclusive)
+			bit_blt((char*)GET_PIXEL(tmp,0,0), tmp->rowstride * 2, 
+				(const char*)GET_PIXEL(input,roi->x,roi->y), input->rowstride * 2, tmp->w * tmp->pixelsize * 2, tmp->h);
 	}
 	else
 	{
-		output = rs_image16_copy(input, TRUE);
+		output = exclusive ? g_object_ref(input) : rs_image16_copy(input, !fuse);
 		tmp = g_object_ref(output);
 	}
-	g_object_unref(input);
 	rs_filter_response_set_image(response, output);
 	g_object_unref(output);
 
-	g_static_rec_mutex_lock(&dcp_mutex);
+	g_static_rec_mutex_lock(&dcp->lock);
 	init_exposure(dcp);
 
-	guint i, y_offset, y_per_thread, threaded_h;
-	guint threads = rs_get_number_of_processor_cores();
-	if (tmp->h * tmp->w < 200*200)
-		threads = 1;
-
-	ThreadInfo *t = g_new(ThreadInfo, threads);
-
-	threaded_h = tmp->h;
-	y_per_thread = (threaded_h + threads-1)/threads;
-	y_offset = 0;
-
-	for (i = 0; i < threads; i++)
+	ThreadInfo *t = g_new0(ThreadInfo, 1);
+	t->dcp = dcp;
+	t->tmp = tmp;
+	for(j = 0; j < 256; j++)
+		t->curve_input_values[j] = 0;
+	if (fuse)
 	{
-		t[i].tmp = tmp;
-		t[i].start_y = y_offset;
-		t[i].start_x = 0;
-		t[i].dcp = dcp;
-		y_offset += y_per_thread;
-		y_offset = MIN(tmp->h, y_offset);
-		t[i].end_y = y_offset;
-		for(j = 0; j < 256; j++)
-			t[i].curve_input_values[j] = 0;
-		t[i].single_thread = (threads == 1);
-		if (threads == 1)
-			start_single_dcp_thread(&t[0]);
-		else	
-			t[i].threadid = g_thread_create(start_single_dcp_thread, &t[i], TRUE, NULL);
+		t->input = input;
+		t->input_x = roi ? roi->x : 0;
+		t->input_y = roi ? roi->y : 0;
+		matrix3_to_matrix3int(&input_matrix, &t->input_matrix);
 	}
 
-	/* Wait for threads to finish */
-	for(i = 0; threads > 1 && i < threads; i++)
-		g_thread_join(t[i].threadid);
+	/* Small images are not worth splitting */
+	rs_parallel_for_cancellable(0, tmp->h, (tmp->h * tmp->w < 200*200) ? tmp->h : 0, render_part, t, rs_filter_request_get_cancellable(request));
 
 	/* Settings can change now */
-	g_static_rec_mutex_unlock(&dcp_mutex);
+	g_static_rec_mutex_unlock(&dcp->lock);
 
 	/* If we must deliver histogram data, do it now */
 	if (dcp->read_out_curve)
 	{
 		gint *values = g_malloc0(256*sizeof(gint));
-		for(i = 0; i < threads; i++)
-			for(j = 0; j < 256; j++)
-				values[j] += t[i].curve_input_values[j];
+		for(j = 0; j < 256; j++)
+			values[j] = t->curve_input_values[j];
 		rs_curve_set_histogram_data(RS_CURVE_WIDGET(dcp->read_out_curve), values);
 		g_free(values);
 	}
 	g_free(t);
 	g_object_unref(tmp);
+	g_object_unref(input);
 
 	return response;
 }
@@ -1458,14 +1628,14 @@ precalc(RSDcp *dcp)
 	}};
 
 	/* Camera to ProPhoto */
-	g_static_rec_mutex_lock(&dcp_mutex);
+	g_static_rec_mutex_lock(&dcp->lock);
 	if (dcp->use_profile)
 		matrix3_multiply(&xyz_to_prophoto, &dcp->camera_to_pcs, &dcp->camera_to_prophoto); /* verified by SDK */
 	if (dcp->huesatmap && (rs_detect_cpu_features() & RS_CPU_FLAG_SSE2))
 		calc_hsm_constants(dcp->huesatmap, dcp->huesatmap_precalc); 
 	if (dcp->looktable && (rs_detect_cpu_features() & RS_CPU_FLAG_SSE2))
 		calc_hsm_constants(dcp->looktable, dcp->looktable_precalc); 
-	g_static_rec_mutex_unlock(&dcp_mutex);
+	g_static_rec_mutex_unlock(&dcp->lock);
 }
 
 static void
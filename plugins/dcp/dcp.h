@@ -105,6 +105,10 @@ struct _RSDcp {
 	void* _looktable_precalc_unaligned;
 	gfloat junk_value;
 	RSCurveWidget* read_out_curve;
+	RSDcpFile *profile;
+
+	/* Protects everything above from being changed while rendering */
+	GStaticRecMutex lock;
 };
 
 struct _RSDcpClass {
@@ -115,18 +119,23 @@ struct _RSDcpClass {
 
 typedef struct {
 	RSDcp *dcp;
-	GThread *threadid;
 	gint start_x;
 	gint start_y;
 	gint end_y;
 	RS_IMAGE16 *tmp;
 	guint curve_input_values[256];
-	gboolean single_thread;
+
+	/* If set, rows are converted from input to tmp before rendering */
+	RS_IMAGE16 *input;
+	gint input_x;
+	gint input_y;
+	RS_MATRIX3Int input_matrix;
 } ThreadInfo;
 
 gboolean render_SSE2(ThreadInfo* t);
 gboolean render_SSE4(ThreadInfo* t);
 gboolean render_AVX(ThreadInfo* t);
+gboolean render_AVX2(ThreadInfo* t);
 void calc_hsm_constants(const RSHuesatMap *map, PrecalcHSM* table); 
 
 #endif /* DCP_H */
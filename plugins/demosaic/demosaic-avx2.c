@@ -0,0 +1,225 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "demosaic.h"
+
+#if defined (__x86_64__) && defined(__AVX2__)
+
+#include <immintrin.h>
+
+static inline __m256i
+_mm256_absdiff_epu16(__m256i a, __m256i b)
+{
+	return _mm256_or_si256(_mm256_subs_epu16(a, b), _mm256_subs_epu16(b, a));
+}
+
+/* See hotpixel_detect_SSE2(), this is the same with 16 pixels at a time */
+void
+hotpixel_detect_AVX2(const ThreadInfo* t)
+{
+	RS_IMAGE16 *image = t->image;
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi16(1);
+	const __m256i threshold = _mm256_set1_epi16(2000);
+	gint x, y, end_y, i;
+
+	if (image->pixelsize != 1)
+	{
+		hotpixel_detect(t);
+		return;
+	}
+
+	y = MAX( 4, t->start_y);
+	end_y = MIN(t->end_y, image->h - 4);
+
+	for(; y < end_y; y++)
+	{
+		gint col_end = image->w - 4;
+		gushort* img = GET_PIXEL(image, 0, y);
+		gint p = image->rowstride * 2;
+		gint p_one = image->rowstride;
+
+		for (x = 4; x + 16 <= col_end; x += 16)
+		{
+			__m256i c = _mm256_loadu_si256((__m256i *) &img[x]);
+			__m256i left = _mm256_loadu_si256((__m256i *) &img[x - 2]);
+			__m256i right = _mm256_loadu_si256((__m256i *) &img[x + 2]);
+			__m256i up = _mm256_loadu_si256((__m256i *) &img[x - p]);
+			__m256i down = _mm256_loadu_si256((__m256i *) &img[x + p]);
+
+			__m256i d = _mm256_min_epu16(_mm256_absdiff_epu16(c, left), _mm256_absdiff_epu16(c, right));
+			d = _mm256_min_epu16(d, _mm256_absdiff_epu16(c, up));
+			d = _mm256_min_epu16(d, _mm256_absdiff_epu16(c, down));
+			__m256i d2 = _mm256_max_epu16(_mm256_absdiff_epu16(left, right), _mm256_absdiff_epu16(up, down));
+
+			__m256i limit = _mm256_srli_epi16(_mm256_subs_epu16(d, one), 3);
+			__m256i candidate = _mm256_andnot_si256(
+				_mm256_cmpeq_epi16(_mm256_subs_epu16(d, threshold), zero),
+				_mm256_cmpeq_epi16(_mm256_subs_epu16(d2, limit), zero));
+
+			if (_mm256_movemask_epi8(candidate))
+				for (i = 0; i < 16; i++)
+					hotpixel_detect_pixel(img, x + i, p, p_one);
+		}
+
+		for (; x < col_end; x++)
+			hotpixel_detect_pixel(img, x, p, p_one);
+	}
+}
+
+/* Eight CFA values two pixels apart, starting at offset from in, as 32 bit */
+#define LOAD_CFA(offset) _mm256_and_si256(_mm256_loadu_si256((__m256i *) &in[offset]), mask)
+
+/* See interpolate_INDI_green_SSE2(), this is the same with 8 pixels at a time */
+void
+interpolate_INDI_green_AVX2(ThreadInfo *t)
+{
+	RS_IMAGE16 *image = t->output;
+	RS_IMAGE16 *cfa = t->image;
+	const unsigned int filters = t->filters;
+	const int start_y = MAX(3, t->start_y);
+	const int end_y = MIN(image->h-3, t->end_y);
+	const __m256i mask = _mm256_set1_epi32(0xffff);
+	const gint p = image->pitch;
+	const gint s = cfa->rowstride;
+	gint row, col, c, i;
+	gint out[8] __attribute__ ((aligned (32)));
+
+	if (!CFA_IS_BAYER(filters) || cfa->pixelsize != 1 || cfa->w != image->w)
+	{
+		interpolate_INDI_green(t);
+		return;
+	}
+
+	for (row=start_y; row < end_y; row++)
+	{
+		const gushort *in = GET_PIXEL(cfa, 0, row);
+
+		col = 3 + (FC(row,3) & 1);
+		c = FC(row,col);
+
+		/* The last load reads up to col+18, which must be inside the row */
+		for (; col + 18 < image->w; col += 16)
+		{
+			const __m256i c0 = LOAD_CFA(col);
+
+			/* Horizontal */
+			const __m256i hm3 = LOAD_CFA(col - 3);
+			const __m256i hm2 = LOAD_CFA(col - 2);
+			const __m256i hm1 = LOAD_CFA(col - 1);
+			const __m256i hp1 = LOAD_CFA(col + 1);
+			const __m256i hp2 = LOAD_CFA(col + 2);
+			const __m256i hp3 = LOAD_CFA(col + 3);
+
+			__m256i guessA = _mm256_sub_epi32(_mm256_sub_epi32(
+				_mm256_slli_epi32(_mm256_add_epi32(_mm256_add_epi32(hm1, c0), hp1), 1), hm2), hp2);
+			__m256i diffA = _mm256_add_epi32(_mm256_add_epi32(
+				_mm256_abs_epi32(_mm256_sub_epi32(hm2, c0)),
+				_mm256_abs_epi32(_mm256_sub_epi32(hp2, c0))),
+				_mm256_abs_epi32(_mm256_sub_epi32(hm1, hp1)));
+			__m256i diffA2 = _mm256_add_epi32(
+				_mm256_abs_epi32(_mm256_sub_epi32(hp3, hp1)),
+				_mm256_abs_epi32(_mm256_sub_epi32(hm3, hm1)));
+			diffA = _mm256_add_epi32(_mm256_add_epi32(_mm256_slli_epi32(diffA, 1), diffA), _mm256_slli_epi32(diffA2, 1));
+
+			/* Vertical */
+			const __m256i vm3 = LOAD_CFA(col - 3*s);
+			const __m256i vm2 = LOAD_CFA(col - 2*s);
+			const __m256i vm1 = LOAD_CFA(col - s);
+			const __m256i vp1 = LOAD_CFA(col + s);
+			const __m256i vp2 = LOAD_CFA(col + 2*s);
+			const __m256i vp3 = LOAD_CFA(col + 3*s);
+
+			__m256i guessB = _mm256_sub_epi32(_mm256_sub_epi32(
+				_mm256_slli_epi32(_mm256_add_epi32(_mm256_add_epi32(vm1, c0), vp1), 1), vm2), vp2);
+			__m256i diffB = _mm256_add_epi32(_mm256_add_epi32(
+				_mm256_abs_epi32(_mm256_sub_epi32(vm2, c0)),
+				_mm256_abs_epi32(_mm256_sub_epi32(vp2, c0))),
+				_mm256_abs_epi32(_mm256_sub_epi32(vm1, vp1)));
+			__m256i diffB2 = _mm256_add_epi32(
+				_mm256_abs_epi32(_mm256_sub_epi32(vp3, vp1)),
+				_mm256_abs_epi32(_mm256_sub_epi32(vm3, vm1)));
+			diffB = _mm256_add_epi32(_mm256_add_epi32(_mm256_slli_epi32(diffB, 1), diffB), _mm256_slli_epi32(diffB2, 1));
+
+			guessA = _mm256_max_epi32(_mm256_srai_epi32(guessA, 2), _mm256_min_epi32(hm1, hp1));
+			guessA = _mm256_min_epi32(guessA, _mm256_max_epi32(hm1, hp1));
+			guessB = _mm256_max_epi32(_mm256_srai_epi32(guessB, 2), _mm256_min_epi32(vm1, vp1));
+			guessB = _mm256_min_epi32(guessB, _mm256_max_epi32(vm1, vp1));
+
+			__m256i use_b = _mm256_cmpgt_epi32(diffA, diffB);
+			_mm256_store_si256((__m256i *) out, _mm256_blendv_epi8(guessA, guessB, use_b));
+
+			gushort (*pix)[4] = (gushort (*)[4]) GET_PIXEL(image, col, row);
+			for (i = 0; i < 8; i++)
+				pix[i*2][1] = out[i];
+		}
+
+		for (; col < image->w-3; col+=2)
+			ppg_green_pixel((gushort (*)[4])GET_PIXEL(image, col, row), c, p);
+	}
+}
+
+#undef LOAD_CFA
+
+void
+bin_cfa_rows_AVX2(const gushort *in, gint pitch, gint rows, gint width, guint32 *sum)
+{
+	gint x, i;
+
+	for (x = 0; x + 16 <= width; x += 16)
+	{
+		const gushort *p = &in[x];
+		__m256i lo = _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i *) p));
+		__m256i hi = _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i *) &p[8]));
+
+		for (i = 1; i < rows; i++)
+		{
+			p += pitch;
+			lo = _mm256_add_epi32(lo, _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i *) p)));
+			hi = _mm256_add_epi32(hi, _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i *) &p[8])));
+		}
+		_mm256_storeu_si256((__m256i *) &sum[x], lo);
+		_mm256_storeu_si256((__m256i *) &sum[x + 8], hi);
+	}
+
+	if (x < width)
+		bin_cfa_rows(&in[x], pitch, rows, width - x, &sum[x]);
+}
+
+#else // not defined (__x86_64__) && defined(__AVX2__)
+
+void
+hotpixel_detect_AVX2(const ThreadInfo* t)
+{
+	hotpixel_detect(t);
+}
+
+void
+interpolate_INDI_green_AVX2(ThreadInfo *t)
+{
+	interpolate_INDI_green(t);
+}
+
+void
+bin_cfa_rows_AVX2(const gushort *in, gint pitch, gint rows, gint width, guint32 *sum)
+{
+	bin_cfa_rows(in, pitch, rows, width, sum);
+}
+
+#endif // not defined (__x86_64__) && defined(__AVX2__)
@@ -0,0 +1,272 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "demosaic.h"
+
+#if defined (__SSE2__)
+
+#include <emmintrin.h>
+
+/* SSE2 has no unsigned 16 bit min/max, these are exact for all values */
+static inline __m128i
+_mm_min_epu16_sse2(__m128i a, __m128i b)
+{
+	return _mm_sub_epi16(a, _mm_subs_epu16(a, b));
+}
+
+static inline __m128i
+_mm_max_epu16_sse2(__m128i a, __m128i b)
+{
+	return _mm_add_epi16(b, _mm_subs_epu16(a, b));
+}
+
+static inline __m128i
+_mm_absdiff_epu16(__m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_subs_epu16(a, b), _mm_subs_epu16(b, a));
+}
+
+/* Nor signed 32 bit min/max/abs */
+static inline __m128i
+_mm_min_epi32_sse2(__m128i a, __m128i b)
+{
+	__m128i gt = _mm_cmpgt_epi32(a, b);
+	return _mm_or_si128(_mm_and_si128(gt, b), _mm_andnot_si128(gt, a));
+}
+
+static inline __m128i
+_mm_max_epi32_sse2(__m128i a, __m128i b)
+{
+	__m128i gt = _mm_cmpgt_epi32(a, b);
+	return _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, b));
+}
+
+static inline __m128i
+_mm_abs_epi32_sse2(__m128i a)
+{
+	__m128i sign = _mm_srai_epi32(a, 31);
+	return _mm_sub_epi32(_mm_xor_si128(a, sign), sign);
+}
+
+/* Only the first test is done in SSE2, it rules out almost all pixels. If
+ * any pixel of 8 passes it, all 8 are done in C in the same order as the C
+ * version, so pixels fixed earlier are seen by the following pixels */
+void
+hotpixel_detect_SSE2(const ThreadInfo* t)
+{
+	RS_IMAGE16 *image = t->image;
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i threshold = _mm_set1_epi16(2000);
+	gint x, y, end_y, i;
+
+	if (image->pixelsize != 1)
+	{
+		hotpixel_detect(t);
+		return;
+	}
+
+	y = MAX( 4, t->start_y);
+	end_y = MIN(t->end_y, image->h - 4);
+
+	for(; y < end_y; y++)
+	{
+		gint col_end = image->w - 4;
+		gushort* img = GET_PIXEL(image, 0, y);
+		gint p = image->rowstride * 2;
+		gint p_one = image->rowstride;
+
+		for (x = 4; x + 8 <= col_end; x += 8)
+		{
+			__m128i c = _mm_loadu_si128((__m128i *) &img[x]);
+			__m128i left = _mm_loadu_si128((__m128i *) &img[x - 2]);
+			__m128i right = _mm_loadu_si128((__m128i *) &img[x + 2]);
+			__m128i up = _mm_loadu_si128((__m128i *) &img[x - p]);
+			__m128i down = _mm_loadu_si128((__m128i *) &img[x + p]);
+
+			__m128i d = _mm_min_epu16_sse2(_mm_absdiff_epu16(c, left), _mm_absdiff_epu16(c, right));
+			d = _mm_min_epu16_sse2(d, _mm_absdiff_epu16(c, up));
+			d = _mm_min_epu16_sse2(d, _mm_absdiff_epu16(c, down));
+			__m128i d2 = _mm_max_epu16_sse2(_mm_absdiff_epu16(left, right), _mm_absdiff_epu16(up, down));
+
+			/* d > 2000 and d > d2 * 8, which is d2 <= (d - 1) / 8 without overflow */
+			__m128i limit = _mm_srli_epi16(_mm_subs_epu16(d, one), 3);
+			__m128i candidate = _mm_andnot_si128(
+				_mm_cmpeq_epi16(_mm_subs_epu16(d, threshold), zero),
+				_mm_cmpeq_epi16(_mm_subs_epu16(d2, limit), zero));
+
+			if (_mm_movemask_epi8(candidate))
+				for (i = 0; i < 8; i++)
+					hotpixel_detect_pixel(img, x + i, p, p_one);
+		}
+
+		for (; x < col_end; x++)
+			hotpixel_detect_pixel(img, x, p, p_one);
+	}
+}
+
+/* Four CFA values two pixels apart, starting at offset from in, as 32 bit */
+#define LOAD_CFA(offset) _mm_and_si128(_mm_loadu_si128((__m128i *) &in[offset]), mask)
+
+/* Green is interpolated at 4 red or blue pixels at a time. All values read
+ * are CFA values, so they are read from the single channel input, where
+ * pixels two apart are next to each other */
+void
+interpolate_INDI_green_SSE2(ThreadInfo *t)
+{
+	RS_IMAGE16 *image = t->output;
+	RS_IMAGE16 *cfa = t->image;
+	const unsigned int filters = t->filters;
+	const int start_y = MAX(3, t->start_y);
+	const int end_y = MIN(image->h-3, t->end_y);
+	const __m128i mask = _mm_set1_epi32(0xffff);
+	const gint p = image->pitch;
+	const gint s = cfa->rowstride;
+	gint row, col, c;
+	gint out[4] __attribute__ ((aligned (16)));
+
+	/* Neighbours must be green in both directions */
+	if (!CFA_IS_BAYER(filters) || cfa->pixelsize != 1 || cfa->w != image->w)
+	{
+		interpolate_INDI_green(t);
+		return;
+	}
+
+	for (row=start_y; row < end_y; row++)
+	{
+		const gushort *in = GET_PIXEL(cfa, 0, row);
+
+		col = 3 + (FC(row,3) & 1);
+		c = FC(row,col);
+
+		/* The last load reads up to col+10, which must be inside the row */
+		for (; col + 10 < image->w; col += 8)
+		{
+			const __m128i c0 = LOAD_CFA(col);
+
+			/* Horizontal */
+			const __m128i hm3 = LOAD_CFA(col - 3);
+			const __m128i hm2 = LOAD_CFA(col - 2);
+			const __m128i hm1 = LOAD_CFA(col - 1);
+			const __m128i hp1 = LOAD_CFA(col + 1);
+			const __m128i hp2 = LOAD_CFA(col + 2);
+			const __m128i hp3 = LOAD_CFA(col + 3);
+
+			__m128i guessA = _mm_sub_epi32(_mm_sub_epi32(
+				_mm_slli_epi32(_mm_add_epi32(_mm_add_epi32(hm1, c0), hp1), 1), hm2), hp2);
+			__m128i diffA = _mm_add_epi32(_mm_add_epi32(
+				_mm_abs_epi32_sse2(_mm_sub_epi32(hm2, c0)),
+				_mm_abs_epi32_sse2(_mm_sub_epi32(hp2, c0))),
+				_mm_abs_epi32_sse2(_mm_sub_epi32(hm1, hp1)));
+			__m128i diffA2 = _mm_add_epi32(
+				_mm_abs_epi32_sse2(_mm_sub_epi32(hp3, hp1)),
+				_mm_abs_epi32_sse2(_mm_sub_epi32(hm3, hm1)));
+			diffA = _mm_add_epi32(_mm_add_epi32(_mm_slli_epi32(diffA, 1), diffA), _mm_slli_epi32(diffA2, 1));
+
+			/* Vertical */
+			const __m128i vm3 = LOAD_CFA(col - 3*s);
+			const __m128i vm2 = LOAD_CFA(col - 2*s);
+			const __m128i vm1 = LOAD_CFA(col - s);
+			const __m128i vp1 = LOAD_CFA(col + s);
+			const __m128i vp2 = LOAD_CFA(col + 2*s);
+			const __m128i vp3 = LOAD_CFA(col + 3*s);
+
+			__m128i guessB = _mm_sub_epi32(_mm_sub_epi32(
+				_mm_slli_epi32(_mm_add_epi32(_mm_add_epi32(vm1, c0), vp1), 1), vm2), vp2);
+			__m128i diffB = _mm_add_epi32(_mm_add_epi32(
+				_mm_abs_epi32_sse2(_mm_sub_epi32(vm2, c0)),
+				_mm_abs_epi32_sse2(_mm_sub_epi32(vp2, c0))),
+				_mm_abs_epi32_sse2(_mm_sub_epi32(vm1, vp1)));
+			__m128i diffB2 = _mm_add_epi32(
+				_mm_abs_epi32_sse2(_mm_sub_epi32(vp3, vp1)),
+				_mm_abs_epi32_sse2(_mm_sub_epi32(vm3, vm1)));
+			diffB = _mm_add_epi32(_mm_add_epi32(_mm_slli_epi32(diffB, 1), diffB), _mm_slli_epi32(diffB2, 1));
+
+			/* ULIM() is a clamp between the smallest and largest neighbour */
+			guessA = _mm_max_epi32_sse2(_mm_srai_epi32(guessA, 2), _mm_min_epi32_sse2(hm1, hp1));
+			guessA = _mm_min_epi32_sse2(guessA, _mm_max_epi32_sse2(hm1, hp1));
+			guessB = _mm_max_epi32_sse2(_mm_srai_epi32(guessB, 2), _mm_min_epi32_sse2(vm1, vp1));
+			guessB = _mm_min_epi32_sse2(guessB, _mm_max_epi32_sse2(vm1, vp1));
+
+			__m128i use_b = _mm_cmpgt_epi32(diffA, diffB);
+			_mm_store_si128((__m128i *) out, _mm_or_si128(_mm_and_si128(use_b, guessB), _mm_andnot_si128(use_b, guessA)));
+
+			gushort (*pix)[4] = (gushort (*)[4]) GET_PIXEL(image, col, row);
+			pix[0][1] = out[0];
+			pix[2][1] = out[1];
+			pix[4][1] = out[2];
+			pix[6][1] = out[3];
+		}
+
+		for (; col < image->w-3; col+=2)
+			ppg_green_pixel((gushort (*)[4])GET_PIXEL(image, col, row), c, p);
+	}
+}
+
+#undef LOAD_CFA
+
+void
+bin_cfa_rows_SSE2(const gushort *in, gint pitch, gint rows, gint width, guint32 *sum)
+{
+	const __m128i zero = _mm_setzero_si128();
+	gint x, i;
+
+	for (x = 0; x + 8 <= width; x += 8)
+	{
+		const gushort *p = &in[x];
+		__m128i v = _mm_loadu_si128((__m128i *) p);
+		__m128i lo = _mm_unpacklo_epi16(v, zero);
+		__m128i hi = _mm_unpackhi_epi16(v, zero);
+
+		for (i = 1; i < rows; i++)
+		{
+			p += pitch;
+			v = _mm_loadu_si128((__m128i *) p);
+			lo = _mm_add_epi32(lo, _mm_unpacklo_epi16(v, zero));
+			hi = _mm_add_epi32(hi, _mm_unpackhi_epi16(v, zero));
+		}
+		_mm_storeu_si128((__m128i *) &sum[x], lo);
+		_mm_storeu_si128((__m128i *) &sum[x + 4], hi);
+	}
+
+	if (x < width)
+		bin_cfa_rows(&in[x], pitch, rows, width - x, &sum[x]);
+}
+
+#else // not defined (__SSE2__)
+
+void
+hotpixel_detect_SSE2(const ThreadInfo* t)
+{
+	hotpixel_detect(t);
+}
+
+void
+interpolate_INDI_green_SSE2(ThreadInfo *t)
+{
+	interpolate_INDI_green(t);
+}
+
+void
+bin_cfa_rows_SSE2(const gushort *in, gint pitch, gint rows, gint width, guint32 *sum)
+{
+	bin_cfa_rows(in, pitch, rows, width, sum);
+}
+
+#endif // not defined (__SSE2__)
@@ -21,33 +21,28 @@
 
 #include <rawstudio.h>
 #include <string.h>
+#include <math.h>
+#include "demosaic.h"
 
 #define RS_TYPE_DEMOSAIC (rs_demosaic_type)
 #define RS_DEMOSAIC(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), RS_TYPE_DEMOSAIC, RSDemosaic))
 #define RS_DEMOSAIC_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST ((klass), RS_TYPE_DEMOSAIC, RSDemosaicClass))
 #define RS_IS_DEMOSAIC(obj) (G_TYPE_CHECK_INSTANCE_TYPE ((obj), RS_TYPE_DEMOSAIC))
 
-typedef struct {
-	gint start_y;
-	gint end_y;
-	RS_IMAGE16 *image;
-	RS_IMAGE16 *output;
-	guint filters;
-	GThread *threadid;
-} ThreadInfo;
-
 typedef enum {
 	RS_DEMOSAIC_NONE,
 	RS_DEMOSAIC_BILINEAR,
 	RS_DEMOSAIC_PPG,
+	RS_DEMOSAIC_AHD,
 	RS_DEMOSAIC_MAX,
-	RS_DEMOSAIC_NONE_HALF
+	RS_DEMOSAIC_BINNING
 } RS_DEMOSAIC;
 
 const static gchar *rs_demosaic_ascii[RS_DEMOSAIC_MAX] = {
 	"none",
 	"bilinear",
-	"pixel-grouping"
+	"pixel-grouping",
+	"ahd"
 };
 
 typedef struct _RSDemosaic RSDemosaic;
@@ -75,17 +70,25 @@ enum {
 static void get_property (GObject *object, guint property_id, GValue *value, GParamSpec *pspec);
 static void set_property (GObject *object, guint property_id, const GValue *value, GParamSpec *pspec);
 static RSFilterResponse *get_image(RSFilter *filter, const RSFilterRequest *request);
+static gint get_border(RSFilter *filter, const RSFilterRequest *request);
 static inline int fc_INDI (const unsigned int filters, const int row, const int col);
 static void border_interpolate_INDI (const ThreadInfo* t, int colors, int border);
 static void lin_interpolate_INDI(RS_IMAGE16 *image, RS_IMAGE16 *output, const unsigned int filters, const int colors);
-static void ppg_interpolate_INDI(RS_IMAGE16 *image, RS_IMAGE16 *output, const unsigned int filters, const int colors);
-static void none_interpolate_INDI(RS_IMAGE16 *in, RS_IMAGE16 *out, const unsigned int filters, const int colors, gboolean half_size);
-static void hotpixel_detect(const ThreadInfo* t);
+static void ppg_interpolate_INDI(RS_IMAGE16 *image, RS_IMAGE16 *output, const unsigned int filters, const int colors, GCancellable *cancellable);
+static void none_interpolate_INDI(RS_IMAGE16 *in, RS_IMAGE16 *out, const unsigned int filters, const int colors, GCancellable *cancellable);
+static void binning_interpolate_INDI(RS_IMAGE16 *in, RS_IMAGE16 *out, const unsigned int filters, gint shift, GCancellable *cancellable);
+static void ahd_interpolate_INDI(RS_IMAGE16 *image, RS_IMAGE16 *output, const unsigned int filters, GCancellable *cancellable);
+static void ahd_init(void);
 static void expand_cfa_data(const ThreadInfo* t);
 
 
 static RSFilterClass *rs_demosaic_parent_class = NULL;
 
+/* The best kernels for this cpu, picked when the class is initialized */
+static void (*hotpixel_detect_func)(const ThreadInfo* t) = hotpixel_detect;
+static void (*interpolate_green_func)(ThreadInfo *t) = interpolate_INDI_green;
+static void (*bin_cfa_rows_func)(const gushort *in, gint pitch, gint rows, gint width, guint32 *sum) = bin_cfa_rows;
+
 G_MODULE_EXPORT void
 rs_plugin_load(RSPlugin *plugin)
 {
@@ -98,25 +101,36 @@ rs_demosaic_class_init(RSDemosaicClass *klass)
 	RSFilterClass *filter_class = RS_FILTER_CLASS (klass);
 	GObjectClass *object_class = G_OBJECT_CLASS(klass);
 
+	const gpointer hotpixel_kernels[RS_CPU_LEVELS] = {hotpixel_detect, hotpixel_detect_SSE2, NULL, NULL, hotpixel_detect_AVX2};
+	const gpointer green_kernels[RS_CPU_LEVELS] = {interpolate_INDI_green, interpolate_INDI_green_SSE2, NULL, NULL, interpolate_INDI_green_AVX2};
+	const gpointer binning_kernels[RS_CPU_LEVELS] = {bin_cfa_rows, bin_cfa_rows_SSE2, NULL, NULL, bin_cfa_rows_AVX2};
+
 	rs_demosaic_parent_class = g_type_class_peek_parent (klass);
 
+	hotpixel_detect_func = rs_cpu_dispatch(hotpixel_kernels);
+	interpolate_green_func = rs_cpu_dispatch(green_kernels);
+	bin_cfa_rows_func = rs_cpu_dispatch(binning_kernels);
+
 	object_class->get_property = get_property;
 	object_class->set_property = set_property;
 
 	g_object_class_install_property(object_class,
 		PROP_METHOD, g_param_spec_string(
-			"method", "demosaic method", "The demosaic algorithm to use (\"bilinear\" or \"pixel-grouping\")",
+			"method", "demosaic method", "The demosaic algorithm to use (\"bilinear\", \"pixel-grouping\" or \"ahd\")",
 			rs_demosaic_ascii[RS_DEMOSAIC_PPG], G_PARAM_READWRITE)
 	);
 
 	g_object_class_install_property(object_class,
 		PROP_ALLOW_HALF, g_param_spec_boolean(
-			"demosaic-allow-downscale", "demosaic-allow-downscale", "Allow demosaic to return half size image",
+			"demosaic-allow-downscale", "demosaic-allow-downscale", "Allow demosaic to return a 1/2, 1/4 or 1/8 size image for quick requests",
 			FALSE, G_PARAM_READWRITE)
 	);
 
 	filter_class->name = "Demosaic filter";
 	filter_class->get_image = get_image;
+	filter_class->get_border = get_border;
+
+	ahd_init();
 }
 
 static void
@@ -168,15 +182,111 @@ set_property(GObject *object, guint property_id, const GValue *value, GParamSpec
 	}
 }
 
-/*
-   In order to inline this calculation, I make the risky
-   assumption that all filter patterns can be described
-   by a repeating pattern of eight rows and two columns
+static gint
+get_border(RSFilter *filter, const RSFilterRequest *request)
+{
+	RSDemosaic *demosaic = RS_DEMOSAIC(filter);
 
-   Return values are either 0/1/2/3 = G/M/C/Y or 0/1/2/3 = R/G1/B/G2
- */
-#define FC(row,col) \
-  (int)(filters >> ((((row) << 1 & 14) + ((col) & 1)) << 1) & 3)
+	if (rs_filter_request_get_quick(request))
+		return 2;
+
+	switch (demosaic->method)
+	{
+		case RS_DEMOSAIC_BILINEAR:
+			return 2;
+		case RS_DEMOSAIC_PPG:
+			/* Hotpixel detection looks 2 pixels out, PPG another 3 */
+			return 5;
+		case RS_DEMOSAIC_AHD:
+			/* Hotpixel detection looks 2 pixels out, AHD another 5 */
+			return 7;
+		default:
+			/* Keep the CFA phase when pixels are simply copied */
+			return 2;
+	}
+}
+
+/* Hotpixel detection skips 4 pixels at the edges of what is interpolated,
+ * so we interpolate that much more than the ROI including our border */
+#define ROI_MARGIN 4
+
+/* Returns the pattern as seen from a subframe starting at x,y */
+static guint
+cfa_filters_offset(guint filters, gint x, gint y)
+{
+	/* Every row of the pattern is 4 bits, 8 rows in all */
+	const gint shift = (y & 7) * 4;
+
+	if (shift)
+		filters = (filters >> shift) | (filters << (32 - shift));
+
+	/* Swap the two columns of every row */
+	if (x & 1)
+		filters = ((filters & 0x33333333) << 2) | ((filters >> 2) & 0x33333333);
+
+	return filters;
+}
+
+/* Binning is done by up to 8x8 pixels */
+#define BINNING_MAX_SHIFT 3
+
+/* Binned images smaller than this are not worth it */
+#define BINNING_MIN_SIZE 16
+
+/* Find how many times the image can be halved by binning, and still be at
+ * least the "demosaic-scale" asked for in the request. Without a scale we
+ * return half size images */
+static gint
+get_binning_shift(const RS_IMAGE16 *input, const RSFilterRequest *request)
+{
+	gfloat scale = 0.0f;
+	gint shift = 1;
+
+	if (rs_filter_param_get_float(RS_FILTER_PARAM(request), "demosaic-scale", &scale) && scale > 0.0f)
+		while (shift < BINNING_MAX_SHIFT && scale * (2 << shift) <= 1.0f
+			&& (MIN(input->w, input->h) >> (shift + 1)) >= BINNING_MIN_SIZE)
+			shift++;
+
+	return shift;
+}
+
+/* Find the area to interpolate for a ROI, returns FALSE if the whole image
+ * should be interpolated */
+static gboolean
+get_roi_area(const RS_IMAGE16 *input, const GdkRectangle *roi, guint filters, GdkRectangle *area)
+{
+	gint x1, y1, x2, y2;
+
+	/* Leaf backs use a 16x16 pattern we can't shift */
+	if (!roi || filters == 1)
+		return FALSE;
+
+	x1 = MAX(0, roi->x - ROI_MARGIN);
+	y1 = MAX(0, roi->y - ROI_MARGIN);
+	x2 = MIN(input->w, roi->x + roi->width + ROI_MARGIN);
+	y2 = MIN(input->h, roi->y + roi->height + ROI_MARGIN);
+
+	/* Input and output subframes must start at the same even column and
+	 * have the same width */
+	x1 &= ~1;
+	if ((x2 - x1) & 1)
+		x2 = MIN(input->w, x2 + 1);
+
+	/* Too small to run the algorithms on */
+	if ((x2 - x1) < 16 || (y2 - y1) < 16)
+		return FALSE;
+
+	/* Almost everything, not worth it */
+	if ((x2 - x1) * (y2 - y1) > (input->w * input->h / 4) * 3)
+		return FALSE;
+
+	area->x = x1;
+	area->y = y1;
+	area->width = x2 - x1;
+	area->height = y2 - y1;
+
+	return TRUE;
+}
 
 static RSFilterResponse *
 get_image(RSFilter *filter, const RSFilterRequest *request)
@@ -186,10 +296,25 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	RSFilterResponse *response;
 	RS_IMAGE16 *input;
 	RS_IMAGE16 *output = NULL;
-	guint filters;
+	RS_IMAGE16 *input_area = NULL;
+	RS_IMAGE16 *output_area = NULL;
+	GdkRectangle area;
+	guint filters, area_filters;
 	RS_DEMOSAIC method;
+	gint shift = 0;
+	gfloat scale;
 
-	previous_response = rs_filter_get_image(filter->previous, request);
+	/* "demosaic-scale" is only meant for us, keep it out of requests - and
+	 * cache keys - upstream */
+	if (rs_filter_param_get_float(RS_FILTER_PARAM(request), "demosaic-scale", &scale))
+	{
+		RSFilterRequest *previous_request = rs_filter_request_clone(request);
+		rs_filter_param_delete(RS_FILTER_PARAM(previous_request), "demosaic-scale");
+		previous_response = rs_filter_get_image(filter->previous, previous_request);
+		g_object_unref(previous_request);
+	}
+	else
+		previous_response = rs_filter_get_image(filter->previous, request);
 
 	input = rs_filter_response_get_image(previous_response);
 
@@ -209,9 +334,11 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	response = rs_filter_response_clone(previous_response);
 	g_object_unref(previous_response);
 
-	gint fuji_width;
+	/* Decided per request, the same instance may render several at once */
+	gboolean allow_half = demosaic->allow_half;
+	gint fuji_width = 0;
 	if (rs_filter_param_get_integer(RS_FILTER_PARAM(response), "fuji-width", &fuji_width) && (fuji_width > 0))
-		demosaic->allow_half = FALSE;
+		allow_half = FALSE;
 
 	method = demosaic->method;
 	if (rs_filter_request_get_quick(request))
@@ -233,11 +360,13 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 
 	if (method == RS_DEMOSAIC_NONE)
 	{
-		if (demosaic->allow_half)
+		if (allow_half && CFA_IS_BAYER(filters))
 		{
-			output = rs_image16_new(input->w/2, input->h/2, 3, 4);
-			rs_filter_param_set_boolean(RS_FILTER_PARAM(response), "half-size", TRUE);
-			method = RS_DEMOSAIC_NONE_HALF;
+			shift = get_binning_shift(input, request);
+			RS_DEBUG(PERFORMANCE, "Binning %dx%d by %d", input->w, input->h, 1 << shift);
+			output = rs_image16_new(input->w >> shift, input->h >> shift, 3, 4);
+			rs_filter_param_set_integer(RS_FILTER_PARAM(response), "downscale-shift", shift);
+			method = RS_DEMOSAIC_BINNING;
 		}
 		else
 		{
@@ -249,27 +378,48 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	
 	rs_filter_response_set_image(response, output);
 	g_object_unref(output);
-		
+
+	/* Only interpolate the requested area. Fuji images are rotated after
+	 * us, so the ROI doesn't match our coordinates */
+	if ((method == RS_DEMOSAIC_BILINEAR || method == RS_DEMOSAIC_PPG || method == RS_DEMOSAIC_AHD) && fuji_width <= 0
+		&& get_roi_area(input, rs_filter_request_get_roi(request), filters, &area))
+	{
+		RS_DEBUG(PERFORMANCE, "Demosaicing %dx%d of %dx%d", area.width, area.height, input->w, input->h);
+		input_area = rs_image16_new_subframe(input, &area);
+		output_area = rs_image16_new_subframe(output, &area);
+		area_filters = cfa_filters_offset(filters, area.x, area.y);
+	}
+	else
+	{
+		input_area = g_object_ref(input);
+		output_area = g_object_ref(output);
+		area_filters = filters;
+	}
 
 	switch (method)
 	{
 	  case RS_DEMOSAIC_BILINEAR:
-			lin_interpolate_INDI(input, output, filters, 3);
+			lin_interpolate_INDI(input_area, output_area, area_filters, 3);
 			break;
 	  case RS_DEMOSAIC_PPG:
-			ppg_interpolate_INDI(input,output, filters, 3);
+			ppg_interpolate_INDI(input_area, output_area, area_filters, 3, rs_filter_request_get_cancellable(request));
+			break;
+	  case RS_DEMOSAIC_AHD:
+			ahd_interpolate_INDI(input_area, output_area, area_filters, rs_filter_request_get_cancellable(request));
 			break;
 		case RS_DEMOSAIC_NONE:
-			none_interpolate_INDI(input, output, filters, 3, FALSE);
+			none_interpolate_INDI(input, output, filters, 3, rs_filter_request_get_cancellable(request));
 			break;
-		case RS_DEMOSAIC_NONE_HALF:
-			none_interpolate_INDI(input, output, filters, 3, TRUE);
+		case RS_DEMOSAIC_BINNING:
+			binning_interpolate_INDI(input, output, filters, shift, rs_filter_request_get_cancellable(request));
 			break;
 		default:
 			/* Do nothing */
 			break;
 		}
 
+	g_object_unref(input_area);
+	g_object_unref(output_area);
 	g_object_unref(input);
 	return response;
 }
@@ -349,7 +499,7 @@ lin_interpolate_INDI(RS_IMAGE16 *input, RS_IMAGE16 *output, const unsigned int f
 	t->output = output;
 	t->filters = filters;
 	t->start_y = 0;
-	t->end_y = input->w;
+	t->end_y = input->h;
 
 	expand_cfa_data(t);
 	RS_IMAGE16* image = output;
@@ -391,6 +541,43 @@ lin_interpolate_INDI(RS_IMAGE16 *input, RS_IMAGE16 *output, const unsigned int f
     }
 }
 
+static inline void
+expand_cfa_row(const gushort *src, gushort *dest, const gint width, const gint pixelsize, const gint c_even, const gint c_odd)
+{
+	gint col;
+
+	for(col=0; col < (width & ~1); col+=2)
+	{
+		dest[c_even] = src[0];
+		dest[pixelsize + c_odd] = src[1];
+		dest += pixelsize * 2;
+		src += 2;
+	}
+	if (width & 1)
+		dest[c_even] = src[0];
+}
+
+/* The colours of a 2x2 pattern are constants in these, so nothing is
+ * decoded per pixel */
+#define EXPAND_CFA_2X2(name, c00, c01, c10, c11) \
+static void \
+expand_cfa_data_##name(const ThreadInfo* t) \
+{ \
+	gint row; \
+	for(row=t->start_y; row<t->end_y; row++) \
+	{ \
+		if (row & 1) \
+			expand_cfa_row(GET_PIXEL(t->image, 0, row), GET_PIXEL(t->output, 0, row), t->output->w, t->output->pixelsize, c10, c11); \
+		else \
+			expand_cfa_row(GET_PIXEL(t->image, 0, row), GET_PIXEL(t->output, 0, row), t->output->w, t->output->pixelsize, c00, c01); \
+	} \
+}
+
+EXPAND_CFA_2X2(rggb, 0, 1, 1, 2)
+EXPAND_CFA_2X2(bggr, 2, 1, 1, 0)
+EXPAND_CFA_2X2(grbg, 1, 0, 2, 1)
+EXPAND_CFA_2X2(gbrg, 1, 2, 0, 1)
+
 static void
 expand_cfa_data(const ThreadInfo* t) {
 
@@ -399,6 +586,29 @@ expand_cfa_data(const ThreadInfo* t) {
 	guint filters = t->filters;
 	guint col, row;
 
+	/* Use a specialised version for the common patterns. Pattern bytes are
+	 * the colours of (0,0), (0,1), (1,0) and (1,1), two bits each */
+	if (filters == 0x94949494)
+	{
+		expand_cfa_data_rggb(t);
+		return;
+	}
+	if (filters == 0x16161616)
+	{
+		expand_cfa_data_bggr(t);
+		return;
+	}
+	if (filters == 0x61616161)
+	{
+		expand_cfa_data_grbg(t);
+		return;
+	}
+	if (filters == 0x49494949)
+	{
+		expand_cfa_data_gbrg(t);
+		return;
+	}
+
 	/* Populate new image with bayer data */
 	for(row=t->start_y; row<t->end_y; row++)
 	{
@@ -415,14 +625,13 @@ expand_cfa_data(const ThreadInfo* t) {
 
 /*
    Patterned Pixel Grouping Interpolation by Alain Desbiolles
-*/
-inline guint clampbits16(gint x) { guint32 _y_temp; if( (_y_temp=x>>16) ) x = ~_y_temp >> 16; return x;}
-
-#define CLIP(x) clampbits16(x)
-#define ULIM(x,y,z) ((y) < (z) ? CLAMP(x,y,z) : CLAMP(x,z,y))
 
-static void
-interpolate_INDI_part(ThreadInfo *t)
+   Unlike expand_cfa_data() these passes are not specialised per Bayer
+   pattern: FC() is only evaluated once per row and the colour then just
+   alternates, so inlining constant colours per row measured no faster.
+*/
+void
+interpolate_INDI_green(ThreadInfo *t)
 {
   RS_IMAGE16 *image = t->output;
   const unsigned int filters = t->filters;
@@ -430,41 +639,32 @@ interpolate_INDI_part(ThreadInfo *t)
   /* Subtract 3 from top and bottom  */
   const int start_y = MAX(3, t->start_y);
   const int end_y = MIN(image->h-3, t->end_y);
+  int row, col, c;
+	int p = image->pitch;
+
+/*  Fill in the green layer with gradients and pattern recognition: */
+  for (row=start_y; row < end_y; row++)
+    for (col=3+(FC(row,3) & 1), c=FC(row,col); col < image->w-3; col+=2)
+      ppg_green_pixel((gushort (*)[4])GET_PIXEL(image, col, row), c, p);
+}
+
+static void
+interpolate_INDI_redblue(ThreadInfo *t)
+{
+  RS_IMAGE16 *image = t->output;
+  const unsigned int filters = t->filters;
+
+  /* Green must be ready in the rows above and below */
+  const int start_y = MAX(1, t->start_y);
+  const int end_y = MIN(image->h-1, t->end_y);
   int row, col, c, d;
 	int diffA, diffB, guessA, guessB;
 	int p = image->pitch;
-	int p3 = p*3;
   gushort (*pix)[4];
 
   {
-/*  Fill in the green layer with gradients and pattern recognition: */
-  for (row=start_y; row < end_y; row++)
-    for (col=3+(FC(row,3) & 1), c=FC(row,col); col < image->w-3; col+=2) {
-      pix = (gushort (*)[4])GET_PIXEL(image, col, row);
-
-	guessA = (pix[-1][1] + pix[0][c] + pix[1][1]) * 2
-		      - pix[-2*1][c] - pix[2*1][c];
-	diffA = ( ABS(pix[-2*1][c] - pix[ 0][c]) +
-		    ABS(pix[ 2*1][c] - pix[ 0][c]) +
-		    ABS(pix[  -1][1] - pix[ 1][1]) ) * 3 +
-		  ( ABS(pix[ 3*1][1] - pix[ 1][1]) +
-		    ABS(pix[-3*1][1] - pix[-1][1]) ) * 2;
-
-	guessB = (pix[-p][1] + pix[0][c] + pix[p][1]) * 2
-		      - pix[-2*p][c] - pix[2*p][c];
-	diffB = ( ABS(pix[-2*p][c] - pix[ 0][c]) +
-		    ABS(pix[ 2*p][c] - pix[ 0][c]) +
-		    ABS(pix[  -p][1] - pix[ p][1]) ) * 3 +
-		  ( ABS(pix[ p3][1] - pix[ p][1]) +
-		    ABS(pix[-p3][1] - pix[-p][1]) ) * 2;
-
-		if (diffA > diffB)
-			pix[0][1] = ULIM(guessB >> 2, pix[p][1], pix[-p][1]);
-		else
-			pix[0][1] = ULIM(guessA >> 2, pix[1][1], pix[-1][1]);
-    }
 /*  Calculate red and blue for each green pixel:		*/
-  for (row=start_y-2; row < end_y+2; row++)
+  for (row=start_y; row < end_y; row++)
     for (col=1+(FC(row,2) & 1), c=FC(row,col+1); col < image->w-1; col+=2) {
       pix = (gushort (*)[4])GET_PIXEL(image, col, row);
       pix[0][c] = CLIP((pix[-1][c] + pix[1][c] + 2*pix[0][1]
@@ -476,7 +676,7 @@ interpolate_INDI_part(ThreadInfo *t)
     }
 
 /*  Calculate blue for red pixels and vice versa:		*/
-	for (row=start_y-2; row < end_y+2; row++)
+	for (row=start_y; row < end_y; row++)
 		for (col=1+(FC(row,1) & 1), c=2-FC(row,col); col < image->w-1; col+=2) {
 			pix = (gushort (*)[4])GET_PIXEL(image, col, row);
 			d = 1 + p;
@@ -501,53 +701,327 @@ interpolate_INDI_part(ThreadInfo *t)
 	}
 }
 
-gpointer
-start_interp_thread(gpointer _thread_info)
+/* Rows in a band of hotpixel detection, must be more than the 4 rows read on
+ * either side of a pixel */
+#define HOTPIXEL_BAND 32
+
+typedef struct {
+	const ThreadInfo *t;
+	gint parity;
+} HotpixelInfo;
+
+static void
+hotpixel_part(gint start, gint end, gpointer _hotpixel_info)
 {
-	ThreadInfo* t = _thread_info;
-	hotpixel_detect(t);
-	expand_cfa_data(t);
-	border_interpolate_INDI (t, 3, 3);
-	interpolate_INDI_part(t);
-	g_thread_exit(NULL);
+	HotpixelInfo *h = _hotpixel_info;
+	ThreadInfo t = *h->t;
+	gint band;
 
-	return NULL; /* Make the compiler shut up - we'll never return */
+	for(band = start; band < end; band++)
+	{
+		t.start_y = (band * 2 + h->parity) * HOTPIXEL_BAND;
+		t.end_y = MIN(t.start_y + HOTPIXEL_BAND, t.image->h);
+		hotpixel_detect_func(&t);
+	}
 }
 
+/* Hot pixels are fixed in the CFA data in place, and the fixes are read when
+ * testing pixels up to 4 rows away. Bands next to each other are never done
+ * at the same time, so the result doesn't depend on thread timing */
 static void
-ppg_interpolate_INDI(RS_IMAGE16 *image, RS_IMAGE16 *output, const unsigned int filters, const int colors)
+hotpixel_pass(const ThreadInfo *t, GCancellable *cancellable)
 {
-	guint i, y_offset, y_per_thread, threaded_h;
-	const guint threads = rs_get_number_of_processor_cores();
-	ThreadInfo *t = g_new(ThreadInfo, threads);
+	HotpixelInfo h;
+	const gint bands = (t->image->h + HOTPIXEL_BAND - 1) / HOTPIXEL_BAND;
+
+	h.t = t;
+	for(h.parity = 0; h.parity < 2; h.parity++)
+		rs_parallel_for_cancellable(0, (bands - h.parity + 1) / 2, 1, hotpixel_part, &h, cancellable);
+}
 
-	threaded_h = image->h;
-	y_per_thread = (threaded_h + threads-1)/threads;
-	y_offset = 0;
+static void
+ppg_expand_part(gint start_y, gint end_y, gpointer _thread_info)
+{
+	ThreadInfo t = *(ThreadInfo *) _thread_info;
+	t.start_y = start_y;
+	t.end_y = end_y;
+
+	expand_cfa_data(&t);
+}
+
+static void
+ppg_green_part(gint start_y, gint end_y, gpointer _thread_info)
+{
+	ThreadInfo t = *(ThreadInfo *) _thread_info;
+	t.start_y = start_y;
+	t.end_y = end_y;
+
+	border_interpolate_INDI(&t, 3, 3);
+	interpolate_green_func(&t);
+}
+
+static void
+ppg_redblue_part(gint start_y, gint end_y, gpointer _thread_info)
+{
+	ThreadInfo t = *(ThreadInfo *) _thread_info;
+	t.start_y = start_y;
+	t.end_y = end_y;
+
+	interpolate_INDI_redblue(&t);
+}
 
-	for (i = 0; i < threads; i++)
+static void
+ppg_interpolate_INDI(RS_IMAGE16 *image, RS_IMAGE16 *output, const unsigned int filters, const int colors, GCancellable *cancellable)
+{
+	ThreadInfo t;
+
+	t.image = image;
+	t.output = output;
+	t.filters = filters;
+
+	/* Every pass reads rows interpolated by the pass before, so each pass
+	 * must be complete before the next is started */
+	hotpixel_pass(&t, cancellable);
+	rs_parallel_for_cancellable(0, image->h, 0, ppg_expand_part, &t, cancellable);
+	rs_parallel_for_cancellable(0, image->h, 0, ppg_green_part, &t, cancellable);
+	rs_parallel_for_cancellable(0, image->h, 0, ppg_redblue_part, &t, cancellable);
+}
+
+/*
+   Adaptive Homogeneity-Directed interpolation by Keigo Hirakawa and
+   Thomas Parks, after dcraw.
+
+   The image is processed in tiles that overlap by 6 pixels, all buffers
+   for a tile (26 bytes/pixel) fit in L2 cache. Tiles only write the pixels
+   they own, and only read the CFA colour of each pixel which is never
+   changed, so they can be interpolated in any order.
+*/
+#define AHD_TS 128
+
+/* Tiles start at 2 and advance by AHD_TS-6 while less than size-5 */
+#define AHD_TILES(size) (((size) - 7 + (AHD_TS-6) - 1) / (AHD_TS-6))
+
+/* Converting camera RGB as if it was linear sRGB is good enough to compare
+   homogeneity */
+static gfloat ahd_cbrt[0x10000];
+static gfloat ahd_xyz_cam[3][3];
+
+static void
+ahd_init(void)
+{
+	static const gdouble xyz_rgb[3][3] = {
+		{ 0.412453, 0.357580, 0.180423 },
+		{ 0.212671, 0.715160, 0.072169 },
+		{ 0.019334, 0.119193, 0.950227 } };
+	static const gdouble d65_white[3] = { 0.950456, 1.0, 1.088754 };
+	gint i, j;
+
+	for (i=0; i < 0x10000; i++)
+	{
+		gdouble r = i / 65535.0;
+		ahd_cbrt[i] = r > 0.008856 ? pow(r, 1/3.0) : 7.787*r + 16/116.0;
+	}
+
+	for (i=0; i < 3; i++)
+		for (j=0; j < 3; j++)
+			ahd_xyz_cam[i][j] = xyz_rgb[i][j] / d65_white[i];
+}
+
+static inline void
+ahd_cielab(const gushort rgb[3], gshort lab[3])
+{
+	gfloat xyz[3];
+	gint c;
+
+	for (c=0; c < 3; c++)
+		xyz[c] = 0.5f + ahd_xyz_cam[c][0] * rgb[0] + ahd_xyz_cam[c][1] * rgb[1] + ahd_xyz_cam[c][2] * rgb[2];
+
+	xyz[0] = ahd_cbrt[CLIP((gint) xyz[0])];
+	xyz[1] = ahd_cbrt[CLIP((gint) xyz[1])];
+	xyz[2] = ahd_cbrt[CLIP((gint) xyz[2])];
+	lab[0] = 64 * (116 * xyz[1] - 16);
+	lab[1] = 64 * 500 * (xyz[0] - xyz[1]);
+	lab[2] = 64 * 200 * (xyz[1] - xyz[2]);
+}
+
+static void
+ahd_tile(RS_IMAGE16 *image, const guint filters, gint top, gint left, gchar *buffer)
+{
+	static const gint dir[4] = { -1, 1, -AHD_TS, AHD_TS };
+	const gint width = image->w;
+	const gint height = image->h;
+	const gint p = image->pitch;
+	gint i, j, row, col, tr, tc, c, d, val, hm[2];
+	guint ldiff[2][4], abdiff[2][4], leps, abeps;
+	gushort (*rgb)[AHD_TS][AHD_TS][3], (*rix)[3], (*pix)[4];
+	gshort (*lab)[AHD_TS][AHD_TS][3], (*lix)[3];
+	gchar (*homo)[AHD_TS][AHD_TS];
+
+	rgb  = (gushort (*)[AHD_TS][AHD_TS][3]) buffer;
+	lab  = (gshort (*)[AHD_TS][AHD_TS][3]) (buffer + 12*AHD_TS*AHD_TS);
+	homo = (gchar (*)[AHD_TS][AHD_TS]) (buffer + 24*AHD_TS*AHD_TS);
+
+	/* Interpolate green horizontally and vertically */
+	for (row=top; row < top+AHD_TS && row < height-2; row++)
+	{
+		col = left + (FC(row,left) & 1);
+		for (c = FC(row,col); col < left+AHD_TS && col < width-2; col+=2)
+		{
+			pix = (gushort (*)[4]) GET_PIXEL(image, col, row);
+			val = ((pix[-1][1] + pix[0][c] + pix[1][1]) * 2
+				- pix[-2][c] - pix[2][c]) >> 2;
+			rgb[0][row-top][col-left][1] = ULIM(val, pix[-1][1], pix[1][1]);
+			val = ((pix[-p][1] + pix[0][c] + pix[p][1]) * 2
+				- pix[-2*p][c] - pix[2*p][c]) >> 2;
+			rgb[1][row-top][col-left][1] = ULIM(val, pix[-p][1], pix[p][1]);
+		}
+	}
+
+	/* Interpolate red and blue, and convert to CIELab. The colour only
+	 * depends on the row and if the column is even, so every row is done
+	 * as two runs of pixels of one colour. Pixels only read green
+	 * interpolated above, so the order doesn't matter */
+	for (d=0; d < 2; d++)
+		for (row=top+1; row < top+AHD_TS-1 && row < height-3; row++)
+			for (i=0; i < 2; i++)
+			{
+				const gint f = FC(row, left+1+i);
+
+				if (f == 1)
+				{
+					/* Green, red and blue are found above/below and left/right */
+					c = FC(row+1, left+1+i);
+					for (col=left+1+i; col < left+AHD_TS-1 && col < width-3; col+=2)
+					{
+						pix = (gushort (*)[4]) GET_PIXEL(image, col, row);
+						rix = &rgb[d][row-top][col-left];
+						lix = &lab[d][row-top][col-left];
+						val = pix[0][1] + (( pix[-1][2-c] + pix[1][2-c]
+							- rix[-1][1] - rix[1][1] ) >> 1);
+						rix[0][2-c] = CLIP(val);
+						val = pix[0][1] + (( pix[-p][c] + pix[p][c]
+							- rix[-AHD_TS][1] - rix[AHD_TS][1] ) >> 1);
+						rix[0][c] = CLIP(val);
+						rix[0][1] = pix[0][1];
+						ahd_cielab(rix[0], lix[0]);
+					}
+				}
+				else
+				{
+					/* Red or blue, the other is found diagonally */
+					c = 2 - f;
+					for (col=left+1+i; col < left+AHD_TS-1 && col < width-3; col+=2)
+					{
+						pix = (gushort (*)[4]) GET_PIXEL(image, col, row);
+						rix = &rgb[d][row-top][col-left];
+						lix = &lab[d][row-top][col-left];
+						val = rix[0][1] + (( pix[-p-1][c] + pix[-p+1][c]
+							+ pix[p-1][c] + pix[p+1][c]
+							- rix[-AHD_TS-1][1] - rix[-AHD_TS+1][1]
+							- rix[AHD_TS-1][1] - rix[AHD_TS+1][1] + 1) >> 2);
+						rix[0][c] = CLIP(val);
+						rix[0][f] = pix[0][f];
+						ahd_cielab(rix[0], lix[0]);
+					}
+				}
+			}
+
+	/* Build homogeneity maps from the CIELab images */
+	memset(homo, 0, 2*AHD_TS*AHD_TS);
+	for (row=top+2; row < top+AHD_TS-2 && row < height-4; row++)
 	{
-		t[i].image = image;
-		t[i].output = output;
-		t[i].filters = filters;
-		t[i].start_y = y_offset;
-		y_offset += y_per_thread;
-		y_offset = MIN(image->h, y_offset);
-		t[i].end_y = y_offset;
-
-		t[i].threadid = g_thread_create(start_interp_thread, &t[i], TRUE, NULL);
+		tr = row-top;
+		for (col=left+2; col < left+AHD_TS-2 && col < width-4; col++)
+		{
+			tc = col-left;
+			for (d=0; d < 2; d++)
+			{
+				lix = &lab[d][tr][tc];
+				for (i=0; i < 4; i++)
+				{
+					ldiff[d][i] = ABS(lix[0][0]-lix[dir[i]][0]);
+					abdiff[d][i] = (lix[0][1]-lix[dir[i]][1]) * (lix[0][1]-lix[dir[i]][1])
+						+ (lix[0][2]-lix[dir[i]][2]) * (lix[0][2]-lix[dir[i]][2]);
+				}
+			}
+			leps = MIN(MAX(ldiff[0][0],ldiff[0][1]), MAX(ldiff[1][2],ldiff[1][3]));
+			abeps = MIN(MAX(abdiff[0][0],abdiff[0][1]), MAX(abdiff[1][2],abdiff[1][3]));
+			for (d=0; d < 2; d++)
+				for (i=0; i < 4; i++)
+					if (ldiff[d][i] <= leps && abdiff[d][i] <= abeps)
+						homo[d][tr][tc]++;
+		}
 	}
 
-	/* Wait for threads to finish */
-	for(i = 0; i < threads; i++)
-		g_thread_join(t[i].threadid);
+	/* Combine the most homogenous pixels for the final result */
+	for (row=top+3; row < top+AHD_TS-3 && row < height-5; row++)
+	{
+		tr = row-top;
+		for (col=left+3; col < left+AHD_TS-3 && col < width-5; col++)
+		{
+			tc = col-left;
+			for (d=0; d < 2; d++)
+				for (hm[d]=0, i=tr-1; i <= tr+1; i++)
+					for (j=tc-1; j <= tc+1; j++)
+						hm[d] += homo[d][i][j];
+			pix = (gushort (*)[4]) GET_PIXEL(image, col, row);
+			if (hm[0] != hm[1])
+				for (c=0; c < 3; c++)
+					pix[0][c] = rgb[hm[1] > hm[0]][tr][tc][c];
+			else
+				for (c=0; c < 3; c++)
+					pix[0][c] = (rgb[0][tr][tc][c] + rgb[1][tr][tc][c]) >> 1;
+		}
+	}
+}
+
+static void
+ahd_border_part(gint start_y, gint end_y, gpointer _thread_info)
+{
+	ThreadInfo t = *(ThreadInfo *) _thread_info;
+	t.start_y = start_y;
+	t.end_y = end_y;
 
-	g_free(t);
+	border_interpolate_INDI(&t, 3, 5);
 }
 
+static void
+ahd_tiles_part(gint start, gint end, gpointer _thread_info)
+{
+	ThreadInfo *t = _thread_info;
+	RS_IMAGE16 *image = t->output;
+	const gint tiles_x = AHD_TILES(image->w);
+	gchar *buffer = g_malloc(26*AHD_TS*AHD_TS);
+	gint tile;
+
+	for(tile = start; tile < end; tile++)
+		ahd_tile(image, t->filters, 2 + (tile / tiles_x) * (AHD_TS-6), 2 + (tile % tiles_x) * (AHD_TS-6), buffer);
+
+	g_free(buffer);
+}
+
+static void
+ahd_interpolate_INDI(RS_IMAGE16 *image, RS_IMAGE16 *output, const unsigned int filters, GCancellable *cancellable)
+{
+	ThreadInfo t;
+	gint tiles_x, tiles_y;
+
+	t.image = image;
+	t.output = output;
+	t.filters = filters;
+
+	tiles_x = AHD_TILES(output->w);
+	tiles_y = AHD_TILES(output->h);
+
+	hotpixel_pass(&t, cancellable);
+	rs_parallel_for_cancellable(0, image->h, 0, ppg_expand_part, &t, cancellable);
+	rs_parallel_for_cancellable(0, image->h, 0, ahd_border_part, &t, cancellable);
+	if (tiles_x > 0 && tiles_y > 0)
+		rs_parallel_for_cancellable(0, tiles_x * tiles_y, 1, ahd_tiles_part, &t, cancellable);
+}
 
-gpointer
-start_none_thread(gpointer _thread_info)
+static void
+none_part(gint start_y, gint end_y, gpointer _thread_info)
 {
 	gint row, col;
 	gushort *src;
@@ -558,7 +1032,7 @@ start_none_thread(gpointer _thread_info)
 	gint ors = t->output->rowstride;
 	guint filters = t->filters;
 
-	for(row=t->start_y; row < t->end_y; row++)
+	for(row=start_y; row < end_y; row++)
 	{
 		src = GET_PIXEL(t->image, 0, row);
 		dest = GET_PIXEL(t->output, 0, row);
@@ -614,105 +1088,194 @@ start_none_thread(gpointer _thread_info)
 				dest[2] = dest[-ops+2];
 			}
 		}
-		/*  Duplicate first & last line */
-		if (t->end_y == t->output->h - 1) 
-		{
-			memcpy(GET_PIXEL(t->output, 0, t->end_y), GET_PIXEL(t->output, 0, t->end_y - 1), t->output->rowstride * 2);
-			memcpy(GET_PIXEL(t->output, 0, 0), GET_PIXEL(t->output, 0, 1), t->output->rowstride * 2);
-		}
 	}
-	g_thread_exit(NULL);
-
-	return NULL; /* Make the compiler shut up - we'll never return */
 }
 
 
-gpointer
-start_none_thread_half(gpointer _thread_info)
+static void
+none_interpolate_INDI(RS_IMAGE16 *in, RS_IMAGE16 *out, const unsigned int filters, const int colors, GCancellable *cancellable)
 {
-	gint row, col, i, j;
-	gushort *src;
-	gushort *dest;
+	ThreadInfo t;
 
-	ThreadInfo* t = _thread_info;
-	guint filters = t->filters;
-	gint col_end = t->output->w;
+	t.image = in;
+	t.output = out;
+	t.filters = filters;
 
-	for(row=t->start_y; row < t->end_y; row++)
+	/* Subtract 1 from bottom  */
+	rs_parallel_for_cancellable(0, out->h-1, 0, none_part, &t, cancellable);
+
+	/*  Duplicate first & last line */
+	if (out->h > 2)
 	{
-		gint src_row = row*2;
-		src = GET_PIXEL(t->image, 0, src_row);
-		dest = GET_PIXEL(t->output, 0, row);
-		gushort *g_src = (FC(src_row, 0) == 1) ? &src[0] : &src[1];
-		gushort *r_src = NULL;
-		gushort *b_src = NULL;
-		for(i = src_row; i < src_row + 2; i++)
+		memcpy(GET_PIXEL(out, 0, out->h-1), GET_PIXEL(out, 0, out->h-2), out->rowstride * 2);
+		memcpy(GET_PIXEL(out, 0, 0), GET_PIXEL(out, 0, 1), out->rowstride * 2);
+	}
+}
+
+typedef struct {
+	RS_IMAGE16 *input;
+	RS_IMAGE16 *output;
+	guint filters;
+	gint shift;
+} BinningInfo;
+
+/**
+ * Sums rows of CFA values
+ * @param in The first row to sum
+ * @param pitch The distance between the rows in gushorts
+ * @param rows The number of rows to sum
+ * @param width The number of values in a row
+ * @param sum Where the sum of each column is stored
+ */
+void
+bin_cfa_rows(const gushort *in, gint pitch, gint rows, gint width, guint32 *sum)
+{
+	gint x, i;
+
+	for (x = 0; x < width; x++)
+		sum[x] = in[x];
+
+	for (i = 1; i < rows; i++)
+	{
+		in += pitch;
+		for (x = 0; x < width; x++)
+			sum[x] += in[x];
+	}
+}
+
+static void
+binning_part(gint start_y, gint end_y, gpointer _binning_info)
+{
+	BinningInfo *b = _binning_info;
+	RS_IMAGE16 *input = b->input;
+	RS_IMAGE16 *output = b->output;
+	const guint filters = b->filters;
+	const gint shift = b->shift;
+	const gint size = 1 << shift;
+	const gint width = output->w << shift;
+	gint row, col, i, c;
+
+	/* Blocks start at an even row and column, so the colours of a 2x2
+	 * square are the same for all blocks */
+	const gint colour[4] = { FC(0, 0), FC(0, 1), FC(1, 0), FC(1, 1) };
+
+	/* Red and blue is 1/4 of a block, green 1/2 */
+	const gint rb_shift = shift * 2 - 2;
+	const gint g_shift = shift * 2 - 1;
+
+	/* Column sums of the even and the odd rows of a block */
+	guint32 *even = g_new(guint32, width * 2);
+	guint32 *odd = even + width;
+
+	for (row = start_y; row < end_y; row++)
+	{
+		const gushort *in = GET_PIXEL(input, 0, row << shift);
+		gushort *out = GET_PIXEL(output, 0, row);
+
+		bin_cfa_rows_func(in, input->rowstride * 2, size / 2, width, even);
+		bin_cfa_rows_func(in + input->rowstride, input->rowstride * 2, size / 2, width, odd);
+
+		for (col = 0; col < output->w; col++)
 		{
-			for( j = 0; j < 2; j ++)
+			const guint32 *e = &even[col << shift];
+			const guint32 *o = &odd[col << shift];
+			guint32 square[4] = { 0, 0, 0, 0 };
+			guint32 rgb[3] = { 0, 0, 0 };
+
+			for (i = 0; i < size; i += 2)
 			{
-				if (FC(i, j) == 0)
-					r_src = GET_PIXEL(t->image, j, i);
-				if (FC(i, j) == 2)
-					b_src = GET_PIXEL(t->image, j, i);
+				square[0] += e[i];
+				square[1] += e[i+1];
+				square[2] += o[i];
+				square[3] += o[i+1];
 			}
-		}
-		
-		g_assert(r_src);
-		g_assert(b_src);
-		for(col=0 ; col < col_end; col++)
-		{
-			*dest++ = *r_src;
-			*dest++ = *g_src;
-			*dest++ = *b_src;
-			dest++;
-			r_src+=2;
-			g_src+=2;
-			b_src+=2;
-		}
 
+			for (c = 0; c < 4; c++)
+				rgb[colour[c]] += square[c];
+
+			out[R] = (rgb[R] + ((1 << rb_shift) >> 1)) >> rb_shift;
+			out[G] = (rgb[G] + ((1 << g_shift) >> 1)) >> g_shift;
+			out[B] = (rgb[B] + ((1 << rb_shift) >> 1)) >> rb_shift;
+			out += 4;
+		}
 	}
-	g_thread_exit(NULL);
 
-	return NULL; /* Make the compiler shut up - we'll never return */
+	g_free(even);
 }
 
-
+/* Averages blocks of 2x2, 4x4 or 8x8 pixels of a Bayer image to one RGB
+ * pixel. This is much faster than interpolating, and has less noise and
+ * aliasing than skipping pixels */
 static void
-none_interpolate_INDI(RS_IMAGE16 *in, RS_IMAGE16 *out, const unsigned int filters, const int colors, gboolean half_size)
+binning_interpolate_INDI(RS_IMAGE16 *in, RS_IMAGE16 *out, const unsigned int filters, gint shift, GCancellable *cancellable)
 {
-	guint i, y_offset, y_per_thread, threaded_h;
-	const guint threads = rs_get_number_of_processor_cores();
-	ThreadInfo *t = g_new(ThreadInfo, threads);
+	BinningInfo b;
 
-	/* Subtract 1 from bottom  */
-	threaded_h = out->h-1;
-	y_per_thread = (threaded_h + threads-1)/threads;
-	y_offset = 0;
+	b.input = in;
+	b.output = out;
+	b.filters = filters;
+	b.shift = shift;
 
-	for (i = 0; i < threads; i++)
-	{
-		t[i].image = in;
-		t[i].filters = filters;
-		t[i].start_y = y_offset;
-		t[i].output = out;
-		y_offset += y_per_thread;
-		y_offset = MIN(out->h-1, y_offset);
-		t[i].end_y = y_offset;
-
-		if (half_size)
-			t[i].threadid = g_thread_create(start_none_thread_half, &t[i], TRUE, NULL);
-		else
-			t[i].threadid = g_thread_create(start_none_thread, &t[i], TRUE, NULL);
-	}
-
-	/* Wait for threads to finish */
-	for(i = 0; i < threads; i++)
-		g_thread_join(t[i].threadid);
+	rs_parallel_for_cancellable(0, out->h, 0, binning_part, &b, cancellable);
+}
 
-	g_free(t);
+/* Checks one CFA pixel and replaces it if it is hot, p is two rows and
+ * p_one is one row */
+void
+hotpixel_detect_pixel(gushort *img, gint x, gint p, gint p_one)
+{
+	/* Calculate minimum difference to surrounding pixels */
+	gint left = (int)img[x - 2];
+	gint c = (int)img[x];
+	gint right = (int)img[x + 2];
+	gint up = (int)img[x - p];
+	gint down = (int)img[x + p];
+
+	gint d = ABS(c - left);
+	d = MIN(d, ABS(c - right));
+	d = MIN(d, ABS(c - up));
+	d = MIN(d, ABS(c - down));
+
+	/* Also calculate maximum difference between surrounding pixels themselves */
+	gint d2 = ABS(left - right);
+	d2 = MAX(d2, ABS(up - down));
+
+	/* If difference larger than surrounding pixels by a factor of 4,
+		replace with left/right pixel interpolation */
+
+	if ((d > d2 * 8) && (d > 2000)) {
+		/* Do extended test! */
+		left = (int)img[x - 4];
+		right = (int)img[x + 4];
+		up = (int)img[x - p * 2];
+		down = (int)img[x + p * 2];
+
+		d = MIN(d, ABS(c - left));
+		d = MIN(d, ABS(c - right));
+		d = MIN(d, ABS(c - up));
+		d = MIN(d, ABS(c - down));
+
+		/* Create threshold for surrounding pixels - also include other colors */
+		d2 = MAX(d2, ABS(left - right));
+		d2 = MAX(d2, ABS(up - down));
+		d = MIN(d, ABS(c - (int)img[x - 2 - p]));
+		d = MIN(d, ABS(c - (int)img[x + 2 - p]));
+		d = MIN(d, ABS(c - (int)img[x - 2 + p]));
+		d = MIN(d, ABS(c - (int)img[x + 2 + p]));
+		d2 = MAX(d2, ABS((int)img[x - 1] - (int)img[x + 1]));
+		d2 = MAX(d2, ABS((int)img[x - p_one] - (int)img[x + p_one]));
+		d2 = MAX(d2, ABS((int)img[x - 1 - p_one] - (int)img[x + 1 + p_one]));
+		d2 = MAX(d2, ABS((int)img[x - 1 + p_one] - (int)img[x + 1 - p_one]));
+		d2 = MAX(d2, ABS((int)img[x - 2 - p] - (int)img[x + 2 + p]));
+		d2 = MAX(d2, ABS((int)img[x - 2 + p] - (int)img[x + 2 - p]));
+
+		if ((d > d2 * 4) && (d > 1600)) {
+			img[x] = (gushort)(((gint)img[x-2] + (gint)img[x+2] + 1) >> 1);
+		}
+	}
 }
 
-static void
+void
 hotpixel_detect(const ThreadInfo* t)
 {
 
@@ -728,57 +1291,7 @@ hotpixel_detect(const ThreadInfo* t)
 		gushort* img = GET_PIXEL(image, 0, y);
 		gint p = image->rowstride * 2;
 		gint p_one = image->rowstride;
-		for (x = 4; x < col_end ; x++) {
-			/* Calculate minimum difference to surrounding pixels */
-			gint left = (int)img[x - 2];
-			gint c = (int)img[x];
-			gint right = (int)img[x + 2];
-			gint up = (int)img[x - p];
-			gint down = (int)img[x + p];
-
-			gint d = ABS(c - left);
-			d = MIN(d, ABS(c - right));
-			d = MIN(d, ABS(c - up));
-			d = MIN(d, ABS(c - down));
-
-			/* Also calculate maximum difference between surrounding pixels themselves */
-			gint d2 = ABS(left - right);
-			d2 = MAX(d2, ABS(up - down));
-
-			/* If difference larger than surrounding pixels by a factor of 4,
-				replace with left/right pixel interpolation */
-
-			if ((d > d2 * 8) && (d > 2000)) {
-				/* Do extended test! */
-				left = (int)img[x - 4];
-				right = (int)img[x + 4];
-				up = (int)img[x - p * 2];
-				down = (int)img[x + p * 2];
-
-				d = MIN(d, ABS(c - left));
-				d = MIN(d, ABS(c - right));
-				d = MIN(d, ABS(c - up));
-				d = MIN(d, ABS(c - down));
-
-				/* Create threshold for surrounding pixels - also include other colors */
-				d2 = MAX(d2, ABS(left - right));
-				d2 = MAX(d2, ABS(up - down));
-				d = MIN(d, ABS(c - (int)img[x - 2 - p]));
-				d = MIN(d, ABS(c - (int)img[x + 2 - p]));
-				d = MIN(d, ABS(c - (int)img[x - 2 + p]));
-				d = MIN(d, ABS(c - (int)img[x + 2 + p]));
-				d2 = MAX(d2, ABS((int)img[x - 1] - (int)img[x + 1]));
-				d2 = MAX(d2, ABS((int)img[x - p_one] - (int)img[x + p_one]));
-				d2 = MAX(d2, ABS((int)img[x - 1 - p_one] - (int)img[x + 1 + p_one]));
-				d2 = MAX(d2, ABS((int)img[x - 1 + p_one] - (int)img[x + 1 - p_one]));
-				d2 = MAX(d2, ABS((int)img[x - 2 - p] - (int)img[x + 2 + p]));
-				d2 = MAX(d2, ABS((int)img[x - 2 + p] - (int)img[x + 2 - p]));
-
-				if ((d > d2 * 4) && (d > 1600)) {
-					img[x] = (gushort)(((gint)img[x-2] + (gint)img[x+2] + 1) >> 1);
-				}
-			}
-
-		}
+		for (x = 4; x < col_end ; x++)
+			hotpixel_detect_pixel(img, x, p, p_one);
 	}
 }
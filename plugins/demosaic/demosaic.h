@@ -0,0 +1,96 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef DEMOSAIC_H
+#define DEMOSAIC_H
+
+#include <rawstudio.h>
+
+typedef struct {
+	gint start_y;
+	gint end_y;
+	RS_IMAGE16 *image;
+	RS_IMAGE16 *output;
+	guint filters;
+} ThreadInfo;
+
+/*
+   In order to inline this calculation, I make the risky
+   assumption that all filter patterns can be described
+   by a repeating pattern of eight rows and two columns
+
+   Return values are either 0/1/2/3 = G/M/C/Y or 0/1/2/3 = R/G1/B/G2
+ */
+#define FC(row,col) \
+  (int)(filters >> ((((row) << 1 & 14) + ((col) & 1)) << 1) & 3)
+
+/* 2x2 Bayer patterns, after G2 has been mapped to G1 */
+#define CFA_IS_BAYER(filters) \
+	((filters) == 0x94949494 || (filters) == 0x16161616 || (filters) == 0x61616161 || (filters) == 0x49494949)
+
+static inline guint clampbits16(gint x) { guint32 _y_temp; if( (_y_temp=x>>16) ) x = ~_y_temp >> 16; return x;}
+
+#define CLIP(x) clampbits16(x)
+#define ULIM(x,y,z) ((y) < (z) ? CLAMP(x,y,z) : CLAMP(x,z,y))
+
+/* PPG green at a red or blue pixel of colour c, p is the image pitch */
+static inline void
+ppg_green_pixel(gushort (*pix)[4], const gint c, const gint p)
+{
+	const gint p3 = p*3;
+	gint diffA, diffB, guessA, guessB;
+
+	guessA = (pix[-1][1] + pix[0][c] + pix[1][1]) * 2
+		- pix[-2*1][c] - pix[2*1][c];
+	diffA = ( ABS(pix[-2*1][c] - pix[ 0][c]) +
+		ABS(pix[ 2*1][c] - pix[ 0][c]) +
+		ABS(pix[  -1][1] - pix[ 1][1]) ) * 3 +
+		( ABS(pix[ 3*1][1] - pix[ 1][1]) +
+		ABS(pix[-3*1][1] - pix[-1][1]) ) * 2;
+
+	guessB = (pix[-p][1] + pix[0][c] + pix[p][1]) * 2
+		- pix[-2*p][c] - pix[2*p][c];
+	diffB = ( ABS(pix[-2*p][c] - pix[ 0][c]) +
+		ABS(pix[ 2*p][c] - pix[ 0][c]) +
+		ABS(pix[  -p][1] - pix[ p][1]) ) * 3 +
+		( ABS(pix[ p3][1] - pix[ p][1]) +
+		ABS(pix[-p3][1] - pix[-p][1]) ) * 2;
+
+	if (diffA > diffB)
+		pix[0][1] = ULIM(guessB >> 2, pix[p][1], pix[-p][1]);
+	else
+		pix[0][1] = ULIM(guessA >> 2, pix[1][1], pix[-1][1]);
+}
+
+/* C versions, also used by the SIMD versions for what they can't do */
+extern void hotpixel_detect(const ThreadInfo* t);
+extern void hotpixel_detect_pixel(gushort *img, gint x, gint p, gint p_one);
+extern void interpolate_INDI_green(ThreadInfo *t);
+extern void bin_cfa_rows(const gushort *in, gint pitch, gint rows, gint width, guint32 *sum);
+
+/* The SIMD versions read the CFA values from the input image, they are
+ * the same as the values expanded into the output */
+extern void hotpixel_detect_SSE2(const ThreadInfo* t);
+extern void hotpixel_detect_AVX2(const ThreadInfo* t);
+extern void interpolate_INDI_green_SSE2(ThreadInfo *t);
+extern void interpolate_INDI_green_AVX2(ThreadInfo *t);
+extern void bin_cfa_rows_SSE2(const gushort *in, gint pitch, gint rows, gint width, guint32 *sum);
+extern void bin_cfa_rows_AVX2(const gushort *in, gint pitch, gint rows, gint width, guint32 *sum);
+
+#endif /* DEMOSAIC_H */
@@ -40,6 +40,7 @@ struct _RSDenoise {
 	gulong settings_signal_id;
 
 	FFTDenoiseInfo info;
+	GMutex *info_lock; /* The denoiser works on one image at a time */
 	gint sharpen;
 	gint denoise_luma;
 	gint denoise_chroma;
@@ -78,6 +79,7 @@ finalize(GObject *object)
 {
 	RSDenoise *denoise = RS_DENOISE(object);
 	destroyDenoiser(&denoise->info);
+	g_mutex_free(denoise->info_lock);
 	if (denoise->settings && denoise->settings_signal_id)
 	{
 		g_signal_handler_disconnect(denoise->settings, denoise->settings_signal_id);
@@ -146,6 +148,7 @@ rs_denoise_init(RSDenoise *denoise)
 {
 	denoise->info.processMode = PROCESS_YUV;
 	initDenoiser(&denoise->info);
+	denoise->info_lock = g_mutex_new();
 	denoise->sharpen = 0;
 	denoise->denoise_luma = 0;
 	denoise->denoise_chroma = 0;
@@ -224,6 +227,12 @@ bit_blt(char* dstp, int dst_pitch, const char* srcp, int src_pitch, int row_size
 }
 
 
+static void
+abort_denoise(GCancellable *cancellable, FFTDenoiseInfo *info)
+{
+	abortDenoiser(info);
+}
+
 static RSFilterResponse *
 get_image(RSFilter *filter, const RSFilterRequest *request)
 {
@@ -234,6 +243,12 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	RS_IMAGE16 *input;
 	RS_IMAGE16 *output;
 	RS_IMAGE16 *tmp;
+	GCancellable *cancellable;
+	gulong handler = 0;
+	gboolean exclusive;
+	RSImage *output_float = NULL;
+	gint output_x = 0;
+	gint output_y = 0;
 
 	previous_response = rs_filter_get_image(filter->previous, request);
 
@@ -263,27 +278,60 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	gfloat scale = 1.0;
 	rs_filter_get_recursive(RS_FILTER(denoise), "scale", &scale, NULL);
 
-	if ((roi = rs_filter_request_get_roi(request)))
+	/* If the next filter can take float data, we can skip converting back to
+	 * 16 bit, and we don't touch the input */
+	if (rs_filter_request_get_float_allowed(request, filter) && input->channels == 3)
 	{
-		/* Align so we start at even pixel counts */
-		roi->width += (roi->x&1);
-		roi->x -= (roi->x&1);
-		roi->width = MIN(input->w - roi->x, roi->width);
-		output = rs_image16_copy(input, FALSE);
-		tmp = rs_image16_new_subframe(output, roi);
-		bit_blt((char*)GET_PIXEL(tmp,0,0), tmp->rowstride * 2, 
-			(const char*)GET_PIXEL(input,roi->x,roi->y), input->rowstride * 2, tmp->w * tmp->pixelsize * 2, tmp->h);
+		output_float = rs_image_new(input->w, input->h, 3);
+		if ((roi = rs_filter_request_get_roi(request)))
+		{
+			/* Align so we start at even pixel counts */
+			roi->width += (roi->x&1);
+			roi->x -= (roi->x&1);
+			roi->width = MIN(input->w - roi->x, roi->width);
+			tmp = rs_image16_new_subframe(input, roi);
+		}
+		else
+			tmp = g_object_ref(input);
+		output_x = roi ? roi->x : 0;
+		output_y = roi ? roi->y : 0;
+		rs_filter_response_set_float_image(response, output_float);
+		g_object_unref(output_float);
+		g_object_unref(input);
 	}
 	else
 	{
-		output = rs_image16_copy(input, TRUE);
-		tmp = g_object_ref(output);
-	}
+		/* If nobody else is using the input, we can denoise in place */
+		exclusive = rs_image16_is_exclusive(input);
 
-	g_object_unref(input);
-	rs_filter_response_set_image(response, output);
-	g_object_unref(output);
+		if ((roi = rs_filter_request_get_roi(request)))
+		{
+			/* Align so we start at even pixel counts */
+			roi->width += (roi->x&1);
+			roi->x -= (roi->x&1);
+			roi->width = MIN(input->w - roi->x, roi->width);
+			output = exclusive ? g_object_ref(input) : rs_image16_copy(input, FALSE);
+			tmp = rs_image16_new_subframe(output, roi);
+			if (!exclusive)
+				bit_blt((char*)GET_PIXEL(tmp,0,0), tmp->rowstride * 2, 
+					(const char*)GET_PIXEL(input,roi->x,roi->y), input->rowstride * 2, tmp->w * tmp->pixelsize * 2, tmp->h);
+		}
+		else
+		{
+			output = exclusive ? g_object_ref(input) : rs_image16_copy(input, TRUE);
+			tmp = g_object_ref(output);
+		}
+
+		g_object_unref(input);
+		rs_filter_response_set_image(response, output);
+		g_object_unref(output);
+	}
 
+	/* Requests for this instance may come from several threads */
+	g_mutex_lock(denoise->info_lock);
+	denoise->info.outputFloat = output_float;
+	denoise->info.outputX = output_x;
+	denoise->info.outputY = output_y;
 	denoise->info.image = tmp;
 	denoise->info.sigmaLuma = ((float) denoise->denoise_luma * scale) / 3.0;
 	denoise->info.sigmaChroma = ((float) denoise->denoise_chroma * scale) / 2.0;
@@ -297,7 +345,19 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	denoise->info.redCorrection = 1.0f;
 	denoise->info.blueCorrection = 1.0f;
 
-	denoiseImage(&denoise->info);
+	/* Let the denoiser know if we get cancelled while it works. An earlier
+	 * abort must be cleared before, or we could clear this one */
+	resetDenoiser(&denoise->info);
+	cancellable = rs_filter_request_get_cancellable(request);
+	if (cancellable)
+		handler = g_cancellable_connect(cancellable, G_CALLBACK(abort_denoise), &denoise->info, NULL);
+
+	if (!rs_filter_request_is_cancelled(request))
+		denoiseImage(&denoise->info);
+
+	if (cancellable)
+		g_cancellable_disconnect(cancellable, handler);
+	g_mutex_unlock(denoise->info_lock);
 	g_object_unref(tmp);
 
 	return response;
@@ -54,6 +54,9 @@ typedef struct {
 
   float redCorrection;          // Red coefficient, multiplid to R in YUV conversion. (default: 1.0)
   float blueCorrection;         // Blue coefficient, multiplid to R in YUV conversion. (default: 1.0)
+  RSImage* outputFloat;         // If set, output is written here as float planar RGB and image is left untouched. (default: NULL)
+  int outputX;                  // Position of image in outputFloat.
+  int outputY;
   void* _this;                  // Do not modify this value.
 } FFTDenoiseInfo;
 
@@ -61,6 +64,7 @@ void initDenoiser(FFTDenoiseInfo* info);
 void denoiseImage(FFTDenoiseInfo* info);
 void destroyDenoiser(FFTDenoiseInfo* info);
 void abortDenoiser(FFTDenoiseInfo* info);
+void resetDenoiser(FFTDenoiseInfo* info);
 
 #ifdef _unix_
 G_END_DECLS
@@ -105,6 +105,12 @@ void DenoiseThread::runDenoise() {
               job->img->packInterleavedYUV(job);
               break;
             }
+          case JOB_CONVERT_FROMFLOAT_YUV_PLANAR:
+            {
+              ImgConvertJob *job = (ImgConvertJob*)j;
+              job->img->packPlanarYUV(job);
+              break;
+            }
           case JOB_CONVERT_TOFLOAT_YUV: 
             {
               ImgConvertJob *job = (ImgConvertJob*)j;
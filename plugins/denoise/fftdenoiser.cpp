@@ -33,6 +33,9 @@ FFTDenoiser::FFTDenoiser(void)
 {
   nThreads = rs_get_number_of_processor_cores();
   threads = new DenoiseThread[nThreads];
+  outputFloat = 0;
+  wroteFloat = false;
+  abort = false;
   initializeFFT();
   FloatPlanarImage::initConvTable();
 }
@@ -87,7 +90,16 @@ void FFTDenoiser::denoiseImage( RS_IMAGE16* image )
 
   // Convert back
   if (image->channels > 1 && image->filters==0) {
-     outImg.packInterleaved(image);
+    if (outputFloat) {
+      // Input must be left untouched
+      RS_IMAGE16 *tmp = rs_image16_copy(image, FALSE);
+      outImg.packInterleaved(tmp);
+      copyToFloat(tmp);
+      g_object_unref(tmp);
+      wroteFloat = true;
+    } else {
+      outImg.packInterleaved(image);
+    }
   }
 }
 
@@ -179,6 +191,28 @@ void FFTDenoiser::setParameters( FFTDenoiseInfo *info )
   sharpenCutoff = info->sharpenCutoffLuma;
   sharpenMinSigma = info->sharpenMinSigmaLuma*SIGMA_FACTOR;
   sharpenMaxSigma = info->sharpenMaxSigmaLuma*SIGMA_FACTOR;
+  outputFloat = info->outputFloat;
+  outputX = info->outputX;
+  outputY = info->outputY;
+}
+
+// Used when the image could not be denoised, or the denoiser can only
+// write 16 bit output.
+void FFTDenoiser::copyToFloat( RS_IMAGE16* image )
+{
+  const int planar_w = rs_image_get_width(outputFloat);
+  const int planes = MIN((int)image->channels, rs_image_get_number_of_planes(outputFloat));
+
+  for (int c = 0; c < planes; c++) {
+    for (int y = 0; y < image->h; y++ ) {
+      const gushort* in = GET_PIXEL(image,0,y) + c;
+      gfloat* out = rs_image_get_plane(outputFloat, c) + (y + outputY) * planar_w + outputX;
+      for (int x=0; x<image->w; x++) {
+        out[x] = (float)*in * (1.0f/65535.0f);
+        in += image->pixelsize;
+      }
+    }
+  }
 }
 
 }}// namespace RawStudio::FFTFilter
@@ -215,13 +249,18 @@ extern "C" {
     info->sharpenMaxSigmaChroma = 20.0f;
     info->redCorrection = 1.0f;
     info->blueCorrection = 1.0f;
+    info->outputFloat = NULL;
+    info->outputX = 0;
+    info->outputY = 0;
   }
 
   void denoiseImage(FFTDenoiseInfo* info) {
     RawStudio::FFTFilter::FFTDenoiser *t = (RawStudio::FFTFilter::FFTDenoiser*)info->_this;  
-    t->abort = false;
+    t->wroteFloat = false;
     t->setParameters(info);
     t->denoiseImage(info->image);
+    if (info->outputFloat && !t->wroteFloat && !t->abort)
+      t->copyToFloat(info->image);
   }
 
   void destroyDenoiser(FFTDenoiseInfo* info) {
@@ -234,5 +273,10 @@ extern "C" {
     t->abort = true;
   }
 
+  void resetDenoiser(FFTDenoiseInfo* info) {
+    RawStudio::FFTFilter::FFTDenoiser *t = (RawStudio::FFTFilter::FFTDenoiser*)info->_this;
+    t->abort = false;
+  }
+
 } // extern "C"
 
@@ -39,7 +39,9 @@ public:
   gboolean initializeFFT();
   virtual void setParameters( FFTDenoiseInfo *info);
   virtual void denoiseImage(RS_IMAGE16* image);
+  void copyToFloat(RS_IMAGE16* image);
   gboolean abort;
+  gboolean wroteFloat;      // Set by denoiseImage() if the result was written to outputFloat
 protected:
   virtual void processJobs(FloatPlanarImage &img, FloatPlanarImage &outImg);
   void waitForJobs(JobQueue *waiting_jobs);
@@ -53,6 +55,9 @@ protected:
   float sharpenCutoff;      
   float sharpenMinSigma;  
   float sharpenMaxSigma;
+  RSImage *outputFloat;
+  int outputX;
+  int outputY;
 };
 
 }} // namespace RawStudio::FFTFilter
@@ -76,7 +76,12 @@ void FFTDenoiserYUV::denoiseImage( RS_IMAGE16* image )
   if (abort) return;
 
   // Convert back
-  waitForJobs(outImg.getPackInterleavedYUVJobs(image));
+  if (outputFloat) {
+    waitForJobs(outImg.getPackPlanarYUVJobs(image, outputFloat, outputX, outputY));
+    wroteFloat = true;
+  } else {
+    waitForJobs(outImg.getPackInterleavedYUVJobs(image));
+  }
 }
 
 
@@ -273,6 +273,65 @@ void FloatPlanarImage::packInterleavedYUV( const ImgConvertJob* j)
   }
 }
 
+JobQueue* FloatPlanarImage::getPackPlanarYUVJobs(RS_IMAGE16* image, RSImage* planar, int x, int y) {
+  JobQueue* queue = new JobQueue();
+
+  if (image->channels != 3 || rs_image_get_number_of_planes(planar) != 3)
+    return queue;
+
+  g_assert(x + image->w <= rs_image_get_width(planar));
+  g_assert(y + image->h <= rs_image_get_height(planar));
+
+  int threads = rs_get_number_of_processor_cores()*4;
+  int hEvery = MAX(1,(image->h+threads)/threads);
+  for (int i = 0; i < threads; i++) {
+    ImgConvertJob *j = new ImgConvertJob(this,JOB_CONVERT_FROMFLOAT_YUV_PLANAR);
+    j->start_y = i*hEvery;
+    j->end_y = MIN((i+1)*hEvery,image->h);
+    j->rs = image;
+    j->planar = planar;
+    j->planar_x = x;
+    j->planar_y = y;
+    queue->addJob(j);
+  }
+  return queue;
+}
+
+// Same as packInterleavedYUV, but writes one float plane per colour, so the
+// next filter doesn't have to convert back. Plain loops, the compiler
+// vectorizes these fine since nothing is interleaved.
+void FloatPlanarImage::packPlanarYUV( const ImgConvertJob* j)
+{
+  RS_IMAGE16* image = j->rs;
+  const int planar_w = rs_image_get_width(j->planar);
+  gfloat r_factor = (1.0f/redCorrection) * (1.0f/65535.0f);
+  gfloat g_factor = (1.0f/65535.0f);
+  gfloat b_factor = (1.0f/blueCorrection) * (1.0f/65535.0f);
+  for (int y = j->start_y; y < j->end_y; y++ ) {
+    gfloat *Y = p[0]->getAt(ox, y+oy);
+    gfloat *Cb = p[1]->getAt(ox, y+oy);
+    gfloat *Cr = p[2]->getAt(ox, y+oy);
+    const int offset = (y + j->planar_y) * planar_w + j->planar_x;
+    gfloat *out_r = rs_image_get_plane(j->planar, 0) + offset;
+    gfloat *out_g = rs_image_get_plane(j->planar, 1) + offset;
+    gfloat *out_b = rs_image_get_plane(j->planar, 2) + offset;
+    for (int x=0; x<image->w; x++) {
+      float cr = Cr[x];
+      float cb = Cb[x];
+      if (cr > 0.0f) /* 50% Stronger denoise on red/blue */
+        cr += cr;
+      if (cb > 0.0f)
+        cb += cb;
+      float fr = (Y[x] + 1.402f * cr);
+      float fg = Y[x] - 0.344f * cb - 0.714f * cr;
+      float fb = (Y[x] + 1.772f * cb) ;
+      /* Clamp like the 16 bit version, to give the same result */
+      out_r[x] = MIN(fr*fr*r_factor, 1.0f);
+      out_g[x] = MIN(fg*fg*g_factor, 1.0f);
+      out_b[x] = MIN(fb*fb*b_factor, 1.0f);
+    }
+  }
+}
 
 JobQueue* FloatPlanarImage::getJobs(FloatPlanarImage &outImg) {
   JobQueue *jobs = new JobQueue();
@@ -59,6 +59,8 @@ public:
   void packInterleavedYUV( const ImgConvertJob* j);
   JobQueue* getUnpackInterleavedYUVJobs(RS_IMAGE16* image);
   JobQueue* getPackInterleavedYUVJobs(RS_IMAGE16* image);
+  void packPlanarYUV( const ImgConvertJob* j);
+  JobQueue* getPackPlanarYUVJobs(RS_IMAGE16* image, RSImage* planar, int x, int y);
   FloatImagePlane* getPlaneSliceFrom(int plane, int x, int y);
 
   int bw;  // Block width
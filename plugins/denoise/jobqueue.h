@@ -32,7 +32,8 @@ using namespace std;
 typedef enum {
   JOB_FFT,
   JOB_CONVERT_TOFLOAT_YUV,
-  JOB_CONVERT_FROMFLOAT_YUV
+  JOB_CONVERT_FROMFLOAT_YUV,
+  JOB_CONVERT_FROMFLOAT_YUV_PLANAR
 } JobType;
 
 class Job 
@@ -58,6 +59,9 @@ public:
   ImgConvertJob(FloatPlanarImage *_img, JobType _type) : Job(_type), img(_img) {};
   virtual ~ImgConvertJob(void) {};
   RS_IMAGE16 *rs;
+  RSImage *planar;   // Output for JOB_CONVERT_FROMFLOAT_YUV_PLANAR
+  int planar_x;
+  int planar_y;
   FloatPlanarImage *img;
   int start_y;
   int end_y;
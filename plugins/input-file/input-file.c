@@ -131,8 +131,9 @@ set_property (GObject *object, guint property_id, const GValue *value, GParamSpe
 				if (rs_filter_response_has_image(response))
 					input->image = rs_filter_response_get_image(response);
 				g_object_unref(response);
-				rs_filter_changed(RS_FILTER(input), RS_FILTER_CHANGED_DIMENSION);
 			}
+			/* Even failing to load changes our size */
+			rs_filter_changed(RS_FILTER(input), RS_FILTER_CHANGED_DIMENSION);
 			break;
 		case PROP_COLOR_SPACE:
 			if (input->colorspace)
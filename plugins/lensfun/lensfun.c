@@ -355,17 +355,20 @@ typedef struct {
 	lfModifier *mod;
 	RS_IMAGE16 *input;
 	RS_IMAGE16 *output;
-	GThread *threadid;
 	gint effective_flags;
 	GdkRectangle *roi;
 	gint stage;
 } ThreadInfo;
 
-static gpointer
-thread_func(gpointer _thread_info)
+static void
+lensfun_part(gint start_y, gint end_y, gpointer _thread_info)
 {
 	gint x, y;
-	ThreadInfo* t = _thread_info;
+	ThreadInfo t_local = *(ThreadInfo *) _thread_info;
+	ThreadInfo* t = &t_local;
+
+	t->start_y = start_y;
+	t->end_y = end_y;
 
 	if (t->stage == 2) 
 	{
@@ -377,7 +380,7 @@ thread_func(gpointer _thread_info)
 				LF_CR_4 (RED, GREEN, BLUE, UNKNOWN),
 				t->input->rowstride*2);
 		}
-		return NULL;
+		return;
 	}
 
 	gboolean sse2_available = !!(rs_detect_cpu_features() & RS_CPU_FLAG_SSE2) && is_sse2_compiled();
@@ -439,7 +442,6 @@ thread_func(gpointer _thread_info)
 		}
 		g_free(pos);
 	}
-	return NULL;
 }
 
 
@@ -455,8 +457,16 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	const gchar *model = NULL;
 	GdkRectangle *roi, *vign_roi;
 
-
-	previous_response = rs_filter_get_image(filter->previous, request);
+	/* Corrections read the input well outside the ROI, ask for all of it */
+	if (!rs_filter_request_get_quick(request) && rs_filter_request_get_roi(request))
+	{
+		RSFilterRequest *previous_request = rs_filter_request_clone(request);
+		rs_filter_request_set_roi(previous_request, NULL);
+		previous_response = rs_filter_get_image(filter->previous, previous_request);
+		g_object_unref(previous_request);
+	}
+	else
+		previous_response = rs_filter_get_image(filter->previous, request);
 	input = rs_filter_response_get_image(previous_response);
 	response = rs_filter_response_clone(previous_response);
 	g_object_unref(previous_response);
@@ -475,8 +485,6 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	if (!RS_IS_IMAGE16(input))
 		return response;
 
-	gint i;
-
 	if (!lensfun->ldb)
 	{
 		g_warning ("Failed to create database");
@@ -657,76 +665,40 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 			
 		if (effective_flags > 0)
 		{
-			const guint threads = rs_get_number_of_processor_cores();
-			ThreadInfo *t = g_new(ThreadInfo, threads);
+			ThreadInfo t;
 
-			/* Set up job description for individual threads */
-			for (i = 0; i < threads; i++)
-			{
-				t[i].mod = mod;
-				t[i].effective_flags = effective_flags;
-			}
+			/* Set up job description for the workers */
+			t.mod = mod;
+			t.effective_flags = effective_flags;
 
-			/* Start threads to apply phase 2, Vignetting and CA Correction */
+			/* Apply phase 2, Vignetting and CA Correction */
 			if (effective_flags & (LF_MODIFY_VIGNETTING | LF_MODIFY_CCI)) 
 			{
-				/* Phase 2 is corrected inplace, so copy input first */
-				guint y_offset, y_per_thread, threaded_h;
-				threaded_h = vign_roi->height;
-				y_per_thread = (threaded_h + threads-1)/threads;
-				y_offset = vign_roi->y;
-				output = rs_image16_copy(input, TRUE);
-				g_object_unref(input);
-				for (i = 0; i < threads; i++)
-				{
-					t[i].input = t[i].output = output;
-					t[i].stage = 2;
-					t[i].roi = vign_roi;
-					t[i].start_y = y_offset;
-					y_offset += y_per_thread;
-					y_offset = MIN(vign_roi->y + vign_roi->height, y_offset);
-					t[i].end_y = y_offset;
-					t[i].threadid = g_thread_create(thread_func, &t[i], TRUE, NULL);
-				}
-				
-				/* Wait for threads to finish */
-				for(i = 0; i < threads; i++)
-					g_thread_join(t[i].threadid);
+				/* Phase 2 is corrected inplace, so copy input first if shared */
+				output = rs_image16_make_writable(input, TRUE);
+				t.input = t.output = output;
+				t.stage = 2;
+				t.roi = vign_roi;
+				rs_parallel_for_cancellable(vign_roi->y, vign_roi->y + vign_roi->height, 0, lensfun_part, &t, rs_filter_request_get_cancellable(request));
 
 				input = output;
 			}
 			
-			/* Start threads to apply phase 1+3, Chromatic abberation and distortion Correction */
+			/* Apply phase 1+3, Chromatic abberation and distortion Correction */
 			if (effective_flags & (LF_MODIFY_TCA | LF_MODIFY_DISTORTION | LF_MODIFY_GEOMETRY)) 
 			{
-				guint y_offset, y_per_thread, threaded_h;
 				output = rs_image16_copy(input, FALSE);
-				threaded_h = roi->height;
-				y_per_thread = (threaded_h + threads-1)/threads;
-				y_offset = roi->y;
-
-				for (i = 0; i < threads; i++)
-				{
-					t[i].input = input;
-					t[i].output = output;
-					t[i].roi = roi;
-					t[i].start_y = y_offset;
-					y_offset += y_per_thread;
-					y_offset = MIN(roi->y + roi->height, y_offset);
-					t[i].end_y = y_offset;
-					t[i].stage = 3;
-					t[i].threadid = g_thread_create(thread_func, &t[i], TRUE, NULL);
-				}
-				
-				/* Wait for threads to finish */
-				for(i = 0; i < threads; i++)
-					g_thread_join(t[i].threadid);
+				t.input = input;
+				t.output = output;
+				t.roi = roi;
+				t.stage = 3;
+				rs_parallel_for_cancellable(roi->y, roi->y + roi->height, 0, lensfun_part, &t, rs_filter_request_get_cancellable(request));
 			}
 			else
 			{
-				output = rs_image16_copy(input, TRUE);
+				/* Nothing more to do, deliver the image as is */
+				output = g_object_ref(input);
 			}
-			g_free(t);
 			rs_filter_response_set_image(response, output);
 			g_object_unref(output);
 		}
@@ -2026,6 +2026,11 @@ raw_thumbnail_reader(const gchar *service, RSMetadata *meta)
 	rs_filter_request_set_roi(request, FALSE);
 	rs_filter_request_set_quick(request, TRUE);
 
+	/* Let demosaic bin the image to a size close to the thumbnail */
+	gint raw_width, raw_height;
+	if (rs_filter_get_size_simple(fdemosaic, request, &raw_width, &raw_height) && raw_width > 0 && raw_height > 0)
+		rs_filter_param_set_float(RS_FILTER_PARAM(request), "demosaic-scale", 256.0f / MAX(raw_width, raw_height));
+
 
 	if (dcp)
 	{
@@ -25,6 +25,7 @@
 #endif
 #include <jpeglib.h>
 #include <gettext.h>
+#include <glib/gstdio.h> /* g_unlink() */
 
 /* stat() */
 #include <sys/types.h>
@@ -217,6 +218,50 @@ rs_jpeg_write_icc_profile(j_compress_ptr cinfo, const JOCTET *icc_data_ptr, guin
 	return;
 }
 
+typedef struct {
+	struct jpeg_compress_struct *cinfo;
+	guchar *line;
+} StripInfo;
+
+/* Compresses a strip of the image as soon as it's rendered, so we never
+ * need the complete 8 bit image in memory */
+static gboolean
+write_strip(RSFilter *filter, RSFilterResponse *response, const GdkRectangle *tile, gpointer user_data)
+{
+	StripInfo *info = user_data;
+	GdkPixbuf *pixbuf = rs_filter_response_get_image8(response);
+	JSAMPROW row_pointer[1];
+	gint x, y;
+
+	if (!pixbuf)
+		return FALSE;
+
+	const gint channels = gdk_pixbuf_get_n_channels(pixbuf);
+	row_pointer[0] = info->line;
+
+	rs_io_lock();
+	for(y = tile->y; y < tile->y + tile->height; y++)
+	{
+		const guchar *in = GET_PIXBUF_PIXEL(pixbuf, tile->x, y);
+		guchar *o = info->line;
+		for(x = 0; x < tile->width; x++)
+		{
+			o[0] = in[R];
+			o[1] = in[G];
+			o[2] = in[B];
+			in += channels;
+			o += 3;
+		}
+		if (jpeg_write_scanlines(info->cinfo, row_pointer, 1) != 1)
+			break;
+	}
+	rs_io_unlock();
+
+	g_object_unref(pixbuf);
+
+	return (y == tile->y + tile->height);
+}
+
 static gboolean
 execute(RSOutput *output, RSFilter *filter)
 {
@@ -224,26 +269,31 @@ execute(RSOutput *output, RSFilter *filter)
 	struct jpeg_compress_struct cinfo;
 	struct jpeg_error_mgr jerr;
 	FILE * outfile;
-	JSAMPROW row_pointer[1];
-	gint x,y;
-	
+	StripInfo info;
+	gint width, height;
+	gboolean complete;
 	
 	RSFilterRequest *request = rs_filter_request_new();
 	rs_filter_request_set_quick(RS_FILTER_REQUEST(request), FALSE);
 	rs_filter_param_set_object(RS_FILTER_PARAM(request), "colorspace", jpegfile->color_space);
-	RSFilterResponse *response = rs_filter_get_image8(filter, request);
-	
-	g_object_unref(request);
-	GdkPixbuf *pixbuf = rs_filter_response_get_image8(response);
-	g_object_unref(response);
+
+	if (!rs_filter_get_size_simple(filter, request, &width, &height))
+	{
+		g_object_unref(request);
+		return(FALSE);
+	}
 
 	cinfo.err = jpeg_std_error(&jerr);
 	jpeg_create_compress(&cinfo);
 	if ((outfile = fopen(jpegfile->filename, "wb")) == NULL)
+	{
+		jpeg_destroy_compress(&cinfo);
+		g_object_unref(request);
 		return(FALSE);
+	}
 	jpeg_stdio_dest(&cinfo, outfile);
-	cinfo.image_width = gdk_pixbuf_get_width(pixbuf);
-	cinfo.image_height = gdk_pixbuf_get_height(pixbuf);
+	cinfo.image_width = width;
+	cinfo.image_height = height;
 	cinfo.input_components = 3;
 	cinfo.in_color_space = JCS_RGB;
 	jpeg_set_defaults(&cinfo);
@@ -262,35 +312,30 @@ execute(RSOutput *output, RSFilter *filter)
 			g_free(data);
 		}
 	}
+	rs_io_unlock();
 
-	if (gdk_pixbuf_get_n_channels(pixbuf) == 4)
-	{
-		GdkPixbuf *out = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, cinfo.image_width, cinfo.image_height);
-		for( y = 0; y < cinfo.image_height; y++){
-			gint* in = (gint*)GET_PIXBUF_PIXEL(pixbuf, 0, y);
-			guchar* o = GET_PIXBUF_PIXEL(out, 0, y);
-			for( x = 0; x < cinfo.image_width ; x++) {
-				guint i = *in++;
-				o[0] = i&0xff;
-				o[1] = (i>>8)&0xff;
-				o[2] = (i>>16)&0xff;
-				o+=3;
-			}
-		}
-		g_object_unref(pixbuf);
-		pixbuf = out;
-	}
+	/* Render full width strips, the filters before us only have to render
+	 * RS_FILTER_TILE_SIZE rows of 8 bit data at a time */
+	info.cinfo = &cinfo;
+	info.line = g_new(guchar, width * 3);
+	complete = rs_filter_get_image8_tiled(filter, request, width, RS_FILTER_TILE_SIZE, write_strip, &info);
+	g_free(info.line);
+	g_object_unref(request);
 
-	while (cinfo.next_scanline < cinfo.image_height)
+	rs_io_lock();
+	if (!complete || cinfo.next_scanline < cinfo.image_height)
 	{
-		row_pointer[0] = GET_PIXBUF_PIXEL(pixbuf, 0, cinfo.next_scanline);
-		if (jpeg_write_scanlines(&cinfo, row_pointer, 1) != 1)
-			break;
+		/* Don't leave half an image behind */
+		jpeg_abort_compress(&cinfo);
+		fclose(outfile);
+		jpeg_destroy_compress(&cinfo);
+		g_unlink(jpegfile->filename);
+		rs_io_unlock();
+		return(FALSE);
 	}
 	jpeg_finish_compress(&cinfo);
 	fclose(outfile);
 	jpeg_destroy_compress(&cinfo);
-	g_object_unref(pixbuf);
 
 	gchar *input_filename = NULL;
 	rs_filter_get_recursive(filter, "filename", &input_filename, NULL);
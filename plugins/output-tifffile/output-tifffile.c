@@ -21,6 +21,7 @@
 #include <rawstudio.h>
 #include <tiffio.h>
 #include <gettext.h>
+#include <glib/gstdio.h> /* g_unlink() */
 
 #define RS_TYPE_TIFFFILE (rs_tifffile_type)
 #define RS_TIFFFILE(obj) (G_TYPE_CHECK_INSTANCE_CAST ((obj), RS_TYPE_TIFFFILE, RSTifffile))
@@ -208,86 +209,138 @@ rs_tiff_generic_init(TIFF *output, guint w, guint h, const guint samples_per_pix
 	TIFFSetField(output, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(output, 0));
 }
 
+typedef struct {
+	TIFF *tiff;
+	gpointer line;
+} StripInfo;
+
+/* Writes a strip of the image as soon as it's rendered, so we never need
+ * the complete output image in memory */
+static gboolean
+write_strip16(RSFilter *filter, RSFilterResponse *response, const GdkRectangle *tile, gpointer user_data)
+{
+	StripInfo *info = user_data;
+	RS_IMAGE16 *image = rs_filter_response_get_image(response);
+	gushort *line = info->line;
+	gboolean ret = TRUE;
+	gint row, col;
+
+	if (!image)
+		return FALSE;
+
+	g_assert(image->channels == 3);
+	g_assert(image->pixelsize == 4);
+
+	rs_io_lock();
+	for(row = tile->y; ret && (row < tile->y + tile->height); row++)
+	{
+		gushort *buf = GET_PIXEL(image, tile->x, row);
+		for(col = 0; col < tile->width; col++)
+		{
+			line[col*3 + R] = buf[col*4 + R];
+			line[col*3 + G] = buf[col*4 + G];
+			line[col*3 + B] = buf[col*4 + B];
+		}
+		ret = (TIFFWriteScanline(info->tiff, line, row, 0) == 1);
+	}
+	rs_io_unlock();
+
+	g_object_unref(image);
+
+	return ret;
+}
+
+static gboolean
+write_strip8(RSFilter *filter, RSFilterResponse *response, const GdkRectangle *tile, gpointer user_data)
+{
+	StripInfo *info = user_data;
+	GdkPixbuf *pixbuf = rs_filter_response_get_image8(response);
+	guchar *line = info->line;
+	gboolean ret = TRUE;
+	gint row, col;
+
+	if (!pixbuf)
+		return FALSE;
+
+	gint input_channels = gdk_pixbuf_get_n_channels(pixbuf);
+
+	rs_io_lock();
+	for(row = tile->y; ret && (row < tile->y + tile->height); row++)
+	{
+		guchar *buf = GET_PIXBUF_PIXEL(pixbuf, tile->x, row);
+		for(col = 0; col < tile->width; col++)
+		{
+			line[col*3 + R] = buf[col*input_channels + R];
+			line[col*3 + G] = buf[col*input_channels + G];
+			line[col*3 + B] = buf[col*input_channels + B];
+		}
+		ret = (TIFFWriteScanline(info->tiff, line, row, 0) == 1);
+	}
+	rs_io_unlock();
+
+	g_object_unref(pixbuf);
+
+	return ret;
+}
+
 static gboolean
 execute(RSOutput *output, RSFilter *filter)
 {
-	RSFilterResponse *response;
 	RSTifffile *tifffile = RS_TIFFFILE(output);
 	const RSIccProfile *profile = NULL;
 	TIFF *tiff;
-	gint row;
+	StripInfo info;
+	gint width, height;
+	gboolean complete;
+
+	RSFilterRequest *request = rs_filter_request_new();
+	rs_filter_request_set_quick(request, FALSE);
+	rs_filter_param_set_object(RS_FILTER_PARAM(request), "colorspace", tifffile->color_space);
+
+	if (!rs_filter_get_size_simple(filter, request, &width, &height))
+	{
+		g_object_unref(request);
+		return(FALSE);
+	}
 
 	if((tiff = TIFFOpen(tifffile->filename, "w")) == NULL)
+	{
+		g_object_unref(request);
 		return(FALSE);
+	}
 
 	if (tifffile->color_space)
 		profile = rs_color_space_get_icc_profile(tifffile->color_space, tifffile->save16bit);
 
-	RSFilterRequest *request = rs_filter_request_new();
-	rs_filter_request_set_quick(request, FALSE);
-	rs_filter_param_set_object(RS_FILTER_PARAM(request), "colorspace", tifffile->color_space);
+	rs_tiff_generic_init(tiff, width, height, 3, profile, tifffile->uncompressed);
+	info.tiff = tiff;
 
+	/* Render full width strips, the filters before us only have to render
+	 * RS_FILTER_TILE_SIZE rows at a time */
 	if (tifffile->save16bit)
 	{
-		gint col;
-		response = rs_filter_get_image(filter, request);
-		RS_IMAGE16 *image = rs_filter_response_get_image(response);
-		rs_tiff_generic_init(tiff, image->w, image->h, 3, profile, tifffile->uncompressed);
-		gushort *line = g_new(gushort, image->w*3);
-
-		g_assert(image->channels == 3);
-		g_assert(image->pixelsize == 4);
-
 		TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, 16);
-		printf("pixelsize: %d\n", image->pixelsize);
-		rs_io_lock();
-		for(row=0;row<image->h;row++)
-		{
-			gushort *buf = GET_PIXEL(image, 0, row);
-			for(col=0;col<image->w; col++)
-			{
-				line[col*3 + R] = buf[col*4 + R];
-				line[col*3 + G] = buf[col*4 + G];
-				line[col*3 + B] = buf[col*4 + B];
-			}
-			TIFFWriteScanline(tiff, line, row, 0);
-		}
-
-		g_object_unref(image);
-		g_object_unref(response);
-		g_free(line);
+		info.line = g_new(gushort, width * 3);
+		complete = rs_filter_get_image_tiled(filter, request, width, RS_FILTER_TILE_SIZE, write_strip16, &info);
 	}
 	else
 	{
-		gint col;
-		response = rs_filter_get_image8(filter, request);
-		GdkPixbuf *pixbuf = rs_filter_response_get_image8(response);
-		gint width = gdk_pixbuf_get_width(pixbuf);
-		gint height = gdk_pixbuf_get_height(pixbuf);
-		gint input_channels = gdk_pixbuf_get_n_channels(pixbuf);
-		rs_tiff_generic_init(tiff, width, height, 3, profile, tifffile->uncompressed);
-		gchar *line = g_new(gchar, width * 3);
-
 		TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, 8);
-		rs_io_lock();
-		for(row=0;row<height;row++)
-		{
-			guchar *buf = GET_PIXBUF_PIXEL(pixbuf, 0, row);
-			for(col=0; col<width; col++)
-			{
-				line[col*3 + R] = buf[col*input_channels + R];
-				line[col*3 + G] = buf[col*input_channels + G];
-				line[col*3 + B] = buf[col*input_channels + B];
-			}
-			TIFFWriteScanline(tiff, line, row, 0);
-		}
-
-		g_free(line);
-		g_object_unref(pixbuf);
-		g_object_unref(response);
+		info.line = g_new(guchar, width * 3);
+		complete = rs_filter_get_image8_tiled(filter, request, width, RS_FILTER_TILE_SIZE, write_strip8, &info);
 	}
+	g_free(info.line);
 	g_object_unref(request);
 
+	rs_io_lock();
+	if (!complete)
+	{
+		/* Don't leave half an image behind */
+		TIFFClose(tiff);
+		g_unlink(tifffile->filename);
+		rs_io_unlock();
+		return(FALSE);
+	}
 	TIFFClose(tiff);
 
 	gchar *input_filename = NULL;
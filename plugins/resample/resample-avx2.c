@@ -0,0 +1,361 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* Plugin tmpl version 4 */
+
+#include <rawstudio.h>
+#include <math.h>
+
+
+/* AVX2 resamplers. Pixel values are biased to signed shorts, so two filter
+ * taps can be multiplied and added by a single madd instruction. This is
+ * corrected by adding 32768 * FPScale to the sum.
+ */
+
+typedef struct {
+	RS_IMAGE16 *input;			/* Input Image to Resampler */
+	RS_IMAGE16 *output;			/* Output Image from Resampler */
+	guint old_size;				/* Old dimension in the direction of the resampler*/
+	guint new_size;				/* New size in the direction of the resampler */
+	guint dest_offset_other;	/* Where in the unchanged direction should we begin writing? */
+	guint dest_end_other;		/* Where in the unchanged direction should we stop writing? */
+	guint (*resample_support)(void);
+	gfloat (*resample_func)(gfloat);
+	gboolean use_compatible;	/* Use compatible resampler if pixelsize != 4 */
+	gboolean use_fast;		/* Use nearest neighbour resampler, also compatible*/
+} ResampleInfo;
+
+extern void ResizeV(ResampleInfo *info);
+extern void ResizeV_fast(ResampleInfo *info);
+extern void ResizeV_AVX(ResampleInfo *info);
+extern void ResizeH(ResampleInfo *info);
+extern void ResizeH_fast(ResampleInfo *info);
+static inline guint clampbits(gint x, guint n) { guint32 _y_temp; if( (_y_temp=x>>n) ) x = ~_y_temp >> (32-n); return x;}
+
+static guint
+lanczos_taps(void)
+{
+	return 3;
+}
+
+static gfloat
+sinc(gfloat value)
+{
+	if (value != 0.0f)
+	{
+		value *= M_PI;
+		return sinf(value) / value;
+	}
+	else
+		return 1.0f;
+}
+
+static gfloat
+lanczos_weight(gfloat value)
+{
+	value = fabsf(value);
+	if (value < lanczos_taps())
+	{
+		return (sinc(value) * sinc(value / lanczos_taps()));
+	}
+	else
+		return 0.0f;
+}
+
+const static gint FPScale = 16384; /* fixed point scaler */
+const static gint FPScaleShift = 14; /* fixed point scaler */
+
+
+#if defined (__x86_64__) && defined(__AVX2__)
+#include <immintrin.h>
+
+/* Calculate filter weights adding up to exactly FPScale for each output pixel */
+static gint *
+calc_weights(guint old_size, guint new_size, gint fir_filter_size, gfloat filter_step, gfloat filter_support, gint *offsets)
+{
+	gfloat pos_step = ((gfloat) old_size) / ((gfloat)new_size);
+	gint *weights = g_new(gint, new_size * fir_filter_size);
+	gfloat pos = 0.0f;
+	gint i,j,k;
+
+	for (i=0; i<new_size; ++i)
+	{
+		gint end_pos = (gint) (pos + filter_support);
+		if (end_pos > old_size-1)
+			end_pos = old_size-1;
+
+		gint start_pos = end_pos - fir_filter_size + 1;
+
+		if (start_pos < 0)
+			start_pos = 0;
+
+		offsets[i] = start_pos;
+
+		gfloat total = 0.0;
+
+		/* Ensure that we have a valid position */
+		gfloat ok_pos = MAX(0.0f,MIN(old_size-1,pos));
+
+		for (j=0; j<fir_filter_size; ++j)
+		{
+			/* Accumulate all coefficients */
+			total += lanczos_weight((start_pos+j - ok_pos) * filter_step);
+		}
+
+		g_assert(total > 0.0f);
+
+		gfloat total2 = 0.0;
+
+		for (k=0; k<fir_filter_size; ++k)
+		{
+			gfloat total3 = total2 + lanczos_weight((start_pos+k - ok_pos) * filter_step) / total;
+			weights[i*fir_filter_size+k] = ((gint) (total3*FPScale+0.5) - (gint) (total2*FPScale+0.5));
+			total2 = total3;
+		}
+		pos += pos_step;
+	}
+	return weights;
+}
+
+/* Two weights as shorts in one dword, for _mm256_madd_epi16() */
+static inline gint
+weight_pair(gint w1, gint w2)
+{
+	return (w1 & 0xffff) | (w2 << 16);
+}
+
+void
+ResizeV_AVX2(ResampleInfo *info)
+{
+	const RS_IMAGE16 *input = info->input;
+	const RS_IMAGE16 *output = info->output;
+	const guint old_size = info->old_size;
+	const guint new_size = info->new_size;
+	const guint start_x = info->dest_offset_other * input->pixelsize;
+	const guint end_x = info->dest_end_other * input->pixelsize;
+
+	gfloat pos_step = ((gfloat) old_size) / ((gfloat)new_size);
+	gfloat filter_step = MIN(1.0f / pos_step, 1.0f);
+	gfloat filter_support = (gfloat) lanczos_taps() / filter_step;
+	gint fir_filter_size = (gint) (ceil(filter_support*2));
+
+	if (old_size <= fir_filter_size)
+		return ResizeV_fast(info);
+
+	gint *offsets = g_new(gint, new_size);
+	gint *weights = calc_weights(old_size, new_size, fir_filter_size, filter_step, filter_support, offsets);
+
+	guint y,x;
+	gint i;
+	gint *wg = weights;
+	const gint rowstride = input->rowstride;
+
+	/* Rounder and correction for the sign bias */
+	const __m256i add_32 = _mm256_set1_epi32((32768 << FPScaleShift) + (FPScale >> 1));
+	const __m256i sign = _mm256_set1_epi16((gshort) 0x8000);
+
+	for (y = 0; y < new_size ; y++)
+	{
+		gushort *in = GET_PIXEL(input, start_x / input->pixelsize, offsets[y]);
+		gushort *out = GET_PIXEL(output, 0, y);
+
+		/* 32 values = 64 bytes/loop */
+		for (x = start_x; x + 32 <= end_x; x += 32)
+		{
+			__m256i acc1, acc1_h, acc2, acc2_h;
+			acc1 = acc1_h = acc2 = acc2_h = _mm256_setzero_si256();
+
+			for (i = 0; i < fir_filter_size; i += 2)
+			{
+				__m256i src1, src2, next1, next2, w;
+				__m256i *in_avx = (__m256i*)&in[i * rowstride];
+
+				src1 = _mm256_xor_si256(_mm256_loadu_si256(in_avx), sign);
+				src2 = _mm256_xor_si256(_mm256_loadu_si256(in_avx + 1), sign);
+
+				if (i + 1 < fir_filter_size)
+				{
+					in_avx = (__m256i*)&in[(i + 1) * rowstride];
+					next1 = _mm256_xor_si256(_mm256_loadu_si256(in_avx), sign);
+					next2 = _mm256_xor_si256(_mm256_loadu_si256(in_avx + 1), sign);
+					w = _mm256_set1_epi32(weight_pair(wg[i], wg[i+1]));
+				}
+				else
+				{
+					/* Odd number of taps, the last one is paired with a zero weight */
+					next1 = src1;
+					next2 = src2;
+					w = _mm256_set1_epi32(weight_pair(wg[i], 0));
+				}
+
+				/* Interleave the two rows and multiply-add */
+				acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(_mm256_unpacklo_epi16(src1, next1), w));
+				acc1_h = _mm256_add_epi32(acc1_h, _mm256_madd_epi16(_mm256_unpackhi_epi16(src1, next1), w));
+				acc2 = _mm256_add_epi32(acc2, _mm256_madd_epi16(_mm256_unpacklo_epi16(src2, next2), w));
+				acc2_h = _mm256_add_epi32(acc2_h, _mm256_madd_epi16(_mm256_unpackhi_epi16(src2, next2), w));
+			}
+
+			/* Add rounder and bias, shift down */
+			acc1 = _mm256_srai_epi32(_mm256_add_epi32(acc1, add_32), FPScaleShift);
+			acc1_h = _mm256_srai_epi32(_mm256_add_epi32(acc1_h, add_32), FPScaleShift);
+			acc2 = _mm256_srai_epi32(_mm256_add_epi32(acc2, add_32), FPScaleShift);
+			acc2_h = _mm256_srai_epi32(_mm256_add_epi32(acc2_h, add_32), FPScaleShift);
+
+			/* Pack to unsigned shorts, unpack and pack work within lanes so the order is kept */
+			__m256i* avx_dst = (__m256i*)&out[x];
+			_mm256_storeu_si256(avx_dst, _mm256_packus_epi32(acc1, acc1_h));
+			_mm256_storeu_si256(avx_dst + 1, _mm256_packus_epi32(acc2, acc2_h));
+			in += 32;
+		}
+
+		/* Process remaining pixels */
+		for (; x < end_x; x++)
+		{
+			gint acc1 = 0;
+			for (i = 0; i < fir_filter_size; i++)
+			{
+				acc1 += in[i * rowstride] * wg[i];
+			}
+			out[x] = clampbits((acc1 + (FPScale / 2)) >> FPScaleShift, 16);
+			in++;
+		}
+		wg += fir_filter_size;
+	}
+	g_free(weights);
+	g_free(offsets);
+}
+
+void
+ResizeH_AVX2(ResampleInfo *info)
+{
+	const RS_IMAGE16 *input = info->input;
+	const RS_IMAGE16 *output = info->output;
+	const guint old_size = info->old_size;
+	const guint new_size = info->new_size;
+
+	gfloat pos_step = ((gfloat) old_size) / ((gfloat)new_size);
+	gfloat filter_step = MIN(1.0f / pos_step, 1.0f);
+	gfloat filter_support = (gfloat) lanczos_taps() / filter_step;
+	gint fir_filter_size = (gint) (ceil(filter_support*2));
+
+	if (old_size <= fir_filter_size)
+		return ResizeH_fast(info);
+
+	g_assert(input->pixelsize == 4);
+	g_assert(input->channels == 3);
+
+	gint *offsets = g_new(gint, new_size);
+	gint *weights = calc_weights(old_size, new_size, fir_filter_size, filter_step, filter_support, offsets);
+
+	const __m256i add_32 = _mm256_set1_epi32((32768 << FPScaleShift) + (FPScale >> 1));
+	const __m256i sign = _mm256_set1_epi16((gshort) 0x8000);
+
+	guint y,x;
+	gint i;
+	for (y = info->dest_offset_other; y < info->dest_end_other ; y++)
+	{
+		gushort *in_line = GET_PIXEL(input, 0, y);
+		gushort *out = GET_PIXEL(output, 0, y);
+		gint *wg = weights;
+
+		/* Two output pixels per loop, one in each lane */
+		for (x = 0; x + 2 <= new_size; x += 2)
+		{
+			const gushort *in1 = &in_line[offsets[x] * 4];
+			const gushort *in2 = &in_line[offsets[x+1] * 4];
+			const gint *wg2 = wg + fir_filter_size;
+			__m256i acc = _mm256_setzero_si256();
+
+			for (i = 0; i < fir_filter_size; i += 2)
+			{
+				__m128i p1, p2;
+				__m256i src, w;
+
+				if (i + 1 < fir_filter_size)
+				{
+					/* Two adjacent input pixels */
+					p1 = _mm_loadu_si128((__m128i*)&in1[i*4]);
+					p2 = _mm_loadu_si128((__m128i*)&in2[i*4]);
+					w = _mm256_setr_epi32(
+						weight_pair(wg[i], wg[i+1]), weight_pair(wg[i], wg[i+1]), weight_pair(wg[i], wg[i+1]), weight_pair(wg[i], wg[i+1]),
+						weight_pair(wg2[i], wg2[i+1]), weight_pair(wg2[i], wg2[i+1]), weight_pair(wg2[i], wg2[i+1]), weight_pair(wg2[i], wg2[i+1]));
+				}
+				else
+				{
+					/* Last of an odd number of taps, don't read past it */
+					p1 = _mm_loadl_epi64((__m128i*)&in1[i*4]);
+					p2 = _mm_loadl_epi64((__m128i*)&in2[i*4]);
+					w = _mm256_setr_epi32(
+						weight_pair(wg[i], 0), weight_pair(wg[i], 0), weight_pair(wg[i], 0), weight_pair(wg[i], 0),
+						weight_pair(wg2[i], 0), weight_pair(wg2[i], 0), weight_pair(wg2[i], 0), weight_pair(wg2[i], 0));
+				}
+				src = _mm256_xor_si256(_mm256_inserti128_si256(_mm256_castsi128_si256(p1), p2, 1), sign);
+
+				/* Interleave channels of the two pixels and multiply-add */
+				src = _mm256_unpacklo_epi16(src, _mm256_srli_si256(src, 8));
+				acc = _mm256_add_epi32(acc, _mm256_madd_epi16(src, w));
+			}
+			acc = _mm256_srai_epi32(_mm256_add_epi32(acc, add_32), FPScaleShift);
+			acc = _mm256_packus_epi32(acc, acc);
+
+			/* Move the second pixel next to the first and store both */
+			acc = _mm256_permute4x64_epi64(acc, _MM_SHUFFLE(0,0,2,0));
+			_mm_storeu_si128((__m128i*)&out[x*4], _mm256_castsi256_si128(acc));
+			wg += fir_filter_size * 2;
+		}
+
+		/* Process remaining pixel */
+		for (; x < new_size; x++)
+		{
+			gushort *in = &in_line[offsets[x] * 4];
+			gint acc1 = 0;
+			gint acc2 = 0;
+			gint acc3 = 0;
+
+			for (i = 0; i < fir_filter_size; i++)
+			{
+				gint w = *wg++;
+				acc1 += in[i*4]*w;
+				acc2 += in[i*4+1]*w;
+				acc3 += in[i*4+2]*w;
+			}
+			out[x*4] = clampbits((acc1 + (FPScale/2))>>FPScaleShift, 16);
+			out[x*4+1] = clampbits((acc2 + (FPScale/2))>>FPScaleShift, 16);
+			out[x*4+2] = clampbits((acc3 + (FPScale/2))>>FPScaleShift, 16);
+		}
+	}
+	g_free(weights);
+	g_free(offsets);
+}
+
+#else // not defined (__x86_64__) and not defined (__AVX2__)
+
+void
+ResizeV_AVX2(ResampleInfo *info)
+{
+	ResizeV_AVX(info);
+}
+
+void
+ResizeH_AVX2(ResampleInfo *info)
+{
+	ResizeH(info);
+}
+
+#endif // not defined (__x86_64__) and not defined (__AVX2__)
@@ -43,6 +43,9 @@ struct _RSResample {
 	gfloat scale;
 	gboolean bounding_box;
 	gboolean never_quick;
+
+	/* Protects the above, get_image() only holds this while reading */
+	GStaticRecMutex lock;
 };
 
 struct _RSResampleClass {
@@ -58,7 +61,6 @@ typedef struct {
 	guint dest_end_other;		/* Where in the unchanged direction should we stop writing? */
 	guint (*resample_support)(void);
 	gfloat (*resample_func)(gfloat);
-	GThread *threadid;
 	gboolean use_compatible;	/* Use compatible resampler if pixelsize != 4 */
 	gboolean use_fast;		/* Use nearest neighbour resampler, also compatible*/
 } ResampleInfo;
@@ -80,19 +82,25 @@ static void previous_changed(RSFilter *filter, RSFilter *parent, RSFilterChanged
 static RSFilterChangedMask recalculate_dimensions(RSResample *resample);
 static RSFilterResponse *get_image(RSFilter *filter, const RSFilterRequest *request);
 static RSFilterResponse *get_size(RSFilter *filter, const RSFilterRequest *request);
-static void ResizeH(ResampleInfo *info);
+static void finalize(GObject *object);
+void ResizeH(ResampleInfo *info);
 void ResizeV(ResampleInfo *info);
 extern void ResizeV_SSE2(ResampleInfo *info);
 extern void ResizeV_SSE4(ResampleInfo *info);
 extern void ResizeV_AVX(ResampleInfo *info);
+extern void ResizeV_AVX2(ResampleInfo *info);
+extern void ResizeH_AVX2(ResampleInfo *info);
 static void ResizeH_compatible(ResampleInfo *info);
 static void ResizeV_compatible(ResampleInfo *info);
-static void ResizeH_fast(ResampleInfo *info);
+void ResizeH_fast(ResampleInfo *info);
 void ResizeV_fast(ResampleInfo *info);
 
+/* The best kernels for this cpu, picked when the class is initialized */
+static void (*resize_v)(ResampleInfo *info) = ResizeV;
+static void (*resize_h)(ResampleInfo *info) = ResizeH;
+
 static RSFilterClass *rs_resample_parent_class = NULL;
 static inline guint clampbits(gint x, guint n) { guint32 _y_temp; if( (_y_temp=x>>n) ) x = ~_y_temp >> (32-n); return x;}
-static GStaticRecMutex resampler_mutex = G_STATIC_REC_MUTEX_INIT;
 
 G_MODULE_EXPORT void
 rs_plugin_load(RSPlugin *plugin)
@@ -106,10 +114,17 @@ rs_resample_class_init(RSResampleClass *klass)
 	RSFilterClass *filter_class = RS_FILTER_CLASS (klass);
 	GObjectClass *object_class = G_OBJECT_CLASS(klass);
 
+	const gpointer resize_v_kernels[RS_CPU_LEVELS] = {ResizeV, ResizeV_SSE2, ResizeV_SSE4, ResizeV_AVX, ResizeV_AVX2};
+	const gpointer resize_h_kernels[RS_CPU_LEVELS] = {ResizeH, NULL, NULL, NULL, ResizeH_AVX2};
+
 	rs_resample_parent_class = g_type_class_peek_parent (klass);
 
+	resize_v = rs_cpu_dispatch(resize_v_kernels);
+	resize_h = rs_cpu_dispatch(resize_h_kernels);
+
 	object_class->get_property = get_property;
 	object_class->set_property = set_property;
+	object_class->finalize = finalize;
 
 	g_object_class_install_property(object_class,
 		PROP_WIDTH, g_param_spec_int(
@@ -153,6 +168,17 @@ rs_resample_init(RSResample *resample)
 	resample->bounding_box = FALSE;
 	resample->scale = 1.0;
 	resample->never_quick = FALSE;
+	g_static_rec_mutex_init(&resample->lock);
+}
+
+static void
+finalize(GObject *object)
+{
+	RSResample *resample = RS_RESAMPLE(object);
+
+	g_static_rec_mutex_free(&resample->lock);
+
+	G_OBJECT_CLASS(rs_resample_parent_class)->finalize(object);
 }
 
 static void
@@ -188,7 +214,7 @@ set_property(GObject *object, guint property_id, const GValue *value, GParamSpec
 	RSResample *resample = RS_RESAMPLE(object);
 	RSFilterChangedMask mask = 0;
 
-	g_static_rec_mutex_lock(&resampler_mutex);
+	g_static_rec_mutex_lock(&resample->lock);
 
 	switch (property_id)
 	{
@@ -224,7 +250,7 @@ set_property(GObject *object, guint property_id, const GValue *value, GParamSpec
 			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
 	}
 
-	g_static_rec_mutex_unlock(&resampler_mutex);
+	g_static_rec_mutex_unlock(&resample->lock);
 	if (mask)
 		rs_filter_changed(RS_FILTER(object), mask);
 }
@@ -245,7 +271,7 @@ recalculate_dimensions(RSResample *resample)
 	gint new_width, new_height;
 	gint previous_width = 0;
 	gint previous_height = 0;
-	g_static_rec_mutex_lock(&resampler_mutex);
+	g_static_rec_mutex_lock(&resample->lock);
 
 	if (RS_FILTER(resample)->previous)
 		rs_filter_get_size_simple(RS_FILTER(resample)->previous, RS_FILTER_REQUEST_QUICK, &previous_width, &previous_height);
@@ -284,7 +310,7 @@ recalculate_dimensions(RSResample *resample)
 	if (new_width < 0 || new_height < 0)
 		resample->scale = 1.0f;
 
-	g_static_rec_mutex_unlock(&resampler_mutex);
+	g_static_rec_mutex_unlock(&resample->lock);
 	return mask;
 }
 
@@ -306,42 +332,29 @@ bit_blt(char* dstp, int dst_pitch, const char* srcp, int src_pitch, int row_size
 	}
 }
 
-gpointer
-start_thread_resampler(gpointer _thread_info)
+static void
+run_resampler(ResampleInfo* t)
 {
-	ResampleInfo* t = _thread_info;
-
 	if (!t->input)
 	{
 		g_debug("Resampler: input is NULL");
-		g_thread_exit(NULL);
-		return NULL;
+		return;
 	}
 
 	if (!t->output)
 	{
 		g_debug("Resampler: output is NULL");
-		g_thread_exit(NULL);
-		return NULL;
+		return;
 	}
 
 	if (t->input->h != t->output->h)
 	{
-		gboolean sse2_available = !!(rs_detect_cpu_features() & RS_CPU_FLAG_SSE2);
-		gboolean sse4_available = !!(rs_detect_cpu_features() & RS_CPU_FLAG_SSE4_1);
-		gboolean avx_available = !!(rs_detect_cpu_features() & RS_CPU_FLAG_AVX);
 		if (t->use_fast)
 			ResizeV_fast(t);
 		else if (t->use_compatible)
 			ResizeV_compatible(t);
-		else if (avx_available)
-			ResizeV_AVX(t);
-		else if (sse4_available)
-			ResizeV_SSE4(t);
-		else if (sse2_available)
-			ResizeV_SSE2(t);
 		else
-			ResizeV(t);
+			resize_v(t);
 	} 
 	else if (t->input->w != t->output->w)
 	{
@@ -350,18 +363,48 @@ start_thread_resampler(gpointer _thread_info)
 		else if (t->use_compatible)
 			ResizeH_compatible(t);
 		else
-			ResizeH(t);
+			resize_h(t);
 	}
-	/* Unchanged in both directions, have thread 0 copy all the image */
+	/* Unchanged in both directions, have the first part copy all the image */
 	else if (t->dest_offset_other == 0)
 		bit_blt((char*)GET_PIXEL(t->output,0,0), t->output->rowstride * 2, 
 			(const char*)GET_PIXEL(t->input,0,0), t->input->rowstride * 2, t->input->rowstride * 2, t->input->h);
+}
+
+/* The vertical resamplers must start at a 16 byte aligned column */
+static guint
+column_alignment(gint pixelsize)
+{
+	guint align = 1;
+	while (((align * pixelsize) & 15) != 0)
+		align++;
+	return align;
+}
+
+static void
+resample_vertical_part(gint start, gint end, gpointer _resample_info)
+{
+	ResampleInfo t = *(ResampleInfo *) _resample_info;
+	const guint align = column_alignment(t.input->pixelsize);
 
-	g_thread_exit(NULL);
+	t.dest_offset_other = start * align;
+	t.dest_end_other = MIN(end * align, t.input->w);
 
-	return NULL; /* Make the compiler shut up - we'll never return */
+	run_resampler(&t);
 }
 
+static void
+resample_horizontal_part(gint start, gint end, gpointer _resample_info)
+{
+	ResampleInfo t = *(ResampleInfo *) _resample_info;
+
+	t.dest_offset_other = start;
+	t.dest_end_other = end;
+
+	run_resampler(&t);
+}
+
+
 static RSFilterResponse *
 get_image(RSFilter *filter, const RSFilterRequest *request)
 {
@@ -374,15 +417,25 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	RS_IMAGE16 *output = NULL;
 	gint input_width;
 	gint input_height;
+	gint new_width, new_height;
+	gboolean never_quick;
+
+	/* Take a snapshot of our settings, the rest of this function must not
+	 * touch resample, so other threads can render through it meanwhile */
+	g_static_rec_mutex_lock(&resample->lock);
+	new_width = resample->new_width;
+	new_height = resample->new_height;
+	never_quick = resample->never_quick;
+	g_static_rec_mutex_unlock(&resample->lock);
 
 	rs_filter_get_size_simple(filter->previous, request, &input_width, &input_height);
 
 	/* Return the input, if the new size is uninitialized */
-	if ((resample->new_width == -1) || (resample->new_height == -1))
+	if ((new_width == -1) || (new_height == -1))
 		return rs_filter_get_image(filter->previous, request);
 
 	/* Simply return the input, if we don't scale */
-	if ((input_width == resample->new_width) && (input_height == resample->new_height))
+	if ((input_width == new_width) && (input_height == new_height))
 		return rs_filter_get_image(filter->previous, request);	
 	
 	/* Remove ROI, it doesn't make sense across resampler */
@@ -401,7 +454,6 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	if (!RS_IS_IMAGE16(input))
 		return previous_response;
 
-	g_static_rec_mutex_lock(&resampler_mutex);
 	input_width = input->w;
 	input_height = input->h;	
 
@@ -412,7 +464,7 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	/* Use compatible (and slow) version if input isn't 3 channels and pixelsize 4 */
 	gboolean use_compatible = ( ! ( input->pixelsize == 4 && input->channels == 3));
 
-	if (!resample->never_quick && rs_filter_request_get_quick(request))
+	if (!never_quick && rs_filter_request_get_quick(request))
 	{
 		use_fast = TRUE;
 		rs_filter_response_set_quick(response);
@@ -421,89 +473,45 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	if (input_width < 32 || input_height < 32)
 		use_compatible = TRUE;
 
-	guint threads = rs_get_number_of_processor_cores();
-
-	ResampleInfo* h_resample = g_new(ResampleInfo,  threads);
-	ResampleInfo* v_resample = g_new(ResampleInfo,  threads);
+	ResampleInfo h_resample, v_resample;
 
 	/* Create intermediate and output images*/
-	afterVertical = rs_image16_new(input_width, resample->new_height, input->channels, input->pixelsize);
+	afterVertical = rs_image16_new(input_width, new_height, input->channels, input->pixelsize);
 
-	// Only even count
-	guint output_x_per_thread = ((input_width + threads - 1 ) / threads );
-	while (((output_x_per_thread * input->pixelsize) & 15) != 0)
-		output_x_per_thread++;
-	guint output_x_offset = 0;
+	/* Set info for Vertical resampler, work is split in aligned groups of columns */
+	v_resample.input = input;
+	v_resample.output = afterVertical;
+	v_resample.old_size = input_height;
+	v_resample.new_size = new_height;
+	v_resample.use_compatible = use_compatible;
+	v_resample.use_fast = use_fast;
 
-	guint i;
-	for (i = 0; i < threads; i++)
-	{
-		/* Set info for Vertical resampler */
-		ResampleInfo *v = &v_resample[i];
-		v->input = input;
-		v->output  = afterVertical;
-		v->old_size = input_height;
-		v->new_size = resample->new_height;
-		v->dest_offset_other = output_x_offset;
-		v->dest_end_other  = MIN(output_x_offset + output_x_per_thread, input_width);
-		v->use_compatible = use_compatible;
-		v->use_fast = use_fast;
-
-		/* Start it up */
-		v->threadid = g_thread_create(start_thread_resampler, v, TRUE, NULL);
-
-		/* Update offset */
-		output_x_offset = v->dest_end_other;
-	}
-
-	/* Wait for vertical threads to finish */
-	for(i = 0; i < threads; i++)
-		g_thread_join(v_resample[i].threadid);
+	guint align = column_alignment(input->pixelsize);
+	rs_parallel_for_cancellable(0, (input_width + align - 1) / align, 0, resample_vertical_part, &v_resample, rs_filter_request_get_cancellable(request));
 
 	/* input no longer needed */
 	g_object_unref(input);
 	input = NULL;
 
 	/* create output */
-	output = rs_image16_new(resample->new_width,  resample->new_height, afterVertical->channels, afterVertical->pixelsize);
-
-	guint input_y_offset = 0;
-	guint input_y_per_thread = (resample->new_height+threads-1) / threads;
-
-	for (i = 0; i < threads; i++)
-	{
-		/* Set info for Horizontal resampler */
-		ResampleInfo *h = &h_resample[i];
-		h->input = afterVertical;
-		h->output  = output;
-		h->old_size = input_width;
-		h->new_size = resample->new_width;
-		h->dest_offset_other = input_y_offset;
-		h->dest_end_other  = MIN(input_y_offset+input_y_per_thread, resample->new_height);
-		h->use_compatible = use_compatible;
-		h->use_fast = use_fast;
-
-		/* Start it up */
-		h->threadid = g_thread_create(start_thread_resampler, h, TRUE, NULL);
-
-		/* Update offset */
-		input_y_offset = h->dest_end_other;
+	output = rs_image16_new(new_width, new_height, afterVertical->channels, afterVertical->pixelsize);
 
-	}
+	/* Set info for Horizontal resampler, work is split in rows */
+	h_resample.input = afterVertical;
+	h_resample.output = output;
+	h_resample.old_size = input_width;
+	h_resample.new_size = new_width;
+	h_resample.use_compatible = use_compatible;
+	h_resample.use_fast = use_fast;
 
-	/* Wait for horizontal threads to finish */
-	for(i = 0; i < threads; i++)
-		g_thread_join(h_resample[i].threadid);
+	rs_parallel_for_cancellable(0, new_height, 0, resample_horizontal_part, &h_resample, rs_filter_request_get_cancellable(request));
 
 	/* Clean up */
-	g_free(h_resample);
-	g_free(v_resample);
 	g_object_unref(afterVertical);
 
 	rs_filter_response_set_image(response, output);
-	rs_filter_param_set_boolean(RS_FILTER_PARAM(response), "half-size", FALSE);
+	rs_filter_param_set_integer(RS_FILTER_PARAM(response), "downscale-shift", 0);
 	g_object_unref(output);
-	g_static_rec_mutex_unlock(&resampler_mutex);
 	return response;
 }
 
@@ -512,15 +520,21 @@ get_size(RSFilter *filter, const RSFilterRequest *request)
 {
 	RSResample *resample = RS_RESAMPLE(filter);
 	RSFilterResponse *previous_response = rs_filter_get_size(filter->previous, request);
+	gint new_width, new_height;
 
-	if ((resample->new_width == -1) || (resample->new_height == -1))
+	g_static_rec_mutex_lock(&resample->lock);
+	new_width = resample->new_width;
+	new_height = resample->new_height;
+	g_static_rec_mutex_unlock(&resample->lock);
+
+	if ((new_width == -1) || (new_height == -1))
 		return previous_response;
 
 	RSFilterResponse *response = rs_filter_response_clone(previous_response);
 	g_object_unref(previous_response);
 
-	rs_filter_response_set_width(response, resample->new_width);
-	rs_filter_response_set_height(response, resample->new_height);
+	rs_filter_response_set_width(response, new_width);
+	rs_filter_response_set_height(response, new_height);
 
 	return response;
 }
@@ -558,7 +572,7 @@ lanczos_weight(gfloat value)
 const static gint FPScale = 16384; /* fixed point scaler */
 const static gint FPScaleShift = 14; /* fixed point scaler */
 
-static void
+void
 ResizeH(ResampleInfo *info)
 {
 	const RS_IMAGE16 *input = info->input;
@@ -980,7 +994,7 @@ ResizeV_fast(ResampleInfo *info)
 
 
 
-static void
+void
 ResizeH_fast(ResampleInfo *info)
 {
 	const RS_IMAGE16 *input = info->input;
@@ -33,16 +33,17 @@ typedef struct _RSRotateClass RSRotateClass;
 struct _RSRotate {
 	RSFilter parent;
 
-	RS_MATRIX3 affine;
-	gboolean dirty;
 	gfloat angle;
 	gint orientation;
-	gint new_width;
-	gint new_height;
-	gint translate_x;
-	gint translate_y;
 };
 
+/* Computed per request, several requests can be rendered at once */
+typedef struct {
+	RS_MATRIX3 affine;
+	gint width;
+	gint height;
+} Transform;
+
 struct _RSRotateClass {
 	RSFilterClass parent_class;
 };
@@ -58,11 +59,9 @@ enum {
 typedef struct {
 	RS_IMAGE16 *input;			/* Input Image */
 	RS_IMAGE16 *output;			/* Output Image*/
-	gint start_y;
-	gint end_y;
-	GThread *threadid;
 	gboolean use_straight;
-	RSRotate* rotate;
+	gint orientation;
+	RS_MATRIX3 affine;
 	gboolean use_fast;		/* Use nearest neighbour resampler */
 } ThreadInfo;
 
@@ -75,9 +74,9 @@ static void turn_right_angle(RS_IMAGE16 *in, RS_IMAGE16 *out, gint start_y, gint
 static RSFilterResponse *get_size(RSFilter *filter, const RSFilterRequest *request);
 static void inline bilinear(RS_IMAGE16 *in, gushort *out, gint x, gint y);
 static void inline nearest(RS_IMAGE16 *in, gushort *out, gint x, gint y);
-static void recalculate(RSRotate *rotate, const RSFilterRequest *request);
-static void recalculate_dims(RSRotate *rotate, gint previous_width, gint previous_height);
-gpointer start_rotate_thread(gpointer _thread_info);
+static void recalculate(RSRotate *rotate, const RSFilterRequest *request, gfloat angle, gint orientation, Transform *transform);
+static void recalculate_dims(gint previous_width, gint previous_height, gfloat angle, gint orientation, Transform *transform);
+static void rotate_part(gint start_y, gint end_y, gpointer _thread_info);
 
 static RSFilterClass *rs_rotate_parent_class = NULL;
 
@@ -119,7 +118,6 @@ static void
 rs_rotate_init(RSRotate *rotate)
 {
 	rotate->angle = 0.0;
-	rotate->dirty = TRUE;
 	ORIENTATION_RESET(rotate->orientation);
 }
 
@@ -162,7 +160,6 @@ set_property(GObject *object, guint property_id, const GValue *value, GParamSpec
 
 				/* We only support positive */
 
-				rotate->dirty = TRUE;
 				rs_filter_changed(RS_FILTER(object), RS_FILTER_CHANGED_DIMENSION);
 			}
 			break;
@@ -171,7 +168,6 @@ set_property(GObject *object, guint property_id, const GValue *value, GParamSpec
 			{
 				rotate->orientation = g_value_get_uint(value);
 
-				rotate->dirty = TRUE;
 				rs_filter_changed(RS_FILTER(object), RS_FILTER_CHANGED_DIMENSION);
 			}
 			break;
@@ -183,11 +179,6 @@ set_property(GObject *object, guint property_id, const GValue *value, GParamSpec
 static void
 previous_changed(RSFilter *filter, RSFilter *parent, RSFilterChangedMask mask)
 {
-	RSRotate *rotate = RS_ROTATE(filter);
-
-	if (mask & RS_FILTER_CHANGED_DIMENSION)
-		rotate->dirty = TRUE;
-
 	rs_filter_changed(filter, mask);
 }
 
@@ -202,8 +193,12 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	gboolean use_fast = FALSE;
 	GdkRectangle *old_roi;
 	GdkRectangle *roi;
+	Transform transform;
+	/* Use the same settings for the whole request */
+	const gfloat angle = rotate->angle;
+	const gint orientation = rotate->orientation;
 
-	if ((ABS(rotate->angle) < 0.001) && (rotate->orientation==0))
+	if ((ABS(angle) < 0.001) && (orientation==0))
 		return rs_filter_get_image(filter->previous, request);
 	
 	/* FIXME: Handle ROI across rotation */
@@ -212,12 +207,11 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 		/* Calculate rotated ROI */
 		old_roi = rs_filter_request_get_roi(request);
 		RSFilterRequest *new_request = rs_filter_request_clone(request);
-		recalculate(rotate, request);
+		recalculate(rotate, request, angle, orientation, &transform);
 		
 		gdouble minx, miny;
 		gdouble maxx, maxy;
-		matrix3_affine_get_minmax(&rotate->affine, &minx, &miny, &maxx, &maxy, old_roi->x-1.0, old_roi->y-1.0, (gdouble) ( old_roi->x+old_roi->width+1), (gdouble) ( old_roi->y + old_roi->height+1));
-		matrix3_affine_translate(&rotate->affine, -minx, -miny);
+		matrix3_affine_get_minmax(&transform.affine, &minx, &miny, &maxx, &maxy, old_roi->x-1.0, old_roi->y-1.0, (gdouble) ( old_roi->x+old_roi->width+1), (gdouble) ( old_roi->y + old_roi->height+1));
 
 		/* Create new ROI */
 		gint prev_w;
@@ -252,17 +246,19 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	g_object_unref(previous_response);
 
 	gboolean straight = FALSE;
+	ThreadInfo t;
 
-	if ((rotate->angle < 0.001) && (rotate->orientation < 4)) 
+	if ((angle < 0.001) && (orientation < 4)) 
 	{
-		if (rotate->orientation == 2)
+		if (orientation == 2)
 			output = rs_image16_new(input->w, input->h, 3, input->pixelsize);
 		else 
 			output = rs_image16_new(input->h, input->w, 3, input->pixelsize);
 		straight = TRUE;
 	} else {
-		recalculate_dims(rotate, input->w, input->h);
-		output = rs_image16_new(rotate->new_width, rotate->new_height, 3, 4);
+		recalculate_dims(input->w, input->h, angle, orientation, &transform);
+		output = rs_image16_new(transform.width, transform.height, 3, 4);
+		t.affine = transform.affine;
 	}
 
 	if (rs_filter_request_get_quick(request))
@@ -271,36 +267,15 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 		rs_filter_response_set_quick(response);
 	}
 
-	/* Prepare threads */
-	guint i, y_offset, y_per_thread, threaded_h;
-	const guint threads = rs_get_number_of_processor_cores();
-	ThreadInfo *t = g_new(ThreadInfo, threads);
+	/* Rotate rows in parallel */
+	t.use_straight = straight;
+	t.input = input;
+	t.output = output;
+	t.orientation = orientation;
+	t.use_fast = use_fast;
 
-	threaded_h = output->h;
+	rs_parallel_for_cancellable(0, output->h, 0, rotate_part, &t, rs_filter_request_get_cancellable(request));
 
-	y_per_thread = (threaded_h + threads-1)/threads;
-	y_offset = 0;
-
-	for (i = 0; i < threads; i++)
-	{
-		t[i].use_straight = straight;
-		t[i].input = input;
-		t[i].output = output;
-		t[i].start_y = y_offset;
-		y_offset += y_per_thread;
-		y_offset = MIN(threaded_h, y_offset);
-		t[i].end_y = y_offset;
-		t[i].rotate = rotate;
-		t[i].use_fast = use_fast;
-
-		t[i].threadid = g_thread_create(start_rotate_thread, &t[i], TRUE, NULL);
-	}
-
-	/* Wait for threads to finish */
-	for(i = 0; i < threads; i++)
-		g_thread_join(t[i].threadid);
-
-	g_free(t);
 	g_object_unref(input);
 
 	rs_filter_response_set_image(response, output);
@@ -309,31 +284,30 @@ get_image(RSFilter *filter, const RSFilterRequest *request)
 	return response;
 }
 
-gpointer
-start_rotate_thread(gpointer _thread_info)
+static void
+rotate_part(gint start_y, gint end_y, gpointer _thread_info)
 {
 	ThreadInfo* t = _thread_info;
 
 	RS_IMAGE16 *input = t->input;
 	RS_IMAGE16 *output = t->output;
-	RSRotate *rotate = t->rotate;
+	const RS_MATRIX3 *affine = &t->affine;
 
 	if (t->use_straight) {
-		turn_right_angle(input, output, t->start_y, t->end_y, rotate->orientation);
-		g_thread_exit(NULL);
-		return NULL;
+		turn_right_angle(input, output, start_y, end_y, t->orientation);
+		return;
 	}
 
 	gint x, y;
 	gint row, col;
 	gint destoffset;
 
-	gint crapx = (gint) (rotate->affine.coeff[0][0]*65536.0);
-	gint crapy = (gint) (rotate->affine.coeff[0][1]*65536.0);
-	for(row=t->start_y;row<t->end_y;row++)
+	gint crapx = (gint) (affine->coeff[0][0]*65536.0);
+	gint crapy = (gint) (affine->coeff[0][1]*65536.0);
+	for(row=start_y;row<end_y;row++)
 	{
-		gint foox = (gint) ((((gdouble)row) * rotate->affine.coeff[1][0] + rotate->affine.coeff[2][0])*65536.0);
-		gint fooy = (gint) ((((gdouble)row) * rotate->affine.coeff[1][1] + rotate->affine.coeff[2][1])*65536.0);
+		gint foox = (gint) ((((gdouble)row) * affine->coeff[1][0] + affine->coeff[2][0])*65536.0);
+		gint fooy = (gint) ((((gdouble)row) * affine->coeff[1][1] + affine->coeff[2][1])*65536.0);
 		destoffset = row * output->rowstride;
 		for(col=0;col<output->w;col++,destoffset += output->pixelsize)
 		{
@@ -345,10 +319,6 @@ start_rotate_thread(gpointer _thread_info)
 				bilinear(input, &output->pixels[destoffset], x>>8, y>>8);
 		}
 	}
-
-	g_thread_exit(NULL);
-
-	return NULL; /* Make the compiler shut up - we'll never return */
 }
 
 
@@ -357,17 +327,18 @@ get_size(RSFilter *filter, const RSFilterRequest *request)
 {
 	RSRotate *rotate = RS_ROTATE(filter);
 	RSFilterResponse *previous_response = rs_filter_get_size(filter->previous, request);
+	Transform transform;
 
 	if (!previous_response)
 		return NULL;
 
-	recalculate(rotate, request);
+	recalculate_dims(rs_filter_response_get_width(previous_response), rs_filter_response_get_height(previous_response), rotate->angle, rotate->orientation, &transform);
 
 	RSFilterResponse *response = rs_filter_response_clone(previous_response);
 	g_object_unref(previous_response);
 
-	rs_filter_response_set_width(response, rotate->new_width);
-	rs_filter_response_set_height(response, rotate->new_height);
+	rs_filter_response_set_width(response, transform.width);
+	rs_filter_response_set_height(response, transform.height);
 
 	return response;
 }
@@ -456,55 +427,59 @@ bilinear(RS_IMAGE16 *in, gushort *out, gint x, gint y)
 }
 
 static void
-recalculate_dims(RSRotate *rotate, gint previous_width, gint previous_height)
+recalculate_dims(gint previous_width, gint previous_height, gfloat angle, gint orientation, Transform *transform)
 {
+	RS_MATRIX3 *affine = &transform->affine;
+
 	/* Bail out, if parent returns negative dimensions */
 	if ((previous_width < 0) || (previous_height < 0))
 	{
-		rotate->new_width = -1;
-		rotate->new_height = -1;
+		matrix3_identity(affine);
+		transform->width = -1;
+		transform->height = -1;
 		return;
 	}
 	gdouble minx, miny;
 	gdouble maxx, maxy;
 
 	/* Start clean */
-	matrix3_identity(&rotate->affine);
+	matrix3_identity(affine);
 
 	/* Rotate + orientation-angle */
-	matrix3_affine_rotate(&rotate->affine, rotate->angle+(rotate->orientation&3)*90.0);
+	matrix3_affine_rotate(affine, angle+(orientation&3)*90.0);
 
 	/* Flip if needed */
-	if (rotate->orientation&4)
-		matrix3_affine_scale(&rotate->affine, 1.0, -1.0);
+	if (orientation&4)
+		matrix3_affine_scale(affine, 1.0, -1.0);
 
 	/* Translate into positive x,y */
-	matrix3_affine_get_minmax(&rotate->affine, &minx, &miny, &maxx, &maxy, 0.0, 0.0, (gdouble) (previous_width-1), (gdouble) (previous_height-1));
+	matrix3_affine_get_minmax(affine, &minx, &miny, &maxx, &maxy, 0.0, 0.0, (gdouble) (previous_width-1), (gdouble) (previous_height-1));
 	minx -= 0.5; /* This SHOULD be the correct rounding :) */
 	miny -= 0.5;
-	matrix3_affine_translate(&rotate->affine, -minx, -miny);
+	matrix3_affine_translate(affine, -minx, -miny);
 
 	/* Get width and height used for calculating scale */
-	rotate->new_width = (gint) (maxx - minx + 1.0);
-	rotate->new_height = (gint) (maxy - miny + 1.0);
+	transform->width = (gint) (maxx - minx + 1.0);
+	transform->height = (gint) (maxy - miny + 1.0);
 
 	/* We use the inverse matrix for our transform */
-	matrix3_affine_invert(&rotate->affine);
-
-	rotate->dirty = FALSE;
+	matrix3_affine_invert(affine);
 }
 
 static void
-recalculate(RSRotate *rotate, const RSFilterRequest *request)
+recalculate(RSRotate *rotate, const RSFilterRequest *request, gfloat angle, gint orientation, Transform *transform)
 {
 	RSFilter *previous = RS_FILTER(rotate)->previous;
 	RSFilterResponse *response = rs_filter_get_size(previous, request);
 	if (!response || !RS_IS_FILTER_RESPONSE(response))
+	{
+		recalculate_dims(-1, -1, angle, orientation, transform);
 		return;
+	}
 	gint previous_width = rs_filter_response_get_width(response);
 	gint previous_height = rs_filter_response_get_height(response);
 	g_object_unref(response);
-	recalculate_dims(rotate, previous_width, previous_height);
+	recalculate_dims(previous_width, previous_height, angle, orientation, transform);
 }
 
 static void turn_right_angle(RS_IMAGE16 *in, RS_IMAGE16 *out, gint start_y, gint end_y, const int direction)
@@ -128,7 +128,10 @@ rs_photo_save(RS_PHOTO *photo, RSFilter *prior_to_resample, RSOutput *output, gi
 	RSFilter *fdcp = rs_filter_new("RSDcp", ftransform_input);
 	RSFilter *fresample= rs_filter_new("RSResample", fdcp);
 	RSFilter *fdenoise= rs_filter_new("RSDenoise", fresample);
-	RSFilter *ftransform_display = rs_filter_new("RSColorspaceTransform", fdenoise);
+	/* Outputs render in strips, resample and denoise only run once */
+	RSFilter *fexport_cache = rs_filter_new("RSCache", fdenoise);
+	g_object_set(fexport_cache, "ignore-roi", TRUE, NULL);
+	RSFilter *ftransform_display = rs_filter_new("RSColorspaceTransform", fexport_cache);
 	RSFilter *fend = ftransform_display;
 
 	gint input_width;
@@ -153,6 +156,7 @@ rs_photo_save(RS_PHOTO *photo, RSFilter *prior_to_resample, RSOutput *output, gi
 	g_object_unref(ftransform_display);
 	g_object_unref(fresample);
 	g_object_unref(fdenoise);
+	g_object_unref(fexport_cache);
 	g_object_unref(fdcp);
 
 	return exported;
@@ -206,6 +210,7 @@ RS_BLOB *
 rs_new(void)
 {
 	RS_BLOB *rs;
+	gboolean packed = FALSE;
 	rs = g_malloc(sizeof(RS_BLOB));
 	rs->settings_buffer = NULL;
 	rs->photo = NULL;
@@ -221,8 +226,11 @@ rs_new(void)
 	rs->filter_fuji_rotate = rs_filter_new("RSFujiRotate", rs->filter_demosaic);
 	rs->filter_demosaic_cache = rs_filter_new("RSCache", rs->filter_fuji_rotate);
 
-	/* We need this for 100% zoom */
-	g_object_set(rs->filter_demosaic_cache, "ignore-roi", TRUE, NULL);
+	/* Entries are keyed on the ROI, so at 100% zoom only the visible area is
+	 * demosaiced - packed entries also only hold that area.
+	 * Trade some CPU for 25% less memory used by demosaiced images */
+	if (rs_conf_get_boolean(CONF_CACHE_PACKED, &packed))
+		g_object_set(rs->filter_demosaic_cache, "packed", packed, NULL);
 
 	rs_filter_set_recursive(rs->filter_input, "color-space", rs_color_space_new_singleton("RSProphoto"), NULL);
 	rs->filter_end = rs->filter_demosaic_cache;
@@ -606,13 +614,18 @@ main(int argc, char **argv)
 	gboolean do_test = FALSE;
 	gboolean use_system_theme = DEFAULT_CONF_USE_SYSTEM_THEME;
 	gchar *debug = NULL;
+	gchar *trace_filename = NULL;
     gchar *client_mode_dest = NULL;
+	RSTrace *trace = NULL;
+	gint cache_memory_limit = 0;
+	gboolean huge_pages = FALSE;
 
 	GError *error = NULL;
 	GOptionContext *option_context;
 	const GOptionEntry option_entries[] = {
         { "output", 'o', 0, G_OPTION_ARG_STRING, &client_mode_dest, "Run in client mode", "target filename"},
 		{ "debug", 'd', 0, G_OPTION_ARG_STRING, &debug, "Debug flags to use", "flags" },
+		{ "trace", 0, 0, G_OPTION_ARG_FILENAME, &trace_filename, "Trace filters and save the trace on exit (.json or .csv)", "filename" },
 		{ "do-tests", 't', G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE, &do_test, "Do internal tests", NULL },
 		{ NULL }
 	};
@@ -673,6 +686,12 @@ main(int argc, char **argv)
 	/* Make sure the GType system is initialized */
 	g_type_init();
 
+	if (trace_filename)
+	{
+		trace = rs_trace_new();
+		rs_trace_set_default(trace);
+	}
+
 	/* Switch to rawstudio theme before any drawing if needed */
 	rs_conf_get_boolean_with_default(CONF_USE_SYSTEM_THEME, &use_system_theme, DEFAULT_CONF_USE_SYSTEM_THEME);
 	if (!use_system_theme)
@@ -691,6 +710,14 @@ main(int argc, char **argv)
 	gconf_client_add_dir(client, "/apps/" PACKAGE, GCONF_CLIENT_PRELOAD_NONE, NULL);
 #endif
 
+	/* Limit for all cached image data, in megabytes */
+	if (rs_conf_get_integer(CONF_CACHE_MEMORY_LIMIT, &cache_memory_limit) && cache_memory_limit > 0)
+		rs_memory_set_limit((guint64) cache_memory_limit * 1024 * 1024);
+
+	/* Back big pixel buffers with huge pages to save TLB misses */
+	if (rs_conf_get_boolean(CONF_HUGE_PAGES, &huge_pages))
+		rs_buffer_pool_set_huge_pages(huge_pages);
+
 	rs = main_blob = rs_new();
 
 	rs->post_open_event = NULL;
@@ -707,6 +734,14 @@ main(int argc, char **argv)
 	else
 		gui_init(argc, argv, rs);
 
+	if (trace)
+	{
+		rs_trace_set_default(NULL);
+		if (!rs_trace_save(trace, trace_filename, &error))
+			g_warning("Could not save trace: %s", error->message);
+		g_object_unref(trace);
+	}
+
 	/* This is so fucking evil, but Rawstudio will deadlock in some GTK atexit() function from time to time :-/ */
 	_exit(0);
 }
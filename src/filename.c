@@ -33,9 +33,11 @@
 #include "gtk-helper.h"
 #include "rs-metadata.h"
 
+#ifndef RAWSTUDIO_CLI
 static void filename_entry_changed_writeback(GtkEntry *entry, gpointer user_data);
 static void filename_entry_changed_writeconf(GtkEntry *entry, gpointer user_data);
 static void filename_add_clicked(GtkButton *button, gpointer user_data);
+#endif
 
 gchar *
 filename_parse(const gchar *in, const gchar *filename, const gint snapshot, gboolean load_metadata)
@@ -329,6 +331,9 @@ filename_parse(const gchar *in, const gchar *filename, const gint snapshot, gboo
 	return output;
 }
 
+/* rawstudio-cli only needs filename_parse() */
+#ifndef RAWSTUDIO_CLI
+
 static void
 filename_entry_changed_writeback(GtkEntry *entry, gpointer user_data)
 {
@@ -457,3 +462,5 @@ rs_filename_chooser_button_new(gchar **filename, const gchar *conf_key)
 
 	return(hbox);
 }
+
+#endif /* RAWSTUDIO_CLI */
@@ -0,0 +1,543 @@
+/*
+ * * Copyright (C) 2006-2011 Anders Brander <anders@brander.dk>,
+ * * Anders Kvist <akv@lnxbx.dk> and Klaus Post <klauspost@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * rawstudio-cli renders photos through the same filter chain as the batch
+ * queue, using the settings saved in the .rawstudio sidecar files. It never
+ * initializes GTK, so it can run without a display.
+ */
+
+#include <rawstudio.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <config.h>
+#ifdef WITH_GCONF
+#include <gconf/gconf-client.h>
+#endif
+#include "application.h"
+#include "filename.h"
+#include "rs-cache.h"
+#include "rs-photo.h"
+#include "gettext.h"
+#include "conf_interface.h"
+
+typedef struct {
+	gchar **files;
+	gint n_files;
+	gint next_file;
+	gint failed;
+
+	const gchar *output_type;
+	gchar **output_params;
+	gchar *directory;
+	gchar *filename;
+	gint setting_id;
+	gint width;
+	gint height;
+	gdouble scale;
+	gchar *demosaic;
+
+	GMutex *lock;
+	GCond *reserved_cond;
+	GHashTable *reserved; /* Output names being rendered right now */
+} CliJob;
+
+static gboolean
+set_output_param(RSOutput *output, const gchar *param, GError **error)
+{
+	GParamSpec *spec;
+	GValue value = {0};
+	gchar **pair;
+	gchar *end = NULL;
+	gboolean ret = TRUE;
+
+	pair = g_strsplit(param, "=", 2);
+	if (!pair[0] || !pair[1])
+	{
+		g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE, "Expected key=value, got \"%s\"", param);
+		g_strfreev(pair);
+		return FALSE;
+	}
+
+	spec = g_object_class_find_property(G_OBJECT_GET_CLASS(output), pair[0]);
+	if (!spec)
+	{
+		g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE, "%s has no parameter \"%s\"", G_OBJECT_TYPE_NAME(output), pair[0]);
+		g_strfreev(pair);
+		return FALSE;
+	}
+
+	g_value_init(&value, spec->value_type);
+	switch (G_TYPE_FUNDAMENTAL(spec->value_type))
+	{
+		case G_TYPE_BOOLEAN:
+			g_value_set_boolean(&value, g_ascii_strcasecmp(pair[1], "true") == 0 || g_str_equal(pair[1], "1"));
+			break;
+		case G_TYPE_INT:
+			g_value_set_int(&value, (gint) g_ascii_strtoll(pair[1], &end, 10));
+			break;
+		case G_TYPE_UINT:
+			g_value_set_uint(&value, (guint) g_ascii_strtoull(pair[1], &end, 10));
+			break;
+		case G_TYPE_FLOAT:
+			g_value_set_float(&value, (gfloat) g_ascii_strtod(pair[1], &end));
+			break;
+		case G_TYPE_DOUBLE:
+			g_value_set_double(&value, g_ascii_strtod(pair[1], &end));
+			break;
+		case G_TYPE_STRING:
+			g_value_set_string(&value, pair[1]);
+			break;
+		default:
+			g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE, "Parameter \"%s\" of type %s cannot be set from the command line", pair[0], g_type_name(spec->value_type));
+			ret = FALSE;
+			break;
+	}
+
+	if (ret && end && (end == pair[1] || *end != '\0'))
+	{
+		g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE, "Invalid value \"%s\" for parameter \"%s\"", pair[1], pair[0]);
+		ret = FALSE;
+	}
+
+	if (ret)
+		g_object_set_property(G_OBJECT(output), pair[0], &value);
+
+	g_value_unset(&value);
+	g_strfreev(pair);
+
+	return ret;
+}
+
+static RSOutput *
+output_new(CliJob *job, GError **error)
+{
+	RSOutput *output;
+	gint i;
+
+	if (!g_type_from_name(job->output_type) || !g_type_is_a(g_type_from_name(job->output_type), RS_TYPE_OUTPUT))
+	{
+		g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE, "Unknown output type \"%s\"", job->output_type);
+		return NULL;
+	}
+
+	output = rs_output_new(job->output_type);
+
+	for(i = 0; job->output_params && job->output_params[i]; i++)
+		if (!set_output_param(output, job->output_params[i], error))
+		{
+			g_object_unref(output);
+			return NULL;
+		}
+
+	return output;
+}
+
+static void
+list_outputs(void)
+{
+	GType *outputs;
+	guint n_outputs = 0, i, j;
+
+	outputs = g_type_children(RS_TYPE_OUTPUT, &n_outputs);
+	for(i = 0; i < n_outputs; i++)
+	{
+		RSOutputClass *klass = g_type_class_ref(outputs[i]);
+		GParamSpec **specs;
+		guint n_specs = 0;
+
+		g_print("%s - %s\n", g_type_name(outputs[i]), klass->display_name);
+
+		specs = g_object_class_list_properties(G_OBJECT_CLASS(klass), &n_specs);
+		for(j = 0; j < n_specs; j++)
+			if ((specs[j]->flags & G_PARAM_WRITABLE) && !g_str_equal(specs[j]->name, "filename"))
+				g_print("\t%s (%s): %s\n", specs[j]->name, g_type_name(specs[j]->value_type), g_param_spec_get_blurb(specs[j]));
+		g_free(specs);
+
+		g_type_class_unref(klass);
+	}
+	g_free(outputs);
+}
+
+static gchar *
+build_filename(CliJob *job, RSOutput *output, const gchar *input)
+{
+	GString *filename;
+	gchar *parsed_filename;
+
+	if (NULL == g_strrstr(job->filename, "%p"))
+	{
+		filename = g_string_new(job->directory);
+		g_string_append(filename, G_DIR_SEPARATOR_S);
+		g_string_append(filename, job->filename);
+	}
+	else
+		filename = g_string_new(job->filename);
+
+	g_string_append(filename, ".");
+	g_string_append(filename, rs_output_get_extension(output));
+
+	/* Counters are resolved by looking for existing files, a name picked by
+	 * another thread doesn't exist until it's saved. Wait for it and try
+	 * again, then the counter will move on */
+	g_mutex_lock(job->lock);
+	while ((parsed_filename = filename_parse(filename->str, input, job->setting_id, TRUE))
+		&& g_hash_table_lookup(job->reserved, parsed_filename))
+	{
+		g_free(parsed_filename);
+		g_cond_wait(job->reserved_cond, job->lock);
+	}
+	if (parsed_filename)
+		g_hash_table_insert(job->reserved, g_strdup(parsed_filename), GINT_TO_POINTER(TRUE));
+	g_mutex_unlock(job->lock);
+
+	g_string_free(filename, TRUE);
+
+	return parsed_filename;
+}
+
+static void
+release_filename(CliJob *job, const gchar *parsed_filename)
+{
+	g_mutex_lock(job->lock);
+	g_hash_table_remove(job->reserved, parsed_filename);
+	g_cond_broadcast(job->reserved_cond);
+	g_mutex_unlock(job->lock);
+}
+
+static gboolean
+process_file(CliJob *job, RSOutput *output, const gchar *input)
+{
+	RS_PHOTO *photo;
+	RSFilter *finput, *fdemosaic, *ffujirotate, *flensfun, *frotate, *fcrop;
+	RSFilter *ftransform_input, *fdcp, *fcache, *fresample, *fdenoise, *fexport_cache, *ftransform_display;
+	GList *filters;
+	gchar *parsed_filename, *parsed_dir;
+	gint width = 65535, height = 65535;
+	gboolean exported;
+
+	photo = rs_photo_load_from_file(input);
+	if (!photo)
+	{
+		g_printerr("%s: Could not load file\n", input);
+		return FALSE;
+	}
+
+	rs_metadata_load_from_file(photo->metadata, input);
+	rs_cache_load(photo);
+
+	parsed_filename = build_filename(job, output, input);
+	if (!parsed_filename)
+	{
+		g_printerr("%s: Could not build output filename\n", input);
+		g_object_unref(photo);
+		return FALSE;
+	}
+
+	parsed_dir = g_path_get_dirname(parsed_filename);
+	if (FALSE == g_file_test(parsed_dir, G_FILE_TEST_EXISTS | G_FILE_TEST_IS_DIR))
+		if (g_mkdir_with_parents(parsed_dir, 0x1ff))
+		{
+			g_printerr("%s: Could not create output directory %s\n", input, parsed_dir);
+			release_filename(job, parsed_filename);
+			g_free(parsed_dir);
+			g_free(parsed_filename);
+			g_object_unref(photo);
+			return FALSE;
+		}
+	g_free(parsed_dir);
+
+	/* Same chain as the batch queue */
+	finput = rs_filter_new("RSInputImage16", NULL);
+	fdemosaic = rs_filter_new("RSDemosaic", finput);
+	ffujirotate = rs_filter_new("RSFujiRotate", fdemosaic);
+	flensfun = rs_filter_new("RSLensfun", ffujirotate);
+	frotate = rs_filter_new("RSRotate", flensfun);
+	fcrop = rs_filter_new("RSCrop", frotate);
+	ftransform_input = rs_filter_new("RSColorspaceTransform", fcrop);
+	fdcp = rs_filter_new("RSDcp", ftransform_input);
+	fcache = rs_filter_new("RSCache", fdcp);
+	fresample = rs_filter_new("RSResample", fcache);
+	fdenoise = rs_filter_new("RSDenoise", fresample);
+	/* Outputs render in strips, resample and denoise only run once */
+	fexport_cache = rs_filter_new("RSCache", fdenoise);
+	g_object_set(fexport_cache, "ignore-roi", TRUE, NULL);
+	ftransform_display = rs_filter_new("RSColorspaceTransform", fexport_cache);
+
+	if (job->demosaic)
+		g_object_set(fdemosaic, "method", job->demosaic, NULL);
+
+	filters = g_list_append(NULL, ftransform_display);
+	rs_photo_apply_to_filters(photo, filters, job->setting_id);
+	g_list_free(filters);
+
+	rs_filter_set_recursive(ftransform_display,
+		"image", photo->input_response,
+		"filename", photo->filename,
+		NULL);
+
+	/* Calculate new size, photos are saved in full size unless asked */
+	if (job->scale > 0.0)
+	{
+		rs_filter_get_size_simple(fcrop, RS_FILTER_REQUEST_QUICK, &width, &height);
+		width = (gint) (((gdouble) width) * job->scale / 100.0);
+		height = (gint) (((gdouble) height) * job->scale / 100.0);
+	}
+	else
+	{
+		if (job->width > 0)
+			width = job->width;
+		if (job->height > 0)
+			height = job->height;
+	}
+
+	if (job->scale > 0.0 || job->width > 0 || job->height > 0)
+		rs_filter_set_recursive(ftransform_display,
+			"bounding-box", TRUE,
+			"width", width,
+			"height", height,
+			NULL);
+	else
+		rs_filter_set_enabled(fresample, FALSE);
+
+	if (g_object_class_find_property(G_OBJECT_GET_CLASS(output), "filename"))
+		g_object_set(output, "filename", parsed_filename, NULL);
+
+	exported = rs_output_execute(output, ftransform_display);
+
+	if (exported)
+	{
+		rs_cache_save_flags(input, NULL, &exported, NULL);
+		g_print("%s -> %s\n", input, parsed_filename);
+	}
+	else
+		g_printerr("%s: Export to %s failed\n", input, parsed_filename);
+
+	release_filename(job, parsed_filename);
+
+	g_object_unref(finput);
+	g_object_unref(fdemosaic);
+	g_object_unref(ffujirotate);
+	g_object_unref(flensfun);
+	g_object_unref(frotate);
+	g_object_unref(fcrop);
+	g_object_unref(ftransform_input);
+	g_object_unref(fdcp);
+	g_object_unref(fcache);
+	g_object_unref(fresample);
+	g_object_unref(fdenoise);
+	g_object_unref(fexport_cache);
+	g_object_unref(ftransform_display);
+	g_object_unref(photo);
+	g_free(parsed_filename);
+
+	return exported;
+}
+
+static gpointer
+worker_thread(gpointer data)
+{
+	CliJob *job = data;
+	RSOutput *output;
+	gint n;
+
+	/* Parameters were validated in main(), this can't fail */
+	output = output_new(job, NULL);
+
+	while ((n = g_atomic_int_exchange_and_add(&job->next_file, 1)) < job->n_files)
+		if (!process_file(job, output, job->files[n]))
+			g_atomic_int_inc(&job->failed);
+
+	g_object_unref(output);
+
+	return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+	CliJob job = {0};
+	RSOutput *output;
+	GThread **threads;
+	gchar *debug = NULL;
+	gchar *trace_filename = NULL;
+	gchar *setting = NULL;
+	gchar **files = NULL;
+	gint n_threads = 1;
+	gboolean do_list = FALSE;
+	RSTrace *trace = NULL;
+	gint cache_memory_limit = 0;
+	gboolean huge_pages = FALSE;
+	gint i;
+	GError *error = NULL;
+	GOptionContext *option_context;
+#ifdef WITH_GCONF
+	GConfClient *client;
+#endif
+
+	job.output_type = "RSJpegfile";
+	job.filename = "%f";
+	job.directory = ".";
+	job.setting_id = 0;
+
+	const GOptionEntry option_entries[] = {
+		{ "output-dir", 'o', 0, G_OPTION_ARG_FILENAME, &job.directory, "Directory to save images in", "directory" },
+		{ "filename", 'f', 0, G_OPTION_ARG_STRING, &job.filename, "Filename template, without extension", "template" },
+		{ "type", 't', 0, G_OPTION_ARG_STRING, &job.output_type, "Output type, see --list-outputs", "type" },
+		{ "param", 'p', 0, G_OPTION_ARG_STRING_ARRAY, &job.output_params, "Set output parameter, can be repeated", "key=value" },
+		{ "list-outputs", 'l', 0, G_OPTION_ARG_NONE, &do_list, "List output types and their parameters", NULL },
+		{ "setting", 's', 0, G_OPTION_ARG_STRING, &setting, "Setting to use: A, B or C", "setting" },
+		{ "width", 'W', 0, G_OPTION_ARG_INT, &job.width, "Maximum width of output", "pixels" },
+		{ "height", 'H', 0, G_OPTION_ARG_INT, &job.height, "Maximum height of output", "pixels" },
+		{ "scale", 'S', 0, G_OPTION_ARG_DOUBLE, &job.scale, "Scale output", "percent" },
+		{ "demosaic", 0, 0, G_OPTION_ARG_STRING, &job.demosaic, "Demosaic method: bilinear, pixel-grouping or ahd", "method" },
+		{ "jobs", 'j', 0, G_OPTION_ARG_INT, &n_threads, "Number of photos to process at once", "n" },
+		{ "debug", 'd', 0, G_OPTION_ARG_STRING, &debug, "Debug flags to use", "flags" },
+		{ "trace", 0, 0, G_OPTION_ARG_FILENAME, &trace_filename, "Trace filters and save the trace (.json or .csv)", "filename" },
+		{ G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &files, NULL, NULL },
+		{ NULL }
+	};
+
+#if GLIB_MAJOR_VERSION <= 2 && GLIB_MINOR_VERSION < 31
+	g_thread_init(NULL);
+#endif
+
+#ifdef ENABLE_NLS
+	bindtextdomain(GETTEXT_PACKAGE, PACKAGE_LOCALE_DIR);
+	bind_textdomain_codeset(GETTEXT_PACKAGE, "UTF-8");
+	textdomain(GETTEXT_PACKAGE);
+#endif
+
+	option_context = g_option_context_new("FILE...");
+	g_option_context_set_summary(option_context, "Render photos using the settings saved by Rawstudio, without a display.");
+	g_option_context_add_main_entries(option_context, option_entries, NULL);
+
+	if (!g_option_context_parse(option_context, &argc, &argv, &error))
+	{
+		g_printerr("option parsing failed: %s\n", error->message);
+		return 1;
+	}
+	g_option_context_free(option_context);
+
+	if (debug)
+		rs_debug_setup(debug);
+
+	if (setting)
+	{
+		if (strlen(setting) != 1 || g_ascii_toupper(setting[0]) < 'A' || g_ascii_toupper(setting[0]) > 'C')
+		{
+			g_printerr("Setting must be A, B or C\n");
+			return 1;
+		}
+		job.setting_id = g_ascii_toupper(setting[0]) - 'A';
+	}
+
+	/* Make sure the GType system is initialized */
+	g_type_init();
+
+	check_install();
+
+	rs_filetype_init();
+
+	rs_plugin_manager_load_all_plugins();
+
+#ifdef WITH_GCONF
+	/* Add our own directory to default GConfClient before anyone uses it */
+	client = gconf_client_get_default();
+	gconf_client_add_dir(client, "/apps/" PACKAGE, GCONF_CLIENT_PRELOAD_NONE, NULL);
+#endif
+
+	rs_lens_fix_init();
+
+	/* Limit for all cached image data, in megabytes */
+	if (rs_conf_get_integer(CONF_CACHE_MEMORY_LIMIT, &cache_memory_limit) && cache_memory_limit > 0)
+		rs_memory_set_limit((guint64) cache_memory_limit * 1024 * 1024);
+
+	/* Back big pixel buffers with huge pages to save TLB misses */
+	if (rs_conf_get_boolean(CONF_HUGE_PAGES, &huge_pages))
+		rs_buffer_pool_set_huge_pages(huge_pages);
+
+	if (do_list)
+	{
+		list_outputs();
+		return 0;
+	}
+
+	if (!files || !files[0])
+	{
+		g_printerr("No input files given, see --help\n");
+		return 1;
+	}
+
+	/* Catch bad output type and parameters before we start */
+	output = output_new(&job, &error);
+	if (!output)
+	{
+		g_printerr("%s\n", error->message);
+		return 1;
+	}
+
+	if (trace_filename)
+	{
+		trace = rs_trace_new();
+		rs_trace_set_default(trace);
+	}
+
+	job.files = files;
+	job.n_files = g_strv_length(files);
+	job.lock = g_mutex_new();
+	job.reserved_cond = g_cond_new();
+	job.reserved = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+	n_threads = CLAMP(n_threads, 1, job.n_files);
+	threads = g_new0(GThread *, n_threads);
+
+	/* The main thread is the first worker */
+	for(i = 1; i < n_threads; i++)
+		threads[i] = g_thread_create(worker_thread, &job, TRUE, NULL);
+
+	while ((i = g_atomic_int_exchange_and_add(&job.next_file, 1)) < job.n_files)
+		if (!process_file(&job, output, job.files[i]))
+			g_atomic_int_inc(&job.failed);
+	g_object_unref(output);
+
+	for(i = 1; i < n_threads; i++)
+		g_thread_join(threads[i]);
+	g_free(threads);
+
+	g_hash_table_destroy(job.reserved);
+	g_cond_free(job.reserved_cond);
+	g_mutex_free(job.lock);
+
+	if (trace)
+	{
+		rs_trace_set_default(NULL);
+		if (!rs_trace_save(trace, trace_filename, &error))
+			g_printerr("Could not save trace: %s\n", error->message);
+		g_object_unref(trace);
+	}
+
+	if (job.failed > 0)
+		g_printerr("%d of %d photos failed\n", job.failed, job.n_files);
+
+	return (job.failed > 0) ? 1 : 0;
+}
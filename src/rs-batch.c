@@ -19,7 +19,9 @@
 
 #include <rawstudio.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <stdio.h>
+#include <sys/stat.h>
 #include <gtk/gtk.h>
 #include <config.h>
 #include <libxml/encoding.h>
@@ -371,19 +373,468 @@ cancel_clicked(GtkButton *button, gpointer user_data)
 	return;
 }
 
+/* Rough number of full size 16 bit buffers alive while rendering a photo */
+#define BATCH_BUFFERS_PER_PHOTO 6
+
+/* Buffers after demosaic hold 4 shorts per pixel, even if the raw has 1 */
+#define BATCH_SHORTS_PER_PIXEL 4
+
+/* Compressed raw files store at least about one byte per pixel */
+#define BATCH_PIXELS_PER_FILE_BYTE 1
+
+typedef struct {
+	gchar *filename;
+	gint setting_id;
+} BatchJob;
+
+typedef enum {
+	BATCH_MESSAGE_LOADING,
+	BATCH_MESSAGE_SAVING,
+	BATCH_MESSAGE_DONE,
+	BATCH_MESSAGE_SKIPPED,
+	BATCH_MESSAGE_FAILED,
+	BATCH_MESSAGE_WORKER_EXIT,
+} BatchMessageType;
+
+typedef struct {
+	BatchMessageType type;
+	BatchJob *job;
+	gchar *text;
+	GdkPixbuf *pixbuf;
+	gboolean exported;
+} BatchMessage;
+
+typedef struct {
+	RS_QUEUE *queue;
+	RSColorSpace *display_color_space;
+
+	/* Protects everything below */
+	GMutex *lock;
+	GCond *memory_cond;
+	GList *jobs;
+	guint64 memory_budget;
+	guint64 memory_used;
+	gboolean abort;
+	GCond *reserved_cond;
+	GHashTable *reserved; /* Output names being rendered right now */
+
+	/* Messages for the GUI thread */
+	GAsyncQueue *messages;
+} BatchEngine;
+
+/* Filter chain used for rendering a single photo */
+typedef struct {
+	RSFilter *finput;
+	RSFilter *fdemosaic;
+	RSFilter *ffujirotate;
+	RSFilter *flensfun;
+	RSFilter *frotate;
+	RSFilter *fcrop;
+	RSFilter *ftransform_input;
+	RSFilter *fdcp;
+	RSFilter *fcache;
+	RSFilter *fresample;
+	RSFilter *fdenoise;
+	RSFilter *fexport_cache;
+	RSFilter *ftransform_display;
+	RSFilter *fend;
+} BatchChain;
+
+/* Every worker has its own output, as outputs carry per-file state */
+typedef struct {
+	BatchEngine *engine;
+	GThread *thread;
+	RSOutput *output;
+} BatchWorker;
+
+static BatchChain *
+batch_chain_new(void)
+{
+	BatchChain *chain = g_new0(BatchChain, 1);
+
+	chain->finput = rs_filter_new("RSInputImage16", NULL);
+	chain->fdemosaic = rs_filter_new("RSDemosaic", chain->finput);
+	chain->ffujirotate = rs_filter_new("RSFujiRotate", chain->fdemosaic);
+	chain->flensfun = rs_filter_new("RSLensfun", chain->ffujirotate);
+	chain->frotate = rs_filter_new("RSRotate", chain->flensfun);
+	chain->fcrop = rs_filter_new("RSCrop", chain->frotate);
+	chain->ftransform_input = rs_filter_new("RSColorspaceTransform", chain->fcrop);
+	chain->fdcp = rs_filter_new("RSDcp", chain->ftransform_input);
+	chain->fcache = rs_filter_new("RSCache", chain->fdcp);
+	chain->fresample = rs_filter_new("RSResample", chain->fcache);
+	chain->fdenoise = rs_filter_new("RSDenoise", chain->fresample);
+	/* Outputs render in strips, resample and denoise only run once */
+	chain->fexport_cache = rs_filter_new("RSCache", chain->fdenoise);
+	g_object_set(chain->fexport_cache, "ignore-roi", TRUE, NULL);
+	chain->ftransform_display = rs_filter_new("RSColorspaceTransform", chain->fexport_cache);
+	chain->fend = chain->ftransform_display;
+
+	return chain;
+}
+
+static void
+batch_chain_free(BatchChain *chain)
+{
+	g_object_unref(chain->finput);
+	g_object_unref(chain->fdemosaic);
+	g_object_unref(chain->ffujirotate);
+	g_object_unref(chain->flensfun);
+	g_object_unref(chain->frotate);
+	g_object_unref(chain->fcrop);
+	g_object_unref(chain->fcache);
+	g_object_unref(chain->fresample);
+	g_object_unref(chain->fdcp);
+	g_object_unref(chain->fdenoise);
+	g_object_unref(chain->fexport_cache);
+	g_object_unref(chain->ftransform_input);
+	g_object_unref(chain->ftransform_display);
+	g_free(chain);
+}
+
+static BatchWorker *
+batch_worker_new(BatchEngine *engine)
+{
+	BatchWorker *worker = g_new0(BatchWorker, 1);
+
+	worker->engine = engine;
+	worker->output = rs_output_new(G_OBJECT_TYPE_NAME(engine->queue->output));
+	rs_output_set_from_conf(worker->output, "batch");
+
+	return worker;
+}
+
+static void
+batch_worker_free(BatchWorker *worker)
+{
+	g_object_unref(worker->output);
+	g_free(worker);
+}
+
+static void
+batch_post(BatchEngine *engine, BatchMessageType type, BatchJob *job, gchar *text, GdkPixbuf *pixbuf, gboolean exported)
+{
+	BatchMessage *message = g_new0(BatchMessage, 1);
+
+	message->type = type;
+	message->job = job;
+	message->text = text;
+	message->pixbuf = pixbuf;
+	message->exported = exported;
+
+	g_async_queue_push(engine->messages, message);
+}
+
+static void
+batch_abort(BatchEngine *engine)
+{
+	g_mutex_lock(engine->lock);
+	engine->abort = TRUE;
+	g_cond_broadcast(engine->memory_cond);
+	g_mutex_unlock(engine->lock);
+}
+
+static BatchJob *
+batch_next_job(BatchEngine *engine)
+{
+	BatchJob *job = NULL;
+
+	g_mutex_lock(engine->lock);
+	if (!engine->abort && engine->jobs)
+	{
+		job = engine->jobs->data;
+		engine->jobs = g_list_delete_link(engine->jobs, engine->jobs);
+
+		/* Let the I/O system read ahead while we work on this one */
+		if (engine->jobs)
+			rs_io_idle_prefetch_file(((BatchJob *) engine->jobs->data)->filename, 0xC01A);
+	}
+	g_mutex_unlock(engine->lock);
+
+	return job;
+}
+
+/* Waits until bytes fit in the memory budget. A single photo is always let
+ * through, no matter how big, to make sure we make progress */
+static gboolean
+batch_reserve_memory(BatchEngine *engine, guint64 bytes)
+{
+	gboolean ret;
+
+	g_mutex_lock(engine->lock);
+	while (!engine->abort && engine->memory_used > 0 && engine->memory_used + bytes > engine->memory_budget)
+		g_cond_wait(engine->memory_cond, engine->lock);
+	ret = !engine->abort;
+	if (ret)
+		engine->memory_used += bytes;
+	g_mutex_unlock(engine->lock);
+
+	return ret;
+}
+
+/* Corrects a reservation once the real size is known, never waits */
+static void
+batch_adjust_memory(BatchEngine *engine, guint64 reserved, guint64 bytes)
+{
+	g_mutex_lock(engine->lock);
+	engine->memory_used = engine->memory_used - reserved + bytes;
+	if (bytes < reserved)
+		g_cond_broadcast(engine->memory_cond);
+	g_mutex_unlock(engine->lock);
+}
+
+static void
+batch_release_memory(BatchEngine *engine, guint64 bytes)
+{
+	g_mutex_lock(engine->lock);
+	engine->memory_used -= bytes;
+	g_cond_broadcast(engine->memory_cond);
+	g_mutex_unlock(engine->lock);
+}
+
+static guint64
+batch_get_memory_budget(void)
+{
+	gint megabytes = 0;
+	guint64 budget;
+
+	if (rs_conf_get_integer(CONF_BATCH_MEMORY_LIMIT, &megabytes) && megabytes > 0)
+		return (guint64) megabytes * 1024 * 1024;
+
+	/* Default to half of the physical memory */
+	budget = rs_get_physical_memory() / 2;
+	if (budget == 0)
+		budget = (guint64) 1024 * 1024 * 1024;
+
+	return budget;
+}
+
+/* Estimates the memory needed for a photo before it's loaded */
+static guint64
+batch_estimate_memory(const gchar *filename)
+{
+	struct stat st;
+
+	if (g_stat(filename, &st) != 0)
+		return 0;
+
+	return (guint64) st.st_size * BATCH_PIXELS_PER_FILE_BYTE * BATCH_SHORTS_PER_PIXEL * sizeof(gushort) * BATCH_BUFFERS_PER_PHOTO;
+}
+
+/* Returns the name to save to, or NULL if the output directory could not
+ * be created */
+static gchar *
+batch_build_filename(BatchEngine *engine, BatchWorker *worker, BatchJob *job)
+{
+	RS_QUEUE *queue = engine->queue;
+	GString *filename;
+	gchar *parsed_filename, *parsed_dir;
+
+	if (NULL == g_strrstr(queue->filename, "%p"))
+	{
+		filename = g_string_new(queue->directory);
+		g_string_append(filename, G_DIR_SEPARATOR_S);
+		g_string_append(filename, queue->filename);
+	}
+	else
+		filename = g_string_new(queue->filename);
+
+	g_string_append(filename, ".");
+	g_string_append(filename, rs_output_get_extension(worker->output));
+
+	/* Outputs without a file (Flickr and friends) only use the name for
+	 * display */
+	if (!g_object_class_find_property(G_OBJECT_GET_CLASS(worker->output), "filename"))
+	{
+		parsed_filename = filename_parse(filename->str, job->filename, job->setting_id, TRUE);
+		g_string_free(filename, TRUE);
+		return parsed_filename;
+	}
+
+	/* Counters are resolved by looking for existing files, a name picked by
+	 * another worker doesn't exist until it's saved. Wait for it and try
+	 * again, then the counter will move on */
+	g_mutex_lock(engine->lock);
+	while ((parsed_filename = filename_parse(filename->str, job->filename, job->setting_id, TRUE))
+		&& g_hash_table_lookup(engine->reserved, parsed_filename))
+	{
+		g_free(parsed_filename);
+		g_cond_wait(engine->reserved_cond, engine->lock);
+	}
+	if (parsed_filename)
+	{
+		/* Create directory, if it doesn't exist */
+		parsed_dir = g_path_get_dirname(parsed_filename);
+		if (FALSE == g_file_test(parsed_dir, G_FILE_TEST_EXISTS | G_FILE_TEST_IS_DIR)
+			&& g_mkdir_with_parents(parsed_dir, 0x1ff))
+		{
+			g_free(parsed_filename);
+			parsed_filename = NULL;
+		}
+		else
+			g_hash_table_insert(engine->reserved, g_strdup(parsed_filename), GINT_TO_POINTER(TRUE));
+		g_free(parsed_dir);
+	}
+	g_mutex_unlock(engine->lock);
+
+	g_string_free(filename, TRUE);
+
+	return parsed_filename;
+}
+
+static void
+batch_release_filename(BatchEngine *engine, const gchar *parsed_filename)
+{
+	g_mutex_lock(engine->lock);
+	if (g_hash_table_remove(engine->reserved, parsed_filename))
+		g_cond_broadcast(engine->reserved_cond);
+	g_mutex_unlock(engine->lock);
+}
+
+static void
+batch_process_photo(BatchWorker *worker, BatchJob *job)
+{
+	BatchEngine *engine = worker->engine;
+	RS_QUEUE *queue = engine->queue;
+	BatchChain *chain;
+	RS_PHOTO *photo;
+	RS_IMAGE16 *image;
+	RSFilterRequest *request;
+	RSFilterResponse *filter_response;
+	GdkPixbuf *pixbuf;
+	gchar *parsed_filename;
+	gint width, height;
+	gdouble scale;
+	guint64 memory, estimate;
+	gboolean exported;
+
+	/* The decoded image counts too, so we must reserve before loading */
+	memory = estimate = batch_estimate_memory(job->filename);
+	if (!batch_reserve_memory(engine, estimate))
+		return;
+
+	batch_post(engine, BATCH_MESSAGE_LOADING, job, g_path_get_basename(job->filename), NULL, FALSE);
+
+	photo = rs_photo_load_from_file(job->filename);
+	if (!photo)
+	{
+		batch_release_memory(engine, estimate);
+		batch_post(engine, BATCH_MESSAGE_SKIPPED, job, NULL, NULL, FALSE);
+		return;
+	}
+
+	rs_metadata_load_from_file(photo->metadata, job->filename);
+	rs_cache_load(photo);
+
+	/* Now we know how much memory we need to render this photo */
+	image = rs_filter_response_get_image(photo->input_response);
+	if (image)
+	{
+		memory = (guint64) image->w * image->h * BATCH_SHORTS_PER_PIXEL * sizeof(gushort) * BATCH_BUFFERS_PER_PHOTO;
+		g_object_unref(image);
+	}
+	batch_adjust_memory(engine, estimate, memory);
+
+	parsed_filename = batch_build_filename(engine, worker, job);
+	if (!parsed_filename)
+	{
+		batch_post(engine, BATCH_MESSAGE_FAILED, job, g_strdup(_("Could not create output directory.")), NULL, FALSE);
+		batch_abort(engine);
+		batch_release_memory(engine, memory);
+		g_object_unref(photo);
+		return;
+	}
+
+	/* A fresh chain per photo makes sure nothing is kept alive after we
+	 * give back our share of the memory budget */
+	chain = batch_chain_new();
+
+	GList *filters = g_list_append(NULL, chain->fend);
+	rs_photo_apply_to_filters(photo, filters, job->setting_id);
+	g_list_free(filters);
+
+	rs_filter_set_recursive(chain->fend,
+		"image", photo->input_response,
+		"filename", photo->filename,
+		"bounding-box", TRUE,
+		"width", 250,
+		"height", 250,
+		NULL);
+
+	/* Render preview image */
+	request = rs_filter_request_new();
+	rs_filter_request_set_quick(RS_FILTER_REQUEST(request), FALSE);
+	/* FIXME: Should be set to output colorspace, not forced to sRGB */
+	rs_filter_param_set_object(RS_FILTER_PARAM(request), "colorspace", engine->display_color_space);
+	filter_response = rs_filter_get_image8(chain->fend, request);
+	pixbuf = rs_filter_response_get_image8(filter_response);
+	g_object_unref(request);
+	g_object_unref(filter_response);
+
+	batch_post(engine, BATCH_MESSAGE_SAVING, job, g_path_get_basename(parsed_filename), pixbuf, FALSE);
+
+	width = 65535;
+	height = 65535;
+	/* Calculate new size */
+	switch (queue->size_lock)
+	{
+		case LOCK_SCALE:
+			scale = queue->scale/100.0;
+			rs_filter_get_size_simple(chain->fcrop, RS_FILTER_REQUEST_QUICK, &width, &height);
+			width = (gint) (((gdouble) width) * scale);
+			height = (gint) (((gdouble) height) * scale);
+			break;
+		case LOCK_WIDTH:
+			width = queue->width;
+			break;
+		case LOCK_HEIGHT:
+			height = queue->height;
+			break;
+		case LOCK_BOUNDING_BOX:
+			width = queue->width;
+			height = queue->height;
+			break;
+	}
+	rs_filter_set_recursive(chain->fend,
+		"width", width,
+		"height", height,
+		NULL);
+
+	/* Save the image */
+	if (g_object_class_find_property(G_OBJECT_GET_CLASS(worker->output), "filename"))
+		g_object_set(worker->output, "filename", parsed_filename, NULL);
+
+	g_assert(RS_IS_OUTPUT(worker->output));
+	g_assert(RS_IS_FILTER(chain->fend));
+
+	exported = rs_output_execute(worker->output, chain->fend);
+	batch_release_filename(engine, parsed_filename);
+
+	batch_chain_free(chain);
+	g_object_unref(photo);
+	batch_release_memory(engine, memory);
+
+	batch_post(engine, BATCH_MESSAGE_DONE, job, parsed_filename, NULL, exported);
+}
+
+static gpointer
+batch_worker_thread(gpointer data)
+{
+	BatchWorker *worker = data;
+	BatchJob *job;
+
+	while ((job = batch_next_job(worker->engine)))
+		batch_process_photo(worker, job);
+
+	batch_post(worker->engine, BATCH_MESSAGE_WORKER_EXIT, NULL, NULL, NULL, FALSE);
+
+	return NULL;
+}
+
 void
 rs_batch_process(RS_QUEUE *queue)
 {
-	RS_PHOTO *photo = NULL;
 	GtkTreeIter iter;
-	gchar *filename_in;
-	gint setting_id;
 	GtkWidget *preview = gtk_image_new();
-	GdkPixbuf *pixbuf = NULL;
-	gint width = -1, height = -1;
-	gdouble scale = -1.0;
-	gchar *parsed_filename, *basename, *parsed_dir;
-	GString *filename;
 	GString *status = g_string_new(NULL);
 	GtkWidget *window;
 	GtkWidget *label = gtk_label_new(NULL);
@@ -392,26 +843,17 @@ rs_batch_process(RS_QUEUE *queue)
 	gboolean abort_render = FALSE;
 	GTimeVal start_time;
 	GTimeVal now_time = {0,0};
+	GTimeVal timeout;
 	gint time, eta;
 	GtkWidget *eta_label = gtk_label_new(NULL);
 	gchar *eta_text, *title_text;
 	gint h = 0, m = 0, s = 0;
 	gint done = 0, left = 0;
-	RSFilter *finput = rs_filter_new("RSInputImage16", NULL);
-	RSFilter *fdemosaic = rs_filter_new("RSDemosaic", finput);
-	RSFilter *ffujirotate = rs_filter_new("RSFujiRotate", fdemosaic);
-	RSFilter *flensfun = rs_filter_new("RSLensfun", ffujirotate);
-	RSFilter *frotate = rs_filter_new("RSRotate", flensfun);
-	RSFilter *fcrop = rs_filter_new("RSCrop", frotate);
-	RSFilter *ftransform_input = rs_filter_new("RSColorspaceTransform", fcrop);
-	RSFilter *fdcp= rs_filter_new("RSDcp", ftransform_input);
-	RSFilter *fcache = rs_filter_new("RSCache", fdcp);
-	RSFilter *fresample= rs_filter_new("RSResample", fcache);
-	RSFilter *fdenoise= rs_filter_new("RSDenoise", fresample);
-	RSFilter *ftransform_display = rs_filter_new("RSColorspaceTransform", fdenoise);
-	RSFilter *fend = ftransform_display;
-	RSFilterResponse *filter_response;
-	RSColorSpace *display_color_space;
+	gint i, n_workers, running;
+	BatchEngine engine;
+	BatchWorker **workers;
+	BatchMessage *message;
+	GList *jobs = NULL, *node;
 
 	gdk_threads_enter();
 	window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
@@ -435,200 +877,160 @@ rs_batch_process(RS_QUEUE *queue)
 	gtk_widget_show_all(window);
 	while (gtk_events_pending()) gtk_main_iteration();
 
-	display_color_space = rs_get_display_profile(GTK_WIDGET(window));
 	g_mkdir_with_parents(queue->directory, 00755);
 
+	/* Take a copy of the queue, workers should never touch the GtkTreeModel */
+	if (gtk_tree_model_get_iter_first(queue->list, &iter))
+		do
+		{
+			BatchJob *job = g_new0(BatchJob, 1);
+			gtk_tree_model_get(queue->list, &iter,
+				RS_QUEUE_ELEMENT_FILENAME, &job->filename,
+				RS_QUEUE_ELEMENT_SETTING_ID, &job->setting_id,
+				-1);
+			jobs = g_list_append(jobs, job);
+		} while (gtk_tree_model_iter_next(queue->list, &iter));
+
+	engine.queue = queue;
+	engine.display_color_space = rs_get_display_profile(GTK_WIDGET(window));
+	engine.lock = g_mutex_new();
+	engine.memory_cond = g_cond_new();
+	engine.jobs = g_list_copy(jobs);
+	engine.memory_budget = batch_get_memory_budget();
+	engine.memory_used = 0;
+	engine.abort = FALSE;
+	engine.reserved_cond = g_cond_new();
+	engine.reserved = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	engine.messages = g_async_queue_new();
+
+	/* How many photos are in flight at once is limited by the memory budget,
+	 * but we never need more workers than photos or cores */
+	n_workers = MIN(g_list_length(jobs), rs_get_number_of_processor_cores());
+	workers = g_new0(BatchWorker *, MAX(n_workers, 1));
+	for(i = 0; i < n_workers; i++)
+		workers[i] = batch_worker_new(&engine);
+
+	RS_DEBUG(PERFORMANCE, "Batch processing %d photos with %d workers and a budget of %" G_GUINT64_FORMAT " MiB",
+		g_list_length(jobs), n_workers, engine.memory_budget / (1024 * 1024));
+
+	for(i = 0; i < n_workers; i++)
+		workers[i]->thread = g_thread_create(batch_worker_thread, workers[i], TRUE, NULL);
+
 	g_get_current_time(&start_time);
 
-	while(gtk_tree_model_get_iter_first(queue->list, &iter) && (!abort_render))
+	running = n_workers;
+	while (running > 0)
 	{
-		left = rs_batch_num_entries(queue);
-		if (done > 0 && now_time.tv_sec > 0)
-		{
-			time = (gint) (now_time.tv_sec-start_time.tv_sec);
-			eta = (time/done)*left;
-			h = (eta/3600);
-			eta %= 3600;
-			m = (eta/60);
-			eta %= 60;
-			s = eta;
-
-			eta_text = g_strdup_printf(_("Time left: %dh %dm %ds"), h, m, s);
-			title_text = g_strdup_printf(_("Processing Image %d/%d"), done+1, done+left);
-		}
-		else
-		{
-			eta_text = g_strdup(_("Time left: ..."));
-			title_text = g_strdup_printf(_("Processing Image 1/%d."), left);
-		}
-
-		gtk_window_set_title(GTK_WINDOW(window), title_text);
-		gtk_label_set_text(GTK_LABEL(eta_label), eta_text);
-		g_free(eta_text);
-		g_free(title_text);
-		done++;
-
-		gtk_tree_model_get(queue->list, &iter,
-			RS_QUEUE_ELEMENT_FILENAME, &filename_in,
-			RS_QUEUE_ELEMENT_SETTING_ID, &setting_id,
-			-1);
-		basename = g_path_get_basename(filename_in);
-		g_string_printf(status, _("Loading %s ..."), basename);
-		gtk_label_set_text(GTK_LABEL(label), status->str);
 		while (gtk_events_pending()) gtk_main_iteration();
-		g_free(basename);
+
+		if (abort_render)
+			batch_abort(&engine);
 
 		gdk_threads_leave();
-		photo = rs_photo_load_from_file(filename_in);
-		if (photo)
-		{
-			rs_metadata_load_from_file(photo->metadata, filename_in);
-			rs_cache_load(photo);
+		g_get_current_time(&timeout);
+		g_time_val_add(&timeout, 100000);
+		message = g_async_queue_timed_pop(engine.messages, &timeout);
+		gdk_threads_enter();
 
-			/* Build new filename */
-			if (NULL == g_strrstr(queue->filename, "%p"))
-			{
-				filename = g_string_new(queue->directory);
-				g_string_append(filename, G_DIR_SEPARATOR_S);
-				g_string_append(filename, queue->filename);
-			} 
-			else
-				filename = g_string_new(queue->filename);
-			
-			g_string_append(filename, ".");
-			g_string_append(filename, rs_output_get_extension(queue->output));
-			parsed_filename = filename_parse(filename->str, filename_in, setting_id, TRUE);
-			
-			/* Create directory, if it doesn't exist */
-			parsed_dir = g_path_get_dirname(parsed_filename);
-			if (FALSE == g_file_test(parsed_dir, G_FILE_TEST_EXISTS | G_FILE_TEST_IS_DIR))
-				if (g_mkdir_with_parents(parsed_dir, 0x1ff))
+		if (!message)
+			continue;
+
+		switch (message->type)
+		{
+			case BATCH_MESSAGE_LOADING:
+				left = rs_batch_num_entries(queue);
+				if (done > 0 && now_time.tv_sec > 0)
 				{
-					gdk_threads_enter();
-					gui_status_notify(_("Could not create output directory."));
-					break;
+					time = (gint) (now_time.tv_sec-start_time.tv_sec);
+					eta = (time/done)*left;
+					h = (eta/3600);
+					eta %= 3600;
+					m = (eta/60);
+					eta %= 60;
+					s = eta;
+
+					eta_text = g_strdup_printf(_("Time left: %dh %dm %ds"), h, m, s);
+					title_text = g_strdup_printf(_("Processing Image %d/%d"), done+1, done+left);
 				}
-
-			GList *filters = g_list_append(NULL, fend);
-			rs_photo_apply_to_filters(photo, filters, setting_id);
-			g_list_free(filters);
-
-			rs_filter_set_recursive(fend,
-				"image", photo->input_response,
-				"filename", photo->filename,
-				"bounding-box", TRUE,
-				"width", 250,
-				"height", 250,
-				NULL);
-
-			/* Render preview image */
-			RSFilterRequest *request = rs_filter_request_new();
-			rs_filter_request_set_quick(RS_FILTER_REQUEST(request), FALSE);
-			/* FIXME: Should be set to output colorspace, not forced to sRGB */
-
-			rs_filter_param_set_object(RS_FILTER_PARAM(request), "colorspace", display_color_space);	
-			filter_response = rs_filter_get_image8(fend, request);
-			pixbuf = rs_filter_response_get_image8(filter_response);
-			gdk_threads_enter();
-			if (pixbuf)
-			{
-				gtk_image_set_from_pixbuf(GTK_IMAGE(preview), pixbuf);
-				g_object_unref(pixbuf);
-			}
-			g_object_unref(request);
-			g_object_unref(filter_response);
-
-			if (left > 1)
-			{
-				GtkTreeIter iter2 = iter;
-				if (gtk_tree_model_iter_next (queue->list, &iter2))
+				else
 				{
-					gtk_tree_model_get(queue->list, &iter2, RS_QUEUE_ELEMENT_FILENAME, &filename_in, -1);
-					rs_io_idle_prefetch_file(filename_in, 0xC01A);
+					eta_text = g_strdup(_("Time left: ..."));
+					title_text = g_strdup_printf(_("Processing Image 1/%d."), left);
 				}
-			}
-			/* Build text for small preview-window */
-			basename = g_path_get_basename(parsed_filename);
-			g_string_printf(status, _("Saving %s ..."), basename);
-			gtk_label_set_text(GTK_LABEL(label), status->str);
-			while (gtk_events_pending())
-				gtk_main_iteration();
-			g_free(basename);
-			gdk_threads_leave();
-
-			width = 65535;
-			height = 65535;
-			/* Calculate new size */
-			switch (queue->size_lock)
-			{
-				case LOCK_SCALE:
-					scale = queue->scale/100.0;
-					rs_filter_get_size_simple(fcrop, RS_FILTER_REQUEST_QUICK, &width, &height);
-					width = (gint) (((gdouble) width) * scale);
-					height = (gint) (((gdouble) height) * scale);
-					break;
-				case LOCK_WIDTH:
-					width = queue->width;
-					break;
-				case LOCK_HEIGHT:
-					height = queue->height;
-					break;
-				case LOCK_BOUNDING_BOX:
-					width = queue->width;
-					height = queue->height;
-					break;
-			}
-			rs_filter_set_recursive(fend,
-				"width", width,
-				"height", height,
-				NULL);
-
-			/* Save the image */
-			if (g_object_class_find_property(G_OBJECT_GET_CLASS(queue->output), "filename"))
-				g_object_set(queue->output, "filename", parsed_filename, NULL);
-
-			rs_output_set_from_conf(queue->output, "batch");
 
-			g_assert(RS_IS_OUTPUT(queue->output));
-			g_assert(RS_IS_FILTER(fend));
+				gtk_window_set_title(GTK_WINDOW(window), title_text);
+				gtk_label_set_text(GTK_LABEL(eta_label), eta_text);
+				g_free(eta_text);
+				g_free(title_text);
 
-			gboolean exported = rs_output_execute(queue->output, fend);
-			gdk_threads_enter();
-			if (exported)
-				rs_store_set_flags(NULL, photo->filename, NULL, NULL, &exported, NULL);
-			else
-			{
-				gui_status_notify(_("Could not export photo."));
+				g_string_printf(status, _("Loading %s ..."), message->text);
+				gtk_label_set_text(GTK_LABEL(label), status->str);
+				break;
+			case BATCH_MESSAGE_SAVING:
+				if (message->pixbuf)
+				{
+					gtk_image_set_from_pixbuf(GTK_IMAGE(preview), message->pixbuf);
+					g_object_unref(message->pixbuf);
+				}
+				/* Build text for small preview-window */
+				g_string_printf(status, _("Saving %s ..."), message->text);
+				gtk_label_set_text(GTK_LABEL(label), status->str);
+				break;
+			case BATCH_MESSAGE_DONE:
+				if (message->exported)
+				{
+					rs_store_set_flags(NULL, message->job->filename, NULL, NULL, &message->exported, NULL);
+					rs_batch_remove_from_queue(queue, message->job->filename, message->job->setting_id);
+					done++;
+					g_get_current_time(&now_time);
+				}
+				else
+				{
+					gui_status_notify(_("Could not export photo."));
+					batch_abort(&engine);
+				}
+				break;
+			case BATCH_MESSAGE_SKIPPED:
+				rs_batch_remove_from_queue(queue, message->job->filename, message->job->setting_id);
+				break;
+			case BATCH_MESSAGE_FAILED:
+				gui_status_notify(message->text);
+				break;
+			case BATCH_MESSAGE_WORKER_EXIT:
+				running--;
 				break;
-			}
-
-			g_free(parsed_filename);
-			g_string_free(filename, TRUE);
-			g_object_unref(photo);
-			photo = NULL;
 		}
-		gtk_list_store_remove(GTK_LIST_STORE(queue->list), &iter);
-		batch_queue_save(queue);
 
-		g_get_current_time(&now_time);
+		g_free(message->text);
+		g_free(message);
 	}
 	gtk_widget_destroy(window);
 
 	batch_queue_update_sensivity(queue);
 	gdk_threads_leave();
 
-	g_object_unref(finput);
-	g_object_unref(fdemosaic);
-	g_object_unref(ffujirotate);
-	g_object_unref(flensfun);
-	g_object_unref(frotate);
-	g_object_unref(fcrop);
-	g_object_unref(fcache);
-	g_object_unref(fresample);
-	g_object_unref(fdcp);
-	g_object_unref(fdenoise);
-	g_object_unref(ftransform_input);
-	g_object_unref(ftransform_display);
+	for(i = 0; i < n_workers; i++)
+	{
+		g_thread_join(workers[i]->thread);
+		batch_worker_free(workers[i]);
+	}
+	g_free(workers);
+
+	for(node = jobs; node; node = g_list_next(node))
+	{
+		BatchJob *job = node->data;
+		g_free(job->filename);
+		g_free(job);
+	}
+	g_list_free(jobs);
+	g_list_free(engine.jobs);
+
+	g_async_queue_unref(engine.messages);
+	g_mutex_free(engine.lock);
+	g_cond_free(engine.memory_cond);
+	g_hash_table_destroy(engine.reserved);
+	g_cond_free(engine.reserved_cond);
+	g_string_free(status, TRUE);
 }
 
 static void
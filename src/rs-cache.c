@@ -55,7 +55,11 @@ rs_cache_get_name(const gchar *src)
 static void
 notity_save_failed()
 {
+#ifdef RAWSTUDIO_CLI
+	g_warning("Failed to save image settings! Check you have sufficient rights, and free space on your device.");
+#else
 	gui_status_error(_("WARNING: Failed to save image settings! Check you have sufficient rights, and free space on your device."));
+#endif
 }
 
 void
@@ -412,6 +412,9 @@ save_db(RSCameraDb *camera_db)
 	return;
 }
 
+/* rawstudio-cli doesn't edit the database */
+#ifndef RAWSTUDIO_CLI
+
 static void
 icon_func(GtkTreeViewColumn *tree_column, GtkCellRenderer *cell, GtkTreeModel *model, GtkTreeIter *iter, gpointer data)
 {
@@ -483,3 +486,5 @@ rs_camera_db_editor_new(RSCameraDb *camera_db)
 
 	return dialog;
 }
+
+#endif /* RAWSTUDIO_CLI */
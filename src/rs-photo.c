@@ -23,7 +23,9 @@
 #include "rs-cache.h"
 #include "rs-camera-db.h"
 #include "rs-profile-factory.h"
+#ifndef RAWSTUDIO_CLI
 #include "rs-geo-db.h"
+#endif
 
 static void rs_photo_class_init (RS_PHOTOClass *klass);
 
@@ -427,6 +429,8 @@ rs_photo_apply_to_filters(RS_PHOTO *photo, GList *filters, const gint snapshot)
 		RSLensDb *lens_db = rs_lens_db_get_default();
 		RSLens *lens = rs_lens_db_lookup_from_metadata(lens_db, meta);
 
+#ifndef RAWSTUDIO_CLI
+		/* Geo tagging is only shown in the GUI */
 		RSGeoDb *geodb = rs_geo_db_get_singleton();
 		gdouble tlon = photo->lon, tlat = photo->lat; /* FIXME: setting offset will make it use gps data and not what's set in cache */
 
@@ -443,6 +447,7 @@ rs_photo_apply_to_filters(RS_PHOTO *photo, GList *filters, const gint snapshot)
 			rs_geo_db_find_coordinate(geodb, meta->timestamp + photo->time_offset);
 			rs_geo_db_set_coordinates(geodb, photo);
 		}
+#endif /* RAWSTUDIO_CLI */
 
 		/* Apply lens information to RSLensfun */
 		if (lens)
@@ -227,6 +227,7 @@ struct _RSPreviewWidget
 	GdkDisplay *display;
 	guint status_num;
 	ThreadInfo *render_thread;
+	GCancellable *render_cancellable;
 };
 
 /* Define the boiler plate stuff using the predefined macro */
@@ -321,6 +322,7 @@ rs_preview_widget_init(RSPreviewWidget *preview)
 	preview->render_thread->render = g_cond_new();
 	preview->render_thread->render_mutex = g_static_mutex_get_mutex(&render_mutex);
 	preview->render_thread->finish_rendering = FALSE;
+	preview->render_cancellable = NULL;
 	g_mutex_lock(preview->render_thread->render_mutex);
 	preview->render_thread->thread_id = g_thread_create(render_thread_func, preview->render_thread, TRUE, NULL);
 	gint i;
@@ -2340,6 +2342,9 @@ filter_changed(RSFilter *filter, RSFilterChangedMask mask, RSPreviewWidget *prev
 				val = (gdouble) height;
 				g_object_set(G_OBJECT(preview->vadjustment), "upper", val, NULL);
 			}
+			/* Stop rendering the old settings */
+			if (preview->render_cancellable)
+				g_cancellable_cancel(preview->render_cancellable);
 			DIRTY(preview->dirty[view], SCREEN);
 			rs_preview_widget_update(preview, TRUE);
 		}
@@ -2671,13 +2676,41 @@ rs_preview_do_render(RSPreviewWidget *preview, GdkRectangle *dirty_area)
 			else
 				rs_filter_request_set_roi(preview->request[i], &roi);
 
+			/* Let demosaic bin quick renderings close to the displayed size.
+			 * The parameter ends up in all cache keys, so it's only set for
+			 * quick requests binned more than the default half size, and
+			 * rounded to the power of two used - demosaic bins by 8 at most */
+			gint shift = 1;
+			if (preview->zoom_to_fit && rs_filter_request_get_quick(preview->request[i]))
+			{
+				gfloat scale;
+				g_object_get(preview->filter_resample[i], "scale", &scale, NULL);
+				while (shift < 3 && scale * (2 << shift) <= 1.0f)
+					shift++;
+			}
+			if (shift > 1)
+				rs_filter_param_set_float(RS_FILTER_PARAM(preview->request[i]), "demosaic-scale", 1.0f / (1 << shift));
+			else
+				rs_filter_param_delete(RS_FILTER_PARAM(preview->request[i]), "demosaic-scale");
+
 			/* Clone, now so it cannot change while filters are being called */
 			RSFilterRequest *new_request = rs_filter_request_clone(preview->request[i]);  
 
+			/* Allow new settings to abort this render */
+			GCancellable *cancellable = g_cancellable_new();
+			rs_filter_request_set_cancellable(new_request, cancellable);
+			preview->render_cancellable = cancellable;
+
 			gdk_threads_leave();
 			RSFilterResponse *response = rs_filter_get_image8(preview->filter_end[i], new_request);
 			gdk_threads_enter();
-			GdkPixbuf *buffer = rs_filter_response_get_image8(response);
+
+			preview->render_cancellable = NULL;
+			gboolean cancelled = g_cancellable_is_cancelled(cancellable);
+			g_object_unref(cancellable);
+
+			/* The image is incomplete if cancelled, don't show it */
+			GdkPixbuf *buffer = cancelled ? NULL : rs_filter_response_get_image8(response);
 
 			if (buffer)
 			{
@@ -2694,7 +2727,12 @@ rs_preview_do_render(RSPreviewWidget *preview, GdkRectangle *dirty_area)
 				g_object_unref(buffer);
 			}
 
-			if(preview->views > 1 && rs_filter_request_get_quick(new_request) && !preview->keep_quick_enabled)
+			if (cancelled)
+			{
+				/* Try again with the new settings */
+				gdk_window_invalidate_rect(window, &area, FALSE);
+			}
+			else if(preview->views > 1 && rs_filter_request_get_quick(new_request) && !preview->keep_quick_enabled)
 			{
 				rs_filter_request_set_quick(preview->request[i], FALSE);
 				gdk_window_invalidate_rect(window, &area, FALSE);